@@ -0,0 +1,275 @@
+/*-----------------------------------------------------------------------------
+ * file:  log.c
+ *
+ * Description:
+ *
+ * Asynchronous sink behind the log.h macros, see log.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "log.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/* ----------------------------------------------------------------------------
+ * struct log_slot
+ *
+ * One record in the ring.  seq is pos while the slot is free for the
+ * producer claiming position pos, pos + 1 once that record is written
+ * and pos + LOG_RING_SLOTS after the writer has consumed it.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct log_slot {
+  unsigned int seq;
+  int level;
+  char msg[LOG_MSG_MAX];
+};
+
+int log_level = LOG_LEVEL_INFO;
+
+static const char* log_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+static struct log_slot log_ring[LOG_RING_SLOTS];
+static unsigned int log_tail __attribute__((aligned(64))); /* next position to claim, shared by producers */
+static unsigned int log_head __attribute__((aligned(64))); /* next position to write out, advanced by the writer */
+static unsigned long log_drops;
+static int log_running;
+static int log_sleeping;
+static int log_evfd = -1;
+static pthread_t log_thread;
+
+static FILE* log_stream(int level) { return level >= LOG_LEVEL_WARN ? stderr : stdout; }
+
+/*---------------------------------------------------------------------
+ * Method: log_wake(..)
+ * Scope: Local
+ *
+ * Called after publishing the record at pos.  The writer comes round
+ * every LOG_FLUSH_MS by itself, so this only costs a syscall when the
+ * ring is past LOG_WAKE and the writer is asleep.
+ *
+ *---------------------------------------------------------------------*/
+
+static void log_wake(unsigned int pos) {
+  uint64_t one = 1;
+
+  /* -- order the publish before reading the flag, pairs with the writer -- */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (pos + 1 - __atomic_load_n(&log_head, __ATOMIC_RELAXED) >= LOG_WAKE &&
+      __atomic_load_n(&log_sleeping, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&log_sleeping, 0, __ATOMIC_SEQ_CST)) {
+    if (write(log_evfd, &one, sizeof(one)) != sizeof(one)) {
+      perror("write(..):log.c::log_wake(..)");
+    }
+  }
+} /* -- log_wake -- */
+
+/*---------------------------------------------------------------------
+ * Method: log_write(..)
+ * Scope: Global
+ *
+ * Format a record into the ring for the writer thread.  Until log_start()
+ * has run the record is written out directly instead.
+ *
+ *---------------------------------------------------------------------*/
+
+void log_write(int level, const char* format, ...) {
+  struct log_slot* slot;
+  unsigned int pos, seq;
+  va_list ap;
+
+  va_start(ap, format);
+  if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+    fprintf(log_stream(level), "%s ", log_names[level]);
+    vfprintf(log_stream(level), format, ap);
+    fputc('\n', log_stream(level));
+    va_end(ap);
+    return;
+  }
+
+  /* -- claim a slot; a full ring drops the record rather than wait -- */
+  pos = __atomic_load_n(&log_tail, __ATOMIC_RELAXED);
+  for (;;) {
+    slot = &(log_ring[pos & (LOG_RING_SLOTS - 1)]);
+    seq = __atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE);
+    if (seq == pos) {
+      if (__atomic_compare_exchange_n(&log_tail, &pos, pos + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if ((int)(seq - pos) < 0) {
+      __atomic_add_fetch(&log_drops, 1, __ATOMIC_RELAXED);
+      va_end(ap);
+      return;
+    } else {
+      pos = __atomic_load_n(&log_tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->level = level;
+  vsnprintf(slot->msg, LOG_MSG_MAX, format, ap);
+  va_end(ap);
+  __atomic_store_n(&(slot->seq), pos + 1, __ATOMIC_RELEASE);
+
+  log_wake(pos);
+} /* -- log_write -- */
+
+/*---------------------------------------------------------------------
+ * Method: log_drain(..)
+ * Scope: Local
+ *
+ * Write out every record published so far, in order.  Returns how many
+ * there were.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int log_drain(void) {
+  struct log_slot* slot;
+  unsigned int n = 0;
+
+  for (;;) {
+    slot = &(log_ring[log_head & (LOG_RING_SLOTS - 1)]);
+    if (__atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE) != log_head + 1) {
+      break;
+    }
+    fprintf(log_stream(slot->level), "%s %s\n", log_names[slot->level], slot->msg);
+    __atomic_store_n(&(slot->seq), log_head + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+    __atomic_store_n(&log_head, log_head + 1, __ATOMIC_RELAXED);
+    n++;
+  }
+
+  if (n > 0) {
+    fflush(stdout);
+    fflush(stderr);
+  }
+  return n;
+} /* -- log_drain -- */
+
+static int log_pending(void) {
+  return __atomic_load_n(&(log_ring[log_head & (LOG_RING_SLOTS - 1)].seq), __ATOMIC_ACQUIRE) == log_head + 1;
+} /* -- log_pending -- */
+
+/*---------------------------------------------------------------------
+ * Method: log_writer(..)
+ * Scope: Local
+ *
+ * Writer thread: drain the ring, then sleep on log_evfd for up to
+ * LOG_FLUSH_MS when it is empty.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* log_writer(void* arg) {
+  struct pollfd pfd;
+  uint64_t val;
+
+  pfd.fd = log_evfd;
+  pfd.events = POLLIN;
+
+  while (__atomic_load_n(&log_running, __ATOMIC_SEQ_CST)) {
+    if (log_drain() == 0) {
+      __atomic_store_n(&log_sleeping, 1, __ATOMIC_SEQ_CST);
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if (!log_pending() && __atomic_load_n(&log_running, __ATOMIC_SEQ_CST) && poll(&pfd, 1, LOG_FLUSH_MS) > 0) {
+        if (read(log_evfd, &val, sizeof(val)) == -1 && errno != EINTR) {
+          perror("read(..):log.c::log_writer(..)");
+        }
+      }
+      __atomic_store_n(&log_sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+  }
+
+  log_drain();
+  return 0;
+} /* -- log_writer -- */
+
+/*---------------------------------------------------------------------
+ * Method: log_parse_level(..)
+ * Scope: Global
+ *
+ * Level named by name ("debug", "info", "warn", "error" or "none"), or -1.
+ *
+ *---------------------------------------------------------------------*/
+
+int log_parse_level(const char* name) {
+  int i;
+
+  for (i = LOG_LEVEL_DEBUG; i <= LOG_LEVEL_ERROR; i++) {
+    if (strcasecmp(name, log_names[i]) == 0) {
+      return i;
+    }
+  }
+  return strcasecmp(name, "none") == 0 ? LOG_LEVEL_NONE : -1;
+} /* -- log_parse_level -- */
+
+/*---------------------------------------------------------------------
+ * Method: log_start(..)
+ * Scope: Global
+ *
+ * Start the writer thread.  From here on records go through the ring.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error, records keep being written directly
+ *
+ *---------------------------------------------------------------------*/
+
+int log_start(void) {
+  unsigned int i;
+
+  if ((log_evfd = eventfd(0, EFD_CLOEXEC)) == -1) {
+    perror("eventfd(..):log.c::log_start(..)");
+    return -1;
+  }
+  for (i = 0; i < LOG_RING_SLOTS; i++) {
+    log_ring[i].seq = i;
+  }
+  log_head = log_tail = 0;
+
+  __atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+  if ((errno = pthread_create(&log_thread, 0, log_writer, 0)) != 0) {
+    perror("pthread_create(..):log.c::log_start(..)");
+    __atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+    close(log_evfd);
+    log_evfd = -1;
+    return -1;
+  }
+  return 0;
+} /* -- log_start -- */
+
+/*---------------------------------------------------------------------
+ * Method: log_stop(..)
+ * Scope: Global
+ *
+ * Write out what is left in the ring and stop the writer.  Only call it
+ * once every other thread that logs has finished.
+ *
+ *---------------------------------------------------------------------*/
+
+void log_stop(void) {
+  uint64_t one = 1;
+
+  if (log_evfd == -1) {
+    return;
+  }
+
+  __atomic_store_n(&log_running, 0, __ATOMIC_SEQ_CST);
+  if (write(log_evfd, &one, sizeof(one)) != sizeof(one)) {
+    perror("write(..):log.c::log_stop(..)");
+  }
+  pthread_join(log_thread, 0);
+  close(log_evfd);
+  log_evfd = -1;
+
+  if (log_drops > 0) {
+    fprintf(stderr, "WARN %lu log records dropped, ring full\n", log_drops);
+  }
+} /* -- log_stop -- */
+
+unsigned long log_dropped(void) { return __atomic_load_n(&log_drops, __ATOMIC_RELAXED); }
@@ -1,21 +1,89 @@
+/*-----------------------------------------------------------------------------
+ * file:  log.h
+ *
+ * Description:
+ *
+ * Leveled logging.  Levels below LOG_COMPILE_LEVEL are compiled out
+ * entirely (build with -DLOG_COMPILE_LEVEL=LOG_LEVEL_INFO to drop the per
+ * packet chatter); the rest are checked against log_level at run time.
+ * A record that passes is formatted into a lock-free ring and written
+ * out by a background thread once log_start() has run, so the caller
+ * never waits on the terminal or a file.  The writer polls the ring every
+ * LOG_FLUSH_MS and is only woken early once it is half full, so logging
+ * costs the caller no syscall either.  If the ring is full the record is
+ * dropped and counted instead.
+ *
+ *---------------------------------------------------------------------------*/
+
 #ifndef __LOG_H
 #define __LOG_H
 
-#define DEBUG
-
 #include <stdio.h>
 #include <string.h>
 
-#ifdef DEBUG
-#define LOG_DEBUG(format, ...) printf("DEBUG [-:-] " format "\n");
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_RING_SLOTS 4096 /* records in flight, a power of two */
+#define LOG_MSG_MAX 240     /* longest record, longer ones are cut short */
+#define LOG_FLUSH_MS 100    /* writer's poll period, longest a record waits */
+#define LOG_WAKE (LOG_RING_SLOTS / 2) /* records queued before a caller wakes the writer */
+
+/* -- runtime threshold, LOG_LEVEL_INFO unless changed -- */
+extern int log_level;
+
+#define LOG_ENABLED(lvl) ((lvl) >= LOG_COMPILE_LEVEL && (lvl) >= log_level)
+
+#define LOG_AT(lvl, format, ...)                                              \
+  do {                                                                        \
+    if ((lvl) >= log_level) {                                                 \
+      log_write((lvl), "[%s:%d] " format, __FILE__, __LINE__, ##__VA_ARGS__); \
+    }                                                                         \
+  } while (0)
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) LOG_AT(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) \
+  do {                         \
+  } while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) LOG_AT(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
 #else
-#define LOG_DEBUG(format, ...)
+#define LOG_INFO(format, ...) \
+  do {                        \
+  } while (0)
 #endif
 
-#define LOG_INFO(format, ...) printf("DEBUG [-:-] " format "\n");
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...) LOG_AT(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) \
+  do {                        \
+  } while (0)
+#endif
 
-#define LOG_WARN(format, ...) printf("DEBUG [-:-] " format "\n");
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) LOG_AT(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) \
+  do {                         \
+  } while (0)
+#endif
 
-#define LOG_ERROR(format, ...) printf("DEBUG [-:-] " format "\n");
+void log_write(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+int log_parse_level(const char* name);
+int log_start(void);
+void log_stop(void);
+unsigned long log_dropped(void);
 
-#endif /* __LOG_h */
\ No newline at end of file
+#endif /* __LOG_h */
@@ -0,0 +1,470 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_afpacket.c
+ *
+ * Description:
+ *
+ * AF_PACKET TPACKET_V3 backend, see sr_afpacket.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_afpacket.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_router.h"
+#include "sr_utils.h"
+
+/* where frame data starts in a TX slot, as the kernel expects it */
+#define SR_AFP_TX_DATA TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+
+static const uint8_t sr_afp_broadcast[ETHER_ADDR_LEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_port(..)
+ * Scope: Local
+ *
+ * Port attached to interface ifidx, or 0.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_afp_port* sr_afpacket_port(struct sr_afpacket* afp, unsigned int ifidx) {
+  int i;
+
+  for (i = 0; i < afp->nports; i++) {
+    if (afp->ports[i].iface->index == ifidx) {
+      return &(afp->ports[i]);
+    }
+  }
+  return 0;
+} /* -- sr_afpacket_port -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_open_port(..)
+ * Scope: Local
+ *
+ * Open, map and bind the packet socket for one interface.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_afpacket_open_port(struct sr_instance* sr, struct sr_afp_port* port, const char* name) {
+  struct tpacket_req3 req;
+  struct sockaddr_ll sll;
+  size_t rx_len;
+  int val;
+
+  port->sr = sr;
+  if ((port->iface = sr_add_os_interface(sr, name, &(port->ifindex))) == 0) {
+    return -1;
+  }
+
+  port->fd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, htons(ETH_P_ALL));
+  if (port->fd == -1) {
+    perror("socket(AF_PACKET):sr_afpacket.c::sr_afpacket_open_port(..)");
+    return -1;
+  }
+
+  val = TPACKET_V3;
+  if (setsockopt(port->fd, SOL_PACKET, PACKET_VERSION, &val, sizeof(val)) == -1) {
+    perror("setsockopt(PACKET_VERSION):sr_afpacket.c::sr_afpacket_open_port(..)");
+    return -1;
+  }
+
+  /* -- skip malformed TX slots instead of stalling the ring on them -- */
+  val = 1;
+  setsockopt(port->fd, SOL_PACKET, PACKET_LOSS, &val, sizeof(val));
+
+#ifdef PACKET_IGNORE_OUTGOING
+  /* -- our own transmissions are not looped back into the RX ring -- */
+  setsockopt(port->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &val, sizeof(val));
+#endif
+
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = SR_AFP_BLOCK_SIZE;
+  req.tp_block_nr = SR_AFP_RX_BLOCKS;
+  req.tp_frame_size = SR_AFP_FRAME_SIZE;
+  req.tp_frame_nr = (SR_AFP_BLOCK_SIZE / SR_AFP_FRAME_SIZE) * SR_AFP_RX_BLOCKS;
+  req.tp_retire_blk_tov = SR_AFP_BLOCK_TIMEOUT;
+  if (setsockopt(port->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+    perror("setsockopt(PACKET_RX_RING):sr_afpacket.c::sr_afpacket_open_port(..)");
+    return -1;
+  }
+  rx_len = (size_t)SR_AFP_BLOCK_SIZE * SR_AFP_RX_BLOCKS;
+
+  /* -- TX rings are fixed size slots, the block timeout must stay 0 -- */
+  req.tp_block_nr = SR_AFP_TX_BLOCKS;
+  req.tp_frame_nr = (SR_AFP_BLOCK_SIZE / SR_AFP_FRAME_SIZE) * SR_AFP_TX_BLOCKS;
+  req.tp_retire_blk_tov = 0;
+  if (setsockopt(port->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) == -1) {
+    perror("setsockopt(PACKET_TX_RING):sr_afpacket.c::sr_afpacket_open_port(..)");
+    return -1;
+  }
+  port->tx_frames = req.tp_frame_nr;
+
+  port->map_len = rx_len + (size_t)SR_AFP_BLOCK_SIZE * SR_AFP_TX_BLOCKS;
+  port->map = (uint8_t*)mmap(0, port->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, port->fd, 0);
+  if (port->map == MAP_FAILED) {
+    perror("mmap(..):sr_afpacket.c::sr_afpacket_open_port(..)");
+    port->map = 0;
+    return -1;
+  }
+  port->tx_ring = port->map + rx_len;
+
+  memset(&sll, 0, sizeof(sll));
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = htons(ETH_P_ALL);
+  sll.sll_ifindex = port->ifindex;
+  if (bind(port->fd, (struct sockaddr*)&sll, sizeof(sll)) == -1) {
+    perror("bind(..):sr_afpacket.c::sr_afpacket_open_port(..)");
+    return -1;
+  }
+
+  return 0;
+} /* -- sr_afpacket_open_port -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_open(..)
+ * Scope: Global
+ *
+ * Attach to the comma separated list of interfaces in ifnames, building
+ * the router's interface list from them.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_afpacket_open(struct sr_instance* sr, const char* ifnames) {
+  struct sr_afpacket* afp;
+  struct sr_if* iface;
+  char* names;
+  char* name;
+  char* save = 0;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(ifnames);
+
+  if ((afp = (struct sr_afpacket*)calloc(1, sizeof(struct sr_afpacket))) == 0 || (names = strdup(ifnames)) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_afpacket_open)\n");
+    free(afp);
+    return -1;
+  }
+  sr->afp = afp;
+
+  for (name = strtok_r(names, ",", &save); name; name = strtok_r(0, ",", &save)) {
+    if (afp->nports == SR_AFP_MAX_PORTS) {
+      fprintf(stderr, "Error: more than %d interfaces\n", SR_AFP_MAX_PORTS);
+      free(names);
+      return -1;
+    }
+    if ((iface = sr_get_interface(sr, name)) != 0 && sr_afpacket_port(afp, iface->index)) {
+      continue;
+    }
+    afp->ports[afp->nports].fd = -1;
+    if (sr_afpacket_open_port(sr, &(afp->ports[afp->nports++]), name) != 0) {
+      free(names);
+      return -1;
+    }
+  }
+  free(names);
+
+  if (afp->nports == 0) {
+    fprintf(stderr, "Error: no interfaces to attach to\n");
+    return -1;
+  }
+
+  sr_print_if_list(sr);
+  return 0;
+} /* -- sr_afpacket_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_finish_csum(..)
+ * Scope: Local
+ *
+ * Frames sent by the local stack, e.g. from the far end of a veth pair,
+ * arrive with TCP/UDP checksum offload still pending: the checksum field
+ * only holds the pseudo header sum.  Finish it the way the NIC would have
+ * before the frame is forwarded anywhere.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_afpacket_finish_csum(uint8_t* frame, unsigned int len) {
+  sr_ip_hdr_t* ip_hdr;
+  unsigned int hl, l4_len, off;
+  uint16_t sum;
+
+  if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) || ethertype(frame) != ethertype_ip) {
+    return;
+  }
+  ip_hdr = (sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+  hl = ip_hdr->ip_hl * 4;
+  if (ip_hdr->ip_p == ip_protocol_tcp) {
+    off = 16;
+  } else if (ip_hdr->ip_p == ip_protocol_udp) {
+    off = 6;
+  } else {
+    return;
+  }
+
+  l4_len = ntohs(ip_hdr->ip_len) - hl;
+  if (hl < sizeof(sr_ip_hdr_t) || ntohs(ip_hdr->ip_len) < hl + off + 2 ||
+      sizeof(sr_ethernet_hdr_t) + hl + l4_len > len) {
+    return;
+  }
+
+  sum = cksum(frame + sizeof(sr_ethernet_hdr_t) + hl, l4_len);
+  memcpy(frame + sizeof(sr_ethernet_hdr_t) + hl + off, &sum, sizeof(sum));
+} /* -- sr_afpacket_finish_csum -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_input(..)
+ * Scope: Local
+ *
+ * Check one received frame and, if it is ours, add it to the vector
+ * handed to the router once the block is done.  Returns 1 if it was added.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_afpacket_input(struct sr_afp_port* port, uint8_t* frame, unsigned int len, uint32_t status) {
+  struct sr_ethernet_hdr* e_hdr = (struct sr_ethernet_hdr*)frame;
+
+  if (len < sizeof(struct sr_ethernet_hdr)) {
+    return 0;
+  }
+
+  /* -- multicast floods the link, only unicast to us and broadcast are ours -- */
+  if (memcmp(e_hdr->ether_dhost, port->iface->addr, ETHER_ADDR_LEN) != 0 &&
+      memcmp(e_hdr->ether_dhost, sr_afp_broadcast, ETHER_ADDR_LEN) != 0) {
+    return 0;
+  }
+
+  if (status & TP_STATUS_CSUMNOTREADY) {
+    sr_afpacket_finish_csum(frame, len);
+  }
+  return 1;
+} /* -- sr_afpacket_input -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_event(..)
+ * Scope: Local
+ *
+ * Event loop callback for a port's socket.  Walk every RX block the
+ * kernel has handed over (up to SR_AFP_RX_BURST), hand its frames to the
+ * router in vectors of up to SR_BURST_MAX, give the block back once they
+ * are handled and flush what the burst produced.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_afpacket_event(int fd, uint32_t events, void* arg) {
+  struct sr_afp_port* port = (struct sr_afp_port*)arg;
+  struct tpacket_block_desc* bd;
+  struct tpacket3_hdr* hdr;
+  struct sockaddr_ll* sll;
+  uint8_t* frames[SR_BURST_MAX];
+  unsigned int lens[SR_BURST_MAX];
+  unsigned int ifidx[SR_BURST_MAX];
+  unsigned int i, n, m;
+
+  if (events & EPOLLERR) {
+    fprintf(stderr, "Error on interface %s\n", port->iface->name);
+  }
+
+  for (n = 0; n < SR_AFP_RX_BURST; n++) {
+    bd = (struct tpacket_block_desc*)(port->map + (size_t)port->rx_block * SR_AFP_BLOCK_SIZE);
+    if (!(__atomic_load_n(&(bd->hdr.bh1.block_status), __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+      break;
+    }
+
+    hdr = (struct tpacket3_hdr*)((uint8_t*)bd + bd->hdr.bh1.offset_to_first_pkt);
+    for (i = 0, m = 0; i < bd->hdr.bh1.num_pkts; i++) {
+      sll = (struct sockaddr_ll*)((uint8_t*)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+      /* -- drop looped back transmissions and truncated frames -- */
+      if (sll->sll_pkttype != PACKET_OUTGOING && hdr->tp_snaplen == hdr->tp_len &&
+          sr_afpacket_input(port, (uint8_t*)hdr + hdr->tp_mac, hdr->tp_snaplen, hdr->tp_status)) {
+        frames[m] = (uint8_t*)hdr + hdr->tp_mac;
+        lens[m] = hdr->tp_snaplen;
+        ifidx[m] = port->iface->index;
+        if (++m == SR_BURST_MAX) {
+          sr_input_burst(port->sr, frames, lens, ifidx, m);
+          m = 0;
+        }
+      }
+      hdr = (struct tpacket3_hdr*)((uint8_t*)hdr + hdr->tp_next_offset);
+    }
+    if (m > 0) {
+      sr_input_burst(port->sr, frames, lens, ifidx, m);
+    }
+
+    __atomic_store_n(&(bd->hdr.bh1.block_status), TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    port->rx_block = (port->rx_block + 1) % SR_AFP_RX_BLOCKS;
+  }
+
+  /* -- end of the receive burst -- */
+  sr_flush_packets(port->sr);
+} /* -- sr_afpacket_event -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_start(..)
+ * Scope: Global
+ *
+ * Register every port with the event loop.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_afpacket_start(struct sr_instance* sr) {
+  struct sr_afp_port* port;
+  int i;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(sr->afp);
+
+  for (i = 0; i < sr->afp->nports; i++) {
+    port = &(sr->afp->ports[i]);
+    if ((port->ev = sr_event_add_fd(&(sr->loop), port->fd, EPOLLIN, sr_afpacket_event, port)) == 0) {
+      return -1;
+    }
+  }
+
+  printf(" <-- Ready to process packets --> \n");
+  return 0;
+} /* -- sr_afpacket_start -- */
+
+void sr_afpacket_close(struct sr_instance* sr) {
+  struct sr_afp_port* port;
+  int i;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+
+  if (!sr->afp) {
+    return;
+  }
+
+  for (i = 0; i < sr->afp->nports; i++) {
+    port = &(sr->afp->ports[i]);
+    if (port->map) {
+      munmap(port->map, port->map_len);
+    }
+    if (port->fd >= 0) {
+      close(port->fd);
+    }
+  }
+  free(sr->afp);
+  sr->afp = 0;
+} /* -- sr_afpacket_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_kick(..)
+ * Scope: Local
+ *
+ * Have the kernel transmit every filled TX slot of port.  With wait, block
+ * until they are all out so their slots can be reused.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_afpacket_kick(struct sr_afp_port* port, int wait) {
+  port->tx_pending = 0;
+  while (sendto(port->fd, 0, 0, wait ? 0 : MSG_DONTWAIT, 0, 0) == -1) {
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+      perror("sendto(..):sr_afpacket.c::sr_afpacket_kick(..)");
+      return -1;
+    }
+    break;
+  }
+  return 0;
+} /* -- sr_afpacket_kick -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_send(..)
+ * Scope: Global
+ *
+ * Copy a frame into the next TX slot of the port attached to ifidx.  The
+ * kernel is only told about it every SR_TX_BATCH_FRAMES frames or when
+ * sr_afpacket_flush(..) runs.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_afpacket_send(struct sr_instance* sr, uint8_t* buf, unsigned int len, unsigned int ifidx) {
+  struct sr_afp_port* port;
+  struct tpacket3_hdr* hdr;
+  uint32_t status;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(buf);
+
+  if ((port = sr_afpacket_port(sr->afp, ifidx)) == 0) {
+    fprintf(stderr, "** Error, interface %u is not attached\n", ifidx);
+    return -1;
+  }
+  if (len > SR_AFP_FRAME_SIZE - SR_AFP_TX_DATA) {
+    fprintf(stderr, "** Error: packet of %u bytes does not fit a TX slot\n", len);
+    return -1;
+  }
+
+  hdr = (struct tpacket3_hdr*)(port->tx_ring + (size_t)port->tx_head * SR_AFP_FRAME_SIZE);
+  status = __atomic_load_n(&(hdr->tp_status), __ATOMIC_ACQUIRE);
+  if (status != TP_STATUS_AVAILABLE && !(status & TP_STATUS_WRONG_FORMAT)) {
+    /* -- ring is full, push everything out and wait for it -- */
+    sr_afpacket_kick(port, 1);
+    status = __atomic_load_n(&(hdr->tp_status), __ATOMIC_ACQUIRE);
+    if (status != TP_STATUS_AVAILABLE && !(status & TP_STATUS_WRONG_FORMAT)) {
+      fprintf(stderr, "** Error: TX ring of %s is full\n", port->iface->name);
+      return -1;
+    }
+  }
+
+  memcpy((uint8_t*)hdr + SR_AFP_TX_DATA, buf, len);
+  hdr->tp_len = len;
+  hdr->tp_snaplen = len;
+  hdr->tp_next_offset = 0;
+  __atomic_store_n(&(hdr->tp_status), TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+  port->tx_head = (port->tx_head + 1) % port->tx_frames;
+  if (++port->tx_pending >= SR_TX_BATCH_FRAMES) {
+    return sr_afpacket_kick(port, 0);
+  }
+  return 0;
+} /* -- sr_afpacket_send -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_flush(..)
+ * Scope: Global
+ *
+ * Transmit the filled TX slots of every port, one sendto(..) per port.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_afpacket_flush(struct sr_instance* sr) {
+  int i, ret = 0;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(sr->afp);
+
+  for (i = 0; i < sr->afp->nports; i++) {
+    if (sr->afp->ports[i].tx_pending && sr_afpacket_kick(&(sr->afp->ports[i]), 0) != 0) {
+      ret = -1;
+    }
+  }
+  return ret;
+} /* -- sr_afpacket_flush -- */
@@ -0,0 +1,77 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_afpacket.h
+ *
+ * Description:
+ *
+ * Direct attachment to local Linux interfaces, as an alternative to the VNS
+ * server.  Every sr_if gets its own AF_PACKET socket with TPACKET_V3 RX and
+ * TX rings mapped into the process: received frames are handed to the
+ * router straight out of the RX blocks, and sent frames are written into TX
+ * ring slots and pushed to the kernel with one sendto(..) per batch.  The
+ * interface MAC and IP addresses are taken from the OS.
+ *
+ * The kernel keeps running its own stack on these interfaces, so the host
+ * (or namespace) running sr should have ip_forward turned off.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_AFPACKET_H
+#define SR_AFPACKET_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include <stddef.h>
+
+#define SR_AFP_MAX_PORTS 16
+#define SR_AFP_BLOCK_SIZE (256 * 1024) /* ring block, multiple of the page size */
+#define SR_AFP_FRAME_SIZE 2048         /* TX slot, also caps the RX frame size */
+#define SR_AFP_RX_BLOCKS 16
+#define SR_AFP_TX_BLOCKS 4
+#define SR_AFP_BLOCK_TIMEOUT 1 /* ms before the kernel retires a partly filled block */
+#define SR_AFP_RX_BURST 8      /* RX blocks handled per readiness event */
+
+struct sr_instance;
+struct sr_if;
+struct sr_event;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_afp_port
+ *
+ * One attached interface and its mapped rings
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_afp_port {
+  struct sr_instance* sr;
+  struct sr_if* iface;
+  int fd;
+  int ifindex;
+  struct sr_event* ev; /* fd's registration with the loop */
+  uint8_t* map;        /* RX blocks followed by TX blocks */
+  size_t map_len;
+  unsigned int rx_block; /* next RX block to look at */
+  uint8_t* tx_ring;
+  unsigned int tx_frames;
+  unsigned int tx_head;    /* next TX slot to fill */
+  unsigned int tx_pending; /* slots filled since the last sendto(..) */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_afpacket
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_afpacket {
+  struct sr_afp_port ports[SR_AFP_MAX_PORTS];
+  int nports;
+};
+
+int sr_afpacket_open(struct sr_instance* sr, const char* ifnames);
+int sr_afpacket_start(struct sr_instance* sr);
+void sr_afpacket_close(struct sr_instance* sr);
+int sr_afpacket_send(struct sr_instance* sr, uint8_t* buf, unsigned int len, unsigned int ifidx);
+int sr_afpacket_flush(struct sr_instance* sr);
+
+#endif /* -- SR_AFPACKET_H -- */
@@ -9,9 +9,13 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "log.h"
+#include "sr_flight.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
 #include "sr_router.h"
+#include "sr_stats.h"
+#include "sr_utils.h"
 
 /* [x] sr_arpcache_sweepreqs
   This function gets called every second. For each request sent out, we keep
@@ -19,150 +23,169 @@
   See the comments in the header file for an idea of what it should look like.
 */
 void sr_arpcache_sweepreqs(struct sr_instance *sr) {
-  struct sr_arpreq *req = sr->cache.requests;
+  struct sr_arpreq *req = sr->cache.requests, *next;
   while (req != NULL) {
+    /* handle_arpreq may destroy req */
+    next = req->next;
     handle_arpreq(sr, req);
-    req = req->next;
+    req = next;
   }
 }
 
 /* [x] handle_arpreq
 @param sr the router instance
 @param req the arp request
+Sends while the cache lock is held, so it must only run on the loop thread,
+which never waits on a worker. Workers use sr_arpreq_due and send after
+unlocking.
 */
 void handle_arpreq(struct sr_instance *sr, struct sr_arpreq *req) {
+  struct sr_arpsend send;
+
+  /* 1s timeout, 5 retries */
+  if (difftime(time(NULL), req->sent) >= 1.0 && req->times_sent >= 5) {
+    struct sr_packet *pkt = req->packets;
+    while (pkt != NULL) {
+      /* back out of the interface the packet came in on */
+      sr_send_icmp_t3(sr, &(pkt->meta), pkt->meta.in_idx, 3, 1, 0);
+      pkt = pkt->next;
+    }
+    /* destroy the request */
+    sr_arpreq_destroy(&sr->cache, req);
+  } else if (sr_arpreq_due(req, &send)) {
+    /* resend the request */
+    sr_arpreq_send(sr, &send);
+  }
+}
+
+/* [x] sr_arpreq_due
+@param req the arp request, with the cache lock held
+@param send filled in with what to send if the request is due
+@return 1 if the request has not gone out within the last second and has
+        tries left; it is counted as sent now
+*/
+int sr_arpreq_due(struct sr_arpreq *req, struct sr_arpsend *send) {
   time_t now = time(NULL);
 
-  /* 1s timeout */
-  if (difftime(now, req->sent) >= 1.0) {
-    /* 5 retries */
-    if (req->times_sent >= 5) {
-      struct sr_packet *pkt = req->packets;
-      while (pkt != NULL) {
-        sr_send_icmp_t3(sr, pkt->buf, pkt->len, pkt->iface, 3, 1);
-        pkt = pkt->next;
-      }
-      /* destroy the request */
-      sr_arpreq_destroy(&sr->cache, req);
-    } else {
-      /* resend the request */
-      uint8_t *arp_req = create_arp_request(sr, req->ip, req->packets->iface);
-      sr_send_packet(sr, arp_req, ARP_PACKET_LEN, req->packets->iface);
-      free(arp_req);
-      req->sent = now;
-      req->times_sent++;
-    }
+  if (difftime(now, req->sent) < 1.0 || req->times_sent >= 5) {
+    return 0;
+  }
+  send->ip = req->ip;
+  send->ifidx = req->ifidx;
+  req->sent = now;
+  req->times_sent++;
+  return 1;
+}
+
+/* [x] sr_arpreq_send
+@param sr the router instance
+@param send an ARP request picked by sr_arpreq_due
+*/
+void sr_arpreq_send(struct sr_instance *sr, const struct sr_arpsend *send) {
+  struct sr_pktbuf *arp_req = create_arp_request(sr, send->ip, send->ifidx);
+  if (arp_req) {
+    sr_send_packet_idx(sr, arp_req->data, arp_req->len, send->ifidx);
+    sr_pktbuf_put(&(sr->pool), arp_req);
   }
 }
 
 /* [x] create_arp_request
 @param sr the router instance
 @param ip the ip address of the destination
+@param ifidx the index of the interface to ask on
+@return a pool buffer holding the request, or NULL if the pool is empty
 */
-uint8_t *create_arp_request(struct sr_instance *sr, uint32_t ip, const char *iface) {
-  /* ARP Packet Length = Ethernet Header Length + ARP Header Length */ 
-  unsigned int packet_len = ARP_PACKET_LEN;
-  uint8_t *packet = (uint8_t *)malloc(packet_len);
-
-  /* Allocate headers */
-  struct sr_ethernet_hdr *eth_hdr = (struct sr_ethernet_hdr *)packet;
-  struct sr_arp_hdr *arp_hdr = (struct sr_arp_hdr *)(packet + sizeof(struct sr_ethernet_hdr));
-
-  /* Fill Ethernet Header */
-  /* Broadcast MAC address */
-  memset(eth_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN);
-  /* Source (sender) MAC address */
-  memcpy(eth_hdr->ether_shost, sr_get_interface(sr, iface)->addr, ETHER_ADDR_LEN);
-  /* ARP */
-  eth_hdr->ether_type = htons(ethertype_arp);
-
-  /* Fill ARP Header */
-  /* Ethernet */
-  arp_hdr->ar_hrd = htons(arp_hrd_ethernet);
-  /* IP */
-  arp_hdr->ar_pro = htons(ethertype_ip);
-  /* MAC address length */
-  arp_hdr->ar_hln = ETHER_ADDR_LEN;
-  /*IP address length*/
-  arp_hdr->ar_pln = sizeof(uint32_t);
-  /* ARP Request */
-  arp_hdr->ar_op = htons(arp_op_request);
-
-  /* Source MAC and IP address */
-  memcpy(arp_hdr->ar_sha, sr_get_interface(sr, iface)->addr, ETHER_ADDR_LEN);
-  arp_hdr->ar_sip = sr_get_interface(sr, iface)->ip;
-
-  /* Target MAC and IP address */
-  memset(arp_hdr->ar_tha, 0x00, ETHER_ADDR_LEN);
+struct sr_pktbuf *create_arp_request(struct sr_instance *sr, uint32_t ip, unsigned int ifidx) {
+  struct sr_if *out_if = sr_get_interface_idx(sr, ifidx);
+  if (!out_if) {
+    return NULL;
+  }
+  struct sr_pktbuf *pb = sr_pktbuf_alloc(&(sr->pool), SR_IF_ARP_TMPL_LEN);
+  if (!pb) {
+    LOG_ERROR("No packet buffer for ARP request");
+    return NULL;
+  }
+
+  /* Everything but the target IP comes from the interface's template */
+  memcpy(pb->data, out_if->arp_tmpl, SR_IF_ARP_TMPL_LEN);
+  struct sr_arp_hdr *arp_hdr = (struct sr_arp_hdr *)(pb->data + sizeof(struct sr_ethernet_hdr));
   arp_hdr->ar_tip = ip;
 
-  return packet;
+  return pb;
 }
 
 /*
 [x] This function implements `sr_router.c:send_icmp_response`.
-[ ] Move this function to the right place.
+[x] Move this function to the right place.
 @param sr the router instance
-@param packet the packet to send
-@param len the length of the packet
-@param iface the interface to send the packet
+@param meta the packet to answer
+@param ifidx the index of the interface to send the packet
 @param type the type of the ICMP packet
 @param code the code of the ICMP packet
+@param ip_src the source address, or 0 for the address of the interface
  */
-void sr_send_icmp_t3(struct sr_instance *sr, uint8_t *packet, unsigned int len, const char *iface, uint8_t type,
-                     uint8_t code) {
-  /* Get the Ethernet and IP headers */
-  struct sr_ethernet_hdr *eth_hdr = (struct sr_ethernet_hdr *)packet;
-  struct sr_ip_hdr *ip_hdr = (struct sr_ip_hdr *)(packet + sizeof(struct sr_ethernet_hdr));
-
-  /* Allocate memory for the ICMP packet */
-  unsigned int icmp_packet_len =
-      sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr) + sizeof(struct sr_icmp_t3_hdr);
-  uint8_t *icmp_packet = (uint8_t *)malloc(icmp_packet_len);
-
-  /* Fill Ethernet Header */
+void sr_send_icmp_t3(struct sr_instance *sr, const struct sr_pkt_meta *meta, unsigned int ifidx, uint8_t type,
+                     uint8_t code, uint32_t ip_src) {
+  struct sr_if *out_if = sr_get_interface_idx(sr, ifidx);
+  if (!out_if) {
+    return;
+  }
+
+  /* Take a pool buffer for the ICMP packet and start from the template */
+  struct sr_pktbuf *pb = sr_pktbuf_alloc(&(sr->pool), SR_IF_ICMP_TMPL_LEN);
+  if (!pb) {
+    LOG_ERROR("No packet buffer for ICMP message");
+    return;
+  }
+  uint8_t *icmp_packet = pb->data;
+  memcpy(icmp_packet, out_if->icmp_tmpl, SR_IF_ICMP_TMPL_LEN);
+
+  /* Ethernet: back to whoever sent the packet */
+  struct sr_ethernet_hdr *eth_hdr = (struct sr_ethernet_hdr *)meta->frame;
   struct sr_ethernet_hdr *new_eth_hdr = (struct sr_ethernet_hdr *)icmp_packet;
   memcpy(new_eth_hdr->ether_dhost, eth_hdr->ether_shost, ETHER_ADDR_LEN);
-  memcpy(new_eth_hdr->ether_shost, sr_get_interface(sr, iface)->addr, ETHER_ADDR_LEN);
-  new_eth_hdr->ether_type = htons(ethertype_ip);
 
-  /* Fill IP Header */
+  /* IP: fill in the addresses, patching the checksum for each */
   struct sr_ip_hdr *new_ip_hdr = (struct sr_ip_hdr *)(icmp_packet + sizeof(struct sr_ethernet_hdr));
-  new_ip_hdr->ip_v = 4;
-  new_ip_hdr->ip_hl = sizeof(struct sr_ip_hdr) / 4;
-  new_ip_hdr->ip_tos = 0;
-  new_ip_hdr->ip_len = htons(sizeof(struct sr_ip_hdr) + sizeof(struct sr_icmp_t3_hdr));
-  new_ip_hdr->ip_id = 0;
-  new_ip_hdr->ip_off = htons(IP_DF);
-  new_ip_hdr->ip_ttl = 64;
-  new_ip_hdr->ip_p = ip_protocol_icmp;
-  new_ip_hdr->ip_src = sr_get_interface(sr, iface)->ip;
-  new_ip_hdr->ip_dst = ip_hdr->ip_src;
-  new_ip_hdr->ip_sum = 0;
-  new_ip_hdr->ip_sum = cksum(new_ip_hdr, sizeof(struct sr_ip_hdr));
-
-  /* Fill ICMP Header */
+  new_ip_hdr->ip_dst = meta->ip_src;
+  new_ip_hdr->ip_sum = cksum_adjust32(new_ip_hdr->ip_sum, 0, meta->ip_src);
+  if (ip_src != 0 && ip_src != out_if->ip) {
+    new_ip_hdr->ip_src = ip_src;
+    new_ip_hdr->ip_sum = cksum_adjust32(new_ip_hdr->ip_sum, out_if->ip, ip_src);
+  }
+
+  /* ICMP: quotes the offending header, so it is summed afresh */
   struct sr_icmp_t3_hdr *icmp_hdr =
       (struct sr_icmp_t3_hdr *)(icmp_packet + sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr));
   icmp_hdr->icmp_type = type;
   icmp_hdr->icmp_code = code;
-  icmp_hdr->unused = 0;
-  icmp_hdr->next_mtu = 0;
-  memcpy(icmp_hdr->data, ip_hdr, ICMP_DATA_SIZE);
-  icmp_hdr->icmp_sum = 0;
+  memcpy(icmp_hdr->data, meta->frame + meta->l3_off, ICMP_DATA_SIZE);
   icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(struct sr_icmp_t3_hdr));
 
-  sr_send_packet(sr, icmp_packet, icmp_packet_len, iface);
+  sr_send_packet_idx(sr, icmp_packet, SR_IF_ICMP_TMPL_LEN, ifidx);
 
-  free(icmp_packet);
+  sr_pktbuf_put(&(sr->pool), pb);
 }
 
 /* You should not need to touch the rest of this code. */
 
+/* The cache lock is only taken when more than one thread uses the cache. */
+void sr_arpcache_lock(struct sr_arpcache *cache) {
+  if (cache->shared) {
+    pthread_mutex_lock(&(cache->lock));
+  }
+}
+
+void sr_arpcache_unlock(struct sr_arpcache *cache) {
+  if (cache->shared) {
+    pthread_mutex_unlock(&(cache->lock));
+  }
+}
+
 /* Checks if an IP->MAC mapping is in the cache. IP is in network byte
    order. You must free the returned structure if it is not NULL. */
 struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
-  pthread_mutex_lock(&(cache->lock));
+  sr_arpcache_lock(cache);
 
   struct sr_arpentry *entry = NULL, *copy = NULL;
 
@@ -180,7 +203,7 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
     memcpy(copy, entry, sizeof(struct sr_arpentry));
   }
 
-  pthread_mutex_unlock(&(cache->lock));
+  sr_arpcache_unlock(cache);
 
   return copy;
 }
@@ -190,10 +213,12 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
    that corresponds to this ARP request. You should free the passed *packet.
 
    A pointer to the ARP request is returned; it should not be freed. The caller
-   can remove the ARP request from the queue by calling sr_arpreq_destroy. */
-struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache, uint32_t ip, uint8_t *packet, /* borrowed */
-                                       unsigned int packet_len, char *iface) {
-  pthread_mutex_lock(&(cache->lock));
+   can remove the ARP request from the queue by calling sr_arpreq_destroy.
+   Returns NULL if the packet could not be queued. */
+struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache, uint32_t ip,
+                                       const struct sr_pkt_meta *meta, /* borrowed */
+                                       unsigned int ifidx) {
+  sr_arpcache_lock(cache);
 
   struct sr_arpreq *req;
   for (req = cache->requests; req != NULL; req = req->next) {
@@ -202,28 +227,62 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache, uint32_t ip, u
     }
   }
 
+  /* The frame sits in a receive buffer that is reused, copy it into the pool once */
+  unsigned int packet_len = meta->len;
+  struct sr_pktbuf *pb = sr_pktbuf_alloc(cache->pool, packet_len);
+  if (pb == NULL) {
+    LOG_ERROR("No packet buffer to queue on ARP, dropping packet");
+    sr_arpcache_unlock(cache);
+    return NULL;
+  }
+  uint8_t *packet = pb->data;
+  memcpy(packet, meta->frame, packet_len);
+
   /* If the IP wasn't found, add it */
   if (!req) {
     req = (struct sr_arpreq *)calloc(1, sizeof(struct sr_arpreq));
     req->ip = ip;
+    req->ifidx = ifidx;
     req->next = cache->requests;
     cache->requests = req;
   }
 
-  /* Add the packet to the list of packets for this request */
-  if (packet && packet_len && iface) {
-    struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
+  /* One dead next hop must not hold the whole pool, make room by dropping the oldest */
+  struct sr_packet *new_pkt;
+  if (req->npackets == SR_ARPREQ_MAX_PACKETS) {
+    LOG_DEBUG("ARP queue full, dropping the oldest packet");
+    new_pkt = req->packets;
+    req->packets = new_pkt->next;
+    req->npackets--;
+
+    /* It was counted as queued when its burst was done, it is dropped after all */
+    new_pkt->meta.disp = SR_DISP_ARP_OVERFLOW;
+    new_pkt->meta.out_idx = req->ifidx;
+    sr_stats_redecide(new_pkt->meta.in_idx, SR_DISP_ARP_QUEUED, SR_DISP_ARP_OVERFLOW);
+    sr_flight_redecide(&(new_pkt->meta), sr_clock_ns());
+    sr_pktbuf_put(cache->pool, new_pkt->pb);
+  } else {
+    new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
+  }
 
-    new_pkt->buf = (uint8_t *)malloc(packet_len);
-    memcpy(new_pkt->buf, packet, packet_len);
-    new_pkt->len = packet_len;
-    new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
-    strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
-    new_pkt->next = req->packets;
+  /* Add the packet to the end of the list of packets for this request */
+  new_pkt->buf = packet;
+  new_pkt->len = packet_len;
+  new_pkt->meta = *meta;
+  new_pkt->meta.frame = packet;
+  new_pkt->pb = pb;
+  new_pkt->ifidx = ifidx;
+  new_pkt->queued_ns = sr_clock_ns();
+  new_pkt->next = NULL;
+  if (req->packets) {
+    req->last->next = new_pkt;
+  } else {
     req->packets = new_pkt;
   }
+  req->last = new_pkt;
+  req->npackets++;
 
-  pthread_mutex_unlock(&(cache->lock));
+  sr_arpcache_unlock(cache);
 
   return req;
 }
@@ -233,7 +292,7 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache, uint32_t ip, u
       to the sr_arpreq with this IP. Otherwise, returns NULL.
    2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
 struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache, unsigned char *mac, uint32_t ip) {
-  pthread_mutex_lock(&(cache->lock));
+  sr_arpcache_lock(cache);
 
   struct sr_arpreq *req, *prev = NULL, *next = NULL;
   for (req = cache->requests; req != NULL; req = req->next) {
@@ -265,7 +324,7 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache, unsigned char *m
     cache->entries[i].valid = 1;
   }
 
-  pthread_mutex_unlock(&(cache->lock));
+  sr_arpcache_unlock(cache);
 
   return req;
 }
@@ -273,7 +332,7 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache, unsigned char *m
 /* Frees all memory associated with this arp request entry. If this arp request
    entry is on the arp request queue, it is removed from the queue. */
 void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
-  pthread_mutex_lock(&(cache->lock));
+  sr_arpcache_lock(cache);
 
   if (entry) {
     struct sr_arpreq *req, *prev = NULL, *next = NULL;
@@ -296,19 +355,14 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
 
     for (pkt = entry->packets; pkt; pkt = nxt) {
       nxt = pkt->next;
-      if (pkt->buf) {
-        free(pkt->buf);
-      }
-      if (pkt->iface) {
-        free(pkt->iface);
-      }
+      sr_pktbuf_put(cache->pool, pkt->pb);
       free(pkt);
     }
 
     free(entry);
   }
 
-  pthread_mutex_unlock(&(cache->lock));
+  sr_arpcache_unlock(cache);
 }
 
 /* Prints out the ARP table. */
@@ -335,6 +389,7 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
   /* Invalidate all entries */
   memset(cache->entries, 0, sizeof(cache->entries));
   cache->requests = NULL;
+  cache->shared = 1;
 
   /* Acquire mutex lock */
   pthread_mutexattr_init(&(cache->attr));
@@ -349,29 +404,43 @@ int sr_arpcache_destroy(struct sr_arpcache *cache) {
   return pthread_mutex_destroy(&(cache->lock)) && pthread_mutexattr_destroy(&(cache->attr));
 }
 
-/* Thread which sweeps through the cache and invalidates entries that were added
-   more than SR_ARPCACHE_TO seconds ago. */
-void *sr_arpcache_timeout(void *sr_ptr) {
-  struct sr_instance *sr = sr_ptr;
+/* Invalidates entries that were added more than SR_ARPCACHE_TO seconds ago
+   and gives every outstanding request a chance to be resent. Must be called
+   once a second. */
+void sr_arpcache_tick(struct sr_instance *sr) {
   struct sr_arpcache *cache = &(sr->cache);
 
-  while (1) {
-    sleep(1.0);
+  sr_arpcache_lock(cache);
 
-    pthread_mutex_lock(&(cache->lock));
-
-    time_t curtime = time(NULL);
+  time_t curtime = time(NULL);
 
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-      if ((cache->entries[i].valid) && (difftime(curtime, cache->entries[i].added) > SR_ARPCACHE_TO)) {
-        cache->entries[i].valid = 0;
-      }
+  int i;
+  for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+    if ((cache->entries[i].valid) && (difftime(curtime, cache->entries[i].added) > SR_ARPCACHE_TO)) {
+      cache->entries[i].valid = 0;
     }
+  }
 
-    sr_arpcache_sweepreqs(sr);
+  sr_arpcache_sweepreqs(sr);
 
-    pthread_mutex_unlock(&(cache->lock));
+  sr_arpcache_unlock(cache);
+
+  /* ARP requests and ICMP errors from this pass are batched on this thread */
+  sr_flush_packets(sr);
+}
+
+/* Event loop callback driving sr_arpcache_tick from a one second timer. */
+void sr_arpcache_timer(int fd, uint32_t events, void *sr_ptr) { sr_arpcache_tick((struct sr_instance *)sr_ptr); }
+
+/* Thread which sweeps through the cache and invalidates entries that were added
+   more than SR_ARPCACHE_TO seconds ago. Only needed when the router is not
+   run from an event loop; cache->shared must be set before starting it. */
+void *sr_arpcache_timeout(void *sr_ptr) {
+  struct sr_instance *sr = sr_ptr;
+
+  while (1) {
+    sleep(1.0);
+    sr_arpcache_tick(sr);
   }
 
   return NULL;
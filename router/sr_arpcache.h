@@ -70,16 +70,22 @@
 #include <pthread.h>
 #include <time.h>
 #include "sr_if.h"
+#include "sr_pktbuf.h"
+#include "sr_pktmeta.h"
 
 
 #define SR_ARPCACHE_SZ 100
 #define SR_ARPCACHE_TO 15.0
+#define SR_ARPREQ_MAX_PACKETS 64 /* queued per request; the oldest is dropped past it */
 #define ARP_PACKET_LEN sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr)
 
 struct sr_packet {
-  uint8_t *buf;     /* A raw Ethernet frame, presumably with the dest MAC empty */
-  unsigned int len; /* Length of raw Ethernet frame */
-  char *iface;      /* The outgoing interface */
+  uint8_t *buf;                 /* A raw Ethernet frame, presumably with the dest MAC empty */
+  unsigned int len;             /* Length of raw Ethernet frame */
+  struct sr_pkt_meta meta;      /* Its decoded headers, meta.frame == buf */
+  struct sr_pktbuf *pb;         /* Pool buffer holding buf, referenced while queued */
+  unsigned int ifidx;           /* The outgoing interface's index */
+  uint64_t queued_ns;           /* sr_clock_ns() when it was queued */
   struct sr_packet *next;
 };
 
@@ -97,15 +103,28 @@ struct sr_arpreq {
                                 never sent, will be 0. */
   uint32_t times_sent;       /* Number of times this request was sent. You
                                 should update this. */
-  struct sr_packet *packets; /* List of pkts waiting on this req to finish */
+  unsigned int ifidx;        /* Interface the request is sent out of */
+  struct sr_packet *packets; /* List of pkts waiting on this req to finish,
+                                oldest first; never empty */
+  struct sr_packet *last;    /* The newest of them */
+  unsigned int npackets;     /* How many there are, SR_ARPREQ_MAX_PACKETS at most */
   struct sr_arpreq *next;
 };
 
+/* An ARP request that came due while the cache lock was held, sent by
+   sr_arpreq_send once the lock is dropped. */
+struct sr_arpsend {
+  uint32_t ip;
+  unsigned int ifidx;
+};
+
 struct sr_arpcache {
   struct sr_arpentry entries[SR_ARPCACHE_SZ];
   struct sr_arpreq *requests;
+  int shared; /* set if more than one thread uses the cache; 0 skips lock */
   pthread_mutex_t lock;
   pthread_mutexattr_t attr;
+  struct sr_pktpool *pool; /* queued packets are held in its buffers */
 };
 
 /* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
@@ -114,13 +133,21 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
-   that corresponds to this ARP request. The packet argument should not be
-   freed by the caller.
-
-   A pointer to the ARP request is returned; it should be freed. The caller
-   can remove the ARP request from the queue by calling sr_arpreq_destroy. */
-struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache, uint32_t ip, uint8_t *packet, /* borrowed */
-                                       unsigned int packet_len, char *iface);
+   that corresponds to this ARP request. The packet, described by meta, should
+   not be freed by the caller. It will go out of interface ifidx, which a new
+   request is also sent out of. The packet is copied into a pool buffer; if
+   the pool is exhausted the packet is dropped. A request holds at most
+   SR_ARPREQ_MAX_PACKETS packets, past that the oldest one is dropped and
+   counted and recorded again as SR_DISP_ARP_OVERFLOW; call this while
+   handling a burst, see sr_flight_redecide.
+
+   A pointer to the ARP request is returned; it should not be freed. The
+   caller can remove the ARP request from the queue by calling
+   sr_arpreq_destroy. NULL is returned if the packet was dropped, whether or
+   not a request for ip is pending. */
+struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache, uint32_t ip,
+                                       const struct sr_pkt_meta *meta, /* borrowed */
+                                       unsigned int ifidx);
 
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
@@ -132,18 +159,31 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache, unsigned char *m
    entry is on the arp request queue, it is removed from the queue. */
 void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry);
 
+/* Take and release the cache lock. Recursive, and a no-op unless the cache
+   is shared between threads; hold it to make a lookup and the queueing that
+   follows a miss atomic. */
+void sr_arpcache_lock(struct sr_arpcache *cache);
+void sr_arpcache_unlock(struct sr_arpcache *cache);
+
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache);
 
 /* You shouldn't have to call these methods--they're already called in the
    starter code for you. The init call is a constructor, the destroy call is
-   a destructor, and a cleanup thread times out cache entries every 15
-   seconds. */
+   a destructor, and sr_arpcache_tick, run once a second from an event loop
+   timer (sr_arpcache_timer) or a cleanup thread (sr_arpcache_timeout), times
+   out cache entries every 15 seconds. */
 
 int sr_arpcache_init(struct sr_arpcache *cache);
 int sr_arpcache_destroy(struct sr_arpcache *cache);
+void sr_arpcache_tick(struct sr_instance *sr);
+void sr_arpcache_timer(int fd, uint32_t events, void *sr_ptr);
 void *sr_arpcache_timeout(void *cache_ptr);
-uint8_t *create_arp_request(struct sr_instance *sr, uint32_t ip, const char *iface);
+struct sr_pktbuf *create_arp_request(struct sr_instance *sr, uint32_t ip, unsigned int ifidx);
 void handle_arpreq(struct sr_instance *sr, struct sr_arpreq *req);
+int sr_arpreq_due(struct sr_arpreq *req, struct sr_arpsend *send);
+void sr_arpreq_send(struct sr_instance *sr, const struct sr_arpsend *send);
+void sr_send_icmp_t3(struct sr_instance *sr, const struct sr_pkt_meta *meta, unsigned int ifidx, uint8_t type,
+                     uint8_t code, uint32_t ip_src);
 
 #endif
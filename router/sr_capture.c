@@ -0,0 +1,572 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.c
+ *
+ * Description:
+ *
+ * Asynchronous pcap / pcapng writer, see sr_capture.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_capture.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "sr_dumper.h"
+#include "sr_if.h"
+#include "sr_router.h"
+
+/* -- pcapng block types and options, see draft-ietf-opsawg-pcapng -- */
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_END 0
+#define PCAPNG_IF_NAME 2
+#define PCAPNG_IF_TSRESOL 9
+#define PCAPNG_EPB_FLAGS 2
+#define PCAPNG_EPB_INBOUND 1
+#define PCAPNG_EPB_OUTBOUND 2
+
+#define PAD4(n) (((n) + 3) & ~3u)
+
+/* -- frames each thread has let through the filter, for sampling -- */
+static __thread unsigned int sr_cap_seen;
+
+static uint8_t* sr_cap_put32(uint8_t* p, uint32_t v) {
+  memcpy(p, &v, 4);
+  return p + 4;
+} /* -- sr_cap_put32 -- */
+
+static uint8_t* sr_cap_put16(uint8_t* p, uint16_t v) {
+  memcpy(p, &v, 2);
+  return p + 2;
+} /* -- sr_cap_put16 -- */
+
+/* -- option of len bytes, padded to 4 -- */
+static uint8_t* sr_cap_put_opt(uint8_t* p, uint16_t code, const void* val, uint16_t len) {
+  p = sr_cap_put16(p, code);
+  p = sr_cap_put16(p, len);
+  memset(p, 0, PAD4(len));
+  memcpy(p, val, len);
+  return p + PAD4(len);
+} /* -- sr_cap_put_opt -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_cap_write(..)
+ * Scope: Local
+ *
+ * Write the block out, dropping it (and saying so) if the file will not
+ * take it; the capture must never hold up the writer for good.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_cap_write(struct sr_capture* cap) {
+  unsigned int off = 0;
+  ssize_t n;
+
+  while (off < cap->block_used) {
+    if ((n = write(cap->fd, cap->block + off, cap->block_used - off)) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("write(..):sr_capture.c::sr_cap_write(..)");
+      break;
+    }
+    off += n;
+  }
+  cap->file_bytes += cap->block_used;
+  __atomic_add_fetch(&(cap->stats.bytes), cap->block_used, __ATOMIC_RELAXED);
+  cap->block_used = 0;
+} /* -- sr_cap_write -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_cap_header(..)
+ * Scope: Local
+ *
+ * Start a file's contents in the (empty) block: the pcap file header, or
+ * a pcapng section header and an interface description per sr_if.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_cap_header(struct sr_capture* cap) {
+  struct pcap_file_header hdr;
+  struct sr_if* iface;
+  uint8_t* p = cap->block;
+  uint8_t* start;
+  uint8_t tsresol = 9;
+  unsigned int i;
+
+  if (!cap->pcapng) {
+    hdr.magic = TCPDUMP_MAGIC;
+    hdr.version_major = PCAP_VERSION_MAJOR;
+    hdr.version_minor = PCAP_VERSION_MINOR;
+    hdr.thiszone = 0;
+    hdr.sigfigs = 0;
+    hdr.snaplen = PACKET_DUMP_SIZE;
+    hdr.linktype = LINKTYPE_ETHERNET;
+    memcpy(p, &hdr, sizeof(hdr));
+    cap->block_used = sizeof(hdr);
+    return;
+  }
+
+  p = sr_cap_put32(p, PCAPNG_SHB);
+  p = sr_cap_put32(p, 28);
+  p = sr_cap_put32(p, PCAPNG_BYTE_ORDER_MAGIC);
+  p = sr_cap_put16(p, 1);
+  p = sr_cap_put16(p, 0);
+  p = sr_cap_put32(p, 0xffffffff); /* section length unknown */
+  p = sr_cap_put32(p, 0xffffffff);
+  p = sr_cap_put32(p, 28);
+
+  /* -- interface IDs are sr_if indices, so one block per index in order -- */
+  for (i = 0; i < cap->sr->if_count; i++) {
+    iface = sr_get_interface_idx(cap->sr, i);
+    start = p;
+    p = sr_cap_put32(p, PCAPNG_IDB);
+    p += 4; /* length, filled in below */
+    p = sr_cap_put16(p, LINKTYPE_ETHERNET);
+    p = sr_cap_put16(p, 0);
+    p = sr_cap_put32(p, PACKET_DUMP_SIZE);
+    p = sr_cap_put_opt(p, PCAPNG_IF_NAME, iface->name, strnlen(iface->name, sr_IFACE_NAMELEN));
+    p = sr_cap_put_opt(p, PCAPNG_IF_TSRESOL, &tsresol, 1);
+    p = sr_cap_put32(p, PCAPNG_OPT_END);
+    p = sr_cap_put32(p, p - start + 4);
+    sr_cap_put32(start + 4, p - start);
+  }
+  cap->block_used = p - cap->block;
+} /* -- sr_cap_header -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_cap_next_file(..)
+ * Scope: Local
+ *
+ * Close the current file, if any, and open the next one.  Its header is
+ * put in the block with the first frame, by which time the interfaces
+ * are known.  Returns -1 if it could not be opened.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_cap_next_file(struct sr_capture* cap) {
+  char name[1024];
+
+  if (cap->fd == STDOUT_FILENO || strcmp(cap->fname, "-") == 0) {
+    cap->fd = STDOUT_FILENO;
+  } else {
+    if (cap->fd != -1) {
+      close(cap->fd);
+    }
+    if (cap->stats.files == 0) {
+      snprintf(name, sizeof(name), "%s", cap->fname);
+    } else {
+      snprintf(name, sizeof(name), "%s.%u", cap->fname, cap->stats.files);
+    }
+    if ((cap->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+      LOG_ERROR("Can't open capture file %s: %s", name, strerror(errno));
+      return -1;
+    }
+  }
+
+  __atomic_add_fetch(&(cap->stats.files), 1, __ATOMIC_RELAXED);
+  cap->file_bytes = 0;
+  cap->need_header = 1;
+  return 0;
+} /* -- sr_cap_next_file -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_cap_encode(..)
+ * Scope: Local
+ *
+ * Append the record for slot to the block, moving on to the next file
+ * first if this one is full.  Frames are dropped once a file could not
+ * be opened.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_cap_encode(struct sr_capture* cap, struct sr_cap_slot* slot, const uint8_t* frame) {
+  unsigned int rec_len;
+  uint32_t flags;
+  uint8_t* p;
+
+  rec_len = cap->pcapng ? 32 + PAD4(slot->caplen) + 12 : 16 + slot->caplen;
+
+  if (cap->rotate && !cap->need_header && cap->fd != STDOUT_FILENO &&
+      cap->file_bytes + cap->block_used + rec_len > cap->rotate) {
+    sr_cap_write(cap);
+    sr_cap_next_file(cap);
+  }
+  if (cap->fd == -1) {
+    __atomic_add_fetch(&(cap->stats.dropped), 1, __ATOMIC_RELAXED);
+    return;
+  }
+  if (cap->need_header) {
+    sr_cap_header(cap);
+    cap->need_header = 0;
+  }
+  if (cap->block_used + rec_len > SR_CAP_BLOCK) {
+    sr_cap_write(cap);
+  }
+
+  p = cap->block + cap->block_used;
+  if (cap->pcapng) {
+    flags = slot->dir == SR_CAP_OUT ? PCAPNG_EPB_OUTBOUND : PCAPNG_EPB_INBOUND;
+    p = sr_cap_put32(p, PCAPNG_EPB);
+    p = sr_cap_put32(p, rec_len);
+    p = sr_cap_put32(p, slot->ifidx);
+    p = sr_cap_put32(p, (uint32_t)(slot->ts_ns >> 32));
+    p = sr_cap_put32(p, (uint32_t)slot->ts_ns);
+    p = sr_cap_put32(p, slot->caplen);
+    p = sr_cap_put32(p, slot->len);
+    memset(p + slot->caplen, 0, PAD4(slot->caplen) - slot->caplen);
+    memcpy(p, frame, slot->caplen);
+    p += PAD4(slot->caplen);
+    p = sr_cap_put_opt(p, PCAPNG_EPB_FLAGS, &flags, 4);
+    p = sr_cap_put32(p, PCAPNG_OPT_END);
+    sr_cap_put32(p, rec_len);
+  } else {
+    p = sr_cap_put32(p, (uint32_t)(slot->ts_ns / 1000000000));
+    p = sr_cap_put32(p, (uint32_t)(slot->ts_ns % 1000000000 / 1000));
+    p = sr_cap_put32(p, slot->caplen);
+    p = sr_cap_put32(p, slot->len);
+    memcpy(p, frame, slot->caplen);
+  }
+  cap->block_used += rec_len;
+  __atomic_add_fetch(&(cap->stats.written), 1, __ATOMIC_RELAXED);
+} /* -- sr_cap_encode -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_cap_drain(..)
+ * Scope: Local
+ *
+ * Encode every frame published so far, in order.  Returns how many there
+ * were.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int sr_cap_drain(struct sr_capture* cap) {
+  struct sr_cap_slot* slot;
+  unsigned long dropped;
+  unsigned int i, n = 0;
+
+  for (;;) {
+    i = cap->head & (SR_CAP_SLOTS - 1);
+    slot = &(cap->slots[i]);
+    if (__atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE) != cap->head + 1) {
+      break;
+    }
+    sr_cap_encode(cap, slot, cap->data + (size_t)i * PACKET_DUMP_SIZE);
+    __atomic_store_n(&(slot->seq), cap->head + SR_CAP_SLOTS, __ATOMIC_RELEASE);
+    __atomic_store_n(&(cap->head), cap->head + 1, __ATOMIC_RELAXED);
+    n++;
+  }
+
+  if ((dropped = __atomic_load_n(&(cap->stats.dropped), __ATOMIC_RELAXED)) != cap->reported) {
+    LOG_WARN("Capture writer behind, %lu frames dropped so far", dropped);
+    cap->reported = dropped;
+  }
+  return n;
+} /* -- sr_cap_drain -- */
+
+static int sr_cap_pending(struct sr_capture* cap) {
+  return __atomic_load_n(&(cap->slots[cap->head & (SR_CAP_SLOTS - 1)].seq), __ATOMIC_ACQUIRE) == cap->head + 1;
+} /* -- sr_cap_pending -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_cap_writer(..)
+ * Scope: Local
+ *
+ * Writer thread: drain the ring into the block, write the block when it
+ * is full, and otherwise sleep on evfd for SR_CAP_FLUSH_MS at a time.
+ * Every timeout drains the ring and writes out a partly filled block, so
+ * producers only wake the writer early when the ring passes SR_CAP_WAKE.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_cap_writer(void* arg) {
+  struct sr_capture* cap = (struct sr_capture*)arg;
+  struct pollfd pfd;
+  uint64_t val;
+  int ret;
+
+  pfd.fd = cap->evfd;
+  pfd.events = POLLIN;
+
+  while (__atomic_load_n(&(cap->running), __ATOMIC_SEQ_CST)) {
+    if (sr_cap_drain(cap) > 0) {
+      continue;
+    }
+
+    __atomic_store_n(&(cap->sleeping), 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!sr_cap_pending(cap) && __atomic_load_n(&(cap->running), __ATOMIC_SEQ_CST)) {
+      ret = poll(&pfd, 1, SR_CAP_FLUSH_MS);
+      if (ret > 0) {
+        if (read(cap->evfd, &val, sizeof(val)) == -1 && errno != EINTR) {
+          perror("read(..):sr_capture.c::sr_cap_writer(..)");
+        }
+      } else if (ret == 0) {
+        sr_cap_drain(cap);
+        if (cap->block_used > 0) {
+          sr_cap_write(cap);
+        }
+      }
+    }
+    __atomic_store_n(&(cap->sleeping), 0, __ATOMIC_SEQ_CST);
+  }
+
+  sr_cap_drain(cap);
+  if (cap->block_used > 0) {
+    sr_cap_write(cap);
+  }
+  return 0;
+} /* -- sr_cap_writer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_frame(..)
+ * Scope: Global
+ *
+ * Copy a frame sent or received on interface ifidx onto the ring, unless
+ * its direction, the filter or sampling leave it out.  Never blocks: with
+ * the ring full the frame is counted as dropped.  No syscall either unless
+ * the ring is past SR_CAP_WAKE, the writer picks frames up on its own
+ * every SR_CAP_FLUSH_MS.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capture_frame(struct sr_capture* cap, const uint8_t* frame, unsigned int len, unsigned int ifidx, int dir) {
+  struct sr_cap_slot* slot;
+  struct timespec ts;
+  unsigned int pos, seq;
+  uint64_t one = 1;
+
+  /* -- cheapest test first, and all before anything shared is touched -- */
+  if (!(cap->dirs & (1 << dir)) || !sr_filter_match(&(cap->filter), frame, len)) {
+    return;
+  }
+  if (cap->sample > 1 && sr_cap_seen++ % cap->sample != 0) {
+    return;
+  }
+
+  /* -- claim a slot -- */
+  pos = __atomic_load_n(&(cap->tail), __ATOMIC_RELAXED);
+  for (;;) {
+    slot = &(cap->slots[pos & (SR_CAP_SLOTS - 1)]);
+    seq = __atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE);
+    if (seq == pos) {
+      if (__atomic_compare_exchange_n(&(cap->tail), &pos, pos + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if ((int)(seq - pos) < 0) {
+      __atomic_add_fetch(&(cap->stats.dropped), 1, __ATOMIC_RELAXED);
+      return;
+    } else {
+      pos = __atomic_load_n(&(cap->tail), __ATOMIC_RELAXED);
+    }
+  }
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  slot->ts_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  slot->ifidx = ifidx;
+  slot->dir = dir;
+  slot->len = len;
+  slot->caplen = len < PACKET_DUMP_SIZE ? len : PACKET_DUMP_SIZE;
+  memcpy(cap->data + (size_t)(pos & (SR_CAP_SLOTS - 1)) * PACKET_DUMP_SIZE, frame, slot->caplen);
+  __atomic_store_n(&(slot->seq), pos + 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&(cap->stats.captured), 1, __ATOMIC_RELAXED);
+
+  /* -- order the publish before reading the flag, pairs with the writer -- */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (pos + 1 - __atomic_load_n(&(cap->head), __ATOMIC_RELAXED) >= SR_CAP_WAKE &&
+      __atomic_load_n(&(cap->sleeping), __ATOMIC_SEQ_CST) && __atomic_exchange_n(&(cap->sleeping), 0, __ATOMIC_SEQ_CST)) {
+    if (write(cap->evfd, &one, sizeof(one)) != sizeof(one)) {
+      perror("write(..):sr_capture.c::sr_capture_frame(..)");
+    }
+  }
+} /* -- sr_capture_frame -- */
+
+static void sr_cap_free(struct sr_capture* cap) {
+  if (cap->fd != -1 && cap->fd != STDOUT_FILENO) {
+    close(cap->fd);
+  }
+  if (cap->evfd != -1) {
+    close(cap->evfd);
+  }
+  free(cap->fname);
+  free(cap->block);
+  free(cap->data);
+  free(cap->slots);
+  free(cap);
+} /* -- sr_cap_free -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_open(..)
+ * Scope: Global
+ *
+ * Create the capture file fname ("-" for stdout, which is never rotated)
+ * and start the writer.  rotate is the size in bytes past which a new
+ * file is started, 0 for no limit.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_capture_open(struct sr_instance* sr, const char* fname, unsigned long rotate) {
+  struct sr_capture* cap;
+  sigset_t all, old;
+  size_t len;
+  unsigned int i;
+  int rc;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(fname);
+
+  if ((cap = (struct sr_capture*)calloc(1, sizeof(struct sr_capture))) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_capture_open)\n");
+    return -1;
+  }
+  cap->sr = sr;
+  cap->fd = -1;
+  cap->evfd = -1;
+  if ((cap->slots = (struct sr_cap_slot*)calloc(SR_CAP_SLOTS, sizeof(struct sr_cap_slot))) == 0 ||
+      (cap->data = (uint8_t*)malloc((size_t)SR_CAP_SLOTS * PACKET_DUMP_SIZE)) == 0 ||
+      (cap->block = (uint8_t*)malloc(SR_CAP_BLOCK)) == 0 || (cap->fname = strdup(fname)) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_capture_open)\n");
+    sr_cap_free(cap);
+    return -1;
+  }
+  len = strlen(fname);
+  cap->pcapng = len >= 7 && strcmp(fname + len - 7, ".pcapng") == 0;
+  cap->rotate = rotate;
+  cap->dirs = SR_CAP_DIR_BOTH;
+  cap->sample = 1;
+  for (i = 0; i < SR_CAP_SLOTS; i++) {
+    cap->slots[i].seq = i;
+  }
+  /* -- fault the ring and block in now rather than a page at a time on the data path -- */
+  memset(cap->data, 0, (size_t)SR_CAP_SLOTS * PACKET_DUMP_SIZE);
+  memset(cap->block, 0, SR_CAP_BLOCK);
+  if (sr_cap_next_file(cap) != 0) {
+    sr_cap_free(cap);
+    return -1;
+  }
+
+  if ((cap->evfd = eventfd(0, EFD_CLOEXEC)) == -1) {
+    perror("eventfd(..):sr_capture.c::sr_capture_open(..)");
+    sr_cap_free(cap);
+    return -1;
+  }
+  cap->running = 1;
+
+  /* -- the writer starts before the loop takes over the signals, keep them off it -- */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  rc = pthread_create(&(cap->thread), 0, sr_cap_writer, cap);
+  pthread_sigmask(SIG_SETMASK, &old, 0);
+  if ((errno = rc) != 0) {
+    perror("pthread_create(..):sr_capture.c::sr_capture_open(..)");
+    sr_cap_free(cap);
+    return -1;
+  }
+
+  sr->capture = cap;
+  return 0;
+} /* -- sr_capture_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_close(..)
+ * Scope: Global
+ *
+ * Write out what is left on the ring, stop the writer and report on the
+ * capture.  Only call it once no thread can capture any more.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capture_close(struct sr_instance* sr) {
+  struct sr_capture* cap = sr->capture;
+  uint64_t one = 1;
+
+  if (cap == 0) {
+    return;
+  }
+
+  __atomic_store_n(&(cap->running), 0, __ATOMIC_SEQ_CST);
+  if (write(cap->evfd, &one, sizeof(one)) != sizeof(one)) {
+    perror("write(..):sr_capture.c::sr_capture_close(..)");
+  }
+  pthread_join(cap->thread, 0);
+
+  sr_capture_dump(cap, stdout);
+  sr_cap_free(cap);
+  sr->capture = 0;
+} /* -- sr_capture_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_configure(..)
+ * Scope: Global
+ *
+ * Narrow what the capture keeps: only directions in the SR_CAP_DIR_* mask
+ * dirs, only frames matching filter (0 for all of them) and of those only
+ * 1 in sample (0 or 1 for all).  Call it before any frame is captured.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 if filter does not compile, the capture is then left unchanged
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_capture_configure(struct sr_capture* cap, const char* filter, unsigned int sample, int dirs) {
+  struct sr_filter f;
+
+  /* -- REQUIRES -- */
+  assert(cap);
+
+  if (sr_filter_compile(&f, filter) != 0) {
+    return -1;
+  }
+  cap->filter = f;
+  cap->sample = sample;
+  cap->dirs = dirs;
+  return 0;
+} /* -- sr_capture_configure -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_stats(..)
+ * Scope: Global
+ *
+ * Snapshot the capture counters; safe from any thread.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capture_stats(struct sr_capture* cap, struct sr_capture_stats* stats) {
+  /* -- REQUIRES -- */
+  assert(cap);
+  assert(stats);
+
+  stats->captured = __atomic_load_n(&(cap->stats.captured), __ATOMIC_RELAXED);
+  stats->dropped = __atomic_load_n(&(cap->stats.dropped), __ATOMIC_RELAXED);
+  stats->written = __atomic_load_n(&(cap->stats.written), __ATOMIC_RELAXED);
+  stats->bytes = __atomic_load_n(&(cap->stats.bytes), __ATOMIC_RELAXED);
+  stats->files = __atomic_load_n(&(cap->stats.files), __ATOMIC_RELAXED);
+} /* -- sr_capture_stats -- */
+
+void sr_capture_dump(struct sr_capture* cap, FILE* out) {
+  struct sr_capture_stats stats;
+
+  sr_capture_stats(cap, &stats);
+  fprintf(out, "Capture: %lu frames, %lu written, %lu dropped, %lu bytes in %u file%s\n", stats.captured,
+          stats.written, stats.dropped, stats.bytes, stats.files, stats.files == 1 ? "" : "s");
+} /* -- sr_capture_dump -- */
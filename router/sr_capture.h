@@ -0,0 +1,123 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.h
+ *
+ * Description:
+ *
+ * Packet capture behind -l.  Forwarding threads copy each frame (up to
+ * PACKET_DUMP_SIZE bytes) and its metadata into a lock-free ring and go
+ * on; a writer thread encodes the records into SR_CAP_BLOCK sized blocks
+ * and writes each block with one write(..).  If the writer falls behind
+ * the ring fills and frames are dropped and counted rather than slowing
+ * the router down.
+ *
+ * A file name ending in .pcapng gets pcapng, with one interface block
+ * per sr_if (the EPB interface ID is the sr_if index), nanosecond time
+ * stamps and the direction of each frame.  Anything else gets classic
+ * microsecond pcap.  With a rotation size set, a file that would grow
+ * past it is closed and the capture goes on in name.1, name.2, ...
+ *
+ * What gets captured can be narrowed with sr_capture_configure(..): a
+ * direction mask, a filter expression (see sr_filter.h) and 1-in-N
+ * sampling of what the filter lets through.  All three are checked in
+ * that order before a slot is claimed, so a frame that is left out costs
+ * neither a copy nor a touch of the shared ring.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CAPTURE_H
+#define SR_CAPTURE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "sr_filter.h"
+
+#define SR_CAP_SLOTS 4096         /* frames in flight, a power of two */
+#define SR_CAP_BLOCK (1024 * 1024) /* bytes per write(..) */
+#define SR_CAP_FLUSH_MS 100       /* writer's poll period, longest a frame or block waits */
+#define SR_CAP_WAKE (SR_CAP_SLOTS / 2) /* frames on the ring before a producer wakes the writer */
+
+/* -- which way a frame went -- */
+#define SR_CAP_IN 0
+#define SR_CAP_OUT 1
+
+/* -- direction mask bits for sr_capture_configure(..) -- */
+#define SR_CAP_DIR_IN (1 << SR_CAP_IN)
+#define SR_CAP_DIR_OUT (1 << SR_CAP_OUT)
+#define SR_CAP_DIR_BOTH (SR_CAP_DIR_IN | SR_CAP_DIR_OUT)
+
+struct sr_instance;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_cap_slot
+ *
+ * One captured frame.  seq follows the same protocol as the log ring: pos
+ * while free for position pos, pos + 1 once written, pos + SR_CAP_SLOTS
+ * once the writer is done with it.  The frame bytes live in sr_capture.data.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_cap_slot {
+  unsigned int seq;
+  unsigned int ifidx;
+  unsigned int dir; /* SR_CAP_IN or SR_CAP_OUT */
+  uint32_t caplen;
+  uint32_t len;
+  uint64_t ts_ns; /* CLOCK_REALTIME */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_capture_stats
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_capture_stats {
+  unsigned long captured; /* frames put on the ring */
+  unsigned long dropped;  /* frames refused, the ring was full */
+  unsigned long written;  /* frames written out */
+  unsigned long bytes;    /* bytes written out, headers included */
+  unsigned int files;     /* files opened */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_capture
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_capture {
+  struct sr_instance* sr;
+  char* fname;
+  int pcapng;
+  unsigned long rotate; /* bytes per file, 0 to never rotate */
+  int dirs;             /* SR_CAP_DIR_* mask of directions to capture */
+  unsigned int sample;  /* keep 1 in sample frames that pass the filter */
+  struct sr_filter filter;
+  int fd;               /* current file, -1 if it could not be opened */
+  int need_header;      /* nothing written to fd yet */
+  unsigned long file_bytes;
+  struct sr_cap_slot* slots;
+  uint8_t* data; /* PACKET_DUMP_SIZE bytes per slot */
+  uint8_t* block;
+  unsigned int block_used;
+  unsigned int tail __attribute__((aligned(64))); /* next position to claim, shared by producers */
+  unsigned int head __attribute__((aligned(64))); /* next position to write out, advanced by the writer */
+  struct sr_capture_stats stats; /* updated atomically, see sr_capture_stats(..) */
+  unsigned long reported;        /* drops already warned about */
+  int running;
+  int sleeping;
+  int evfd;
+  pthread_t thread;
+};
+
+int sr_capture_open(struct sr_instance* sr, const char* fname, unsigned long rotate);
+void sr_capture_close(struct sr_instance* sr);
+int sr_capture_configure(struct sr_capture* cap, const char* filter, unsigned int sample, int dirs);
+void sr_capture_frame(struct sr_capture* cap, const uint8_t* frame, unsigned int len, unsigned int ifidx, int dir);
+void sr_capture_stats(struct sr_capture* cap, struct sr_capture_stats* stats);
+void sr_capture_dump(struct sr_capture* cap, FILE* out);
+
+#endif /* -- SR_CAPTURE_H -- */
@@ -0,0 +1,745 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ctl.c
+ *
+ * Description:
+ *
+ * Control socket, see sr_ctl.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_ctl.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "sr_arpcache.h"
+#include "sr_event.h"
+#include "sr_flight.h"
+#include "sr_hist.h"
+#include "sr_if.h"
+#include "sr_pktbuf.h"
+#include "sr_prof.h"
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_stats.h"
+
+typedef void (*sr_ctl_fn)(struct sr_instance* sr, FILE* out);
+
+/* ----------------------------------------------------------------------------
+ * struct sr_ctl_cmd
+ *
+ * What a request can name.  json writes one "name": value member, or is 0
+ * if there is only text.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_ctl_cmd {
+  const char* name;
+  sr_ctl_fn text;
+  sr_ctl_fn json;
+  int in_all; /* part of "all" */
+  const char* help;
+};
+
+static const char* sr_ctl_ip(uint32_t ip, char* buf) {
+  return inet_ntop(AF_INET, &ip, buf, INET_ADDRSTRLEN);
+} /* -- sr_ctl_ip -- */
+
+static const char* sr_ctl_mac(const unsigned char* mac, char* buf) {
+  sprintf(buf, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return buf;
+} /* -- sr_ctl_mac -- */
+
+/* -- s as a JSON string -- */
+static void sr_ctl_json_str(FILE* out, const char* s) {
+  fputc('"', out);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      fprintf(out, "\\%c", *s);
+    } else if ((unsigned char)*s < 0x20) {
+      fprintf(out, "\\u%04x", (unsigned char)*s);
+    } else {
+      fputc(*s, out);
+    }
+  }
+  fputc('"', out);
+} /* -- sr_ctl_json_str -- */
+
+/* -- interfaces -- */
+
+static void sr_ctl_interfaces_text(struct sr_instance* sr, FILE* out) {
+  char ip[INET_ADDRSTRLEN], mac[18];
+  struct sr_if* iface;
+
+  fprintf(out, "%-5s %-8s %-17s %s\n", "Index", "Name", "MAC", "IP");
+  for (iface = sr->if_list; iface; iface = iface->next) {
+    fprintf(out, "%-5u %-8s %-17s %s\n", iface->index, iface->name, sr_ctl_mac(iface->addr, mac),
+            sr_ctl_ip(iface->ip, ip));
+  }
+} /* -- sr_ctl_interfaces_text -- */
+
+static void sr_ctl_interfaces_json(struct sr_instance* sr, FILE* out) {
+  char ip[INET_ADDRSTRLEN], mac[18];
+  struct sr_if* iface;
+
+  fprintf(out, "\"interfaces\": [");
+  for (iface = sr->if_list; iface; iface = iface->next) {
+    fprintf(out, "%s\n  {\"index\": %u, \"name\": ", iface == sr->if_list ? "" : ",", iface->index);
+    sr_ctl_json_str(out, iface->name);
+    fprintf(out, ", \"mac\": \"%s\", \"ip\": \"%s\"}", sr_ctl_mac(iface->addr, mac), sr_ctl_ip(iface->ip, ip));
+  }
+  fprintf(out, "]");
+} /* -- sr_ctl_interfaces_json -- */
+
+/* -- routes -- */
+
+static void sr_ctl_routes_text(struct sr_instance* sr, FILE* out) {
+  char dest[INET_ADDRSTRLEN], gw[INET_ADDRSTRLEN], mask[INET_ADDRSTRLEN];
+  struct sr_rt* rt;
+
+  fprintf(out, "%-15s %-15s %-15s %s\n", "Destination", "Gateway", "Mask", "Iface");
+  for (rt = sr->routing_table; rt; rt = rt->next) {
+    fprintf(out, "%-15s %-15s %-15s %s\n", sr_ctl_ip(rt->dest.s_addr, dest), sr_ctl_ip(rt->gw.s_addr, gw),
+            sr_ctl_ip(rt->mask.s_addr, mask), rt->interface);
+  }
+} /* -- sr_ctl_routes_text -- */
+
+static void sr_ctl_routes_json(struct sr_instance* sr, FILE* out) {
+  char dest[INET_ADDRSTRLEN], gw[INET_ADDRSTRLEN], mask[INET_ADDRSTRLEN];
+  struct sr_rt* rt;
+
+  fprintf(out, "\"routes\": [");
+  for (rt = sr->routing_table; rt; rt = rt->next) {
+    fprintf(out, "%s\n  {\"dest\": \"%s\", \"gw\": \"%s\", \"mask\": \"%s\", \"iface\": ", rt == sr->routing_table ? "" : ",",
+            sr_ctl_ip(rt->dest.s_addr, dest), sr_ctl_ip(rt->gw.s_addr, gw), sr_ctl_ip(rt->mask.s_addr, mask));
+    sr_ctl_json_str(out, rt->interface);
+    fprintf(out, "}");
+  }
+  fprintf(out, "]");
+} /* -- sr_ctl_routes_json -- */
+
+/* -- neighbors, the ARP cache -- */
+
+static void sr_ctl_neighbors_text(struct sr_instance* sr, FILE* out) {
+  char ip[INET_ADDRSTRLEN], mac[18];
+  struct sr_arpentry* e;
+  time_t now = time(0);
+  int i;
+
+  fprintf(out, "%-15s %-17s %s\n", "IP", "MAC", "Age(s)");
+  sr_arpcache_lock(&(sr->cache));
+  for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+    e = &(sr->cache.entries[i]);
+    if (e->valid) {
+      fprintf(out, "%-15s %-17s %ld\n", sr_ctl_ip(e->ip, ip), sr_ctl_mac(e->mac, mac), (long)(now - e->added));
+    }
+  }
+  sr_arpcache_unlock(&(sr->cache));
+} /* -- sr_ctl_neighbors_text -- */
+
+static void sr_ctl_neighbors_json(struct sr_instance* sr, FILE* out) {
+  char ip[INET_ADDRSTRLEN], mac[18];
+  struct sr_arpentry* e;
+  time_t now = time(0);
+  int i, n = 0;
+
+  fprintf(out, "\"neighbors\": [");
+  sr_arpcache_lock(&(sr->cache));
+  for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+    e = &(sr->cache.entries[i]);
+    if (e->valid) {
+      fprintf(out, "%s\n  {\"ip\": \"%s\", \"mac\": \"%s\", \"age_s\": %ld}", n++ ? "," : "", sr_ctl_ip(e->ip, ip),
+              sr_ctl_mac(e->mac, mac), (long)(now - e->added));
+    }
+  }
+  sr_arpcache_unlock(&(sr->cache));
+  fprintf(out, "]");
+} /* -- sr_ctl_neighbors_json -- */
+
+/* -- pending, ARP requests still waiting for a reply -- */
+
+static void sr_ctl_pending_text(struct sr_instance* sr, FILE* out) {
+  char ip[INET_ADDRSTRLEN];
+  struct sr_arpreq* req;
+  time_t now = time(0);
+
+  fprintf(out, "%-15s %-5s %-12s %s\n", "IP", "Sent", "Last sent(s)", "Queued");
+  sr_arpcache_lock(&(sr->cache));
+  for (req = sr->cache.requests; req; req = req->next) {
+    fprintf(out, "%-15s %-5u %-12ld %u\n", sr_ctl_ip(req->ip, ip), req->times_sent,
+            req->times_sent ? (long)(now - req->sent) : -1L, req->npackets);
+  }
+  sr_arpcache_unlock(&(sr->cache));
+} /* -- sr_ctl_pending_text -- */
+
+static void sr_ctl_pending_json(struct sr_instance* sr, FILE* out) {
+  char ip[INET_ADDRSTRLEN];
+  struct sr_arpreq* req;
+  time_t now = time(0);
+
+  fprintf(out, "\"pending\": [");
+  sr_arpcache_lock(&(sr->cache));
+  for (req = sr->cache.requests; req; req = req->next) {
+    fprintf(out, "%s\n  {\"ip\": \"%s\", \"times_sent\": %u, ", req == sr->cache.requests ? "" : ",",
+            sr_ctl_ip(req->ip, ip), req->times_sent);
+    if (req->times_sent) {
+      fprintf(out, "\"last_sent_s\": %ld, ", (long)(now - req->sent));
+    } else {
+      fprintf(out, "\"last_sent_s\": null, ");
+    }
+    fprintf(out, "\"queued\": %u}", req->npackets);
+  }
+  sr_arpcache_unlock(&(sr->cache));
+  fprintf(out, "]");
+} /* -- sr_ctl_pending_json -- */
+
+/* -- counters and latency, from one snapshot each -- */
+
+static struct sr_stats* sr_ctl_snapshot(void) {
+  struct sr_stats* sum;
+
+  if ((sum = (struct sr_stats*)malloc(sizeof(struct sr_stats))) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_ctl_snapshot)\n");
+    return 0;
+  }
+  sr_stats_snapshot(sum);
+  return sum;
+} /* -- sr_ctl_snapshot -- */
+
+static void sr_ctl_counters_text(struct sr_instance* sr, FILE* out) {
+  struct sr_stats* sum;
+
+  if ((sum = sr_ctl_snapshot()) != 0) {
+    sr_stats_print_counters(sr, sum, out);
+    free(sum);
+  }
+} /* -- sr_ctl_counters_text -- */
+
+static void sr_ctl_counters_json(struct sr_instance* sr, FILE* out) {
+  struct sr_stats* sum;
+  struct sr_if_stats* is;
+  struct sr_if* iface;
+  unsigned int i, d, n = 0, nd;
+
+  fprintf(out, "\"counters\": [");
+  if ((sum = sr_ctl_snapshot()) == 0) {
+    fprintf(out, "]");
+    return;
+  }
+  for (i = 0; i <= SR_IF_MAX; i++) {
+    is = &(sum->ifs[i]);
+    if (is->rx_packets == 0 && is->tx_packets == 0 && is->tx_errors == 0) {
+      continue;
+    }
+    iface = i < SR_IF_MAX ? sr_get_interface_idx(sr, i) : 0;
+    fprintf(out, "%s\n  {\"iface\": ", n++ ? "," : "");
+    if (iface) {
+      sr_ctl_json_str(out, iface->name);
+    } else {
+      fprintf(out, "null");
+    }
+    fprintf(out, ", \"rx_packets\": %lu, \"rx_bytes\": %lu, \"tx_packets\": %lu, \"tx_bytes\": %lu, \"tx_errors\": %lu",
+            (unsigned long)is->rx_packets, (unsigned long)is->rx_bytes, (unsigned long)is->tx_packets,
+            (unsigned long)is->tx_bytes, (unsigned long)is->tx_errors);
+    fprintf(out, ", \"disp\": {");
+    for (d = 0, nd = 0; d < SR_DISP_MAX; d++) {
+      if (is->disp[d]) {
+        fprintf(out, "%s\"%s\": %lu", nd++ ? ", " : "", sr_disp_name(d), (unsigned long)is->disp[d]);
+      }
+    }
+    fprintf(out, "}}");
+  }
+  fprintf(out, "]");
+  free(sum);
+} /* -- sr_ctl_counters_json -- */
+
+static void sr_ctl_latency_text(struct sr_instance* sr, FILE* out) {
+  struct sr_stats* sum;
+
+  if ((sum = sr_ctl_snapshot()) != 0) {
+    sr_stats_print_latency(sum, out);
+    free(sum);
+  }
+} /* -- sr_ctl_latency_text -- */
+
+static void sr_ctl_latency_json(struct sr_instance* sr, FILE* out) {
+  struct sr_stats* sum;
+  struct sr_hist* h;
+  unsigned int i;
+
+  fprintf(out, "\"latency\": {");
+  if ((sum = sr_ctl_snapshot()) == 0) {
+    fprintf(out, "}");
+    return;
+  }
+  for (i = 0; i < SR_LAT_MAX; i++) {
+    h = &(sum->lat[i]);
+    fprintf(out,
+            "%s\n  \"%s\": {\"count\": %lu, \"mean_ns\": %lu, \"p50_ns\": %lu, \"p90_ns\": %lu, \"p99_ns\": %lu, "
+            "\"p999_ns\": %lu, \"max_ns\": %lu}",
+            i ? "," : "", sr_lat_name(i), (unsigned long)h->count,
+            (unsigned long)(h->count ? h->sum_ns / h->count : 0), (unsigned long)sr_hist_percentile(h, 0.5),
+            (unsigned long)sr_hist_percentile(h, 0.9), (unsigned long)sr_hist_percentile(h, 0.99),
+            (unsigned long)sr_hist_percentile(h, 0.999), (unsigned long)sr_hist_max(h));
+  }
+  fprintf(out, "}");
+  free(sum);
+} /* -- sr_ctl_latency_json -- */
+
+/* -- pool -- */
+
+static void sr_ctl_pool_text(struct sr_instance* sr, FILE* out) {
+  sr_pktpool_dump(&(sr->pool), out);
+} /* -- sr_ctl_pool_text -- */
+
+static void sr_ctl_pool_json(struct sr_instance* sr, FILE* out) {
+  struct sr_pktpool_stats stats;
+
+  sr_pktpool_stats(&(sr->pool), &stats);
+  fprintf(out, "\"pool\": {\"count\": %u, \"in_use\": %u, \"peak\": %u, \"allocs\": %lu, \"failures\": %lu, \"huge\": %s}",
+          stats.count, stats.in_use, stats.peak, stats.allocs, stats.failures, sr->pool.huge ? "true" : "false");
+} /* -- sr_ctl_pool_json -- */
+
+/* -- flight recorder and profile, text only -- */
+
+static void sr_ctl_flight_text(struct sr_instance* sr, FILE* out) {
+  if (sr_flight_dump(sr, out) != 0) {
+    fprintf(out, "error: could not copy the flight recorder\n");
+  }
+} /* -- sr_ctl_flight_text -- */
+
+static void sr_ctl_profile_text(struct sr_instance* sr, FILE* out) {
+  if (sr_prof_dump(out) != 0) {
+    fprintf(out, "profile: not built in, rebuild with make PROFILE=1\n");
+  }
+} /* -- sr_ctl_profile_text -- */
+
+static const struct sr_ctl_cmd sr_ctl_cmds[] = {
+    {"interfaces", sr_ctl_interfaces_text, sr_ctl_interfaces_json, 1, "interfaces and their addresses"},
+    {"routes", sr_ctl_routes_text, sr_ctl_routes_json, 1, "routing table"},
+    {"neighbors", sr_ctl_neighbors_text, sr_ctl_neighbors_json, 1, "ARP cache"},
+    {"pending", sr_ctl_pending_text, sr_ctl_pending_json, 1, "ARP requests waiting for a reply"},
+    {"counters", sr_ctl_counters_text, sr_ctl_counters_json, 1, "packet counters by interface and disposition"},
+    {"latency", sr_ctl_latency_text, sr_ctl_latency_json, 1, "receive to send latency percentiles"},
+    {"pool", sr_ctl_pool_text, sr_ctl_pool_json, 1, "packet buffer pool usage"},
+    {"flight", sr_ctl_flight_text, 0, 0, "flight recorder, text only"},
+    {"profile", sr_ctl_profile_text, 0, 0, "per stage cycles (make PROFILE=1), text only"},
+};
+
+#define SR_CTL_NCMDS (sizeof(sr_ctl_cmds) / sizeof(sr_ctl_cmds[0]))
+
+static void sr_ctl_error(FILE* out, int json, const char* msg, const char* arg) {
+  if (json) {
+    fprintf(out, "{\"error\": \"%s", msg);
+    fprintf(out, "\", \"request\": ");
+    sr_ctl_json_str(out, arg);
+    fprintf(out, "}\n");
+  } else {
+    fprintf(out, "error: %s: %s, try help\n", msg, arg);
+  }
+} /* -- sr_ctl_error -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_answer(..)
+ * Scope: Local
+ *
+ * Write the answer to the request in line to out.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ctl_answer(struct sr_instance* sr, char* line, FILE* out) {
+  char *cmd, *fmt, *extra, *save = 0;
+  unsigned int i, n;
+  int json;
+
+  cmd = strtok_r(line, " \t\r\n", &save);
+  fmt = cmd ? strtok_r(0, " \t\r\n", &save) : 0;
+  extra = fmt ? strtok_r(0, " \t\r\n", &save) : 0;
+  json = fmt != 0 && strcmp(fmt, "json") == 0;
+
+  if (cmd == 0) {
+    sr_ctl_error(out, 0, "empty request", "");
+    return;
+  }
+  if ((fmt != 0 && !json) || extra != 0) {
+    sr_ctl_error(out, json, "expected json or nothing after the command", fmt);
+    return;
+  }
+
+  if (strcmp(cmd, "help") == 0) {
+    fprintf(out, "usage: <command> [json]\n");
+    for (i = 0; i < SR_CTL_NCMDS; i++) {
+      fprintf(out, "  %-10s %s\n", sr_ctl_cmds[i].name, sr_ctl_cmds[i].help);
+    }
+    fprintf(out, "  %-10s %s\n", "all", "everything above that is not text only");
+    return;
+  }
+
+  if (strcmp(cmd, "all") == 0) {
+    if (json) {
+      fputc('{', out);
+    }
+    for (i = 0, n = 0; i < SR_CTL_NCMDS; i++) {
+      if (!sr_ctl_cmds[i].in_all) {
+        continue;
+      }
+      if (json) {
+        fprintf(out, "%s\n", n++ ? "," : "");
+        sr_ctl_cmds[i].json(sr, out);
+      } else {
+        fprintf(out, "%s== %s ==\n", n++ ? "\n" : "", sr_ctl_cmds[i].name);
+        sr_ctl_cmds[i].text(sr, out);
+      }
+    }
+    if (json) {
+      fprintf(out, "\n}\n");
+    }
+    return;
+  }
+
+  for (i = 0; i < SR_CTL_NCMDS; i++) {
+    if (strcmp(cmd, sr_ctl_cmds[i].name) != 0) {
+      continue;
+    }
+    if (!json) {
+      sr_ctl_cmds[i].text(sr, out);
+    } else if (sr_ctl_cmds[i].json) {
+      fprintf(out, "{");
+      sr_ctl_cmds[i].json(sr, out);
+      fprintf(out, "}\n");
+    } else {
+      sr_ctl_error(out, 1, "no JSON for this command", cmd);
+    }
+    return;
+  }
+  sr_ctl_error(out, json, "unknown command", cmd);
+} /* -- sr_ctl_answer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_conn_close(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ctl_conn_close(struct sr_ctl_conn* conn) {
+  struct sr_ctl* ctl = conn->ctl;
+  struct sr_ctl_conn** walker;
+
+  for (walker = &(ctl->conns); *walker; walker = &((*walker)->next)) {
+    if (*walker == conn) {
+      *walker = conn->next;
+      break;
+    }
+  }
+  ctl->nconns--;
+
+  if (conn->ev) {
+    sr_event_remove(&(ctl->loop), conn->ev);
+  }
+  close(conn->fd);
+  free(conn->out);
+  free(conn);
+} /* -- sr_ctl_conn_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_conn_event(..)
+ * Scope: Local
+ *
+ * Control loop callback for a client: read the request line, answer it
+ * all at once into memory, then write the answer out as fast as the
+ * client takes it and close.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ctl_conn_event(int fd, uint32_t events, void* arg) {
+  struct sr_ctl_conn* conn = (struct sr_ctl_conn*)arg;
+  FILE* out;
+  ssize_t n;
+
+  if (conn->out == 0) {
+    /* -- the request, up to a newline, the client's EOF or a full buffer -- */
+    n = read(fd, conn->line + conn->line_len, sizeof(conn->line) - 1 - conn->line_len);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+      return;
+    }
+    if (n == -1) {
+      perror("read(..):sr_ctl.c::sr_ctl_conn_event(..)");
+      sr_ctl_conn_close(conn);
+      return;
+    }
+    conn->line_len += n;
+    conn->line[conn->line_len] = 0;
+    if (n > 0 && strchr(conn->line, '\n') == 0 && conn->line_len < sizeof(conn->line) - 1) {
+      return;
+    }
+    if (n == 0 && conn->line_len == 0) {
+      sr_ctl_conn_close(conn);
+      return;
+    }
+
+    if ((out = open_memstream(&(conn->out), &(conn->out_len))) == 0) {
+      perror("open_memstream(..):sr_ctl.c::sr_ctl_conn_event(..)");
+      sr_ctl_conn_close(conn);
+      return;
+    }
+    if (strchr(conn->line, '\n') == 0 && conn->line_len == sizeof(conn->line) - 1) {
+      sr_ctl_error(out, 0, "request too long", "");
+    } else {
+      sr_ctl_answer(conn->ctl->sr, conn->line, out);
+    }
+    fclose(out);
+    conn->out_off = 0;
+  } else if (events & (EPOLLERR | EPOLLHUP)) {
+    sr_ctl_conn_close(conn);
+    return;
+  }
+
+  /* -- the answer, no SIGPIPE if the client went away -- */
+  while (conn->out_off < conn->out_len) {
+    n = send(fd, conn->out + conn->out_off, conn->out_len - conn->out_off, MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1 && errno == EAGAIN) {
+      if (conn->ev->events != EPOLLOUT) {
+        sr_event_modify(&(conn->ctl->loop), conn->ev, EPOLLOUT);
+      }
+      return;
+    }
+    if (n == -1) {
+      break;
+    }
+    conn->out_off += n;
+  }
+  sr_ctl_conn_close(conn);
+} /* -- sr_ctl_conn_event -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_accept(..)
+ * Scope: Local
+ *
+ * Control loop callback for the listening socket.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ctl_accept(int fd, uint32_t events, void* arg) {
+  struct sr_ctl* ctl = (struct sr_ctl*)arg;
+  struct sr_ctl_conn* conn;
+  int cfd;
+
+  while ((cfd = accept4(fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+    if (ctl->nconns >= SR_CTL_CONNS || (conn = (struct sr_ctl_conn*)calloc(1, sizeof(struct sr_ctl_conn))) == 0) {
+      LOG_WARN("Control socket busy, dropping a connection");
+      close(cfd);
+      continue;
+    }
+    conn->fd = cfd;
+    conn->ctl = ctl;
+    if ((conn->ev = sr_event_add_fd(&(ctl->loop), cfd, EPOLLIN, sr_ctl_conn_event, conn)) == 0) {
+      close(cfd);
+      free(conn);
+      continue;
+    }
+    conn->next = ctl->conns;
+    ctl->conns = conn;
+    ctl->nconns++;
+  }
+  if (errno != EAGAIN && errno != EINTR) {
+    perror("accept4(..):sr_ctl.c::sr_ctl_accept(..)");
+  }
+} /* -- sr_ctl_accept -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_bind(..)
+ * Scope: Local
+ *
+ * Bind fd to addr.  A socket file left behind by a router that is gone
+ * (nothing accepts on it) is replaced; one that is still served is not.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_ctl_bind(int fd, const struct sockaddr_un* addr) {
+  int probe, rc;
+
+  if (bind(fd, (const struct sockaddr*)addr, sizeof(*addr)) == 0) {
+    return 0;
+  }
+  if (errno != EADDRINUSE) {
+    return -1;
+  }
+  if ((probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+    return -1;
+  }
+  rc = connect(probe, (const struct sockaddr*)addr, sizeof(*addr));
+  close(probe);
+  if (rc == 0 || errno != ECONNREFUSED) {
+    errno = EADDRINUSE;
+    return -1;
+  }
+  unlink(addr->sun_path);
+  return bind(fd, (const struct sockaddr*)addr, sizeof(*addr));
+} /* -- sr_ctl_bind -- */
+
+/* -- control loop callback for stop_evfd -- */
+static void sr_ctl_stop(int fd, uint32_t events, void* arg) {
+  struct sr_ctl* ctl = (struct sr_ctl*)arg;
+
+  sr_event_stop(&(ctl->loop));
+} /* -- sr_ctl_stop -- */
+
+static void* sr_ctl_thread(void* arg) {
+  struct sr_ctl* ctl = (struct sr_ctl*)arg;
+
+  sr_event_run(&(ctl->loop));
+  return 0;
+} /* -- sr_ctl_thread -- */
+
+static void sr_ctl_free(struct sr_ctl* ctl) {
+  while (ctl->conns) {
+    sr_ctl_conn_close(ctl->conns);
+  }
+  sr_event_destroy(&(ctl->loop));
+  if (ctl->stop_evfd >= 0) {
+    close(ctl->stop_evfd);
+  }
+  if (ctl->fd >= 0) {
+    close(ctl->fd);
+  }
+  free(ctl);
+} /* -- sr_ctl_free -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_open(..)
+ * Scope: Global
+ *
+ * Listen on path and serve requests from a control thread.  The ARP cache
+ * and packet pool locks are switched on before it starts.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error, which is reported; the router runs on without
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ctl_open(struct sr_instance* sr, const char* path) {
+  struct sr_ctl* ctl;
+  struct sockaddr_un addr;
+  sigset_t all, old;
+  int rc;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(path);
+
+  if (strlen(path) >= sizeof(addr.sun_path) || strlen(path) >= sizeof(ctl->path)) {
+    fprintf(stderr, "Error: control socket path too long: %s\n", path);
+    return -1;
+  }
+  if ((ctl = (struct sr_ctl*)calloc(1, sizeof(struct sr_ctl))) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_ctl_open)\n");
+    return -1;
+  }
+  ctl->sr = sr;
+  ctl->fd = ctl->stop_evfd = -1;
+  strcpy(ctl->path, path);
+  if (sr_event_init(&(ctl->loop)) != 0) {
+    free(ctl);
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if ((ctl->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+    perror("socket(..):sr_ctl.c::sr_ctl_open(..)");
+    sr_ctl_free(ctl);
+    return -1;
+  }
+  if (sr_ctl_bind(ctl->fd, &addr) != 0) {
+    fprintf(stderr, "Error: control socket %s: %s\n", path, strerror(errno));
+    sr_ctl_free(ctl);
+    return -1;
+  }
+  if (listen(ctl->fd, SR_CTL_CONNS) != 0) {
+    perror("listen(..):sr_ctl.c::sr_ctl_open(..)");
+    unlink(path);
+    sr_ctl_free(ctl);
+    return -1;
+  }
+  if ((ctl->stop_evfd = eventfd(0, EFD_CLOEXEC)) == -1) {
+    perror("eventfd(..):sr_ctl.c::sr_ctl_open(..)");
+    unlink(path);
+    sr_ctl_free(ctl);
+    return -1;
+  }
+  if ((ctl->ev = sr_event_add_fd(&(ctl->loop), ctl->fd, EPOLLIN, sr_ctl_accept, ctl)) == 0 ||
+      sr_event_add_fd(&(ctl->loop), ctl->stop_evfd, EPOLLIN, sr_ctl_stop, ctl) == 0) {
+    unlink(path);
+    sr_ctl_free(ctl);
+    return -1;
+  }
+
+  /* -- the control thread reads the cache and pool next to the data path -- */
+  sr->cache.shared = 1;
+  sr->pool.shared = 1;
+
+  /* -- keep every signal off the control thread, the main loop takes them -- */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  rc = pthread_create(&(ctl->thread), 0, sr_ctl_thread, ctl);
+  pthread_sigmask(SIG_SETMASK, &old, 0);
+  if ((errno = rc) != 0) {
+    perror("pthread_create(..):sr_ctl.c::sr_ctl_open(..)");
+    unlink(path);
+    sr_ctl_free(ctl);
+    return -1;
+  }
+
+  sr->ctl = ctl;
+  LOG_INFO("Control socket listening on %s", path);
+  return 0;
+} /* -- sr_ctl_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_close(..)
+ * Scope: Global
+ *
+ * Stop the control thread, drop every client, stop listening and remove
+ * the socket file.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_ctl_close(struct sr_instance* sr) {
+  struct sr_ctl* ctl;
+  uint64_t one = 1;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+
+  if ((ctl = sr->ctl) == 0) {
+    return;
+  }
+  if (write(ctl->stop_evfd, &one, sizeof(one)) != sizeof(one)) {
+    perror("write(..):sr_ctl.c::sr_ctl_close(..)");
+  }
+  pthread_join(ctl->thread, 0);
+  unlink(ctl->path);
+  sr_ctl_free(ctl);
+  sr->ctl = 0;
+  if (sr->pipeline == 0) {
+    sr->cache.shared = 0;
+    sr->pool.shared = 0;
+  }
+} /* -- sr_ctl_close -- */
@@ -0,0 +1,80 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ctl.h
+ *
+ * Description:
+ *
+ * Control socket.  The router listens on a Unix stream socket (SR_CTL_SOCKET
+ * by default, -c to move it) and answers one request per connection: a
+ * line naming what to show, optionally followed by "json",
+ *
+ *   routes  interfaces  neighbors  pending  counters  latency  pool
+ *   flight  profile  all  help
+ *
+ * after which it writes the answer and closes the connection.  srctl is
+ * the client.  Connections are served by a control thread with an event
+ * loop of its own, so building an answer (a flight copy and sort, say)
+ * and slow or stuck clients stay off the forwarding thread.  Counters are
+ * read from their snapshots, the flight recorder from its rings, and the
+ * ARP cache and packet pool under their locks.  Those locks are switched
+ * on for as long as the control thread runs, so even without workers the
+ * data path takes them.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CTL_H
+#define SR_CTL_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "sr_event.h"
+
+#define SR_CTL_SOCKET "sr.sock"
+#define SR_CTL_CONNS 8       /* connections served at once, more are closed */
+#define SR_CTL_LINE_MAX 128  /* longest request line */
+
+struct sr_instance;
+struct sr_ctl;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_ctl_conn
+ *
+ * One client: its request as far as it came in, then the answer as far as
+ * it went out.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_ctl_conn {
+  int fd;
+  struct sr_event* ev;
+  struct sr_ctl* ctl;
+  char line[SR_CTL_LINE_MAX];
+  unsigned int line_len;
+  char* out; /* the whole answer, 0 while reading the request */
+  size_t out_len;
+  size_t out_off;
+  struct sr_ctl_conn* next;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_ctl
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_ctl {
+  struct sr_instance* sr;
+  pthread_t thread;
+  struct sr_event_loop loop; /* the control thread's, not sr->loop */
+  int stop_evfd;             /* stops the control thread */
+  int fd;
+  struct sr_event* ev;
+  char path[108]; /* sizeof(sun_path) */
+  struct sr_ctl_conn* conns;
+  unsigned int nconns;
+};
+
+int sr_ctl_open(struct sr_instance* sr, const char* path);
+void sr_ctl_close(struct sr_instance* sr);
+
+#endif /* -- SR_CTL_H -- */
@@ -0,0 +1,338 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_event.c
+ *
+ * Description:
+ *
+ * epoll based event loop, see sr_event.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_event.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_init(..)
+ * Scope: Global
+ *
+ * Returns 0 on success, -1 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_event_init(struct sr_event_loop* loop) {
+  /* -- REQUIRES -- */
+  assert(loop);
+
+  memset(loop, 0, sizeof(*loop));
+  if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+    perror("epoll_create1(..):sr_event.c::sr_event_init(..)");
+    return -1;
+  }
+  return 0;
+} /* -- sr_event_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_destroy(..)
+ * Scope: Global
+ *
+ * Releases every registration.  Timer and signal descriptors are owned by
+ * the loop and closed, plain file descriptors are left to their owners.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_event_destroy(struct sr_event_loop* loop) {
+  /* -- REQUIRES -- */
+  assert(loop);
+
+  while (loop->events) {
+    sr_event_remove(loop, loop->events);
+  }
+  if (loop->epfd >= 0) {
+    close(loop->epfd);
+    loop->epfd = -1;
+  }
+} /* -- sr_event_destroy -- */
+
+static struct sr_event* sr_event_register(struct sr_event_loop* loop, int fd, enum sr_event_kind kind,
+                                         uint32_t events, sr_event_fn fn, void* arg) {
+  struct sr_event* ev;
+  struct epoll_event ee;
+
+  ev = (struct sr_event*)calloc(1, sizeof(struct sr_event));
+  if (!ev) {
+    fprintf(stderr, "Error: out of memory (sr_event_register)\n");
+    return 0;
+  }
+  ev->fd = fd;
+  ev->kind = kind;
+  ev->events = events;
+  ev->fn = fn;
+  ev->arg = arg;
+
+  memset(&ee, 0, sizeof(ee));
+  ee.events = events;
+  ee.data.ptr = ev;
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ee) == -1) {
+    perror("epoll_ctl(..):sr_event.c::sr_event_register(..)");
+    free(ev);
+    return 0;
+  }
+
+  ev->next = loop->events;
+  loop->events = ev;
+  return ev;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_add_fd(..)
+ * Scope: Global
+ *
+ * Watch fd for the given epoll events (level triggered).
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_event* sr_event_add_fd(struct sr_event_loop* loop, int fd, uint32_t events, sr_event_fn fn, void* arg) {
+  /* -- REQUIRES -- */
+  assert(loop);
+  assert(fn);
+
+  return sr_event_register(loop, fd, sr_event_kind_fd, events, fn, arg);
+} /* -- sr_event_add_fd -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_add_timer(..)
+ * Scope: Global
+ *
+ * Call fn every interval_ms milliseconds on the monotonic clock.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_event* sr_event_add_timer(struct sr_event_loop* loop, unsigned int interval_ms, sr_event_fn fn, void* arg) {
+  struct itimerspec its;
+  struct sr_event* ev;
+  int fd;
+
+  /* -- REQUIRES -- */
+  assert(loop);
+  assert(fn);
+  assert(interval_ms > 0);
+
+  if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+    perror("timerfd_create(..):sr_event.c::sr_event_add_timer(..)");
+    return 0;
+  }
+
+  its.it_interval.tv_sec = interval_ms / 1000;
+  its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+  its.it_value = its.it_interval;
+  if (timerfd_settime(fd, 0, &its, 0) == -1) {
+    perror("timerfd_settime(..):sr_event.c::sr_event_add_timer(..)");
+    close(fd);
+    return 0;
+  }
+
+  if ((ev = sr_event_register(loop, fd, sr_event_kind_timer, EPOLLIN, fn, arg)) == 0) {
+    close(fd);
+  }
+  return ev;
+} /* -- sr_event_add_timer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_add_signal(..)
+ * Scope: Global
+ *
+ * Block signo and deliver it through the loop instead.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_event* sr_event_add_signal(struct sr_event_loop* loop, int signo, sr_event_fn fn, void* arg) {
+  struct sr_event* ev;
+  sigset_t mask;
+  int fd;
+
+  /* -- REQUIRES -- */
+  assert(loop);
+  assert(fn);
+
+  sigemptyset(&mask);
+  sigaddset(&mask, signo);
+  if (pthread_sigmask(SIG_BLOCK, &mask, 0) != 0) {
+    fprintf(stderr, "Error: unable to block signal %d\n", signo);
+    return 0;
+  }
+
+  if ((fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+    perror("signalfd(..):sr_event.c::sr_event_add_signal(..)");
+    return 0;
+  }
+
+  if ((ev = sr_event_register(loop, fd, sr_event_kind_signal, EPOLLIN, fn, arg)) == 0) {
+    close(fd);
+  }
+  return ev;
+} /* -- sr_event_add_signal -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_modify(..)
+ * Scope: Global
+ *
+ * Change the epoll events watched for a registration.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_event_modify(struct sr_event_loop* loop, struct sr_event* ev, uint32_t events) {
+  struct epoll_event ee;
+
+  /* -- REQUIRES -- */
+  assert(loop);
+  assert(ev);
+
+  if (ev->events == events) {
+    return 0;
+  }
+
+  memset(&ee, 0, sizeof(ee));
+  ee.events = events;
+  ee.data.ptr = ev;
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, ev->fd, &ee) == -1) {
+    perror("epoll_ctl(..):sr_event.c::sr_event_modify(..)");
+    return -1;
+  }
+  ev->events = events;
+  return 0;
+} /* -- sr_event_modify -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_remove(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_event_remove(struct sr_event_loop* loop, struct sr_event* ev) {
+  struct sr_event** walker;
+
+  /* -- REQUIRES -- */
+  assert(loop);
+  assert(ev);
+
+  for (walker = &(loop->events); *walker; walker = &((*walker)->next)) {
+    if (*walker == ev) {
+      *walker = ev->next;
+      break;
+    }
+  }
+
+  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, ev->fd, 0);
+  if (ev->kind != sr_event_kind_fd) {
+    close(ev->fd);
+  }
+  free(ev);
+} /* -- sr_event_remove -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_set_idle(..)
+ * Scope: Global
+ *
+ * Register the hook run after every batch of ready events, e.g. to push
+ * out transmit batches.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_event_set_idle(struct sr_event_loop* loop, sr_event_idle_fn fn, void* arg) {
+  /* -- REQUIRES -- */
+  assert(loop);
+
+  loop->idle_fn = fn;
+  loop->idle_arg = arg;
+} /* -- sr_event_set_idle -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_drain(..)
+ * Scope: Local
+ *
+ * Consume the expiration count / signal info so a level triggered timer or
+ * signal descriptor does not fire again.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_event_drain(struct sr_event* ev) {
+  struct signalfd_siginfo si;
+  uint64_t expirations;
+
+  if (ev->kind == sr_event_kind_timer) {
+    while (read(ev->fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+      ;
+  } else if (ev->kind == sr_event_kind_signal) {
+    while (read(ev->fd, &si, sizeof(si)) == sizeof(si))
+      ;
+  }
+} /* -- sr_event_drain -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_run(..)
+ * Scope: Global
+ *
+ * Dispatch events until sr_event_stop(..) is called.
+ *
+ * RETURN VALUES:
+ *
+ *  0 when stopped
+ *  -1 if epoll_wait failed
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_event_run(struct sr_event_loop* loop) {
+  struct epoll_event ready[SR_EVENT_BATCH];
+  struct sr_event* ev;
+  int i, n;
+
+  /* -- REQUIRES -- */
+  assert(loop);
+
+  loop->running = 1;
+  while (loop->running) {
+    if ((n = epoll_wait(loop->epfd, ready, SR_EVENT_BATCH, -1)) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait(..):sr_event.c::sr_event_run(..)");
+      return -1;
+    }
+
+    for (i = 0; i < n && loop->running; i++) {
+      ev = (struct sr_event*)ready[i].data.ptr;
+      sr_event_drain(ev);
+      ev->fn(ev->fd, ready[i].events, ev->arg);
+    }
+
+    if (loop->idle_fn) {
+      loop->idle_fn(loop->idle_arg);
+    }
+  }
+
+  return 0;
+} /* -- sr_event_run -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_event_stop(..)
+ * Scope: Global
+ *
+ * Make sr_event_run(..) return after the current callback.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_event_stop(struct sr_event_loop* loop) {
+  /* -- REQUIRES -- */
+  assert(loop);
+
+  loop->running = 0;
+} /* -- sr_event_stop -- */
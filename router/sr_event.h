@@ -0,0 +1,80 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_event.h
+ *
+ * Description:
+ *
+ * Single threaded event loop built on epoll.  File descriptors, periodic
+ * timers (timerfd) and signals (signalfd) are all dispatched from one
+ * epoll_wait, so the data path and the housekeeping timers never run
+ * concurrently and need no locking between them.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_EVENT_H
+#define SR_EVENT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include <sys/epoll.h>
+
+/* maximum number of ready events handled per epoll_wait */
+#define SR_EVENT_BATCH 64
+
+/* callback invoked when fd is ready; events is the epoll event mask.  For
+ * timers and signals the fd has already been drained */
+typedef void (*sr_event_fn)(int fd, uint32_t events, void* arg);
+
+/* callback invoked once per loop iteration, after all ready events */
+typedef void (*sr_event_idle_fn)(void* arg);
+
+enum sr_event_kind {
+  sr_event_kind_fd,
+  sr_event_kind_timer,
+  sr_event_kind_signal,
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_event
+ *
+ * One registration with the loop
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_event {
+  int fd;
+  enum sr_event_kind kind;
+  uint32_t events; /* epoll mask currently armed */
+  sr_event_fn fn;
+  void* arg;
+  struct sr_event* next;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_event_loop
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_event_loop {
+  int epfd;
+  int running;
+  struct sr_event* events; /* every registration, owned by the loop */
+  sr_event_idle_fn idle_fn;
+  void* idle_arg;
+};
+
+int sr_event_init(struct sr_event_loop* loop);
+void sr_event_destroy(struct sr_event_loop* loop);
+
+struct sr_event* sr_event_add_fd(struct sr_event_loop* loop, int fd, uint32_t events, sr_event_fn fn, void* arg);
+struct sr_event* sr_event_add_timer(struct sr_event_loop* loop, unsigned int interval_ms, sr_event_fn fn, void* arg);
+struct sr_event* sr_event_add_signal(struct sr_event_loop* loop, int signo, sr_event_fn fn, void* arg);
+int sr_event_modify(struct sr_event_loop* loop, struct sr_event* ev, uint32_t events);
+void sr_event_remove(struct sr_event_loop* loop, struct sr_event* ev);
+void sr_event_set_idle(struct sr_event_loop* loop, sr_event_idle_fn fn, void* arg);
+
+int sr_event_run(struct sr_event_loop* loop);
+void sr_event_stop(struct sr_event_loop* loop);
+
+#endif /* -- SR_EVENT_H -- */
@@ -0,0 +1,273 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_filter.c
+ *
+ * Description:
+ *
+ * Capture filter compiler and matcher, see sr_filter.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_filter.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sr_protocol.h"
+
+#define SR_FILTER_MAX_TOKENS 128
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_number(..)
+ * Scope: Local
+ *
+ * Parse tok as a number no bigger than max.  Returns -1 if it is not one.
+ *
+ *---------------------------------------------------------------------*/
+
+static long sr_filter_number(const char* tok, long max) {
+  char* end;
+  long v;
+
+  if (tok == 0) {
+    return -1;
+  }
+  v = strtol(tok, &end, 0);
+  return (*end != 0 || end == tok || v < 0 || v > max) ? -1 : v;
+} /* -- sr_filter_number -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_net(..)
+ * Scope: Local
+ *
+ * Parse "A.B.C.D" (as a /32) or, if prefix is set, "A.B.C.D/len" into
+ * term.  Returns -1 if tok is neither.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_filter_net(const char* tok, int prefix, struct sr_filter_term* term) {
+  char addr[32];
+  const char* slash;
+  struct in_addr in;
+  long len = 32;
+
+  if (tok == 0 || strlen(tok) >= sizeof(addr)) {
+    return -1;
+  }
+  strcpy(addr, tok);
+  if (prefix && (slash = strchr(tok, '/')) != 0) {
+    addr[slash - tok] = 0;
+    if ((len = sr_filter_number(slash + 1, 32)) < 0) {
+      return -1;
+    }
+  }
+  if (inet_pton(AF_INET, addr, &in) != 1) {
+    return -1;
+  }
+  term->mask = len == 0 ? 0 : htonl(0xffffffffu << (32 - len));
+  term->val = in.s_addr & term->mask;
+  return 0;
+} /* -- sr_filter_net -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_compile(..)
+ * Scope: Global
+ *
+ * Compile expr into f, see sr_filter.h for the syntax.  An empty or
+ * missing expr gives a filter that matches everything.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on a syntax error, which is reported on stderr
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_filter_compile(struct sr_filter* f, const char* expr) {
+  char* toks[SR_FILTER_MAX_TOKENS + 1];
+  struct sr_filter_term* term;
+  char* copy;
+  char* save = 0;
+  char* tok;
+  unsigned int ntok = 0, i = 0;
+  long v;
+  int ok = 1;
+
+  /* -- REQUIRES -- */
+  assert(f);
+
+  memset(f, 0, sizeof(*f));
+  if (expr == 0) {
+    return 0;
+  }
+  if ((copy = strdup(expr)) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_filter_compile)\n");
+    return -1;
+  }
+  for (tok = strtok_r(copy, " \t", &save); tok; tok = strtok_r(0, " \t", &save)) {
+    if (ntok == SR_FILTER_MAX_TOKENS) {
+      fprintf(stderr, "Error: filter has more than %d words\n", SR_FILTER_MAX_TOKENS);
+      free(copy);
+      return -1;
+    }
+    toks[ntok++] = tok;
+  }
+  toks[ntok] = 0;
+
+  while (ok && i < ntok) {
+    if (f->nterms == SR_FILTER_MAX_TERMS) {
+      fprintf(stderr, "Error: filter has more than %d terms\n", SR_FILTER_MAX_TERMS);
+      ok = 0;
+      break;
+    }
+    term = &(f->terms[f->nterms]);
+    if (strcmp(toks[i], "not") == 0) {
+      term->neg = 1;
+      i++;
+    }
+    if (i < ntok && strcmp(toks[i], "src") == 0) {
+      term->side = SR_FT_SRC;
+      i++;
+    } else if (i < ntok && strcmp(toks[i], "dst") == 0) {
+      term->side = SR_FT_DST;
+      i++;
+    }
+    if (i == ntok) {
+      ok = 0;
+      break;
+    }
+
+    /* -- one primitive -- */
+    tok = toks[i++];
+    if (term->side == SR_FT_EITHER && strcmp(tok, "arp") == 0) {
+      term->kind = SR_FT_ETHERTYPE;
+      term->val = ethertype_arp;
+    } else if (term->side == SR_FT_EITHER && strcmp(tok, "ip") == 0) {
+      term->kind = SR_FT_ETHERTYPE;
+      term->val = ethertype_ip;
+    } else if (term->side == SR_FT_EITHER && strcmp(tok, "icmp") == 0) {
+      term->kind = SR_FT_IPPROTO;
+      term->val = ip_protocol_icmp;
+    } else if (term->side == SR_FT_EITHER && strcmp(tok, "tcp") == 0) {
+      term->kind = SR_FT_IPPROTO;
+      term->val = ip_protocol_tcp;
+    } else if (term->side == SR_FT_EITHER && strcmp(tok, "udp") == 0) {
+      term->kind = SR_FT_IPPROTO;
+      term->val = ip_protocol_udp;
+    } else if (term->side == SR_FT_EITHER && strcmp(tok, "ether") == 0 && i + 1 < ntok &&
+               strcmp(toks[i], "proto") == 0 && (v = sr_filter_number(toks[i + 1], 0xffff)) >= 0) {
+      term->kind = SR_FT_ETHERTYPE;
+      term->val = v;
+      i += 2;
+    } else if (term->side == SR_FT_EITHER && strcmp(tok, "proto") == 0 && (v = sr_filter_number(toks[i], 0xff)) >= 0) {
+      term->kind = SR_FT_IPPROTO;
+      term->val = v;
+      i++;
+    } else if (strcmp(tok, "host") == 0 && sr_filter_net(toks[i], 0, term) == 0) {
+      term->kind = SR_FT_NET;
+      i++;
+    } else if (strcmp(tok, "net") == 0 && sr_filter_net(toks[i], 1, term) == 0) {
+      term->kind = SR_FT_NET;
+      i++;
+    } else if (strcmp(tok, "port") == 0 && (v = sr_filter_number(toks[i], 0xffff)) >= 0) {
+      term->kind = SR_FT_PORT;
+      term->val = v;
+      i++;
+    } else {
+      ok = 0;
+      break;
+    }
+    f->nterms++;
+
+    /* -- and the connective after it -- */
+    if (i == ntok) {
+      f->ends[f->nconj++] = f->nterms;
+    } else if (strcmp(toks[i], "or") == 0) {
+      f->ends[f->nconj++] = f->nterms;
+      ok = ++i < ntok;
+    } else if (strcmp(toks[i], "and") == 0) {
+      ok = ++i < ntok;
+    } else {
+      ok = 0;
+    }
+  }
+
+  if (!ok) {
+    fprintf(stderr, "Error: bad capture filter \"%s\" at \"%s\"\n", expr,
+            i < ntok ? toks[i] : (i > 0 ? toks[i - 1] : ""));
+  }
+  free(copy);
+  return ok ? 0 : -1;
+} /* -- sr_filter_compile -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_match(..)
+ * Scope: Global
+ *
+ * Returns 1 if the Ethernet frame of len bytes passes f, 0 otherwise.
+ * Ports are only seen in unfragmented (or first fragment) TCP and UDP.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_filter_match(const struct sr_filter* f, const uint8_t* frame, unsigned int len) {
+  const struct sr_filter_term* term;
+  const sr_ip_hdr_t* ip_hdr = 0;
+  const uint8_t* l4;
+  unsigned int c, t = 0, hl;
+  uint16_t etype = 0, sport = 0, dport = 0;
+  int have_ports = 0, hit, all;
+
+  if (f->nterms == 0) {
+    return 1;
+  }
+
+  if (len >= sizeof(sr_ethernet_hdr_t)) {
+    etype = ntohs(((const sr_ethernet_hdr_t*)frame)->ether_type);
+  }
+  if (etype == ethertype_ip && len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)) {
+    ip_hdr = (const sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    hl = ip_hdr->ip_hl * 4;
+    l4 = frame + sizeof(sr_ethernet_hdr_t) + hl;
+    if ((ip_hdr->ip_p == ip_protocol_tcp || ip_hdr->ip_p == ip_protocol_udp) &&
+        (ntohs(ip_hdr->ip_off) & IP_OFFMASK) == 0 && sizeof(sr_ethernet_hdr_t) + hl + 4 <= len) {
+      sport = (l4[0] << 8) | l4[1];
+      dport = (l4[2] << 8) | l4[3];
+      have_ports = 1;
+    }
+  }
+
+  for (c = 0; c < f->nconj; c++) {
+    for (all = 1; t < f->ends[c]; t++) {
+      term = &(f->terms[t]);
+      switch (term->kind) {
+        case SR_FT_ETHERTYPE:
+          hit = etype == term->val;
+          break;
+        case SR_FT_IPPROTO:
+          hit = ip_hdr && ip_hdr->ip_p == term->val;
+          break;
+        case SR_FT_NET:
+          hit = ip_hdr && ((term->side != SR_FT_DST && (ip_hdr->ip_src & term->mask) == term->val) ||
+                           (term->side != SR_FT_SRC && (ip_hdr->ip_dst & term->mask) == term->val));
+          break;
+        case SR_FT_PORT:
+          hit = have_ports &&
+                ((term->side != SR_FT_DST && sport == term->val) || (term->side != SR_FT_SRC && dport == term->val));
+          break;
+        default:
+          hit = 0;
+      }
+      if (hit == term->neg) {
+        all = 0;
+        t = f->ends[c];
+        break;
+      }
+    }
+    if (all) {
+      return 1;
+    }
+  }
+  return 0;
+} /* -- sr_filter_match -- */
@@ -0,0 +1,65 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_filter.h
+ *
+ * Description:
+ *
+ * Capture filter: a small tcpdump-like expression compiled once into a
+ * list of terms and matched against raw Ethernet frames.  Primitives are
+ *
+ *   arp  ip  icmp  tcp  udp
+ *   ether proto N   proto N
+ *   [src|dst] host A.B.C.D   [src|dst] net A.B.C.D/len   [src|dst] port N
+ *
+ * each optionally preceded by "not", joined with "and" and "or" ("and"
+ * binds tighter, there are no parentheses).  Numbers may be given in
+ * decimal or 0x hex.  Without src/dst either side may match.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FILTER_H
+#define SR_FILTER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#define SR_FILTER_MAX_TERMS 32
+
+/* -- term kinds -- */
+#define SR_FT_ETHERTYPE 1
+#define SR_FT_IPPROTO 2
+#define SR_FT_NET 3 /* host is a /32 net */
+#define SR_FT_PORT 4
+
+/* -- which address or port a term looks at -- */
+#define SR_FT_EITHER 0
+#define SR_FT_SRC 1
+#define SR_FT_DST 2
+
+struct sr_filter_term {
+  int kind;
+  int side; /* SR_FT_EITHER, SR_FT_SRC or SR_FT_DST */
+  int neg;
+  uint32_t val;  /* ethertype, protocol, port, or network in network byte order */
+  uint32_t mask; /* netmask in network byte order */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_filter
+ *
+ * An "or" of "and"s: conjunction i is terms[ends[i-1] .. ends[i]-1].  A
+ * filter with no terms matches everything.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_filter {
+  unsigned int nterms;
+  unsigned int nconj;
+  struct sr_filter_term terms[SR_FILTER_MAX_TERMS];
+  unsigned int ends[SR_FILTER_MAX_TERMS];
+};
+
+int sr_filter_compile(struct sr_filter* f, const char* expr);
+int sr_filter_match(const struct sr_filter* f, const uint8_t* frame, unsigned int len);
+
+#endif /* -- SR_FILTER_H -- */
@@ -0,0 +1,431 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flight.c
+ *
+ * Description:
+ *
+ * Per thread flight recorder and its dumps, see sr_flight.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_flight.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "sr_if.h"
+#include "sr_pktmeta.h"
+#include "sr_protocol.h"
+#include "sr_router.h"
+
+/* ----------------------------------------------------------------------------
+ * struct sr_flight_rec
+ *
+ * An entry copied out of a ring, with what is needed to order it.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_flight_rec {
+  struct sr_flight_entry e;
+  int tid;
+  unsigned long pos;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_flight_snap
+ *
+ * Every ring's entries at one moment, waiting to be written out.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_flight_snap {
+  struct sr_instance* sr;
+  struct sr_flight_rec* recs;
+  unsigned int n;
+  unsigned int nrings;
+  int64_t wall_off_ns; /* CLOCK_REALTIME - CLOCK_MONOTONIC */
+  char* fname;
+};
+
+static struct sr_flight_ring* sr_flight_rings[SR_FLIGHT_THREADS];
+static unsigned int sr_flight_nrings;
+static unsigned int sr_flight_saves;
+
+/* -- this thread's ring; threads that found none left write to the spare -- */
+static __thread struct sr_flight_ring* sr_flight_self;
+static __thread int sr_flight_unrecorded;
+static __thread struct sr_flight_entry sr_flight_spare;
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_attach(..)
+ * Scope: Local
+ *
+ * Give the calling thread its ring, once.  Returns 0 when every ring is
+ * taken or memory ran out; the thread then goes unrecorded.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_flight_ring* sr_flight_attach(void) {
+  struct sr_flight_ring* ring;
+  unsigned int i;
+
+  if (sr_flight_unrecorded) {
+    return 0;
+  }
+  sr_flight_unrecorded = 1;
+  if ((i = __atomic_fetch_add(&sr_flight_nrings, 1, __ATOMIC_RELAXED)) >= SR_FLIGHT_THREADS) {
+    LOG_WARN("Flight recorder full, thread %ld not recorded", (long)syscall(SYS_gettid));
+    return 0;
+  }
+  if (posix_memalign((void**)&ring, 64, sizeof(struct sr_flight_ring)) != 0) {
+    LOG_ERROR("No memory for a flight recorder ring");
+    return 0;
+  }
+  memset(ring, 0, sizeof(struct sr_flight_ring));
+  ring->tid = (int)syscall(SYS_gettid);
+
+  __atomic_store_n(&(sr_flight_rings[i]), ring, __ATOMIC_RELEASE);
+  sr_flight_unrecorded = 0;
+  sr_flight_self = ring;
+  return ring;
+} /* -- sr_flight_attach -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_begin(..)
+ * Scope: Global
+ *
+ * Take the next entry of this thread's ring for a just parsed packet and
+ * fill in its headers.  meta->fl points at the entry from then on.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_flight_begin(struct sr_pkt_meta* meta) {
+  struct sr_flight_ring* ring = sr_flight_self;
+  struct sr_flight_entry* e;
+  const uint8_t* l4;
+
+  if (ring == 0 && (ring = sr_flight_attach()) == 0) {
+    meta->fl = &sr_flight_spare;
+    return;
+  }
+
+  e = &(ring->entries[ring->pos++ & (SR_FLIGHT_ENTRIES - 1)]);
+  meta->fl = e;
+  e->ip_src = meta->ip_src;
+  e->ip_dst = meta->ip_dst;
+  e->len = meta->len > 0xffff ? 0xffff : meta->len;
+  e->ethertype = meta->ethertype;
+  e->in_if = meta->in_idx < 0xff ? meta->in_idx : 0xff;
+  e->ip_p = meta->ip_p;
+  e->ttl = meta->ttl;
+  e->l4[0] = 0;
+  e->l4[1] = 0;
+
+  if (meta->ethertype == ethertype_arp) {
+    e->l4[0] = meta->arp_op;
+  } else if ((meta->flags & SR_META_L4) && meta->ip_p == ip_protocol_icmp) {
+    e->l4[0] = meta->icmp_type;
+    e->l4[1] = meta->icmp_code;
+  } else if ((meta->flags & SR_META_L4) && (meta->ip_p == ip_protocol_tcp || meta->ip_p == ip_protocol_udp) &&
+             (ntohs(((sr_ip_hdr_t*)(meta->frame + meta->l3_off))->ip_off) & IP_OFFMASK) == 0) {
+    l4 = meta->frame + meta->l4_off;
+    e->l4[0] = (l4[0] << 8) | l4[1];
+    e->l4[1] = (l4[2] << 8) | l4[3];
+  }
+} /* -- sr_flight_begin -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_end(..)
+ * Scope: Global
+ *
+ * Record the decisions for the n packets of a burst handled from start_ns
+ * to end_ns (sr_clock_ns()) and publish their entries.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_flight_end(struct sr_pkt_meta* meta, unsigned int n, uint64_t start_ns, uint64_t end_ns) {
+  struct sr_flight_entry* e;
+  uint32_t proc = end_ns - start_ns > 0xffffffffu ? 0xffffffffu : (uint32_t)(end_ns - start_ns);
+  unsigned int i;
+
+  for (i = 0; i < n; i++) {
+    e = meta[i].fl;
+    e->ts_ns = end_ns;
+    e->proc_ns = proc;
+    e->burst = n;
+    e->disp = meta[i].disp;
+    e->out_if = meta[i].out_idx < 0xff ? meta[i].out_idx : 0xff;
+  }
+  if (sr_flight_self) {
+    __atomic_store_n(&(sr_flight_self->head), sr_flight_self->pos, __ATOMIC_RELEASE);
+  }
+} /* -- sr_flight_end -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_redecide(..)
+ * Scope: Global
+ *
+ * Record a new decision, meta->disp, for a packet whose own burst is long
+ * done, such as a queued packet dropped from a full ARP queue.  It gets an
+ * entry of its own, with the headers as they are now (a forwarded packet's
+ * TTL already decremented), published with the calling thread's next
+ * sr_flight_end(..), so call it while handling a burst; each packet of
+ * that burst can bring at most one such entry.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_flight_redecide(struct sr_pkt_meta* meta, uint64_t now_ns) {
+  struct sr_flight_entry* e;
+
+  sr_flight_begin(meta);
+  e = meta->fl;
+  e->ts_ns = now_ns;
+  e->proc_ns = 0;
+  e->burst = 0;
+  e->disp = meta->disp;
+  e->out_if = meta->out_idx < 0xff ? meta->out_idx : 0xff;
+} /* -- sr_flight_redecide -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_snapshot(..)
+ * Scope: Local
+ *
+ * Copy every published entry out of every ring while their threads go on
+ * recording.  An entry is only kept if its slot cannot have been reused
+ * for a newer packet by the time the copy was done.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_flight_snapshot(struct sr_instance* sr, struct sr_flight_snap* snap) {
+  struct sr_flight_ring* ring;
+  struct timespec mono, wall;
+  unsigned long h1, h2, lo, p;
+  unsigned int i, nrings, base;
+
+  memset(snap, 0, sizeof(*snap));
+  snap->sr = sr;
+  nrings = __atomic_load_n(&sr_flight_nrings, __ATOMIC_RELAXED);
+  nrings = nrings < SR_FLIGHT_THREADS ? nrings : SR_FLIGHT_THREADS;
+  if ((snap->recs = (struct sr_flight_rec*)malloc((size_t)(nrings ? nrings : 1) * SR_FLIGHT_ENTRIES *
+                                                  sizeof(struct sr_flight_rec))) == 0) {
+    LOG_ERROR("No memory for a flight recorder snapshot");
+    return -1;
+  }
+
+  for (i = 0; i < nrings; i++) {
+    if ((ring = __atomic_load_n(&(sr_flight_rings[i]), __ATOMIC_ACQUIRE)) == 0) {
+      continue;
+    }
+    snap->nrings++;
+    base = snap->n;
+    h1 = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+    lo = h1 > SR_FLIGHT_ENTRIES ? h1 - SR_FLIGHT_ENTRIES : 0;
+    for (p = lo; p != h1; p++) {
+      snap->recs[base + (p - lo)].e = ring->entries[p & (SR_FLIGHT_ENTRIES - 1)];
+    }
+
+    /* -- the thread may have refilled the oldest slots meanwhile, two per packet of a burst past its head -- */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    h2 = __atomic_load_n(&(ring->head), __ATOMIC_RELAXED);
+    for (p = lo; p != h1; p++) {
+      if ((long)(p - (h2 + 2 * SR_BURST_MAX - SR_FLIGHT_ENTRIES)) >= 0) {
+        snap->recs[snap->n] = snap->recs[base + (p - lo)];
+        snap->recs[snap->n].tid = ring->tid;
+        snap->recs[snap->n].pos = p;
+        snap->n++;
+      }
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  clock_gettime(CLOCK_REALTIME, &wall);
+  snap->wall_off_ns = ((int64_t)wall.tv_sec - mono.tv_sec) * 1000000000 + ((int64_t)wall.tv_nsec - mono.tv_nsec);
+  return 0;
+} /* -- sr_flight_snapshot -- */
+
+static int sr_flight_rec_cmp(const void* a, const void* b) {
+  const struct sr_flight_rec* x = (const struct sr_flight_rec*)a;
+  const struct sr_flight_rec* y = (const struct sr_flight_rec*)b;
+
+  if (x->e.ts_ns != y->e.ts_ns) {
+    return x->e.ts_ns < y->e.ts_ns ? -1 : 1;
+  }
+  if (x->tid != y->tid) {
+    return x->tid < y->tid ? -1 : 1;
+  }
+  return x->pos < y->pos ? -1 : x->pos > y->pos;
+} /* -- sr_flight_rec_cmp -- */
+
+static const char* sr_flight_if(struct sr_instance* sr, uint8_t idx) {
+  struct sr_if* iface;
+
+  if (idx == 0xff || (iface = sr_get_interface_idx(sr, idx)) == 0) {
+    return "-";
+  }
+  return iface->name;
+} /* -- sr_flight_if -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_write(..)
+ * Scope: Local
+ *
+ * Write a snapshot out as text, one line per packet, oldest first:
+ *
+ *   time  tid  in > out  headers  decision  burst time / packets
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_flight_write(struct sr_flight_snap* snap, FILE* out) {
+  struct sr_flight_entry* e;
+  struct in_addr src, dst;
+  char sbuf[INET_ADDRSTRLEN], dbuf[INET_ADDRSTRLEN], tbuf[32];
+  struct tm tm;
+  time_t secs;
+  int64_t wall;
+  unsigned int i;
+
+  qsort(snap->recs, snap->n, sizeof(struct sr_flight_rec), sr_flight_rec_cmp);
+  fprintf(out, "# flight recorder: %u packets from %u threads\n", snap->n, snap->nrings);
+
+  for (i = 0; i < snap->n; i++) {
+    e = &(snap->recs[i].e);
+    wall = (int64_t)e->ts_ns + snap->wall_off_ns;
+    secs = wall / 1000000000;
+    localtime_r(&secs, &tm);
+    strftime(tbuf, sizeof(tbuf), "%H:%M:%S", &tm);
+    src.s_addr = e->ip_src;
+    dst.s_addr = e->ip_dst;
+    inet_ntop(AF_INET, &src, sbuf, sizeof(sbuf));
+    inet_ntop(AF_INET, &dst, dbuf, sizeof(dbuf));
+
+    fprintf(out, "%s.%09ld %5d %s > %s ", tbuf, (long)(wall % 1000000000), snap->recs[i].tid,
+            sr_flight_if(snap->sr, e->in_if), sr_flight_if(snap->sr, e->out_if));
+    if (e->ethertype == ethertype_arp) {
+      fprintf(out, "arp op %u %s > %s", e->l4[0], sbuf, dbuf);
+    } else if (e->ethertype != ethertype_ip) {
+      fprintf(out, "ethertype 0x%04x", e->ethertype);
+    } else if (e->ip_p == ip_protocol_icmp) {
+      fprintf(out, "%s > %s icmp %u/%u ttl %u", sbuf, dbuf, e->l4[0], e->l4[1], e->ttl);
+    } else if (e->ip_p == ip_protocol_tcp || e->ip_p == ip_protocol_udp) {
+      fprintf(out, "%s:%u > %s:%u %s ttl %u", sbuf, e->l4[0], dbuf, e->l4[1],
+              e->ip_p == ip_protocol_tcp ? "tcp" : "udp", e->ttl);
+    } else {
+      fprintf(out, "%s > %s proto %u ttl %u", sbuf, dbuf, e->ip_p, e->ttl);
+    }
+    fprintf(out, " len %u : %s %u ns/%u\n", e->len, sr_disp_name(e->disp), e->proc_ns, e->burst);
+  }
+} /* -- sr_flight_write -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_writer(..)
+ * Scope: Local
+ *
+ * Detached thread writing one snapshot to its file, then freeing it.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_flight_writer(void* arg) {
+  struct sr_flight_snap* snap = (struct sr_flight_snap*)arg;
+  FILE* out;
+
+  if ((out = fopen(snap->fname, "w")) == 0) {
+    LOG_ERROR("Can't open flight recorder file %s: %s", snap->fname, strerror(errno));
+  } else {
+    sr_flight_write(snap, out);
+    fclose(out);
+    LOG_INFO("Flight recorder: %u packets written to %s", snap->n, snap->fname);
+  }
+  free(snap->fname);
+  free(snap->recs);
+  free(snap);
+  return 0;
+} /* -- sr_flight_writer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_save(..)
+ * Scope: Global
+ *
+ * Copy every ring and have a background thread write the copy to fname,
+ * or fname.1, fname.2, ... for later saves, so the caller only pays for
+ * the copy.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_flight_save(struct sr_instance* sr, const char* fname) {
+  struct sr_flight_snap* snap;
+  pthread_attr_t attr;
+  pthread_t thread;
+  char name[1024];
+  unsigned int n;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(fname);
+
+  if ((n = __atomic_fetch_add(&sr_flight_saves, 1, __ATOMIC_RELAXED)) == 0) {
+    snprintf(name, sizeof(name), "%s", fname);
+  } else {
+    snprintf(name, sizeof(name), "%s.%u", fname, n);
+  }
+  if ((snap = (struct sr_flight_snap*)malloc(sizeof(struct sr_flight_snap))) == 0 ||
+      sr_flight_snapshot(sr, snap) != 0) {
+    LOG_ERROR("Flight recorder not saved");
+    free(snap);
+    return -1;
+  }
+  if ((snap->fname = strdup(name)) == 0) {
+    LOG_ERROR("Flight recorder not saved");
+    free(snap->recs);
+    free(snap);
+    return -1;
+  }
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if ((errno = pthread_create(&thread, &attr, sr_flight_writer, snap)) != 0) {
+    perror("pthread_create(..):sr_flight.c::sr_flight_save(..)");
+    sr_flight_writer(snap);
+  }
+  pthread_attr_destroy(&attr);
+  return 0;
+} /* -- sr_flight_save -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_dump(..)
+ * Scope: Global
+ *
+ * Copy every ring and write the copy to out right away.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_flight_dump(struct sr_instance* sr, FILE* out) {
+  struct sr_flight_snap snap;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(out);
+
+  if (sr_flight_snapshot(sr, &snap) != 0) {
+    return -1;
+  }
+  sr_flight_write(&snap, out);
+  free(snap.recs);
+  return 0;
+} /* -- sr_flight_dump -- */
@@ -0,0 +1,82 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flight.h
+ *
+ * Description:
+ *
+ * Always-on flight recorder.  Every thread that handles packets keeps its
+ * own ring of the last SR_FLIGHT_ENTRIES packets: key header fields when
+ * the packet is parsed, then what the router decided and how long it took
+ * once its burst is done.  Recording is a store into memory only that
+ * thread writes plus two clock reads per burst, so it stays on.
+ *
+ * sr_flight_save(..) copies every ring out (without stopping the threads)
+ * and a background thread writes the copy to a file, oldest entry first.
+ * The router calls it on SIGUSR2.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FLIGHT_H
+#define SR_FLIGHT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include <stdio.h>
+
+#define SR_FLIGHT_ENTRIES 4096 /* per thread, a power of two */
+#define SR_FLIGHT_THREADS 32   /* threads that get a ring, later ones are not recorded */
+#define SR_FLIGHT_FILE "sr_flight.log"
+
+struct sr_instance;
+struct sr_pkt_meta;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_flight_entry
+ *
+ * One packet.  Addresses are in network byte order.  l4 holds the ports
+ * for TCP and UDP, type and code for ICMP and the op for ARP.  proc_ns is
+ * how long the burst the packet was handled in took, burst packets in all.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_flight_entry {
+  uint64_t ts_ns; /* CLOCK_MONOTONIC, when the decision was recorded */
+  uint32_t ip_src;
+  uint32_t ip_dst;
+  uint32_t proc_ns;
+  uint16_t len;
+  uint16_t ethertype;
+  uint16_t l4[2];
+  uint16_t burst;
+  uint8_t in_if;  /* interface index, 0xff for none */
+  uint8_t out_if; /* likewise */
+  uint8_t ip_p;
+  uint8_t ttl; /* as received */
+  uint8_t disp; /* enum sr_disp */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_flight_ring
+ *
+ * pos is the next entry to fill and only its thread touches it; head
+ * trails it and is published once a burst is decided.  Entries from
+ * head to pos are still being filled in, never more than two per packet
+ * of a burst (see sr_flight_redecide(..)).
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_flight_ring {
+  int tid;
+  unsigned long pos;
+  unsigned long head __attribute__((aligned(64)));
+  struct sr_flight_entry entries[SR_FLIGHT_ENTRIES] __attribute__((aligned(64)));
+};
+
+void sr_flight_begin(struct sr_pkt_meta* meta);
+void sr_flight_end(struct sr_pkt_meta* meta, unsigned int n, uint64_t start_ns, uint64_t end_ns);
+void sr_flight_redecide(struct sr_pkt_meta* meta, uint64_t now_ns);
+int sr_flight_save(struct sr_instance* sr, const char* fname);
+int sr_flight_dump(struct sr_instance* sr, FILE* out);
+
+#endif /* -- SR_FLIGHT_H -- */
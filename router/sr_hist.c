@@ -0,0 +1,115 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_hist.c
+ *
+ * Description:
+ *
+ * Log-linear latency histograms, see sr_hist.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_hist.h"
+
+#include <assert.h>
+
+/*---------------------------------------------------------------------
+ * Method: sr_hist_bucket(..)
+ * Scope: Global
+ *
+ * Bucket of a value.  Values below 2^SR_HIST_SUB_BITS are their own
+ * bucket; above that the value is shifted right until SR_HIST_SUB_BITS + 1
+ * bits are left, and the shift picks the group of buckets, the remaining
+ * bits the bucket in it.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_hist_bucket(uint64_t ns) {
+  unsigned int shift;
+
+  if (ns >> SR_HIST_MAX_BITS) {
+    return SR_HIST_BUCKETS - 1;
+  }
+  if (ns < (1u << SR_HIST_SUB_BITS)) {
+    return (unsigned int)ns;
+  }
+  shift = 63 - __builtin_clzll(ns) - SR_HIST_SUB_BITS;
+  return (shift << SR_HIST_SUB_BITS) + (unsigned int)(ns >> shift);
+} /* -- sr_hist_bucket -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_hist_bucket_max(..)
+ * Scope: Global
+ *
+ * Largest value that falls into bucket idx.
+ *
+ *---------------------------------------------------------------------*/
+
+uint64_t sr_hist_bucket_max(unsigned int idx) {
+  unsigned int shift;
+  uint64_t mant;
+
+  /* -- REQUIRES -- */
+  assert(idx < SR_HIST_BUCKETS);
+
+  if (idx < (2u << SR_HIST_SUB_BITS)) {
+    return idx;
+  }
+  shift = (idx >> SR_HIST_SUB_BITS) - 1;
+  mant = idx - (shift << SR_HIST_SUB_BITS);
+  return ((mant + 1) << shift) - 1;
+} /* -- sr_hist_bucket_max -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_hist_percentile(..)
+ * Scope: Global
+ *
+ * Value at or below which a fraction p (0..1) of the recorded values
+ * lie, rounded up to the top of its bucket.  0 for an empty histogram.
+ *
+ *---------------------------------------------------------------------*/
+
+uint64_t sr_hist_percentile(const struct sr_hist* h, double p) {
+  uint64_t rank, seen = 0;
+  unsigned int i;
+
+  /* -- REQUIRES -- */
+  assert(h);
+
+  if (h->count == 0) {
+    return 0;
+  }
+  /* -- the ceil(p * count)-th smallest value, at least the first -- */
+  rank = (uint64_t)(p * h->count);
+  if (rank < p * h->count || rank < 1) {
+    rank++;
+  }
+  for (i = 0; i < SR_HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      return sr_hist_bucket_max(i);
+    }
+  }
+  /* -- buckets and count read at different moments, as during a snapshot -- */
+  return sr_hist_max(h);
+} /* -- sr_hist_percentile -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_hist_max(..)
+ * Scope: Global
+ *
+ * Top of the highest bucket in use, 0 for an empty histogram.
+ *
+ *---------------------------------------------------------------------*/
+
+uint64_t sr_hist_max(const struct sr_hist* h) {
+  unsigned int i;
+
+  /* -- REQUIRES -- */
+  assert(h);
+
+  for (i = SR_HIST_BUCKETS; i > 0; i--) {
+    if (h->buckets[i - 1]) {
+      return sr_hist_bucket_max(i - 1);
+    }
+  }
+  return 0;
+} /* -- sr_hist_max -- */
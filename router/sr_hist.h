@@ -0,0 +1,43 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_hist.h
+ *
+ * Description:
+ *
+ * Log-linear (HDR style) histograms of nanosecond durations.  Each power
+ * of two from 32 up is split into 32 equal buckets, below 32 every value
+ * has a bucket of its own, so any value is known to within 1/32 (about
+ * 3%) from 0 up to 2^36 ns (68 s); longer ones land in the last bucket.
+ *
+ * A histogram is nothing but uint64_t counters, so two of them are
+ * merged by adding them counter by counter.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_HIST_H
+#define SR_HIST_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#define SR_HIST_SUB_BITS 5  /* 2^5 buckets per power of two */
+#define SR_HIST_MAX_BITS 36 /* values from 2^36 ns on are clamped */
+#define SR_HIST_BUCKETS ((SR_HIST_MAX_BITS - SR_HIST_SUB_BITS + 1) << SR_HIST_SUB_BITS)
+
+/* ----------------------------------------------------------------------------
+ * struct sr_hist
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_hist {
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t buckets[SR_HIST_BUCKETS];
+};
+
+unsigned int sr_hist_bucket(uint64_t ns);
+uint64_t sr_hist_bucket_max(unsigned int idx);
+uint64_t sr_hist_percentile(const struct sr_hist* h, double p);
+uint64_t sr_hist_max(const struct sr_hist* h);
+
+#endif /* -- SR_HIST_H -- */
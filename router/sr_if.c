@@ -19,11 +19,16 @@
 #endif /* _DARWIN_ */
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
 #include <netinet/in.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
 #include "sr_if.h"
 #include "sr_router.h"
+#include "sr_utils.h"
 
 /*---------------------------------------------------------------------
  * Method: sr_get_interface
@@ -53,28 +58,61 @@ struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name) {
   return 0;
 } /* -- sr_get_interface -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_get_interface_idx
+ * Scope: Global
+ *
+ * Given an interface index return the interface record or 0 if there is
+ * no such interface.  This is the lookup the data path uses; names are
+ * only resolved where they come in from outside.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_if* sr_get_interface_idx(struct sr_instance* sr, unsigned int idx) {
+  /* -- REQUIRES -- */
+  assert(sr);
+
+  return idx < sr->if_count ? sr->if_table[idx] : 0;
+} /* -- sr_get_interface_idx -- */
+
 /*---------------------------------------------------------------------
  * Method: sr_add_interface(..)
  * Scope: Global
  *
- * Add and interface to the router's list
+ * Add and interface to the router's list, giving it the next index.  The
+ * list comes from outside (the VNS server, the relay, the command line),
+ * so an interface past SR_IF_MAX is reported and left out.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 if the router already has SR_IF_MAX interfaces
  *
  *---------------------------------------------------------------------*/
 
-void sr_add_interface(struct sr_instance* sr, const char* name) {
+int sr_add_interface(struct sr_instance* sr, const char* name) {
   struct sr_if* if_walker = 0;
+  struct sr_if* iface;
 
   /* -- REQUIRES -- */
   assert(name);
   assert(sr);
 
+  if (sr->if_count >= SR_IF_MAX) {
+    fprintf(stderr, "Error: more than %d interfaces, ignoring %.*s\n", SR_IF_MAX, sr_IFACE_NAMELEN, name);
+    return -1;
+  }
+
+  iface = (struct sr_if*)calloc(1, sizeof(struct sr_if));
+  assert(iface);
+  strncpy(iface->name, name, sr_IFACE_NAMELEN);
+  iface->index = sr->if_count;
+  sr->if_table[sr->if_count++] = iface;
+
   /* -- empty list special case -- */
   if (sr->if_list == 0) {
-    sr->if_list = (struct sr_if*)malloc(sizeof(struct sr_if));
-    assert(sr->if_list);
-    sr->if_list->next = 0;
-    strncpy(sr->if_list->name, name, sr_IFACE_NAMELEN);
-    return;
+    sr->if_list = iface;
+    return 0;
   }
 
   /* -- find the end of the list -- */
@@ -82,12 +120,8 @@ void sr_add_interface(struct sr_instance* sr, const char* name) {
   while (if_walker->next) {
     if_walker = if_walker->next;
   }
-
-  if_walker->next = (struct sr_if*)malloc(sizeof(struct sr_if));
-  assert(if_walker->next);
-  if_walker = if_walker->next;
-  strncpy(if_walker->name, name, sr_IFACE_NAMELEN);
-  if_walker->next = 0;
+  if_walker->next = iface;
+  return 0;
 } /* -- sr_add_interface -- */
 
 /*---------------------------------------------------------------------
@@ -138,6 +172,217 @@ void sr_set_ether_ip(struct sr_instance* sr, uint32_t ip_nbo) {
 
 } /* -- sr_set_ether_ip -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_build_if_templates(..)
+ * Scope: Global
+ *
+ * Fill in the frame templates of every interface once its addresses are
+ * known.  The ICMP template's IP checksum covers a destination of 0, so
+ * a sender patches it with cksum_adjust32 when filling in the address.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_build_if_templates(struct sr_instance* sr) {
+  struct sr_if* if_walker;
+  sr_ethernet_hdr_t* eth_hdr;
+  sr_arp_hdr_t* arp_hdr;
+  sr_ip_hdr_t* ip_hdr;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+
+  for (if_walker = sr->if_list; if_walker; if_walker = if_walker->next) {
+    memset(if_walker->arp_tmpl, 0, SR_IF_ARP_TMPL_LEN);
+    eth_hdr = (sr_ethernet_hdr_t*)if_walker->arp_tmpl;
+    memset(eth_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN);
+    memcpy(eth_hdr->ether_shost, if_walker->addr, ETHER_ADDR_LEN);
+    eth_hdr->ether_type = htons(ethertype_arp);
+    arp_hdr = (sr_arp_hdr_t*)(if_walker->arp_tmpl + sizeof(sr_ethernet_hdr_t));
+    arp_hdr->ar_hrd = htons(arp_hrd_ethernet);
+    arp_hdr->ar_pro = htons(ethertype_ip);
+    arp_hdr->ar_hln = ETHER_ADDR_LEN;
+    arp_hdr->ar_pln = sizeof(uint32_t);
+    arp_hdr->ar_op = htons(arp_op_request);
+    memcpy(arp_hdr->ar_sha, if_walker->addr, ETHER_ADDR_LEN);
+    arp_hdr->ar_sip = if_walker->ip;
+
+    memset(if_walker->icmp_tmpl, 0, SR_IF_ICMP_TMPL_LEN);
+    eth_hdr = (sr_ethernet_hdr_t*)if_walker->icmp_tmpl;
+    memcpy(eth_hdr->ether_shost, if_walker->addr, ETHER_ADDR_LEN);
+    eth_hdr->ether_type = htons(ethertype_ip);
+    ip_hdr = (sr_ip_hdr_t*)(if_walker->icmp_tmpl + sizeof(sr_ethernet_hdr_t));
+    ip_hdr->ip_v = 4;
+    ip_hdr->ip_hl = sizeof(sr_ip_hdr_t) / 4;
+    ip_hdr->ip_len = htons(sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
+    ip_hdr->ip_off = htons(IP_DF);
+    ip_hdr->ip_ttl = INIT_TTL;
+    ip_hdr->ip_p = ip_protocol_icmp;
+    ip_hdr->ip_src = if_walker->ip;
+    ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+  }
+} /* -- sr_build_if_templates -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_local_addr_slot(..)
+ * Scope: Local
+ *
+ * Home slot of ip in the local address set (Fibonacci hashing).
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int sr_local_addr_slot(uint32_t ip_nbo) {
+  return (unsigned int)((ip_nbo * 2654435769u) >> 24) & (SR_LOCAL_ADDR_SLOTS - 1);
+} /* -- sr_local_addr_slot -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_add_local_addr(..)
+ * Scope: Global
+ *
+ * Make ip one of the addresses the router answers for on interface
+ * ifidx.  Only unicast addresses belong here; the interfaces carry no
+ * netmask, so sr_build_local_addrs(..) adds each interface's one IP and
+ * nothing else.  An address that is already in the set keeps the
+ * interface it was first added with.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 if the set is full
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_add_local_addr(struct sr_instance* sr, uint32_t ip_nbo, unsigned int ifidx) {
+  unsigned int i;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(ip_nbo != 0);
+
+  for (i = sr_local_addr_slot(ip_nbo); sr->local_addrs[i].ip != 0; i = (i + 1) & (SR_LOCAL_ADDR_SLOTS - 1)) {
+    if (sr->local_addrs[i].ip == ip_nbo) {
+      return 0;
+    }
+  }
+  if (sr->local_addr_count == SR_LOCAL_ADDR_MAX) {
+    fprintf(stderr, "Error: more than %d local addresses\n", SR_LOCAL_ADDR_MAX);
+    return -1;
+  }
+
+  sr->local_addrs[i].ip = ip_nbo;
+  sr->local_addrs[i].ifidx = ifidx;
+  sr->local_addr_count++;
+  return 0;
+} /* -- sr_add_local_addr -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_build_local_addrs(..)
+ * Scope: Global
+ *
+ * Refill the local address set from the interface list once the
+ * interfaces' addresses are known.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_build_local_addrs(struct sr_instance* sr) {
+  struct sr_if* if_walker;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+
+  memset(sr->local_addrs, 0, sizeof(sr->local_addrs));
+  sr->local_addr_count = 0;
+
+  for (if_walker = sr->if_list; if_walker; if_walker = if_walker->next) {
+    if (if_walker->ip != 0) {
+      sr_add_local_addr(sr, if_walker->ip, if_walker->index);
+    }
+  }
+} /* -- sr_build_local_addrs -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_local_addr_lookup(..)
+ * Scope: Global
+ *
+ * Interface owning the local address ip, or 0 if the router does not
+ * answer for it.  The set is kept sparse enough that this is nearly
+ * always a single probe.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_if* sr_local_addr_lookup(const struct sr_instance* sr, uint32_t ip_nbo) {
+  unsigned int i;
+
+  for (i = sr_local_addr_slot(ip_nbo); sr->local_addrs[i].ip != 0; i = (i + 1) & (SR_LOCAL_ADDR_SLOTS - 1)) {
+    if (sr->local_addrs[i].ip == ip_nbo) {
+      return sr->if_table[sr->local_addrs[i].ifidx];
+    }
+  }
+  return 0;
+} /* -- sr_local_addr_lookup -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_add_os_interface(..)
+ * Scope: Global
+ *
+ * Add the local interface called name to the router's list, with the MAC
+ * and IPv4 address the OS has for it.  Its index is stored in ifindex.
+ *
+ * RETURN VALUES:
+ *
+ *  the new interface record, or 0 on error
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_if* sr_add_os_interface(struct sr_instance* sr, const char* name, int* ifindex) {
+  struct ifreq ifr;
+  unsigned char mac[ETHER_ADDR_LEN];
+  int fd;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(name);
+  assert(ifindex);
+
+  if (strlen(name) >= IFNAMSIZ) {
+    fprintf(stderr, "Error: interface name %s too long\n", name);
+    return 0;
+  }
+  if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+    perror("socket(..):sr_if.c::sr_add_os_interface(..)");
+    return 0;
+  }
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+
+  if (ioctl(fd, SIOCGIFINDEX, &ifr) == -1) {
+    fprintf(stderr, "Error: no interface %s: %s\n", name, strerror(errno));
+    close(fd);
+    return 0;
+  }
+  *ifindex = ifr.ifr_ifindex;
+
+  if (ioctl(fd, SIOCGIFHWADDR, &ifr) == -1) {
+    perror("ioctl(SIOCGIFHWADDR):sr_if.c::sr_add_os_interface(..)");
+    close(fd);
+    return 0;
+  }
+  memcpy(mac, ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN);
+
+  if (ioctl(fd, SIOCGIFADDR, &ifr) == -1) {
+    fprintf(stderr, "Error: interface %s has no IPv4 address: %s\n", name, strerror(errno));
+    close(fd);
+    return 0;
+  }
+  close(fd);
+
+  if (sr_add_interface(sr, name) != 0) {
+    return 0;
+  }
+  sr_set_ether_addr(sr, mac);
+  sr_set_ether_ip(sr, ((struct sockaddr_in*)&(ifr.ifr_addr))->sin_addr.s_addr);
+  return sr_get_interface(sr, name);
+} /* -- sr_add_os_interface -- */
+
 /*---------------------------------------------------------------------
  * Method: sr_print_if_list(..)
  * Scope: Global
@@ -28,6 +28,27 @@
 
 struct sr_instance;
 
+/* -- frames every send from an interface starts from, see sr_build_if_templates -- */
+#define SR_IF_ARP_TMPL_LEN (sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))
+#define SR_IF_ICMP_TMPL_LEN (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t))
+
+/* -- slots in the local address set, a power of two kept at most a quarter full -- */
+#define SR_LOCAL_ADDR_SLOTS 256
+#define SR_LOCAL_ADDR_MAX (SR_LOCAL_ADDR_SLOTS / 4)
+
+/* ----------------------------------------------------------------------------
+ * struct sr_local_addr
+ *
+ * Slot in the open addressed set of addresses the router answers for,
+ * see sr_local_addr_lookup(..)
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_local_addr {
+  uint32_t ip;        /* network byte order, 0 for a free slot */
+  unsigned int ifidx; /* interface owning it */
+};
+
 /* ----------------------------------------------------------------------------
  * struct sr_if
  *
@@ -40,13 +61,22 @@ struct sr_if {
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  unsigned int index; /* position in sr_instance.if_table */
+  uint8_t arp_tmpl[SR_IF_ARP_TMPL_LEN];   /* who-has broadcast, target IP blank */
+  uint8_t icmp_tmpl[SR_IF_ICMP_TMPL_LEN]; /* ICMP error, dest MAC/IP and ICMP part blank */
   struct sr_if* next;
 };
 
 struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name);
-void sr_add_interface(struct sr_instance*, const char*);
+struct sr_if* sr_get_interface_idx(struct sr_instance* sr, unsigned int idx);
+int sr_add_interface(struct sr_instance*, const char*);
+struct sr_if* sr_add_os_interface(struct sr_instance*, const char*, int* ifindex);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
+void sr_build_if_templates(struct sr_instance*);
+int sr_add_local_addr(struct sr_instance*, uint32_t ip_nbo, unsigned int ifidx);
+void sr_build_local_addrs(struct sr_instance*);
+struct sr_if* sr_local_addr_lookup(const struct sr_instance*, uint32_t ip_nbo);
 void sr_print_if_list(struct sr_instance*);
 void sr_print_if(struct sr_if*);
 
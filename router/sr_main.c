@@ -19,6 +19,7 @@
 
 #include <assert.h>
 #include <pwd.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,9 +30,20 @@
 #include <getopt.h>
 #endif /* _LINUX_ */
 
-#include "sr_dumper.h"
+#include "log.h"
+#include "sr_afpacket.h"
+#include "sr_capture.h"
+#include "sr_ctl.h"
+#include "sr_flight.h"
+#include "sr_prof.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_shm.h"
+#include "sr_stats.h"
+#include "sr_uring.h"
+#include "sr_utils.h"
+#include "sr_worker.h"
+#include "sr_xdp.h"
 
 extern char *optarg;
 
@@ -44,12 +56,15 @@ extern char *optarg;
 #define DEFAULT_SERVER "localhost"
 #define DEFAULT_RTABLE "rtable"
 #define DEFAULT_TOPO 0
+#define DEFAULT_WORKERS 0
 
 static void usage(char *);
 static void sr_init_instance(struct sr_instance *);
 static void sr_destroy_instance(struct sr_instance *);
 static void sr_set_user(struct sr_instance *);
 static void sr_load_rt_wrap(struct sr_instance *sr, char *rtable);
+static void sr_stop_on_signal(int fd, uint32_t events, void *sr_ptr);
+static void sr_flight_on_signal(int fd, uint32_t events, void *sr_ptr);
 
 /*-----------------------------------------------------------------------------
  *---------------------------------------------------------------------------*/
@@ -63,12 +78,24 @@ int main(int argc, char **argv) {
   char *template = NULL;
   unsigned int port = DEFAULT_PORT;
   unsigned int topo = DEFAULT_TOPO;
+  int workers = DEFAULT_WORKERS;
+  char *ifaces = 0;
+  char *xsk_ifaces = 0;
+  int uring = 0;
+  int hugepages = 0;
+  char *relay = 0;
   char *logfile = 0;
+  unsigned long rotate_mb = 0;
+  char *filter = 0;
+  unsigned int sample = 1;
+  int dirs = SR_CAP_DIR_BOTH;
+  char *flight_file = SR_FLIGHT_FILE;
+  char *ctl_path = SR_CTL_SOCKET;
   struct sr_instance sr;
 
   printf("Using %s\n", VERSION_INFO);
 
-  while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF) {
+  while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:R:F:S:D:f:c:L:T:w:i:x:Um:HC")) != EOF) {
     switch (c) {
     case 'h':
       usage(argv[0]);
@@ -92,17 +119,83 @@ int main(int argc, char **argv) {
     case 'l':
       logfile = optarg;
       break;
+    case 'R':
+      rotate_mb = strtoul(optarg, 0, 10);
+      break;
+    case 'F':
+      filter = optarg;
+      break;
+    case 'S':
+      sample = strtoul(optarg, 0, 10);
+      break;
+    case 'D':
+      if (strcmp(optarg, "in") == 0) {
+        dirs = SR_CAP_DIR_IN;
+      } else if (strcmp(optarg, "out") == 0) {
+        dirs = SR_CAP_DIR_OUT;
+      } else if (strcmp(optarg, "both") == 0) {
+        dirs = SR_CAP_DIR_BOTH;
+      } else {
+        fprintf(stderr, "Unknown capture direction %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'f':
+      flight_file = optarg;
+      break;
+    case 'c':
+      ctl_path = optarg;
+      break;
+    case 'L':
+      if ((log_level = log_parse_level(optarg)) < 0) {
+        fprintf(stderr, "Unknown log level %s\n", optarg);
+        exit(1);
+      }
+      break;
     case 'r':
       rtable = optarg;
       break;
     case 'T':
       template = optarg;
       break;
+    case 'w':
+      workers = atoi((char *)optarg);
+      break;
+    case 'i':
+      ifaces = optarg;
+      break;
+    case 'x':
+      xsk_ifaces = optarg;
+      break;
+    case 'U':
+      uring = 1;
+      break;
+    case 'm':
+      relay = optarg;
+      break;
+    case 'H':
+      hugepages = 1;
+      break;
+    case 'C':
+      /* -- check the checksum kernels against each other, time them and quit -- */
+      if (cksum_selftest(stdout) != 0) {
+        exit(1);
+      }
+      cksum_bench(stdout);
+      exit(0);
+      break;
     } /* switch */
   } /* -- while -- */
 
   /* -- zero out sr instance -- */
   sr_init_instance(&sr);
+  sr.vns_uring = uring;
+  sr.flight_file = flight_file;
+
+  /* -- every packet buffer the router uses comes out of this pool -- */
+  if (sr_pktpool_init(&sr.pool, SR_PKTBUF_COUNT, hugepages) != 0) {
+    exit(1);
+  }
 
   /* -- set up routing table from file -- */
   if (template == NULL) {
@@ -121,42 +214,88 @@ int main(int argc, char **argv) {
     strncpy(sr.user, user, 32);
   }
 
-  /* -- set up file pointer for logging of raw packets -- */
+  /* -- set up the capture of raw packets, written out by its own thread -- */
   if (logfile != 0) {
-    sr.logfile = sr_dump_open(logfile, 0, PACKET_DUMP_SIZE);
-    if (!sr.logfile) {
+    if (sr_capture_open(&sr, logfile, rotate_mb << 20) != 0) {
       fprintf(stderr, "Error opening up dump file %s\n", logfile);
       exit(1);
     }
+    if (sr_capture_configure(sr.capture, filter, sample, dirs) != 0) {
+      exit(1);
+    }
   }
 
-  Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
-  if (template) {
-    Debug("Requesting topology template %s\n", template);
+  if (ifaces != 0 || xsk_ifaces != 0 || relay != 0) {
+    /* attach straight to local interfaces or a local relay instead of a VNS server */
+    if (relay) {
+      Debug("Attaching to relay at %s\n", relay);
+    } else {
+      Debug("Attaching to interfaces %s\n", xsk_ifaces ? xsk_ifaces : ifaces);
+    }
+    if ((relay        ? sr_shm_open(&sr, relay)
+         : xsk_ifaces ? sr_xdp_open(&sr, xsk_ifaces)
+                      : sr_afpacket_open(&sr, ifaces)) != 0) {
+      sr_destroy_instance(&sr);
+      return 1;
+    }
+    sr_build_if_templates(&sr);
+    sr_build_local_addrs(&sr);
+    if (sr_verify_routing_table(&sr) != 0) {
+      fprintf(stderr, "Routing table not consistent with hardware\n");
+      sr_destroy_instance(&sr);
+      return 1;
+    }
   } else {
-    Debug("Requesting topology %d\n", topo);
-  }
+    Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
+    if (template) {
+      Debug("Requesting topology template %s\n", template);
+    } else {
+      Debug("Requesting topology %d\n", topo);
+    }
 
-  /* connect to server and negotiate session */
-  if (sr_connect_to_server(&sr, port, server) == -1) {
-    return 1;
-  }
+    /* connect to server and negotiate session */
+    if (sr_connect_to_server(&sr, port, server) == -1) {
+      return 1;
+    }
 
-  if (template != NULL && strcmp(rtable, "rtable.vrhost") == 0) {
-    /* we've recv'd the rtable now, so read it in */
-    Debug("Connected to new instantiation of topology template %s\n", template);
-    sr_load_rt_wrap(&sr, "rtable.vrhost");
-  } else {
-    /* Read from specified routing table */
-    sr_load_rt_wrap(&sr, rtable);
+    if (template != NULL && strcmp(rtable, "rtable.vrhost") == 0) {
+      /* we've recv'd the rtable now, so read it in */
+      Debug("Connected to new instantiation of topology template %s\n", template);
+      sr_load_rt_wrap(&sr, "rtable.vrhost");
+    } else {
+      /* Read from specified routing table */
+      sr_load_rt_wrap(&sr, rtable);
+    }
   }
 
   /* call router init (for arp subsystem etc.) */
   sr_init(&sr);
 
+  /* -- shut down cleanly on ^C or kill -- */
+  sr_event_add_signal(&sr.loop, SIGINT, sr_stop_on_signal, &sr);
+  sr_event_add_signal(&sr.loop, SIGTERM, sr_stop_on_signal, &sr);
+
+  /* -- kill -USR2 saves what the flight recorder holds -- */
+  sr_event_add_signal(&sr.loop, SIGUSR2, sr_flight_on_signal, &sr);
+
+  /* -- srctl queries are answered by a control thread, off the data path -- */
+  if (strcmp(ctl_path, "-") != 0) {
+    sr_ctl_open(&sr, ctl_path);
+  }
+
+  /* -- from here on log records are written out by a background thread -- */
+  log_start();
+
   /* -- whizbang main loop ;-) */
-  while (sr_read_from_server(&sr) == 1)
-    ;
+  if ((sr.shm   ? sr_shm_start(&sr)
+       : sr.xdp ? sr_xdp_start(&sr)
+       : sr.afp ? sr_afpacket_start(&sr)
+                : sr_vns_start(&sr)) == 0 &&
+      (workers == 0 || sr_pipeline_start(&sr, workers) == 0)) {
+    sr_event_run(&sr.loop);
+  }
+  sr_pipeline_stop(&sr);
+  log_stop();
 
   sr_destroy_instance(&sr);
 
@@ -173,7 +312,19 @@ static void usage(char *argv0) {
   printf("Format: %s [-h] [-v host] [-s server] [-p port] \n", argv0);
   printf("           [-T template_name] [-u username] \n");
   printf("           [-t topo id] [-r routing table] \n");
-  printf("           [-l log file] \n");
+  printf("           [-l log file  pcap, or pcapng if it ends in .pcapng] \n");
+  printf("           [-R megabytes  start a new log file past this size] [-w worker threads] \n");
+  printf("           [-F \"filter\"  only log frames matching it, e.g. \"icmp or dst port 53\"] \n");
+  printf("           [-S n  log 1 in n frames] [-D in|out|both  directions to log, default both] \n");
+  printf("           [-L debug|info|warn|error|none  log level, default info] \n");
+  printf("           [-f file  where SIGUSR2 saves the flight recorder, default %s] \n", SR_FLIGHT_FILE);
+  printf("           [-c socket  control socket for srctl, default %s, - for none] \n", SR_CTL_SOCKET);
+  printf("           [-i iface,iface,...  attach to local interfaces] \n");
+  printf("           [-x iface,iface,...  attach to local interfaces over AF_XDP] \n");
+  printf("           [-U  talk to the server over io_uring] \n");
+  printf("           [-m socket  attach to a local relay over shared memory, see sr_relay] \n");
+  printf("           [-H  put the packet buffer pool on huge pages] \n");
+  printf("           [-C  self-check and benchmark the checksum kernels, then exit] \n");
   printf("   defaults server=%s port=%d host=%s  \n", DEFAULT_SERVER,
          DEFAULT_PORT, DEFAULT_HOST);
 } /* -- usage -- */
@@ -210,9 +361,19 @@ static void sr_destroy_instance(struct sr_instance *sr) {
   /* REQUIRES */
   assert(sr);
 
-  if (sr->logfile) {
-    sr_dump_close(sr->logfile);
-  }
+  sr_shm_close(sr);
+  sr_xdp_close(sr);
+  sr_afpacket_close(sr);
+  sr_uring_close(sr);
+  sr_capture_close(sr);
+  sr_ctl_close(sr);
+  sr_event_destroy(&(sr->loop));
+  free(sr->rx_buf);
+
+  sr_stats_dump(sr, stdout);
+  sr_prof_dump(stdout);
+  sr_pktpool_dump(&(sr->pool), stdout);
+  sr_pktpool_destroy(&(sr->pool));
 
   /*
   fprintf(stderr,"sr_destroy_instance leaking memory\n");
@@ -235,17 +396,68 @@ static void sr_init_instance(struct sr_instance *sr) {
   sr->host[0] = 0;
   sr->topo_id = 0;
   sr->if_list = 0;
+  sr->if_count = 0;
+  memset(sr->local_addrs, 0, sizeof(sr->local_addrs));
+  sr->local_addr_count = 0;
   sr->routing_table = 0;
-  sr->logfile = 0;
+  sr->capture = 0;
+  sr->flight_file = SR_FLIGHT_FILE;
+  sr->ctl = 0;
+  sr->vns_ev = 0;
+  sr->rx_buf = 0;
+  sr->rx_len = 0;
+  sr->rx_off = 0;
+  sr->pipeline = 0;
+  sr->afp = 0;
+  sr->xdp = 0;
+  sr->shm = 0;
+  sr->vns_uring = 0;
+  sr->uring = 0;
+  memset(&(sr->pool), 0, sizeof(sr->pool));
+
+  if (sr_event_init(&(sr->loop)) != 0) {
+    exit(1);
+  }
 } /* -- sr_init_instance -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_stop_on_signal(..)
+ * Scope: Local
+ *
+ * Signal callback, leave the main loop so the instance is torn down.
+ *
+ *----------------------------------------------------------------------------*/
+
+static void sr_stop_on_signal(int fd, uint32_t events, void *sr_ptr) {
+  struct sr_instance *sr = (struct sr_instance *)sr_ptr;
+
+  fprintf(stderr, "Caught signal, shutting down\n");
+  sr_event_stop(&(sr->loop));
+} /* -- sr_stop_on_signal -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flight_on_signal(..)
+ * Scope: Local
+ *
+ * Signal callback, save the flight recorder.  Only the copy is made here,
+ * the file is written by a thread of its own.
+ *
+ *----------------------------------------------------------------------------*/
+
+static void sr_flight_on_signal(int fd, uint32_t events, void *sr_ptr) {
+  struct sr_instance *sr = (struct sr_instance *)sr_ptr;
+
+  sr_flight_save(sr, sr->flight_file);
+} /* -- sr_flight_on_signal -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_verify_routing_table()
  * Scope: Global
  *
  * make sure the routing table is consistent with the interface list by
  * verifying that all interfaces used in the routing table actually exist
- * in the hardware.
+ * in the hardware.  Each entry also learns its interface's index, which is
+ * what the data path sends on.
  *
  * RETURN VALUES:
  *
@@ -279,8 +491,10 @@ int sr_verify_routing_table(struct sr_instance *sr) {
       if_walker = if_walker->next;
     }
     if (if_walker == 0) {
-      ret++;
-    } /* -- interface not found! -- */
+      ret++; /* -- interface not found! -- */
+    } else {
+      rt_walker->if_index = if_walker->index;
+    }
 
     rt_walker = rt_walker->next;
   } /* -- while -- */
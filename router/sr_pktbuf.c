@@ -0,0 +1,266 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pktbuf.c
+ *
+ * Description:
+ *
+ * Pool of reference counted packet buffers, see sr_pktbuf.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_pktbuf.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static void sr_pktpool_lock(struct sr_pktpool* pool) {
+  if (pool->shared) {
+    pthread_mutex_lock(&(pool->lock));
+  }
+} /* -- sr_pktpool_lock -- */
+
+static void sr_pktpool_unlock(struct sr_pktpool* pool) {
+  if (pool->shared) {
+    pthread_mutex_unlock(&(pool->lock));
+  }
+} /* -- sr_pktpool_unlock -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktpool_map(..)
+ * Scope: Local
+ *
+ * Map and fault in len bytes of anonymous memory, on huge pages if huge
+ * is set.  Returns 0 if the mapping failed.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint8_t* sr_pktpool_map(size_t len, int huge) {
+  void* mem;
+
+  mem = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | (huge ? MAP_HUGETLB : 0),
+             -1, 0);
+  return mem == MAP_FAILED ? 0 : (uint8_t*)mem;
+} /* -- sr_pktpool_map -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktpool_init(..)
+ * Scope: Global
+ *
+ * Map count buffers and put them all on the free list.  With huge set
+ * the buffers go on huge pages, falling back to normal pages if the
+ * system has none to spare.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pktpool_init(struct sr_pktpool* pool, unsigned int count, int huge) {
+  size_t len, page;
+  unsigned int i;
+
+  /* -- REQUIRES -- */
+  assert(pool);
+  assert(count > 0);
+
+  memset(pool, 0, sizeof(*pool));
+  len = (size_t)count * SR_PKTBUF_SIZE;
+
+  if (huge) {
+    pool->mem_len = (len + SR_PKTBUF_HUGE_PAGE - 1) & ~((size_t)SR_PKTBUF_HUGE_PAGE - 1);
+    if ((pool->mem = sr_pktpool_map(pool->mem_len, 1)) != 0) {
+      pool->huge = 1;
+    } else {
+      fprintf(stderr, "Huge pages unavailable (%s), using normal pages\n", strerror(errno));
+    }
+  }
+  if (pool->mem == 0) {
+    page = (size_t)sysconf(_SC_PAGESIZE);
+    pool->mem_len = (len + page - 1) & ~(page - 1);
+    if ((pool->mem = sr_pktpool_map(pool->mem_len, 0)) == 0) {
+      perror("mmap(..):sr_pktbuf.c::sr_pktpool_init(..)");
+      return -1;
+    }
+  }
+
+  if ((pool->bufs = (struct sr_pktbuf*)calloc(count, sizeof(struct sr_pktbuf))) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_pktpool_init)\n");
+    munmap(pool->mem, pool->mem_len);
+    pool->mem = 0;
+    return -1;
+  }
+
+  /* -- lowest slots on top so a quiet router keeps touching the same few -- */
+  for (i = count; i > 0; i--) {
+    pool->bufs[i - 1].head = pool->mem + (size_t)(i - 1) * SR_PKTBUF_SIZE;
+    pool->bufs[i - 1].next_free = pool->free_list;
+    pool->free_list = &(pool->bufs[i - 1]);
+  }
+
+  pthread_mutex_init(&(pool->lock), 0);
+  pool->stats.count = count;
+  return 0;
+} /* -- sr_pktpool_init -- */
+
+void sr_pktpool_destroy(struct sr_pktpool* pool) {
+  /* -- REQUIRES -- */
+  assert(pool);
+
+  if (pool->mem == 0) {
+    return;
+  }
+  munmap(pool->mem, pool->mem_len);
+  free(pool->bufs);
+  pthread_mutex_destroy(&(pool->lock));
+  pool->mem = 0;
+  pool->bufs = 0;
+  pool->free_list = 0;
+} /* -- sr_pktpool_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktpool_stats(..)
+ * Scope: Global
+ *
+ * Take a consistent snapshot of the pool's occupancy metrics.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pktpool_stats(struct sr_pktpool* pool, struct sr_pktpool_stats* stats) {
+  /* -- REQUIRES -- */
+  assert(pool);
+  assert(stats);
+
+  sr_pktpool_lock(pool);
+  *stats = pool->stats;
+  sr_pktpool_unlock(pool);
+} /* -- sr_pktpool_stats -- */
+
+void sr_pktpool_dump(struct sr_pktpool* pool, FILE* out) {
+  struct sr_pktpool_stats stats;
+
+  sr_pktpool_stats(pool, &stats);
+  fprintf(out, "Packet buffers: %u of %u in use, peak %u, %lu allocated, %lu refused%s\n", stats.in_use, stats.count,
+          stats.peak, stats.allocs, stats.failures, pool->huge ? " (huge pages)" : "");
+} /* -- sr_pktpool_dump -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktbuf_alloc(..)
+ * Scope: Global
+ *
+ * Take a buffer off the free list with one reference held by the caller
+ * and room for a frame of len bytes at data.  Returns 0 if the pool is
+ * empty or len does not fit behind the headroom.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_pktbuf* sr_pktbuf_alloc(struct sr_pktpool* pool, unsigned int len) {
+  struct sr_pktbuf* buf = 0;
+
+  /* -- REQUIRES -- */
+  assert(pool);
+
+  sr_pktpool_lock(pool);
+  if (len <= SR_PKTBUF_MAX_FRAME && (buf = pool->free_list) != 0) {
+    pool->free_list = buf->next_free;
+    pool->stats.allocs++;
+    if (++pool->stats.in_use > pool->stats.peak) {
+      pool->stats.peak = pool->stats.in_use;
+    }
+  } else {
+    pool->stats.failures++;
+  }
+  sr_pktpool_unlock(pool);
+
+  if (buf) {
+    buf->next_free = 0;
+    buf->data = buf->head + SR_PKTBUF_HEADROOM;
+    buf->len = len;
+    __atomic_store_n(&(buf->refcnt), 1, __ATOMIC_RELAXED);
+  }
+  return buf;
+} /* -- sr_pktbuf_alloc -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktbuf_of(..)
+ * Scope: Global
+ *
+ * The buffer whose slot ptr points into, or 0 if ptr is not pool memory
+ * (a transport's ring, the stack, ...).  Lets code that is only handed a
+ * frame pointer take a reference instead of a copy.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_pktbuf* sr_pktbuf_of(struct sr_pktpool* pool, const uint8_t* ptr) {
+  /* -- REQUIRES -- */
+  assert(pool);
+
+  if (pool->mem == 0 || ptr < pool->mem || ptr >= pool->mem + (size_t)pool->stats.count * SR_PKTBUF_SIZE) {
+    return 0;
+  }
+  return &(pool->bufs[(ptr - pool->mem) / SR_PKTBUF_SIZE]);
+} /* -- sr_pktbuf_of -- */
+
+void sr_pktbuf_get(struct sr_pktbuf* buf) {
+  /* -- REQUIRES -- */
+  assert(buf);
+  assert(buf->refcnt > 0);
+
+  __atomic_add_fetch(&(buf->refcnt), 1, __ATOMIC_RELAXED);
+} /* -- sr_pktbuf_get -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktbuf_put(..)
+ * Scope: Global
+ *
+ * Drop a reference, returning the buffer to the pool with the last one.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pktbuf_put(struct sr_pktpool* pool, struct sr_pktbuf* buf) {
+  /* -- REQUIRES -- */
+  assert(pool);
+
+  if (buf == 0 || __atomic_sub_fetch(&(buf->refcnt), 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+
+  sr_pktpool_lock(pool);
+  buf->next_free = pool->free_list;
+  pool->free_list = buf;
+  pool->stats.in_use--;
+  sr_pktpool_unlock(pool);
+} /* -- sr_pktbuf_put -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktbuf_push(..)
+ * Scope: Global
+ *
+ * Grow the frame by n bytes at the front, into the headroom.  Returns the
+ * new start of the frame, or 0 if the headroom is too small.
+ *
+ *---------------------------------------------------------------------*/
+
+uint8_t* sr_pktbuf_push(struct sr_pktbuf* buf, unsigned int n) {
+  /* -- REQUIRES -- */
+  assert(buf);
+
+  if (sr_pktbuf_headroom(buf) < n) {
+    return 0;
+  }
+  buf->data -= n;
+  buf->len += n;
+  return buf->data;
+} /* -- sr_pktbuf_push -- */
+
+unsigned int sr_pktbuf_headroom(const struct sr_pktbuf* buf) {
+  return buf->data - buf->head;
+} /* -- sr_pktbuf_headroom -- */
+
+unsigned int sr_pktbuf_tailroom(const struct sr_pktbuf* buf) {
+  return SR_PKTBUF_SIZE - sr_pktbuf_headroom(buf) - buf->len;
+} /* -- sr_pktbuf_tailroom -- */
@@ -0,0 +1,91 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pktbuf.h
+ *
+ * Description:
+ *
+ * Fixed pool of reference counted packet buffers, mapped once at startup
+ * (on huge pages if asked to) instead of malloc'ing a buffer per frame.
+ * Each buffer is a SR_PKTBUF_SIZE slot holding a frame at data, with
+ * SR_PKTBUF_HEADROOM bytes in front of it to prepend headers into and the
+ * rest of the slot behind it as tailroom.  A buffer stays allocated until
+ * every holder has dropped its reference, so a frame built or parked on
+ * an ARP request in one can sit in the transmit batch without a copy.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PKTBUF_H
+#define SR_PKTBUF_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define SR_PKTBUF_COUNT 4096   /* buffers in the pool */
+#define SR_PKTBUF_SIZE 2048    /* bytes per buffer, headroom included */
+#define SR_PKTBUF_HEADROOM 128 /* room in front of a fresh buffer's frame */
+#define SR_PKTBUF_MAX_FRAME (SR_PKTBUF_SIZE - SR_PKTBUF_HEADROOM)
+#define SR_PKTBUF_HUGE_PAGE (2 * 1024 * 1024)
+
+/* ----------------------------------------------------------------------------
+ * struct sr_pktbuf
+ *
+ * Per buffer metadata, kept apart from the buffer memory itself.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_pktbuf {
+  uint8_t* head;    /* start of the slot */
+  uint8_t* data;    /* start of the frame */
+  unsigned int len; /* length of the frame */
+  uint32_t refcnt;  /* 0 while on the free list */
+  struct sr_pktbuf* next_free;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_pktpool_stats
+ *
+ * Occupancy of a pool, see sr_pktpool_stats(..)
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_pktpool_stats {
+  unsigned int count;     /* buffers in the pool */
+  unsigned int in_use;    /* buffers allocated right now */
+  unsigned int peak;      /* most buffers ever allocated at once */
+  unsigned long allocs;   /* successful allocations */
+  unsigned long failures; /* allocations refused, pool empty or frame too big */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_pktpool
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_pktpool {
+  uint8_t* mem;           /* count slots of SR_PKTBUF_SIZE bytes */
+  size_t mem_len;         /* mapped length, rounded up to the page size */
+  int huge;               /* mem sits on huge pages */
+  struct sr_pktbuf* bufs; /* metadata, bufs[i] describes slot i */
+  struct sr_pktbuf* free_list;
+  int shared; /* set if more than one thread uses the pool; 0 skips lock */
+  pthread_mutex_t lock;
+  struct sr_pktpool_stats stats;
+};
+
+int sr_pktpool_init(struct sr_pktpool* pool, unsigned int count, int huge);
+void sr_pktpool_destroy(struct sr_pktpool* pool);
+void sr_pktpool_stats(struct sr_pktpool* pool, struct sr_pktpool_stats* stats);
+void sr_pktpool_dump(struct sr_pktpool* pool, FILE* out);
+
+struct sr_pktbuf* sr_pktbuf_alloc(struct sr_pktpool* pool, unsigned int len);
+struct sr_pktbuf* sr_pktbuf_of(struct sr_pktpool* pool, const uint8_t* ptr);
+void sr_pktbuf_get(struct sr_pktbuf* buf);
+void sr_pktbuf_put(struct sr_pktpool* pool, struct sr_pktbuf* buf);
+uint8_t* sr_pktbuf_push(struct sr_pktbuf* buf, unsigned int n);
+unsigned int sr_pktbuf_headroom(const struct sr_pktbuf* buf);
+unsigned int sr_pktbuf_tailroom(const struct sr_pktbuf* buf);
+
+#endif /* -- SR_PKTBUF_H -- */
@@ -0,0 +1,122 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pktmeta.c
+ *
+ * Description:
+ *
+ * Decode a received frame into its metadata, see sr_pktmeta.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_pktmeta.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <string.h>
+
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_router.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_pkt_parse(..)
+ * Scope: Global
+ *
+ * Fill in meta for a frame of len bytes received on interface ifidx.  Only header
+ * lengths are checked here; the IP checksum is left to the router, which
+ * records the outcome in meta->flags.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pkt_parse(struct sr_instance* sr, struct sr_pkt_meta* meta, uint8_t* frame, unsigned int len,
+                  unsigned int ifidx) {
+  sr_ethernet_hdr_t* eth_hdr;
+  sr_arp_hdr_t* arp_hdr;
+  sr_ip_hdr_t* ip_hdr;
+  unsigned int hl, ip_len;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(meta);
+  assert(frame);
+
+  memset(meta, 0, sizeof(*meta));
+  meta->frame = frame;
+  meta->len = len;
+  meta->in_idx = ifidx;
+  meta->in_if = sr_get_interface_idx(sr, ifidx);
+  meta->out_idx = SR_IF_NONE;
+
+  if (len < sizeof(sr_ethernet_hdr_t)) {
+    return;
+  }
+  eth_hdr = (sr_ethernet_hdr_t*)frame;
+  meta->ethertype = ntohs(eth_hdr->ether_type);
+  meta->flags = SR_META_ETH;
+  meta->l3_off = sizeof(sr_ethernet_hdr_t);
+
+  if (meta->ethertype == ethertype_arp) {
+    if (len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)) {
+      arp_hdr = (sr_arp_hdr_t*)(frame + meta->l3_off);
+      meta->arp_op = ntohs(arp_hdr->ar_op);
+      meta->ip_src = arp_hdr->ar_sip;
+      meta->ip_dst = arp_hdr->ar_tip;
+      meta->flags |= SR_META_ARP;
+    }
+    return;
+  }
+
+  if (meta->ethertype != ethertype_ip || len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)) {
+    return;
+  }
+  ip_hdr = (sr_ip_hdr_t*)(frame + meta->l3_off);
+  hl = ip_hdr->ip_hl * 4;
+  meta->ip_p = ip_hdr->ip_p;
+  meta->ttl = ip_hdr->ip_ttl;
+  meta->ip_src = ip_hdr->ip_src;
+  meta->ip_dst = ip_hdr->ip_dst;
+  if (hl < sizeof(sr_ip_hdr_t) || meta->l3_off + hl > len) {
+    return;
+  }
+  meta->flags |= SR_META_IP;
+
+  /* -- the L4 part ends with the IP datagram or the frame, whichever is first -- */
+  meta->l4_off = meta->l3_off + hl;
+  ip_len = ntohs(ip_hdr->ip_len);
+  meta->l4_len = len - meta->l4_off;
+  if (ip_len >= hl && ip_len - hl < meta->l4_len) {
+    meta->l4_len = ip_len - hl;
+  }
+
+  if (meta->l4_len >= 8) {
+    meta->flags |= SR_META_L4;
+    if (meta->ip_p == ip_protocol_icmp) {
+      meta->icmp_type = frame[meta->l4_off];
+      meta->icmp_code = frame[meta->l4_off + 1];
+    }
+  }
+} /* -- sr_pkt_parse -- */
+
+const char* sr_disp_name(unsigned int disp) {
+  /* -- in enum sr_disp order -- */
+  static const char* names[SR_DISP_MAX] = {"none",
+                                           "forward",
+                                           "arp-queued",
+                                           "echo-reply",
+                                           "arp-reply",
+                                           "arp-learned",
+                                           "ttl-exceeded",
+                                           "no-route",
+                                           "port-unreach",
+                                           "bad-len",
+                                           "bad-cksum",
+                                           "not-echo",
+                                           "proto-ignored",
+                                           "arp-ignored",
+                                           "ethertype-ignored",
+                                           "no-iface",
+                                           "no-buffer",
+                                           "tx-fail",
+                                           "arp-overflow"};
+
+  return disp < SR_DISP_MAX ? names[disp] : "?";
+} /* -- sr_disp_name -- */
@@ -0,0 +1,92 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pktmeta.h
+ *
+ * Description:
+ *
+ * Per packet metadata, decoded once when a frame is received and passed
+ * down to every handler instead of the bare buffer.  Records where each
+ * header starts, the ingress interface, the L3/L4 fields the router acts
+ * on and how far the frame has been validated, so later stages read the
+ * cached fields rather than casting and decoding the frame again.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PKTMETA_H
+#define SR_PKTMETA_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+struct sr_instance;
+struct sr_if;
+struct sr_flight_entry;
+
+/* -- validation state, see struct sr_pkt_meta -- */
+#define SR_META_ETH 0x01      /* a whole Ethernet header */
+#define SR_META_ARP 0x02      /* a whole ARP header follows it */
+#define SR_META_IP 0x04       /* a whole IPv4 header, options included */
+#define SR_META_IP_CKSUM 0x08 /* and its checksum was verified */
+#define SR_META_L4 0x10       /* room for the first 8 bytes of the L4 header */
+
+/* -- what became of a packet, set by the router as it decides -- */
+enum sr_disp {
+  SR_DISP_NONE = 0,          /* not decided (yet) */
+  SR_DISP_FORWARD,           /* sent on towards its next hop */
+  SR_DISP_ARP_QUEUED,        /* waiting for the next hop's ARP reply */
+  SR_DISP_ECHO_REPLY,        /* echo request to us, answered */
+  SR_DISP_ARP_REPLY,         /* ARP request for us, answered */
+  SR_DISP_ARP_LEARNED,       /* ARP reply, cached and its queue sent */
+  SR_DISP_TTL_EXCEEDED,      /* dropped, ICMP 11/0 sent */
+  SR_DISP_NO_ROUTE,          /* dropped, ICMP 3/0 sent */
+  SR_DISP_PORT_UNREACH,      /* TCP or UDP to us, ICMP 3/3 sent */
+  SR_DISP_BAD_LEN,           /* dropped, truncated header */
+  SR_DISP_BAD_CKSUM,         /* dropped, IP or ICMP checksum wrong */
+  SR_DISP_NOT_ECHO,          /* ICMP to us other than an echo request */
+  SR_DISP_PROTO_IGNORED,     /* to us, neither ICMP, TCP nor UDP */
+  SR_DISP_ARP_IGNORED,       /* ARP request not for us, or unknown op */
+  SR_DISP_ETHERTYPE_IGNORED, /* neither IP nor ARP */
+  SR_DISP_NO_IFACE,          /* the route's interface is gone */
+  SR_DISP_NO_BUFFER,         /* no packet buffer for the answer or the ARP queue */
+  SR_DISP_TX_FAIL,           /* the send itself failed */
+  SR_DISP_ARP_OVERFLOW,      /* was queued on ARP, dropped later to make room */
+  SR_DISP_MAX
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_pkt_meta
+ *
+ * Offsets are from frame and 0 when the header is absent.  Addresses are
+ * in network byte order, everything else in host byte order.  ttl tracks
+ * the header as the router rewrites it.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_pkt_meta {
+  uint8_t* frame;
+  unsigned int len;
+  unsigned int in_idx; /* ingress interface's index */
+  struct sr_if* in_if; /* and its entry, 0 if unknown */
+  uint16_t ethertype;
+  uint16_t l3_off;
+  uint16_t l4_off;
+  uint16_t l4_len; /* L4 header and payload, as far as the frame holds them */
+  uint16_t arp_op;
+  uint8_t ip_p;
+  uint8_t ttl;
+  uint32_t ip_src;
+  uint32_t ip_dst;
+  uint8_t icmp_type;
+  uint8_t icmp_code;
+  uint8_t flags; /* SR_META_* */
+  uint8_t disp;  /* enum sr_disp */
+  unsigned int out_idx; /* interface the packet or its answer left on, SR_IF_NONE if none */
+  struct sr_flight_entry* fl; /* its flight recorder entry */
+  uint64_t rx_ns;             /* sr_clock_ns() when it was read from its transport */
+};
+
+void sr_pkt_parse(struct sr_instance* sr, struct sr_pkt_meta* meta, uint8_t* frame, unsigned int len,
+                  unsigned int ifidx);
+const char* sr_disp_name(unsigned int disp);
+
+#endif /* -- SR_PKTMETA_H -- */
@@ -0,0 +1,256 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_prof.c
+ *
+ * Description:
+ *
+ * Per stage cycle accounting, see sr_prof.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_prof.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(SR_PROFILE) && !defined(SR_PROFILE_CLOCK) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define SR_PROF_TSC
+#endif
+
+#include "log.h"
+#include "sr_utils.h"
+
+const char* sr_prof_stage_name(unsigned int stage) {
+  static const char* names[SR_PROF_MAX] = {"parse", "cksum", "local", "lpm",  "neigh",
+                                           "arp",   "rewrite", "log", "send", "record"};
+
+  return stage < SR_PROF_MAX ? names[stage] : "?";
+} /* -- sr_prof_stage_name -- */
+
+#ifdef SR_PROFILE
+
+/* ----------------------------------------------------------------------------
+ * struct sr_prof_totals
+ *
+ * One thread's totals, written only by it, read by sr_prof_dump.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_prof_totals {
+  uint64_t ticks[SR_PROF_MAX];
+  uint64_t packets[SR_PROF_MAX];
+  uint64_t spans;
+} __attribute__((aligned(64)));
+
+/* ----------------------------------------------------------------------------
+ * struct sr_prof_state
+ *
+ * Where a thread is, private to it.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_prof_state {
+  struct sr_prof_totals* totals; /* 0 once no block was left */
+  int attached;
+  int active;       /* inside a BEGIN .. END span */
+  unsigned int cur; /* stage being timed */
+  uint64_t last;    /* ticks when cur was entered */
+  unsigned int depth;
+  unsigned int stack[SR_PROF_DEPTH]; /* stages to SR_PROF_RETURN to */
+};
+
+static struct sr_prof_totals* sr_prof_blocks[SR_PROF_THREADS];
+static unsigned int sr_prof_nblocks;
+
+/* -- when the first thread attached, to convert ticks to nanoseconds -- */
+static uint64_t sr_prof_t0_ticks;
+static uint64_t sr_prof_t0_ns;
+
+static __thread struct sr_prof_state sr_prof_self;
+
+static uint64_t sr_prof_ticks(void) {
+#ifdef SR_PROF_TSC
+  return __rdtsc();
+#else
+  return sr_clock_ns();
+#endif
+} /* -- sr_prof_ticks -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_prof_attach(..)
+ * Scope: Local
+ *
+ * Give the calling thread its totals, once.  Threads past
+ * SR_PROF_THREADS run unprofiled.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_prof_attach(struct sr_prof_state* ps) {
+  struct sr_prof_totals* t;
+  unsigned int i;
+
+  ps->attached = 1;
+  if ((i = __atomic_fetch_add(&sr_prof_nblocks, 1, __ATOMIC_RELAXED)) >= SR_PROF_THREADS ||
+      posix_memalign((void**)&t, 64, sizeof(struct sr_prof_totals)) != 0) {
+    LOG_WARN("No profile block left for this thread, not profiling it");
+    return;
+  }
+  memset(t, 0, sizeof(struct sr_prof_totals));
+  if (i == 0) {
+    sr_prof_t0_ns = sr_clock_ns();
+    __atomic_store_n(&sr_prof_t0_ticks, sr_prof_ticks(), __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&(sr_prof_blocks[i]), t, __ATOMIC_RELEASE);
+  ps->totals = t;
+} /* -- sr_prof_attach -- */
+
+/* -- charge the ticks since the last switch to the current stage, then move to stage -- */
+static void sr_prof_switch(struct sr_prof_state* ps, unsigned int stage, unsigned int n) {
+  struct sr_prof_totals* t = ps->totals;
+  uint64_t now = sr_prof_ticks();
+
+  __atomic_store_n(&(t->ticks[ps->cur]), t->ticks[ps->cur] + (now - ps->last), __ATOMIC_RELAXED);
+  if (n) {
+    __atomic_store_n(&(t->packets[stage]), t->packets[stage] + n, __ATOMIC_RELAXED);
+  }
+  ps->cur = stage;
+  ps->last = now;
+} /* -- sr_prof_switch -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_prof_begin(..)
+ * Scope: Global
+ *
+ * Start timing in stage, which n packets enter.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_prof_begin(unsigned int stage, unsigned int n) {
+  struct sr_prof_state* ps = &sr_prof_self;
+
+  /* -- REQUIRES -- */
+  assert(stage < SR_PROF_MAX);
+
+  if (!ps->attached) {
+    sr_prof_attach(ps);
+  }
+  if (ps->totals == 0) {
+    return;
+  }
+  ps->active = 1;
+  ps->depth = 0;
+  ps->cur = stage;
+  __atomic_store_n(&(ps->totals->packets[stage]), ps->totals->packets[stage] + n, __ATOMIC_RELAXED);
+  __atomic_store_n(&(ps->totals->spans), ps->totals->spans + 1, __ATOMIC_RELAXED);
+  ps->last = sr_prof_ticks();
+} /* -- sr_prof_begin -- */
+
+void sr_prof_stage(unsigned int stage, unsigned int n) {
+  struct sr_prof_state* ps = &sr_prof_self;
+
+  if (ps->active) {
+    sr_prof_switch(ps, stage, n);
+  }
+} /* -- sr_prof_stage -- */
+
+void sr_prof_call(unsigned int stage, unsigned int n) {
+  struct sr_prof_state* ps = &sr_prof_self;
+
+  if (ps->active) {
+    assert(ps->depth < SR_PROF_DEPTH);
+    ps->stack[ps->depth++] = ps->cur;
+    sr_prof_switch(ps, stage, n);
+  }
+} /* -- sr_prof_call -- */
+
+void sr_prof_return(void) {
+  struct sr_prof_state* ps = &sr_prof_self;
+
+  if (ps->active) {
+    assert(ps->depth > 0);
+    sr_prof_switch(ps, ps->stack[--ps->depth], 0);
+  }
+} /* -- sr_prof_return -- */
+
+void sr_prof_end(void) {
+  struct sr_prof_state* ps = &sr_prof_self;
+
+  if (ps->active) {
+    sr_prof_switch(ps, ps->cur, 0);
+    ps->active = 0;
+  }
+} /* -- sr_prof_end -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_prof_dump(..)
+ * Scope: Global
+ *
+ * Sum every thread's totals and print them, one stage a row, with the
+ * ticks per packet that entered the stage and the stage's share of all
+ * ticks.  Safe from any thread while the others keep counting.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 if the router was built without PROFILE
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_prof_dump(FILE* out) {
+  struct sr_prof_totals sum;
+  struct sr_prof_totals* t;
+  uint64_t total = 0, t0_ticks, now_ticks;
+  double ns_per_tick = 1.0;
+  unsigned int i, s, n;
+
+  /* -- REQUIRES -- */
+  assert(out);
+
+  memset(&sum, 0, sizeof(sum));
+  n = __atomic_load_n(&sr_prof_nblocks, __ATOMIC_RELAXED);
+  for (i = 0; i < n && i < SR_PROF_THREADS; i++) {
+    if ((t = __atomic_load_n(&(sr_prof_blocks[i]), __ATOMIC_ACQUIRE)) == 0) {
+      continue;
+    }
+    for (s = 0; s < SR_PROF_MAX; s++) {
+      sum.ticks[s] += __atomic_load_n(&(t->ticks[s]), __ATOMIC_RELAXED);
+      sum.packets[s] += __atomic_load_n(&(t->packets[s]), __ATOMIC_RELAXED);
+    }
+    sum.spans += __atomic_load_n(&(t->spans), __ATOMIC_RELAXED);
+  }
+  for (s = 0; s < SR_PROF_MAX; s++) {
+    total += sum.ticks[s];
+  }
+
+#ifdef SR_PROF_TSC
+  /* -- the TSC ticks at a constant rate, measure it against the clock since attach -- */
+  t0_ticks = __atomic_load_n(&sr_prof_t0_ticks, __ATOMIC_ACQUIRE);
+  now_ticks = sr_prof_ticks();
+  if (t0_ticks != 0 && now_ticks > t0_ticks) {
+    ns_per_tick = (double)(sr_clock_ns() - sr_prof_t0_ns) / (now_ticks - t0_ticks);
+  }
+  fprintf(out, "profile: %lu spans, rdtsc at %.3f GHz\n", (unsigned long)sum.spans, 1.0 / ns_per_tick);
+#else
+  (void)t0_ticks;
+  (void)now_ticks;
+  fprintf(out, "profile: %lu spans, clock_gettime ticks (ns)\n", (unsigned long)sum.spans);
+#endif
+  fprintf(out, "%-8s %12s %16s %10s %10s %7s\n", "stage", "packets", "ticks", "ticks/pkt", "ns/pkt", "share");
+  for (s = 0; s < SR_PROF_MAX; s++) {
+    fprintf(out, "%-8s %12lu %16lu %10.1f %10.1f %6.1f%%\n", sr_prof_stage_name(s), (unsigned long)sum.packets[s],
+            (unsigned long)sum.ticks[s], sum.packets[s] ? (double)sum.ticks[s] / sum.packets[s] : 0.0,
+            sum.packets[s] ? sum.ticks[s] * ns_per_tick / sum.packets[s] : 0.0,
+            total ? 100.0 * sum.ticks[s] / total : 0.0);
+  }
+  fprintf(out, "%-8s %12s %16lu\n", "total", "", (unsigned long)total);
+  return 0;
+} /* -- sr_prof_dump -- */
+
+#else /* -- !SR_PROFILE -- */
+
+int sr_prof_dump(FILE* out) {
+  return -1;
+} /* -- sr_prof_dump -- */
+
+#endif /* -- SR_PROFILE -- */
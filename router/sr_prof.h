@@ -0,0 +1,77 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_prof.h
+ *
+ * Description:
+ *
+ * Per stage cycle accounting for the data path, compiled in only with
+ * make PROFILE=1 (-DSR_PROFILE); otherwise the SR_PROF_* macros are empty
+ * and cost nothing.
+ *
+ * While a thread handles packets it is always in exactly one stage.  Each
+ * SR_PROF_STAGE(..) reads the time stamp counter (rdtsc, or clock_gettime
+ * in nanoseconds where there is none or with PROFILE=clock), charges the
+ * ticks since the previous read to the stage being left and counts n
+ * packets into the one entered.  SR_PROF_CALL/SR_PROF_RETURN bracket
+ * shared callees such as sr_send_packet_idx, so they are charged to their
+ * own stage whichever stage called them.  Time outside a BEGIN .. END
+ * span, the event loop and the ARP timer for example, is not counted.
+ *
+ * sr_prof_dump(..) sums every thread's totals into a table.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PROF_H
+#define SR_PROF_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include <stdio.h>
+
+#define SR_PROF_THREADS 32 /* threads with totals of their own, later ones are not counted */
+#define SR_PROF_DEPTH 4    /* SR_PROF_CALL nesting */
+
+/* -- stages, see sr_prof_stage_name(..) -- */
+enum sr_prof_stage {
+  SR_PROF_PARSE = 0, /* sr_pkt_parse, prefetch and classification */
+  SR_PROF_CKSUM,     /* IP header validation */
+  SR_PROF_LOCAL,     /* local address check, answering packets to us */
+  SR_PROF_LPM,       /* TTL and longest prefix match */
+  SR_PROF_NEIGH,     /* ARP cache lookup, queueing on a miss */
+  SR_PROF_ARP,       /* received ARP requests and replies */
+  SR_PROF_REWRITE,   /* Ethernet rewrite of forwarded packets */
+  SR_PROF_LOG,       /* -l capture and packet logging */
+  SR_PROF_SEND,      /* handing a frame to the transport */
+  SR_PROF_RECORD,    /* flight recorder and counters */
+  SR_PROF_MAX
+};
+
+#ifdef SR_PROFILE
+
+#define SR_PROF_BEGIN(s, n) sr_prof_begin((s), (n))
+#define SR_PROF_STAGE(s, n) sr_prof_stage((s), (n))
+#define SR_PROF_CALL(s, n) sr_prof_call((s), (n))
+#define SR_PROF_RETURN() sr_prof_return()
+#define SR_PROF_END() sr_prof_end()
+
+void sr_prof_begin(unsigned int stage, unsigned int n);
+void sr_prof_stage(unsigned int stage, unsigned int n);
+void sr_prof_call(unsigned int stage, unsigned int n);
+void sr_prof_return(void);
+void sr_prof_end(void);
+
+#else /* -- !SR_PROFILE -- */
+
+#define SR_PROF_BEGIN(s, n) ((void)0)
+#define SR_PROF_STAGE(s, n) ((void)0)
+#define SR_PROF_CALL(s, n) ((void)0)
+#define SR_PROF_RETURN() ((void)0)
+#define SR_PROF_END() ((void)0)
+
+#endif /* -- SR_PROFILE -- */
+
+const char* sr_prof_stage_name(unsigned int stage);
+int sr_prof_dump(FILE* out);
+
+#endif /* -- SR_PROF_H -- */
@@ -0,0 +1,401 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_relay.c
+ *
+ * Description:
+ *
+ * Stand-in relay for the shared-memory transport (see sr_shm.h), so the
+ * router's forwarding rate can be measured without POX or mininet:
+ *
+ *   ./sr_relay -n 1000000 &
+ *   ./sr -m /tmp/sr_relay.sock
+ *
+ * The relay announces the interfaces of the lab topology (IP_CONFIG),
+ * plays every host behind them by answering sr's ARP requests, and
+ * streams UDP frames from the client into the ingress interface, keeping
+ * at most a window of them unanswered.  Once every frame has come back
+ * out of sr towards the destination, it prints the rate and exits, which
+ * makes sr exit too.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include "sr_protocol.h"
+#include "sr_shm_ring.h"
+#include "sr_utils.h"
+
+#define DEFAULT_PACKETS 1000000
+#define DEFAULT_LENGTH 64 /* frame bytes, ethernet header included */
+#define DEFAULT_WINDOW 512
+#define DEFAULT_FLOWS 64
+#define DEFAULT_INGRESS "eth3"
+#define DEFAULT_SRC "10.0.1.100"
+#define DEFAULT_DST "192.168.2.2"
+
+#define SR_RELAY_IDLE_MS 100   /* longest sleep waiting for sr */
+#define SR_RELAY_STALL_MS 5000 /* give up after this long without progress */
+#define SR_RELAY_UDP_LEN 8
+
+/* ----------------------------------------------------------------------------
+ * struct sr_relay_iface
+ *
+ * A router interface and the host on its far end
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_relay_iface {
+  const char* name;
+  const char* ip;
+  uint8_t addr[ETHER_ADDR_LEN];      /* router side */
+  uint8_t host_addr[ETHER_ADDR_LEN]; /* every host behind it */
+};
+
+static struct sr_relay_iface sr_relay_ifaces[] = {
+    {"eth1", "192.168.2.1", {0x0a, 0, 0, 0, 0, 0x01}, {0x02, 0, 0, 0, 0, 0x01}},
+    {"eth2", "172.64.3.1", {0x0a, 0, 0, 0, 0, 0x02}, {0x02, 0, 0, 0, 0, 0x02}},
+    {"eth3", "10.0.1.1", {0x0a, 0, 0, 0, 0, 0x03}, {0x02, 0, 0, 0, 0, 0x03}},
+};
+
+#define SR_RELAY_NIFACES (sizeof(sr_relay_ifaces) / sizeof(sr_relay_ifaces[0]))
+
+/* ----------------------------------------------------------------------------
+ * struct sr_relay
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_relay {
+  struct sr_shm_region* region;
+  struct sr_shm_end tx; /* to_sr */
+  struct sr_shm_end rx; /* from_sr */
+  int sock;             /* connection to sr */
+  int efd;              /* sr wakes us through it */
+  uint32_t dst;         /* where the stream goes, network byte order */
+  unsigned long sent;
+  unsigned long forwarded;
+  unsigned long arp_replies;
+  unsigned long other;
+};
+
+static void usage(char* argv0) {
+  printf("Stand-in relay for sr -m\n");
+  printf("Format: %s [-h] [-s socket] [-n packets] [-l frame length] \n", argv0);
+  printf("           [-W window] [-F flows] [-f ingress iface] [-d dst ip] \n");
+  printf("   defaults socket=%s packets=%d length=%d window=%d flows=%d \n", SR_SHM_DEFAULT_PATH, DEFAULT_PACKETS,
+         DEFAULT_LENGTH, DEFAULT_WINDOW, DEFAULT_FLOWS);
+  printf("            ingress=%s src=%s dst=%s \n", DEFAULT_INGRESS, DEFAULT_SRC, DEFAULT_DST);
+} /* -- usage -- */
+
+static double sr_relay_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+} /* -- sr_relay_now -- */
+
+static struct sr_relay_iface* sr_relay_iface(const char* name) {
+  unsigned int i;
+
+  for (i = 0; i < SR_RELAY_NIFACES; i++) {
+    if (strncmp(sr_relay_ifaces[i].name, name, SR_SHM_IFACE_NAMELEN) == 0) {
+      return &(sr_relay_ifaces[i]);
+    }
+  }
+  return 0;
+} /* -- sr_relay_iface -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_relay_accept(..)
+ * Scope: Local
+ *
+ * Create the shared region, wait for sr on the Unix socket path and hand
+ * it the memfd and both eventfds.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_relay_accept(struct sr_relay* relay, const char* path) {
+  struct sockaddr_un addr;
+  int fds[3], lsock;
+  unsigned int i;
+
+  if ((relay->region = sr_shm_create(&(fds[0]))) == 0) {
+    return -1;
+  }
+  relay->region->niface = SR_RELAY_NIFACES;
+  for (i = 0; i < SR_RELAY_NIFACES; i++) {
+    strncpy(relay->region->ifaces[i].name, sr_relay_ifaces[i].name, SR_SHM_IFACE_NAMELEN);
+    memcpy(relay->region->ifaces[i].addr, sr_relay_ifaces[i].addr, ETHER_ADDR_LEN);
+    relay->region->ifaces[i].ip = inet_addr(sr_relay_ifaces[i].ip);
+  }
+
+  if ((fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+      (fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+    perror("eventfd(..):sr_relay.c::sr_relay_accept(..)");
+    return -1;
+  }
+  relay->efd = fds[2];
+  sr_shm_end_init(&(relay->tx), relay->region, 1, fds[1]);
+  sr_shm_end_init(&(relay->rx), relay->region, 0, fds[2]);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  unlink(path);
+
+  if ((lsock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+    perror("socket(..):sr_relay.c::sr_relay_accept(..)");
+    return -1;
+  }
+  if (bind(lsock, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(lsock, 1) == -1) {
+    perror("bind(..):sr_relay.c::sr_relay_accept(..)");
+    close(lsock);
+    return -1;
+  }
+
+  printf("Waiting for sr on %s\n", path);
+  relay->sock = accept(lsock, 0, 0);
+  close(lsock);
+  unlink(path);
+  if (relay->sock == -1) {
+    perror("accept(..):sr_relay.c::sr_relay_accept(..)");
+    return -1;
+  }
+
+  return sr_shm_send_fds(relay->sock, fds, 3);
+} /* -- sr_relay_accept -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_relay_build(..)
+ * Scope: Local
+ *
+ * Build the UDP frame streamed into ingress; only its source port
+ * changes from one frame to the next.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_relay_build(uint8_t* frame, unsigned int len, struct sr_relay_iface* ingress, uint32_t src,
+                           uint32_t dst) {
+  struct sr_ethernet_hdr* eth = (struct sr_ethernet_hdr*)frame;
+  struct sr_ip_hdr* ip = (struct sr_ip_hdr*)(frame + sizeof(struct sr_ethernet_hdr));
+  uint16_t* udp = (uint16_t*)((uint8_t*)ip + sizeof(struct sr_ip_hdr));
+
+  memset(frame, 0, len);
+  memcpy(eth->ether_dhost, ingress->addr, ETHER_ADDR_LEN);
+  memcpy(eth->ether_shost, ingress->host_addr, ETHER_ADDR_LEN);
+  eth->ether_type = htons(ethertype_ip);
+
+  ip->ip_v = 4;
+  ip->ip_hl = sizeof(struct sr_ip_hdr) / 4;
+  ip->ip_len = htons(len - sizeof(struct sr_ethernet_hdr));
+  ip->ip_ttl = 64;
+  ip->ip_p = ip_protocol_udp;
+  ip->ip_src = src;
+  ip->ip_dst = dst;
+  ip->ip_sum = cksum(ip, sizeof(struct sr_ip_hdr));
+
+  /* -- discard port, no UDP checksum -- */
+  udp[1] = htons(9);
+  udp[2] = htons(len - sizeof(struct sr_ethernet_hdr) - sizeof(struct sr_ip_hdr));
+} /* -- sr_relay_build -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_relay_input(..)
+ * Scope: Local
+ *
+ * A frame sr sent out of iface: answer ARP requests on behalf of the
+ * hosts there and count the stream coming out.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_relay_input(struct sr_relay* relay, uint8_t* frame, unsigned int len, const char* name) {
+  uint8_t reply[sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr)];
+  struct sr_ethernet_hdr* eth = (struct sr_ethernet_hdr*)frame;
+  struct sr_ethernet_hdr* reth = (struct sr_ethernet_hdr*)reply;
+  struct sr_arp_hdr* arp = (struct sr_arp_hdr*)(frame + sizeof(struct sr_ethernet_hdr));
+  struct sr_arp_hdr* rarp = (struct sr_arp_hdr*)(reply + sizeof(struct sr_ethernet_hdr));
+  struct sr_ip_hdr* ip = (struct sr_ip_hdr*)(frame + sizeof(struct sr_ethernet_hdr));
+  struct sr_relay_iface* iface = sr_relay_iface(name);
+
+  if (len >= sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr) && eth->ether_type == htons(ethertype_ip) &&
+      ip->ip_dst == relay->dst) {
+    relay->forwarded++;
+    return;
+  }
+
+  if (iface && len >= sizeof(reply) && eth->ether_type == htons(ethertype_arp) && arp->ar_op == htons(arp_op_request)) {
+    memcpy(reth->ether_dhost, arp->ar_sha, ETHER_ADDR_LEN);
+    memcpy(reth->ether_shost, iface->host_addr, ETHER_ADDR_LEN);
+    reth->ether_type = htons(ethertype_arp);
+    memcpy(rarp, arp, sizeof(struct sr_arp_hdr));
+    rarp->ar_op = htons(arp_op_reply);
+    memcpy(rarp->ar_sha, iface->host_addr, ETHER_ADDR_LEN);
+    rarp->ar_sip = arp->ar_tip;
+    memcpy(rarp->ar_tha, arp->ar_sha, ETHER_ADDR_LEN);
+    rarp->ar_tip = arp->ar_sip;
+
+    /* -- sr drains its ring on its own, so this cannot wait forever -- */
+    while (sr_shm_push(&(relay->tx), reply, sizeof(reply), name) != 0) {
+      sr_shm_publish(&(relay->tx));
+    }
+    relay->arp_replies++;
+    return;
+  }
+
+  relay->other++;
+} /* -- sr_relay_input -- */
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+int main(int argc, char** argv) {
+  int c;
+  char* path = SR_SHM_DEFAULT_PATH;
+  char* ingress_name = DEFAULT_INGRESS;
+  char* dst = DEFAULT_DST;
+  unsigned long packets = DEFAULT_PACKETS;
+  unsigned int len = DEFAULT_LENGTH;
+  unsigned long window = DEFAULT_WINDOW;
+  unsigned int flows = DEFAULT_FLOWS;
+  uint8_t frame[SR_SHM_SLOT_SIZE];
+  uint16_t* sport;
+  struct sr_relay relay;
+  struct sr_relay_iface* ingress;
+  struct sr_shm_desc* desc;
+  struct pollfd pfd[2];
+  uint8_t* buf;
+  double start, elapsed;
+  int progress, idle_ms = 0;
+
+  while ((c = getopt(argc, argv, "hs:n:l:W:F:f:d:")) != EOF) {
+    switch (c) {
+      case 'h':
+        usage(argv[0]);
+        exit(0);
+        break;
+      case 's':
+        path = optarg;
+        break;
+      case 'n':
+        packets = strtoul(optarg, 0, 10);
+        break;
+      case 'l':
+        len = atoi(optarg);
+        break;
+      case 'W':
+        window = strtoul(optarg, 0, 10);
+        break;
+      case 'F':
+        flows = atoi(optarg);
+        break;
+      case 'f':
+        ingress_name = optarg;
+        break;
+      case 'd':
+        dst = optarg;
+        break;
+    } /* switch */
+  } /* -- while -- */
+
+  if ((ingress = sr_relay_iface(ingress_name)) == 0) {
+    fprintf(stderr, "Error: no interface %s\n", ingress_name);
+    return 1;
+  }
+  if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr) + SR_RELAY_UDP_LEN || len > SR_SHM_SLOT_SIZE) {
+    fprintf(stderr, "Error: frame length must be %u to %u bytes\n",
+            (unsigned int)(sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr) + SR_RELAY_UDP_LEN),
+            SR_SHM_SLOT_SIZE);
+    return 1;
+  }
+  if (flows == 0 || window == 0) {
+    fprintf(stderr, "Error: window and flows must be at least 1\n");
+    return 1;
+  }
+
+  memset(&relay, 0, sizeof(relay));
+  relay.dst = inet_addr(dst);
+  sr_relay_build(frame, len, ingress, inet_addr(DEFAULT_SRC), relay.dst);
+  sport = (uint16_t*)(frame + sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr));
+
+  if (sr_relay_accept(&relay, path) != 0) {
+    return 1;
+  }
+  printf("sr attached, sending %lu frames of %u bytes into %s\n", packets, len, ingress->name);
+
+  start = sr_relay_now();
+  while (relay.forwarded < packets) {
+    progress = 0;
+
+    /* -- keep the window full -- */
+    while (relay.sent < packets && relay.sent - relay.forwarded < window) {
+      *sport = htons(1024 + relay.sent % flows);
+      if (sr_shm_push(&(relay.tx), frame, len, ingress->name) != 0) {
+        break;
+      }
+      relay.sent++;
+      progress = 1;
+    }
+
+    while ((buf = sr_shm_next(&(relay.rx), &desc)) != 0) {
+      if (desc->len <= SR_SHM_SLOT_SIZE) {
+        sr_relay_input(&relay, buf, desc->len, desc->iface);
+      }
+      sr_shm_release(&(relay.rx));
+      progress = 1;
+    }
+
+    if (sr_shm_publish(&(relay.tx)) != 0) {
+      break;
+    }
+    if (progress) {
+      idle_ms = 0;
+      continue;
+    }
+
+    /* -- nothing to do until sr sends something -- */
+    if (!sr_shm_sleep(&(relay.rx))) {
+      continue;
+    }
+    pfd[0].fd = relay.efd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = relay.sock;
+    pfd[1].events = POLLIN;
+    if (poll(pfd, 2, SR_RELAY_IDLE_MS) == -1 && errno != EINTR) {
+      perror("poll(..):sr_relay.c::main(..)");
+      break;
+    }
+    if (pfd[1].revents) {
+      fprintf(stderr, "Error: sr closed the connection\n");
+      break;
+    }
+    if (pfd[0].revents) {
+      sr_shm_wake_drain(&(relay.rx));
+    } else if ((idle_ms += SR_RELAY_IDLE_MS) >= SR_RELAY_STALL_MS) {
+      fprintf(stderr, "Error: no progress for %d ms\n", SR_RELAY_STALL_MS);
+      break;
+    }
+  }
+  elapsed = sr_relay_now() - start;
+
+  printf("sent %lu, forwarded %lu, arp replies %lu, other %lu\n", relay.sent, relay.forwarded, relay.arp_replies,
+         relay.other);
+  printf("%.3f s: %.0f frames/s, %.1f Mbit/s\n", elapsed, relay.forwarded / elapsed,
+         relay.forwarded * (double)len * 8 / elapsed / 1e6);
+
+  close(relay.sock);
+  sr_shm_unmap(relay.region);
+
+  return relay.forwarded == packets ? 0 : 1;
+} /* -- main -- */
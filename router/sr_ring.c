@@ -0,0 +1,97 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.c
+ *
+ * Description:
+ *
+ * Lock-free single producer / single consumer ring, see sr_ring.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_ring.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_init(..)
+ * Scope: Global
+ *
+ * size must be a power of two.  Returns 0 on success, -1 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ring_init(struct sr_ring* ring, unsigned int size) {
+  /* -- REQUIRES -- */
+  assert(ring);
+  assert(size > 0 && (size & (size - 1)) == 0);
+
+  memset(ring, 0, sizeof(*ring));
+  if ((ring->slots = (void**)calloc(size, sizeof(void*))) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_ring_init)\n");
+    return -1;
+  }
+  ring->size = size;
+  ring->mask = size - 1;
+  return 0;
+} /* -- sr_ring_init -- */
+
+void sr_ring_destroy(struct sr_ring* ring) {
+  /* -- REQUIRES -- */
+  assert(ring);
+
+  free(ring->slots);
+  ring->slots = 0;
+} /* -- sr_ring_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_push(..)
+ * Scope: Global
+ *
+ * Producer side.  Returns 0 on success, -1 if the ring is full.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ring_push(struct sr_ring* ring, void* item) {
+  unsigned int tail = ring->tail;
+
+  if (tail - __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE) == ring->size) {
+    return -1;
+  }
+  ring->slots[tail & ring->mask] = item;
+  __atomic_store_n(&(ring->tail), tail + 1, __ATOMIC_RELEASE);
+  return 0;
+} /* -- sr_ring_push -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_pop(..)
+ * Scope: Global
+ *
+ * Consumer side.  Returns the oldest item or 0 if the ring is empty.
+ *
+ *---------------------------------------------------------------------*/
+
+void* sr_ring_pop(struct sr_ring* ring) {
+  unsigned int head = ring->head;
+  void* item;
+
+  if (head == __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE)) {
+    return 0;
+  }
+  item = ring->slots[head & ring->mask];
+  __atomic_store_n(&(ring->head), head + 1, __ATOMIC_RELEASE);
+  return item;
+} /* -- sr_ring_pop -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_count(..)
+ * Scope: Global
+ *
+ * Number of items queued; only a snapshot when called from a third thread.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_ring_count(struct sr_ring* ring) {
+  return __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE) - __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+} /* -- sr_ring_count -- */
@@ -0,0 +1,38 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.h
+ *
+ * Description:
+ *
+ * Lock-free single producer / single consumer ring of pointers.  Exactly one
+ * thread may push and exactly one (possibly other) thread may pop.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RING_H
+#define SR_RING_H
+
+#define SR_CACHE_LINE 64
+
+/* ----------------------------------------------------------------------------
+ * struct sr_ring
+ *
+ * head and tail live on their own cache lines so producer and consumer do
+ * not false-share.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_ring {
+  unsigned int size; /* power of two */
+  unsigned int mask;
+  void** slots;
+  unsigned int head __attribute__((aligned(SR_CACHE_LINE))); /* next slot to pop, owned by consumer */
+  unsigned int tail __attribute__((aligned(SR_CACHE_LINE))); /* next slot to push, owned by producer */
+};
+
+int sr_ring_init(struct sr_ring* ring, unsigned int size);
+void sr_ring_destroy(struct sr_ring* ring);
+int sr_ring_push(struct sr_ring* ring, void* item);
+void* sr_ring_pop(struct sr_ring* ring);
+unsigned int sr_ring_count(struct sr_ring* ring);
+
+#endif /* -- SR_RING_H -- */
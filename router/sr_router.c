@@ -15,16 +15,19 @@
 
 #include <assert.h>
 #include <stdbool.h>
-#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "log.h"
 #include "sr_arpcache.h"
+#include "sr_flight.h"
 #include "sr_if.h"
+#include "sr_pktmeta.h"
+#include "sr_prof.h"
 #include "sr_protocol.h"
 #include "sr_rt.h"
+#include "sr_stats.h"
 #include "sr_utils.h"
 
 /*---------------------------------------------------------------------
@@ -39,16 +42,17 @@ void sr_init(struct sr_instance *sr) {
   /* REQUIRES */
   assert(sr);
 
-  /* Initialize cache and cache cleanup thread */
+  /* Initialize cache and its once a second cleanup timer.  The timer runs on
+     the same event loop as the data path, so the cache needs no locking. */
   sr_arpcache_init(&(sr->cache));
+  sr->cache.shared = 0;
+  sr->cache.pool = &(sr->pool);
 
   pthread_attr_init(&(sr->attr));
   pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
   pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
-  pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
-  pthread_t thread;
 
-  pthread_create(&thread, &(sr->attr), sr_arpcache_timeout, sr);
+  sr_event_add_timer(&(sr->loop), 1000, sr_arpcache_timer, sr);
 
   /* Add initialization code here! */
 
@@ -70,188 +74,457 @@ void sr_init(struct sr_instance *sr) {
  *
  *---------------------------------------------------------------------*/
 
-static void handle_ip_packet(struct sr_instance *sr, uint8_t *packet, unsigned int len, char *interface);
-static void handle_arp_packet(struct sr_instance *sr, uint8_t *packet, unsigned int len, char *interface);
-static struct sr_if *get_dst_interface(const struct sr_instance *sr, const sr_ip_hdr_t *ip_hdr);
-static void send_icmp_response(struct sr_instance *sr, uint8_t *packet, unsigned int len, char *interface, uint8_t type,
-                               uint8_t code, struct sr_if *dst_interface);
+static void handle_ip_packet(struct sr_instance *sr, struct sr_pkt_meta *meta);
+static void handle_arp_packet(struct sr_instance *sr, struct sr_pkt_meta *meta);
+static struct sr_if *get_dst_interface(const struct sr_instance *sr, uint32_t ip_dst);
+static void send_icmp_response(struct sr_instance *sr, const struct sr_pkt_meta *meta, uint8_t type, uint8_t code,
+                               struct sr_if *dst_interface);
+static void send_icmp_echo_reply(struct sr_instance *sr, struct sr_pkt_meta *meta, struct sr_if *dst_interface);
 
 void sr_handlepacket(struct sr_instance *sr, uint8_t *packet /* lent */, unsigned int len, char *interface /* lent */) {
-  uint16_t type;
+  struct sr_if *iface;
 
   /* REQUIRES */
   assert(sr);
-  assert(packet);
   assert(interface);
 
-  printf("*** -> Received packet of length %d, pointer: %p\n", len, packet);
-  type = ethertype(packet);
-  printf("Received packet type: %d\n", type);
-  if (type == ethertype_ip) {
-    printf("Received packet is an IP packet.\n");
-    handle_ip_packet(sr, packet, len, interface);
-  } else if (type == ethertype_arp) {
-    printf("Received packet is an ARP packet.\n");
-    handle_arp_packet(sr, packet, len, interface);
-  } else {
-    /* Ignored. */
-    printf("Received packet is not an IP or ARP packet.\n");
-  }
-  printf("Packet handled.\n");
+  iface = sr_get_interface(sr, interface);
+  sr_handlepacket_idx(sr, packet, len, iface ? iface->index : SR_IF_NONE, sr_clock_ns());
 } /* end sr_ForwardPacket */
 
-/* TODO: Implements this function. */
-void handle_ip_packet(struct sr_instance *sr, uint8_t *packet, unsigned int len, char *interface) {
-  uint16_t header_checksum;
-  sr_ip_hdr_t *ip_hdr;
-  sr_icmp_hdr_t *icmp_hdr;
-  struct sr_if *ip_interface, *eth_interface;
-  uint8_t protocol;
+/*---------------------------------------------------------------------
+ * Method: sr_handlepacket_idx(..)
+ * Scope:  Global
+ *
+ * sr_handlepacket(..) for a frame whose interface is already known by
+ * index, which is how every transport hands frames in.  rx_ns is when
+ * the transport read it (sr_clock_ns()), for the latency histograms.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_handlepacket_idx(struct sr_instance *sr, uint8_t *packet /* lent */, unsigned int len, unsigned int ifidx,
+                         uint64_t rx_ns) {
+  struct sr_pkt_meta meta;
+  uint64_t start = sr_clock_ns(), end;
 
   /* REQUIRES */
   assert(sr);
   assert(packet);
-  assert(interface);
 
-  /* Sanity-check the packet (meets minimum length and has correct checksum). */
-  if (len < sizeof(struct sr_ethernet_hdr) + sizeof(sr_ip_hdr_t)) {
-    printf("IP packet does not meet expected length.\n");
+  SR_PROF_BEGIN(SR_PROF_PARSE, 1);
+  LOG_DEBUG("*** -> Received packet of length %d, pointer: %p", len, packet);
+  /* Decode the headers once, every handler below reads them from meta */
+  sr_pkt_parse(sr, &meta, packet, len, ifidx);
+  meta.rx_ns = rx_ns;
+  sr_flight_begin(&meta);
+  LOG_DEBUG("Received packet type: %d", meta.ethertype);
+  if (meta.ethertype == ethertype_ip) {
+    LOG_DEBUG("Received packet is an IP packet.");
+    handle_ip_packet(sr, &meta);
+  } else if (meta.ethertype == ethertype_arp) {
+    LOG_DEBUG("Received packet is an ARP packet.");
+    SR_PROF_STAGE(SR_PROF_ARP, 1);
+    handle_arp_packet(sr, &meta);
+  } else {
+    /* Ignored. */
+    LOG_DEBUG("Received packet is not an IP or ARP packet.");
+    meta.disp = SR_DISP_ETHERTYPE_IGNORED;
+  }
+  SR_PROF_STAGE(SR_PROF_RECORD, 1);
+  end = sr_clock_ns();
+  sr_flight_end(&meta, 1, start, end);
+  sr_stats_burst(&meta, 1, end);
+  SR_PROF_END();
+  LOG_DEBUG("Packet handled.");
+} /* -- sr_handlepacket_idx -- */
+
+/* Stages of the IP path, run one packet at a time by handle_ip_packet and
+   one vector at a time by sr_handlepacket_burst. */
+
+/* Sanity-check the packet (meets minimum length and has correct checksum).
+   The checksum is verified in one pass over the header, options included,
+   leaving ip_sum intact for the incremental update in ip_route. */
+static bool ip_validate(struct sr_pkt_meta *meta) {
+  if (!(meta->flags & SR_META_IP)) {
+    LOG_DEBUG("IP packet does not meet expected length.");
+    meta->disp = SR_DISP_BAD_LEN;
+    return false;
+  }
+  if (!cksum_ok(meta->frame + meta->l3_off, meta->l4_off - meta->l3_off)) {
+    LOG_DEBUG("IP: Wrong header checksum.");
+    meta->disp = SR_DISP_BAD_CKSUM;
+    return false;
+  }
+  meta->flags |= SR_META_IP_CKSUM;
+  return true;
+}
+
+/* The packet is sent to one of our interfaces. */
+static void ip_deliver_local(struct sr_instance *sr, struct sr_pkt_meta *meta, struct sr_if *ip_interface) {
+  uint8_t protocol;
+
+  protocol = meta->ip_p;
+  LOG_DEBUG("Iface found, protocol: %d", protocol);
+  /* TODO(Lu Jiaming): Finish the if statement block. */
+  if (protocol == ip_protocol_icmp) {
+    /* The packet is an ICMP echo request, send an ICMP echo reply to the
+      sending host.
+     */
+    LOG_DEBUG("protocol is ICMP");
+    if (!(meta->flags & SR_META_L4)) {
+      LOG_DEBUG("ICMP packet does not meet expected length.");
+      meta->disp = SR_DISP_BAD_LEN;
+      return;
+    }
+    /* [x] Fix: wrong pointer */
+    if (!cksum_ok(meta->frame + meta->l4_off, meta->l4_len)) {
+      LOG_DEBUG("ICMP: Wrong header checksum.");
+      meta->disp = SR_DISP_BAD_CKSUM;
+      return;
+    }
+    if (meta->icmp_type != (uint8_t)8) {
+      LOG_DEBUG("Received packet is not an ICMP echo request.");
+      meta->disp = SR_DISP_NOT_ECHO;
+      return;
+    }
+    meta->disp = SR_DISP_ECHO_REPLY;
+    meta->out_idx = meta->in_idx;
+    send_icmp_echo_reply(sr, meta, ip_interface);
+  } else if (protocol == ip_protocol_tcp || protocol == ip_protocol_udp) {
+    /*
+      The packet contains a TCP or UDP payload, send an ICMP port unreachable
+      to the sending host. Otherwise, ignore the packet. Packets destined
+      elsewhere should be forwarded using your normal forwarding logic.
+      send_icmp_response(sr, packet, len, interface, 3, 3, ip_interface);
+    */
+    LOG_DEBUG("protocol is TCP or UDP");
+    LOG_DEBUG("sending type 3 code 3");
+    meta->disp = SR_DISP_PORT_UNREACH;
+    meta->out_idx = meta->in_idx;
+    send_icmp_response(sr, meta, 3, 3, ip_interface);
+  } else {
+    meta->disp = SR_DISP_PROTO_IGNORED;
+  }
+}
+
+/* Decrement the TTL and find the route out. Sends the ICMP error and
+   returns NULL if the packet goes no further. */
+static struct sr_rt *ip_route(struct sr_instance *sr, struct sr_pkt_meta *meta) {
+  sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(meta->frame + meta->l3_off);
+
+  /*
+    [x] Finish the else statement block
+    Otherwise we need to forward the packet.
+    Decrement the TTL by 1, and update the packet checksum for the
+    modified header (incrementally, only the TTL changed).
+   */
+  LOG_DEBUG("Iface not found");
+  LOG_DEBUG("Decrementing TTL by 1.");
+  ip_hdr->ip_ttl = --meta->ttl;
+  ip_hdr->ip_sum = cksum_ttl_dec(ip_hdr->ip_sum);
+  if (meta->ttl == 0) {
+    /* time out */
+    meta->disp = SR_DISP_TTL_EXCEEDED;
+    meta->out_idx = meta->in_idx;
+    send_icmp_response(sr, meta, 11, 0, NULL);
+    return NULL;
+  }
+
+  /*
+    Find out which entry in the routing table has the longest prefix match
+    with the destination IP address.
+  */
+  LOG_DEBUG("Finding the longest prefix match.");
+  struct sr_rt *longest_match_rt;
+  longest_match_rt = sr_longest_prefix_match(sr, meta->ip_dst);
+  if (longest_match_rt == NULL) {
+    /* No match found, send an ICMP net unreachable message back to the
+     * sender. */
+    meta->disp = SR_DISP_NO_ROUTE;
+    meta->out_idx = meta->in_idx;
+    send_icmp_response(sr, meta, 3, 0, NULL);
+    return NULL;
+  }
+  return longest_match_rt;
+}
+
+/* Check the ARP cache for the next-hop MAC address of the route. On a hit
+   copy it to mac and return true. Otherwise add the packet to the queue of
+   packets waiting on the next-hop IP and return false; if an ARP request
+   for it is due (none sent within the last second), it is appended to
+   sends for the caller to send. The caller holds the cache lock, so a
+   reply handled on another thread cannot slip in between lookup and
+   queueing and strand the packet. Nothing is sent here: on a worker a
+   send can wait for the loop thread, which may be waiting for the lock. */
+static bool ip_resolve(struct sr_instance *sr, struct sr_pkt_meta *meta, struct sr_rt *rt, unsigned char *mac,
+                       struct sr_arpsend *sends, unsigned int *nsends) {
+  struct sr_arpentry *arp_entry;
+
+  LOG_DEBUG("Checking the ARP cache.");
+  arp_entry = sr_arpcache_lookup(&(sr->cache), rt->gw.s_addr);
+  if (arp_entry) {
+    memcpy(mac, arp_entry->mac, ETHER_ADDR_LEN);
+    free(arp_entry);
+    return true;
+  }
+
+  LOG_DEBUG("ARP entry not found. Queue the packet.");
+  struct sr_arpreq *arp_req;
+  arp_req = sr_arpcache_queuereq(&(sr->cache), rt->gw.s_addr, meta, rt->if_index);
+  if (arp_req == NULL) {
+    meta->disp = SR_DISP_NO_BUFFER;
+    return false;
+  }
+  if (sr_arpreq_due(arp_req, &(sends[*nsends]))) {
+    (*nsends)++;
+  }
+  meta->disp = SR_DISP_ARP_QUEUED;
+  meta->out_idx = rt->if_index;
+  return false;
+}
+
+/* Address the packet to the next hop and send it out of the route's
+   interface. */
+static void ip_rewrite_and_send(struct sr_instance *sr, struct sr_pkt_meta *meta, struct sr_rt *rt,
+                                const unsigned char *mac) {
+  LOG_DEBUG("ARP entry found. Forward the packet.");
+  struct sr_if *out_interface = sr_get_interface_idx(sr, rt->if_index);
+  if (out_interface == NULL) {
+    LOG_DEBUG("Route has no interface.");
+    meta->disp = SR_DISP_NO_IFACE;
     return;
   }
-  ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(struct sr_ethernet_hdr));
-  header_checksum = ip_hdr->ip_sum;
-  ip_hdr->ip_sum = 0;
-  if (header_checksum != cksum((const void *)ip_hdr, sizeof(sr_ip_hdr_t))) {
-    printf("IP: Wrong header checksum.\n");
+  sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t *)meta->frame;
+  memcpy(eth_hdr->ether_shost, out_interface->addr, ETHER_ADDR_LEN);
+  memcpy(eth_hdr->ether_dhost, mac, ETHER_ADDR_LEN);
+
+  meta->out_idx = rt->if_index;
+  meta->disp = SR_DISP_FORWARD;
+  if (sr_send_packet_idx(sr, meta->frame, meta->len, rt->if_index) == -1) {
+    LOG_WARN("Failed to send packet.");
+    meta->disp = SR_DISP_TX_FAIL;
+  }
+}
+
+/* TODO: Implements this function. */
+void handle_ip_packet(struct sr_instance *sr, struct sr_pkt_meta *meta) {
+  struct sr_if *ip_interface;
+  struct sr_rt *rt;
+  unsigned char mac[ETHER_ADDR_LEN];
+  struct sr_arpsend send;
+  unsigned int nsends = 0;
+  bool resolved;
+
+  /* REQUIRES */
+  assert(sr);
+  assert(meta);
+
+  SR_PROF_STAGE(SR_PROF_CKSUM, 1);
+  if (!ip_validate(meta)) {
     return;
   }
 
   /* If the packet is sending to one of our interface. */
-  ip_interface = get_dst_interface(sr, ip_hdr);
-  printf("#####################\n");
+  SR_PROF_STAGE(SR_PROF_LOCAL, 1);
+  ip_interface = get_dst_interface(sr, meta->ip_dst);
+  LOG_DEBUG("#####################");
   if (ip_interface != NULL) {
-    struct sr_if *iface = sr_get_interface(sr, interface);
-    protocol = ip_protocol(ip_hdr); /* Wrong pointer fixed */
-    printf("Iface found, protocol: %d\n", protocol);
-    /* TODO(Lu Jiaming): Finish the if statement block. */
-    if (protocol == ip_protocol_icmp) {
-      /* The packet is an ICMP echo request, send an ICMP echo reply to the
-        sending host.
-       */
-      printf("protocol is ICMP\n");
-      /* [x] Fix: wrong pointer */
-      icmp_hdr = (sr_icmp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-      uint16_t icmp_sum = icmp_hdr->icmp_sum;
-      icmp_hdr->icmp_sum = 0; /* [x] Fix: reset icmp_sum each time */
-      header_checksum = cksum(icmp_hdr, len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t));
-
-      if (header_checksum != icmp_sum) {
-        printf("ICMP: Wrong header checksum.\n");
-        printf("header_checksum: %d\n", header_checksum);
-        printf("icmp_hdr->icmp_sum: %d\n", icmp_hdr->icmp_sum);
-        return;
+    ip_deliver_local(sr, meta, ip_interface);
+    return;
+  }
+
+  SR_PROF_STAGE(SR_PROF_LPM, 1);
+  if ((rt = ip_route(sr, meta)) == NULL) {
+    return;
+  }
+
+  SR_PROF_STAGE(SR_PROF_NEIGH, 1);
+  sr_arpcache_lock(&(sr->cache));
+  resolved = ip_resolve(sr, meta, rt, mac, &send, &nsends);
+  sr_arpcache_unlock(&(sr->cache));
+  if (nsends > 0) {
+    LOG_DEBUG("Send an ARP request.");
+    sr_arpreq_send(sr, &send);
+  }
+
+  if (resolved) {
+    /* If it’s there, forward the packet. */
+    SR_PROF_STAGE(SR_PROF_REWRITE, 1);
+    ip_rewrite_and_send(sr, meta, rt, mac);
+  }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_handlepacket_burst(..)
+ * Scope:  Global
+ *
+ * Handle n received packets like n calls to sr_handlepacket, but one
+ * stage at a time over the whole vector: Ethernet classify, IP validate,
+ * local/forward split, LPM, neighbor resolve and rewrite.  Each stage's
+ * code and tables stay hot for the whole vector, the next frames'
+ * headers are prefetched while the current one is classified, and
+ * packets to the same destination or next hop as the one before them
+ * reuse its route and MAC instead of walking the table and ARP cache
+ * again.  ARP frames are handled in the classify stage, so a reply is
+ * known before the IP packets of the same burst are resolved.
+ *
+ * Frames come with their interface index and receive time; the buffers
+ * are lent, as for sr_handlepacket.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_handlepacket_burst(struct sr_instance *sr, uint8_t **pkts /* lent */, unsigned int *lens,
+                           unsigned int *ifidx, const uint64_t *rx_ns, unsigned int n) {
+  struct sr_pkt_meta meta[SR_BURST_MAX];
+  unsigned int ip[SR_BURST_MAX], fwd[SR_BURST_MAX];
+  struct sr_rt *rt[SR_BURST_MAX];
+  unsigned char mac[SR_BURST_MAX][ETHER_ADDR_LEN];
+  bool resolved[SR_BURST_MAX];
+  struct sr_arpsend sends[SR_BURST_MAX];
+  struct sr_if *ip_interface;
+  struct sr_pkt_meta *m;
+  sr_ip_hdr_t *ip_hdr;
+  unsigned int i, k, nip, nfwd, nsends, base, cnt;
+  uint64_t start, end;
+
+  /* REQUIRES */
+  assert(sr);
+  assert(pkts);
+  assert(lens);
+  assert(ifidx);
+  assert(rx_ns);
+
+  for (base = 0; base < n; base += SR_BURST_MAX) {
+    cnt = n - base < SR_BURST_MAX ? n - base : SR_BURST_MAX;
+    start = sr_clock_ns();
+    SR_PROF_BEGIN(SR_PROF_PARSE, cnt);
+
+    /* -- Ethernet classify: ARP is handled now, IP goes on to validation -- */
+    nip = 0;
+    for (i = 0; i < cnt; i++) {
+      if (i + SR_BURST_PREFETCH < cnt) {
+        __builtin_prefetch(pkts[base + i + SR_BURST_PREFETCH]);
       }
-      if (icmp_hdr->icmp_type != (uint8_t)8) {
-        printf("Received packet is not an ICMP echo request.\n");
-        return;
+      assert(pkts[base + i]);
+      LOG_DEBUG("*** -> Received packet of length %d, pointer: %p", lens[base + i], pkts[base + i]);
+      sr_pkt_parse(sr, &(meta[i]), pkts[base + i], lens[base + i], ifidx[base + i]);
+      meta[i].rx_ns = rx_ns[base + i];
+      sr_flight_begin(&(meta[i]));
+      if (meta[i].ethertype == ethertype_ip) {
+        ip[nip++] = i;
+      } else if (meta[i].ethertype == ethertype_arp) {
+        SR_PROF_CALL(SR_PROF_ARP, 1);
+        handle_arp_packet(sr, &(meta[i]));
+        SR_PROF_RETURN();
+      } else {
+        /* Ignored. */
+        LOG_DEBUG("Received packet is not an IP or ARP packet.");
+        meta[i].disp = SR_DISP_ETHERTYPE_IGNORED;
       }
-      send_icmp_response(sr, packet, len, interface, 0, 0, ip_interface);
-    } else if (protocol == ip_protocol_tcp || protocol == ip_protocol_udp) {
-      /*
-        The packet contains a TCP or UDP payload, send an ICMP port unreachable
-        to the sending host. Otherwise, ignore the packet. Packets destined
-        elsewhere should be forwarded using your normal forwarding logic.
-        send_icmp_response(sr, packet, len, interface, 3, 3, ip_interface);
-      */
-      printf("protocol is TCP or UDP\n");
-      printf("sending type 3 code 3\n");
-      send_icmp_response(sr, packet, len, interface, 3, 3, ip_interface);
     }
-  } else {
-    /*
-      [x] Finish the else statement block
-      Otherwise we need to forward the packet.
-      Decrement the TTL by 1, and recompute the packet checksum over the
-      modified header.
-     */
-    printf("Iface not found\n");
-    printf("Decrementing TTL by 1.\n");
-    ip_hdr->ip_ttl--;
-    if (ip_hdr->ip_ttl == 0) {
-      /* time out */
-      send_icmp_response(sr, packet, len, interface, 11, 0, ip_interface);
-      return;
-    }
-    ip_hdr->ip_sum = 0;
-    ip_hdr->ip_sum = cksum((const void *)ip_hdr, sizeof(sr_ip_hdr_t));
 
-    /*
-      Find out which entry in the routing table has the longest prefix match
-      with the destination IP address.
-    */
-    printf("Finding the longest prefix match.\n");
-    struct sr_rt *longest_match_rt;
-    longest_match_rt = sr_longest_prefix_match(sr, ip_hdr->ip_dst);
-    if (longest_match_rt == NULL) {
-      /* No match found, send an ICMP net unreachable message back to the
-       * sender. */
-      send_icmp_response(sr, packet, len, interface, 3, 0, ip_interface);
-      return;
+    /* -- IP validate -- */
+    SR_PROF_STAGE(SR_PROF_CKSUM, nip);
+    for (k = 0, i = 0; i < nip; i++) {
+      if (ip_validate(&(meta[ip[i]]))) {
+        ip[k++] = ip[i];
+      }
+    }
+    nip = k;
+
+    /* -- local/forward split, local packets are answered right away -- */
+    SR_PROF_STAGE(SR_PROF_LOCAL, nip);
+    nfwd = 0;
+    for (i = 0; i < nip; i++) {
+      if ((ip_interface = get_dst_interface(sr, meta[ip[i]].ip_dst)) != NULL) {
+        ip_deliver_local(sr, &(meta[ip[i]]), ip_interface);
+      } else {
+        fwd[nfwd++] = ip[i];
+      }
     }
 
-    /*
-      Check the ARP cache for the next-hop MAC address corresponding to the
-      next-hop IP.
-    */
-    printf("Checking the ARP cache.\n");
-    struct sr_arpentry *arp_entry;
-    arp_entry = sr_arpcache_lookup(&(sr->cache), longest_match_rt->gw.s_addr);
-    if (arp_entry) {
-      /* If it’s there, forward the packet. */
-      printf("ARP entry found. Forward the packet.\n");
-      sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t *)packet;
-      memcpy(eth_hdr->ether_shost, sr_get_interface(sr, longest_match_rt->interface)->addr, ETHER_ADDR_LEN);
-      memcpy(eth_hdr->ether_dhost, arp_entry->mac, ETHER_ADDR_LEN);
-
-      int res = sr_send_packet(sr, packet, len, longest_match_rt->interface);
-      printf("## start free\n");
-      free(arp_entry);
-      if (res == -1) {
-        printf("Failed to send packet.\n");
-        return;
+    /* -- TTL and LPM, reusing the route of a preceding packet to the same host -- */
+    SR_PROF_STAGE(SR_PROF_LPM, nfwd);
+    for (k = 0, i = 0; i < nfwd; i++) {
+      m = &(meta[fwd[i]]);
+      if (k > 0 && m->ttl > 1 && m->ip_dst == meta[fwd[k - 1]].ip_dst) {
+        ip_hdr = (sr_ip_hdr_t *)(m->frame + m->l3_off);
+        ip_hdr->ip_ttl = --m->ttl;
+        ip_hdr->ip_sum = cksum_ttl_dec(ip_hdr->ip_sum);
+        rt[k] = rt[k - 1];
+        fwd[k++] = fwd[i];
+      } else if ((rt[k] = ip_route(sr, m)) != NULL) {
+        fwd[k++] = fwd[i];
+      }
+    }
+    nfwd = k;
+
+    /* -- neighbor resolve, under one hold of the cache lock; ARP requests
+     *    that come due go out once it is dropped -- */
+    SR_PROF_STAGE(SR_PROF_NEIGH, nfwd);
+    if (nfwd > 0) {
+      nsends = 0;
+      sr_arpcache_lock(&(sr->cache));
+      for (i = 0; i < nfwd; i++) {
+        if (i > 0 && resolved[i - 1] && rt[i]->gw.s_addr == rt[i - 1]->gw.s_addr) {
+          memcpy(mac[i], mac[i - 1], ETHER_ADDR_LEN);
+          resolved[i] = true;
+        } else {
+          resolved[i] = ip_resolve(sr, &(meta[fwd[i]]), rt[i], mac[i], sends, &nsends);
+        }
+      }
+      sr_arpcache_unlock(&(sr->cache));
+      for (i = 0; i < nsends; i++) {
+        sr_arpreq_send(sr, &(sends[i]));
       }
+    }
 
-    } else {
-      /*
-        Otherwise, send an ARP request for
-        the next-hop IP (if one hasn’t been sent within the last second), and
-        add the packet to the queue of packets waiting on this ARP request.
-      */
-      printf("ARP entry not found. Send an ARP request.\n");
-      struct sr_arpreq *arp_req;
-      arp_req =
-          sr_arpcache_queuereq(&(sr->cache), longest_match_rt->gw.s_addr, packet, len, longest_match_rt->interface);
-      handle_arpreq(sr, arp_req);
+    /* -- rewrite and send -- */
+    SR_PROF_STAGE(SR_PROF_REWRITE, nfwd);
+    for (i = 0; i < nfwd; i++) {
+      if (resolved[i]) {
+        ip_rewrite_and_send(sr, &(meta[fwd[i]]), rt[i], mac[i]);
+      }
     }
+
+    SR_PROF_STAGE(SR_PROF_RECORD, cnt);
+    end = sr_clock_ns();
+    sr_flight_end(meta, cnt, start, end);
+    sr_stats_burst(meta, cnt, end);
+    SR_PROF_END();
   }
-}
+} /* -- sr_handlepacket_burst -- */
 
 /* [x] (Wei Zheyuan): Implements this function. */
-void handle_arp_packet(struct sr_instance *sr, uint8_t *packet, unsigned int len, char *interface) {
+void handle_arp_packet(struct sr_instance *sr, struct sr_pkt_meta *meta) {
   uint8_t *response;
+  struct sr_pktbuf *pb;
   struct sr_if *iface;
   struct sr_packet *arp_reply_packet;
-  sr_ethernet_hdr_t *packet_eth_hdr, *request_eth_hdr, *response_eth_hdr;
+  sr_ethernet_hdr_t *packet_eth_hdr, *response_eth_hdr;
   sr_arp_hdr_t *packet_arp_hdr, *response_arp_hdr;
+  unsigned int len = meta->len;
+  uint64_t sent;
 
-  iface = sr_get_interface(sr, interface);
-  packet_eth_hdr = (sr_ethernet_hdr_t *)packet;
-  packet_arp_hdr = (sr_arp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
-
-  if (ntohs(packet_arp_hdr->ar_op) == arp_op_request) {
-    printf("#### Handling ARP request\n");
-    if (packet_arp_hdr->ar_tip == iface->ip) {
-      response = malloc(len);
+  if (!(meta->flags & SR_META_ARP) || meta->in_if == NULL) {
+    LOG_DEBUG("ARP packet does not meet expected length.");
+    meta->disp = SR_DISP_BAD_LEN;
+    return;
+  }
+  iface = meta->in_if;
+  packet_eth_hdr = (sr_ethernet_hdr_t *)meta->frame;
+  packet_arp_hdr = (sr_arp_hdr_t *)(meta->frame + meta->l3_off);
+
+  meta->disp = SR_DISP_ARP_IGNORED;
+  if (meta->arp_op == arp_op_request) {
+    LOG_DEBUG("#### Handling ARP request");
+    if (meta->ip_dst == iface->ip) {
+      if ((pb = sr_pktbuf_alloc(&(sr->pool), len)) == NULL) {
+        LOG_ERROR("No packet buffer for ARP reply");
+        meta->disp = SR_DISP_NO_BUFFER;
+        return;
+      }
+      response = pb->data;
       memset(response, 0, len);
       response_eth_hdr = (sr_ethernet_hdr_t *)response;
       response_arp_hdr = (sr_arp_hdr_t *)(response + sizeof(sr_ethernet_hdr_t));
@@ -269,28 +542,34 @@ void handle_arp_packet(struct sr_instance *sr, uint8_t *packet, unsigned int len
       memcpy(response_arp_hdr->ar_tha, packet_arp_hdr->ar_sha, ETHER_ADDR_LEN);
       memcpy(response_arp_hdr->ar_sha, iface->addr, ETHER_ADDR_LEN);
       response_arp_hdr->ar_sip = iface->ip;
-      response_arp_hdr->ar_tip = packet_arp_hdr->ar_sip;
+      response_arp_hdr->ar_tip = meta->ip_src;
 
-      sr_send_packet(sr, response, len, interface);
-      free(response);
+      meta->disp = SR_DISP_ARP_REPLY;
+      meta->out_idx = meta->in_idx;
+      if (sr_send_packet_idx(sr, response, len, meta->in_idx) == -1) {
+        meta->disp = SR_DISP_TX_FAIL;
+      }
+      sr_pktbuf_put(&(sr->pool), pb);
     }
-  } else if (ntohs(packet_arp_hdr->ar_op) == arp_op_reply) {
-    printf("#### Handling ARP reply\n");
+  } else if (meta->arp_op == arp_op_reply) {
+    LOG_DEBUG("#### Handling ARP reply");
+    meta->disp = SR_DISP_ARP_LEARNED;
 
-    struct sr_arpreq *cached_arp_req = sr_arpcache_insert(&(sr->cache), packet_arp_hdr->ar_sha, packet_arp_hdr->ar_sip);
+    struct sr_arpreq *cached_arp_req = sr_arpcache_insert(&(sr->cache), packet_arp_hdr->ar_sha, meta->ip_src);
     if (cached_arp_req) {
       arp_reply_packet = cached_arp_req->packets;
 
       while (arp_reply_packet) {
-        uint8_t *send_packet = malloc(arp_reply_packet->len);
-        memcpy(send_packet, arp_reply_packet->buf, arp_reply_packet->len);
-
-        response_eth_hdr = (sr_ethernet_hdr_t *)send_packet;
+        /* The queued buffer is ours until sr_arpreq_destroy, address it in place */
+        response_eth_hdr = (sr_ethernet_hdr_t *)arp_reply_packet->buf;
         memcpy(response_eth_hdr->ether_dhost, packet_arp_hdr->ar_sha, ETHER_ADDR_LEN);
         memcpy(response_eth_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN);
 
-        sr_send_packet(sr, send_packet, arp_reply_packet->len, arp_reply_packet->iface);
-        free(send_packet);
+        if (sr_send_packet_idx(sr, arp_reply_packet->buf, arp_reply_packet->len, arp_reply_packet->ifidx) == 0) {
+          sent = sr_clock_ns();
+          sr_stats_latency(SR_LAT_ARP_QUEUED, sent - arp_reply_packet->meta.rx_ns);
+          sr_stats_latency(SR_LAT_ARP_WAIT, sent - arp_reply_packet->queued_ns);
+        }
 
         arp_reply_packet = arp_reply_packet->next;
       }
@@ -304,22 +583,25 @@ void handle_arp_packet(struct sr_instance *sr, uint8_t *packet, unsigned int len
   [x] send_arp_reply
   @param sr the router instance
   @param arp_hdr the ARP header
-  @param interface the interface to send the ARP reply
+  @param ifidx the index of the interface to send the ARP reply
 */
-void send_arp_reply(struct sr_instance *sr, sr_arp_hdr_t *arp_hdr, char *interface) {
-  printf("Sending ARP reply.\n");
+void send_arp_reply(struct sr_instance *sr, sr_arp_hdr_t *arp_hdr, unsigned int ifidx) {
+  LOG_DEBUG("Sending ARP reply.");
 
-  /* Allocate memory for the ARP reply */
-  unsigned int arp_reply_len = sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr);
-  uint8_t *arp_reply = (uint8_t *)malloc(arp_reply_len);
-
-  /* Cache sr_get_interface(sr, interface) */
-  struct sr_if *iface = sr_get_interface(sr, interface);
+  struct sr_if *iface = sr_get_interface_idx(sr, ifidx);
   if (!iface) {
-    fprintf(stderr, "Interface not found.\n");
-    free(arp_reply);
+    LOG_ERROR("Interface not found.");
+    return;
+  }
+
+  /* Take a pool buffer for the ARP reply */
+  unsigned int arp_reply_len = sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr);
+  struct sr_pktbuf *pb = sr_pktbuf_alloc(&(sr->pool), arp_reply_len);
+  if (!pb) {
+    LOG_ERROR("No packet buffer for ARP reply");
     return;
   }
+  uint8_t *arp_reply = pb->data;
 
   /* Fill Ethernet Header */
   struct sr_ethernet_hdr *eth_hdr = (struct sr_ethernet_hdr *)arp_reply;
@@ -340,116 +622,128 @@ void send_arp_reply(struct sr_instance *sr, sr_arp_hdr_t *arp_hdr, char *interfa
   new_arp_hdr->ar_tip = arp_hdr->ar_sip;
 
   /* Send the ARP reply */
-  sr_send_packet(sr, arp_reply, arp_reply_len, interface);
+  sr_send_packet_idx(sr, arp_reply, arp_reply_len, ifidx);
 
-  /* Free the memory */
-  free(arp_reply);
+  /* Give the buffer back */
+  sr_pktbuf_put(&(sr->pool), pb);
 
-  printf("ARP reply sent.\n");
+  LOG_DEBUG("ARP reply sent.");
 }
 
-struct sr_if *get_dst_interface(const struct sr_instance *sr, const sr_ip_hdr_t *ip_hdr) {
-  struct sr_if *if_walker = sr->if_list;
-  while (if_walker != NULL) {
-    if (if_walker->ip == ip_hdr->ip_dst) {
-      return if_walker;
-    }
-    if_walker = if_walker->next;
+/* The interface owning ip_dst if the packet is for us: one probe of the
+   local address set rather than a walk of the interface list. */
+struct sr_if *get_dst_interface(const struct sr_instance *sr, uint32_t ip_dst) {
+  return sr_local_addr_lookup(sr, ip_dst);
+}
+
+/* Turn an echo request into its reply where it lies: swap the addresses,
+   flip the type and patch both checksums for the words that changed, so
+   the payload is neither copied nor summed again. Requests carrying IP
+   options take the copying path in send_icmp_response, which drops them. */
+static void send_icmp_echo_reply(struct sr_instance *sr, struct sr_pkt_meta *meta, struct sr_if *ip_interface) {
+  sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t *)meta->frame;
+  sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(meta->frame + meta->l3_off);
+  sr_icmp_hdr_t *icmp_hdr = (sr_icmp_hdr_t *)(meta->frame + meta->l4_off);
+  uint16_t old_word, new_word;
+
+  if (meta->in_if == NULL || meta->l4_off - meta->l3_off != sizeof(sr_ip_hdr_t)) {
+    send_icmp_response(sr, meta, 0, 0, ip_interface);
+    return;
+  }
+  LOG_DEBUG("## sending icmp echo reply in place");
+
+  /* ICMP: type 8 becomes 0, the code stays */
+  old_word = *(uint16_t *)icmp_hdr;
+  icmp_hdr->icmp_type = 0;
+  new_word = *(uint16_t *)icmp_hdr;
+  icmp_hdr->icmp_sum = cksum_adjust(icmp_hdr->icmp_sum, old_word, new_word);
+
+  /* IP: answer from the address that was asked, so the addresses only trade
+     places and leave the sum alone; only the TTL word changes */
+  old_word = *(uint16_t *)&(ip_hdr->ip_ttl);
+  ip_hdr->ip_ttl = INIT_TTL;
+  new_word = *(uint16_t *)&(ip_hdr->ip_ttl);
+  ip_hdr->ip_sum = cksum_adjust(ip_hdr->ip_sum, old_word, new_word);
+  ip_hdr->ip_dst = meta->ip_src;
+  ip_hdr->ip_src = meta->ip_dst;
+  meta->ttl = INIT_TTL;
+  meta->ip_src = ip_hdr->ip_src;
+  meta->ip_dst = ip_hdr->ip_dst;
+  meta->icmp_type = 0;
+
+  /* ETH */
+  memcpy(eth_hdr->ether_dhost, eth_hdr->ether_shost, ETHER_ADDR_LEN);
+  memcpy(eth_hdr->ether_shost, meta->in_if->addr, ETHER_ADDR_LEN);
+
+  /* -- trailing Ethernet padding is not part of the reply -- */
+  if (sr_send_packet_idx(sr, meta->frame, meta->l4_off + meta->l4_len, meta->in_idx) == -1) {
+    meta->disp = SR_DISP_TX_FAIL;
   }
-  return NULL;
 }
 
-static void send_icmp_response(struct sr_instance *sr, uint8_t *packet, unsigned int len, char *interface, uint8_t type,
-                               uint8_t code, struct sr_if *ip_interface) {
-  printf("## sending icmp response\n");
+static void send_icmp_response(struct sr_instance *sr, const struct sr_pkt_meta *meta, uint8_t type, uint8_t code,
+                               struct sr_if *ip_interface) {
+  LOG_DEBUG("## sending icmp response");
   uint8_t *response;
+  struct sr_pktbuf *pb;
   unsigned int response_len;
-  sr_ip_hdr_t *request_ip_hdr, *response_ip_hdr;
+  sr_ip_hdr_t *response_ip_hdr;
   sr_ethernet_hdr_t *request_eth_hdr, *response_eth_hdr;
-  sr_icmp_t3_hdr_t *response_icmp_hdr;
+  sr_icmp_hdr_t *response_icmp_hdr;
   struct sr_if *out_interface;
-  uint32_t ip_src;
 
   /* Sanity-check the packet (meets minimum length). */
-  if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)) {
-    fprintf(stderr, "Error: Packet length is too small for IP header.\n");
+  if (!(meta->flags & SR_META_IP) || meta->in_if == NULL) {
+    LOG_ERROR("Packet length is too small for IP header.");
     return;
   }
-  printf("Size of sr_ethernet_hdr_t: %zu\n", sizeof(sr_ethernet_hdr_t));
-  printf("Size of sr_ip_hdr_t: %zu\n", sizeof(sr_ip_hdr_t));
-  printf("Size of sr_icmp_t3_hdr_t: %zu\n", sizeof(sr_icmp_t3_hdr_t));
-  printf("Offset of data in sr_icmp_t3_hdr_t: %zu\n", offsetof(sr_icmp_t3_hdr_t, data));
+  out_interface = meta->in_if;
+  LOG_DEBUG("## sending icmp response.type: %d", type);
 
-  request_eth_hdr = (sr_ethernet_hdr_t *)packet;
-  request_ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
-
-  if (type == 0) {
-    response_len = len;
-  } else {
-    response_len = sizeof(sr_icmp_t3_hdr_t) + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t);
+  /* [x] Errors start from the interface's template, see sr_send_icmp_t3 */
+  if (type != 0) {
+    sr_send_icmp_t3(sr, meta, meta->in_idx, type, code, ip_interface ? ip_interface->ip : 0);
+    return;
   }
 
-  printf("response_len: %d\n", response_len);
-
-  response = (uint8_t *)calloc(1, response_len);
+  /* Echo the request's ICMP part, dropping any IP options */
+  response_len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + meta->l4_len;
+  LOG_DEBUG("response_len: %d", response_len);
 
-  printf("## getting iface\n");
-  out_interface = sr_get_interface(sr, interface);
-  printf("## sending icmp response.type: %d\n", type);
-  /* ICMP */
-  if (type == 0) {
-    /* [x] Fix: use different struct */
-    sr_icmp_hdr_t *response_icmp_hdr = (sr_icmp_hdr_t *)(response + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-    memcpy(response_icmp_hdr, packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t),
-           response_len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t));
-    response_icmp_hdr->icmp_type = type;
-    response_icmp_hdr->icmp_code = code;
-    response_icmp_hdr->icmp_sum = 0;
-    response_icmp_hdr->icmp_sum =
-        cksum(response_icmp_hdr, response_len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t));
-  } else {
-    sr_icmp_t3_hdr_t *response_icmp_hdr =
-        (sr_icmp_t3_hdr_t *)(response + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-    response_icmp_hdr->next_mtu = 0;
-    response_icmp_hdr->icmp_type = type;
-    response_icmp_hdr->icmp_code = code;
-    response_icmp_hdr->unused = 0;
-
-    memcpy(response_icmp_hdr->data, request_ip_hdr, ICMP_DATA_SIZE);
-    response_icmp_hdr->icmp_sum = 0;
-    response_icmp_hdr->icmp_sum = cksum(response_icmp_hdr, sizeof(sr_icmp_t3_hdr_t));
+  if ((pb = sr_pktbuf_alloc(&(sr->pool), response_len)) == NULL) {
+    LOG_ERROR("No packet buffer for ICMP response");
+    return;
   }
-  printf("response_icmp_hdr icmp_sum: %d\n", response_icmp_hdr->icmp_sum);
+  response = pb->data;
 
-  /* IP */
-  printf("## copying ip header\n");
-  if (ip_interface == NULL) {
-    ip_src = out_interface->ip;
-  } else {
-    ip_src = ip_interface->ip;
-  }
-  /* [x] Fix: wrong pointer */
-  response_ip_hdr = (sr_ip_hdr_t *)(response + sizeof(sr_ethernet_hdr_t)); /* Missing initialization */
-  memcpy(response_ip_hdr, request_ip_hdr, sizeof(sr_ip_hdr_t));
-  response_ip_hdr->ip_ttl = INIT_TTL;
-  response_ip_hdr->ip_p = ip_protocol_icmp;
-  response_ip_hdr->ip_src = ip_src;
-  response_ip_hdr->ip_dst = request_ip_hdr->ip_src;
+  /* ICMP */
+  /* [x] Fix: use different struct */
+  response_icmp_hdr = (sr_icmp_hdr_t *)(response + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
+  memcpy(response_icmp_hdr, meta->frame + meta->l4_off, meta->l4_len);
+  response_icmp_hdr->icmp_type = type;
+  response_icmp_hdr->icmp_code = code;
+  response_icmp_hdr->icmp_sum = 0;
+  response_icmp_hdr->icmp_sum = cksum(response_icmp_hdr, meta->l4_len);
+  LOG_DEBUG("response_icmp_hdr icmp_sum: %d", response_icmp_hdr->icmp_sum);
+
+  /* IP and ETH, from the same template as the errors */
+  LOG_DEBUG("## copying ip header");
+  memcpy(response, out_interface->icmp_tmpl, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
+  response_ip_hdr = (sr_ip_hdr_t *)(response + sizeof(sr_ethernet_hdr_t));
+  response_ip_hdr->ip_src = ip_interface ? ip_interface->ip : out_interface->ip;
+  response_ip_hdr->ip_dst = meta->ip_src;
   response_ip_hdr->ip_len = htons(response_len - sizeof(sr_ethernet_hdr_t));
   response_ip_hdr->ip_sum = 0;
   response_ip_hdr->ip_sum = cksum(response_ip_hdr, sizeof(sr_ip_hdr_t));
 
-  /* ETH */
-  printf("## copying eth header\n");
-  /* [x] Fix: wrong pointer */
-  response_eth_hdr = (sr_ethernet_hdr_t *)response; /* Missing initialization */
-  memcpy(response_eth_hdr->ether_shost, out_interface->addr, sizeof(uint8_t) * ETHER_ADDR_LEN);
+  LOG_DEBUG("## copying eth header");
+  request_eth_hdr = (sr_ethernet_hdr_t *)meta->frame;
+  response_eth_hdr = (sr_ethernet_hdr_t *)response;
   memcpy(response_eth_hdr->ether_dhost, request_eth_hdr->ether_shost, sizeof(uint8_t) * ETHER_ADDR_LEN);
-  response_eth_hdr->ether_type = htons(ethertype_ip);
 
-  printf("## sending packet\n");
-  sr_send_packet(sr, response, response_len, interface);
+  LOG_DEBUG("## sending packet");
+  sr_send_packet_idx(sr, response, response_len, meta->in_idx);
 
-  printf("## free\n");
-  free(response);
-}
\ No newline at end of file
+  LOG_DEBUG("## free");
+  sr_pktbuf_put(&(sr->pool), pb);
+}
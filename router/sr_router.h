@@ -14,6 +14,9 @@
 #include <sys/time.h>
 
 #include "sr_arpcache.h"
+#include "sr_event.h"
+#include "sr_if.h"
+#include "sr_pktbuf.h"
 #include "sr_protocol.h"
 
 /* we dont like this debug , but what to do for varargs ? */
@@ -38,9 +41,31 @@
 #define INIT_TTL 255
 #define PACKET_DUMP_SIZE 1024
 
+/* outgoing frames are batched per thread and written out together once
+ * either limit is hit or at the end of the receive burst or timer pass that
+ * queued them */
+#define SR_TX_BATCH_FRAMES 64
+#define SR_TX_BATCH_BYTES (64 * 1024)
+
+/* received frames are handed to sr_handlepacket_burst(..) in vectors of up
+ * to SR_BURST_MAX; headers are prefetched SR_BURST_PREFETCH frames ahead */
+#define SR_BURST_MAX 32
+#define SR_BURST_PREFETCH 4
+
+/* interfaces are numbered 0 .. if_count-1 in the order they are added and
+ * the data path names them by that index; SR_IF_NONE stands for none */
+#define SR_IF_MAX 32
+#define SR_IF_NONE ((unsigned int)-1)
+
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_pipeline;
+struct sr_afpacket;
+struct sr_xdp;
+struct sr_shm;
+struct sr_uring;
+struct sr_capture;
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -57,10 +82,30 @@ struct sr_instance {
   unsigned short topo_id;
   struct sockaddr_in sr_addr;  /* address to server */
   struct sr_if* if_list;       /* list of interfaces */
+  /* -- the same interfaces by index -- */
+  struct sr_if* if_table[SR_IF_MAX];
+  unsigned int if_count;
+  /* -- every address the router answers for -- */
+  struct sr_local_addr local_addrs[SR_LOCAL_ADDR_SLOTS];
+  unsigned int local_addr_count;
   struct sr_rt* routing_table; /* routing table */
   struct sr_arpcache cache;    /* ARP cache */
+  struct sr_pktpool pool;      /* packet buffers */
+  struct sr_event_loop loop;   /* drives sockfd, timers and signals */
+  struct sr_event* vns_ev;     /* sockfd's registration with loop */
+  uint8_t* rx_buf;             /* commands read from sockfd */
+  unsigned int rx_len;
+  unsigned int rx_off;         /* handled part of rx_buf, kept while batched frames point into it */
+  int vns_uring;                /* drive sockfd through io_uring */
+  struct sr_uring* uring;       /* sockfd's io_uring, 0 if unused */
+  struct sr_pipeline* pipeline; /* worker threads, 0 if single threaded */
+  struct sr_afpacket* afp;      /* local interfaces, 0 when talking to VNS */
+  struct sr_xdp* xdp;           /* local interfaces over AF_XDP, 0 if unused */
+  struct sr_shm* shm;           /* shared memory link to a local relay, 0 if unused */
   pthread_attr_t attr;
-  FILE* logfile;
+  struct sr_capture* capture; /* -l packet capture, 0 if off */
+  const char* flight_file;    /* where SIGUSR2 saves the flight recorder */
+  struct sr_ctl* ctl;         /* control socket, 0 if off */
 };
 
 /* -- sr_main.c -- */
@@ -68,15 +113,26 @@ int sr_verify_routing_table(struct sr_instance* sr);
 
 /* -- sr_vns_comm.c -- */
 int sr_send_packet(struct sr_instance*, uint8_t*, unsigned int, const char*);
+int sr_send_packet_idx(struct sr_instance*, uint8_t*, unsigned int, unsigned int);
 int sr_connect_to_server(struct sr_instance*, unsigned short, char*);
 int sr_read_from_server(struct sr_instance*);
+int sr_vns_start(struct sr_instance*);
+int sr_vns_receive(struct sr_instance*, uint8_t*, unsigned int);
+int sr_flush_packets(struct sr_instance*);
+int sr_vns_queue_frame(struct sr_instance*, uint8_t*, unsigned int, unsigned int);
+int sr_queue_frame(struct sr_instance*, uint8_t*, unsigned int, unsigned int);
+void sr_input_frame(struct sr_instance*, uint8_t*, unsigned int, unsigned int);
+void sr_input_burst(struct sr_instance*, uint8_t**, unsigned int*, unsigned int*, unsigned int);
+void sr_log_packet(struct sr_instance*, uint8_t*, int, unsigned int, int);
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance*);
 void sr_handlepacket(struct sr_instance*, uint8_t*, unsigned int, char*);
+void sr_handlepacket_idx(struct sr_instance*, uint8_t*, unsigned int, unsigned int, uint64_t);
+void sr_handlepacket_burst(struct sr_instance*, uint8_t**, unsigned int*, unsigned int*, const uint64_t*, unsigned int);
 
 /* -- sr_if.c -- */
-void sr_add_interface(struct sr_instance*, const char*);
+int sr_add_interface(struct sr_instance*, const char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_print_if_list(struct sr_instance*);
@@ -93,6 +93,7 @@ void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest, struct in_addr
     sr->routing_table->gw = gw;
     sr->routing_table->mask = mask;
     strncpy(sr->routing_table->interface, if_name, sr_IFACE_NAMELEN);
+    sr->routing_table->if_index = SR_IF_NONE;
 
     return;
   }
@@ -112,6 +113,7 @@ void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest, struct in_addr
   rt_walker->gw = gw;
   rt_walker->mask = mask;
   strncpy(rt_walker->interface, if_name, sr_IFACE_NAMELEN);
+  rt_walker->if_index = SR_IF_NONE;
 
 } /* -- sr_add_entry -- */
 
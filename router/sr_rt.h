@@ -32,6 +32,7 @@ struct sr_rt {
   struct in_addr gw;
   struct in_addr mask;
   char interface[sr_IFACE_NAMELEN];
+  unsigned int if_index; /* interface's index, set by sr_verify_routing_table */
   struct sr_rt* next;
 };
 
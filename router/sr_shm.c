@@ -0,0 +1,315 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.c
+ *
+ * Description:
+ *
+ * Shared-memory relay backend, see sr_shm.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_shm.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "sr_if.h"
+#include "sr_router.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_add_ifaces(..)
+ * Scope: Local
+ *
+ * Create the interfaces the relay announced in the region header.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_shm_add_ifaces(struct sr_instance* sr, struct sr_shm_region* region) {
+  char name[SR_SHM_IFACE_NAMELEN + 1];
+  unsigned int i;
+
+  for (i = 0; i < region->niface; i++) {
+    memcpy(name, region->ifaces[i].name, SR_SHM_IFACE_NAMELEN);
+    name[SR_SHM_IFACE_NAMELEN] = 0;
+    if (sr_add_interface(sr, name) != 0) {
+      break;
+    }
+    sr_set_ether_addr(sr, region->ifaces[i].addr);
+    sr_set_ether_ip(sr, region->ifaces[i].ip);
+  }
+
+  printf("Router interfaces:\n");
+  sr_print_if_list(sr);
+} /* -- sr_shm_add_ifaces -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_open(..)
+ * Scope: Global
+ *
+ * Connect to the relay listening on the Unix socket path, map the shared
+ * region it hands over and set up its interfaces.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_open(struct sr_instance* sr, const char* path) {
+  struct sr_shm* shm;
+  struct sockaddr_un addr;
+  int fds[3];
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(path);
+
+  if ((shm = (struct sr_shm*)calloc(1, sizeof(struct sr_shm))) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_shm_open)\n");
+    return -1;
+  }
+  shm->sr = sr;
+  shm->sock = shm->memfd = shm->efd_sr = shm->efd_relay = -1;
+  sr->shm = shm;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  if ((shm->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+    perror("socket(..):sr_shm.c::sr_shm_open(..)");
+    return -1;
+  }
+  if (connect(shm->sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    fprintf(stderr, "Error connecting to relay at %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  /* -- the relay sends the memfd, then our eventfd, then its own -- */
+  if (sr_shm_recv_fds(shm->sock, fds, 3) != 0) {
+    return -1;
+  }
+  shm->memfd = fds[0];
+  shm->efd_sr = fds[1];
+  shm->efd_relay = fds[2];
+
+  if ((shm->region = sr_shm_map(shm->memfd)) == 0) {
+    return -1;
+  }
+  sr_shm_end_init(&(shm->rx), shm->region, 1, shm->efd_sr);
+  sr_shm_end_init(&(shm->tx), shm->region, 0, shm->efd_relay);
+
+  sr_shm_add_ifaces(sr, shm->region);
+  return 0;
+} /* -- sr_shm_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_event(..)
+ * Scope: Local
+ *
+ * Event loop callback for our eventfd.  Handle the frames in the to_sr
+ * ring (up to SR_SHM_RX_BURST) in vectors of SR_BURST_MAX, releasing
+ * each vector's slots once the router is done with it, then ask the
+ * relay for a wakeup once the ring is empty.  If the burst ran out
+ * first, poke our own eventfd so the loop comes back after its timers.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_shm_event(int fd, uint32_t events, void* arg) {
+  struct sr_shm* shm = (struct sr_shm*)arg;
+  char name[SR_SHM_IFACE_NAMELEN + 1];
+  uint8_t* frames[SR_BURST_MAX];
+  unsigned int lens[SR_BURST_MAX];
+  unsigned int ifidx[SR_BURST_MAX];
+  struct sr_shm_desc* desc;
+  struct sr_if* iface;
+  uint8_t* frame;
+  uint64_t one = 1;
+  unsigned int n, got, m;
+
+  sr_shm_wake_drain(&(shm->rx));
+
+  for (n = 0; n < SR_SHM_RX_BURST; n += got) {
+    m = 0;
+    for (got = 0; got < SR_BURST_MAX && n + got < SR_SHM_RX_BURST && (frame = sr_shm_next(&(shm->rx), &desc)) != 0;
+         got++) {
+      /* -- the descriptor is shared, take a private copy of what we use -- */
+      memcpy(name, desc->iface, SR_SHM_IFACE_NAMELEN);
+      name[SR_SHM_IFACE_NAMELEN] = 0;
+      if ((lens[m] = desc->len) <= SR_SHM_SLOT_SIZE && (iface = sr_get_interface(shm->sr, name)) != 0) {
+        frames[m] = frame;
+        ifidx[m] = iface->index;
+        m++;
+      }
+    }
+
+    if (m > 0) {
+      sr_input_burst(shm->sr, frames, lens, ifidx, m);
+    }
+    if (got > 0) {
+      sr_shm_release(&(shm->rx));
+    }
+    if (frame == 0 && sr_shm_sleep(&(shm->rx))) {
+      break;
+    }
+  }
+
+  if (n == SR_SHM_RX_BURST && write(shm->efd_sr, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+    perror("write(..):sr_shm.c::sr_shm_event(..)");
+  }
+
+  /* -- end of the receive burst -- */
+  sr_flush_packets(shm->sr);
+} /* -- sr_shm_event -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_hangup(..)
+ * Scope: Local
+ *
+ * The relay never writes to the socket, so it being readable means the
+ * relay has gone.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_shm_hangup(int fd, uint32_t events, void* arg) {
+  struct sr_shm* shm = (struct sr_shm*)arg;
+
+  fprintf(stderr, "Error: relay closed the connection\n");
+  sr_event_stop(&(shm->sr->loop));
+} /* -- sr_shm_hangup -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_start(..)
+ * Scope: Global
+ *
+ * Register the eventfd and the relay socket with the event loop.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_start(struct sr_instance* sr) {
+  struct sr_shm* shm;
+  uint64_t one = 1;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(sr->shm);
+
+  shm = sr->shm;
+  if ((shm->ev = sr_event_add_fd(&(sr->loop), shm->efd_sr, EPOLLIN, sr_shm_event, shm)) == 0 ||
+      (shm->sock_ev = sr_event_add_fd(&(sr->loop), shm->sock, EPOLLIN, sr_shm_hangup, shm)) == 0) {
+    return -1;
+  }
+
+  /* -- frames may be waiting already, or the relay must learn we sleep -- */
+  if (!sr_shm_sleep(&(shm->rx)) && write(shm->efd_sr, &one, sizeof(one)) == -1) {
+    perror("write(..):sr_shm.c::sr_shm_start(..)");
+    return -1;
+  }
+
+  printf(" <-- Ready to process packets --> \n");
+  return 0;
+} /* -- sr_shm_start -- */
+
+void sr_shm_close(struct sr_instance* sr) {
+  struct sr_shm* shm;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+
+  if ((shm = sr->shm) == 0) {
+    return;
+  }
+
+  sr_shm_unmap(shm->region);
+  if (shm->efd_relay >= 0) {
+    close(shm->efd_relay);
+  }
+  if (shm->efd_sr >= 0) {
+    close(shm->efd_sr);
+  }
+  if (shm->memfd >= 0) {
+    close(shm->memfd);
+  }
+  if (shm->sock >= 0) {
+    close(shm->sock);
+  }
+  free(shm);
+  sr->shm = 0;
+} /* -- sr_shm_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_send(..)
+ * Scope: Global
+ *
+ * Copy a frame into the from_sr ring.  The relay only sees it every
+ * SR_TX_BATCH_FRAMES frames or when sr_shm_flush(..) runs.  If the ring
+ * is full, publish and wait for the relay to make room.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_send(struct sr_instance* sr, uint8_t* buf, unsigned int len, unsigned int ifidx) {
+  struct sr_shm* shm;
+  struct sr_if* iface;
+  struct pollfd pfd;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(sr->shm);
+  assert(buf);
+
+  shm = sr->shm;
+  if ((iface = sr_get_interface_idx(sr, ifidx)) == 0) {
+    fprintf(stderr, "** Error, interface %u, does not exist\n", ifidx);
+    return -1;
+  }
+  if (len > SR_SHM_SLOT_SIZE) {
+    fprintf(stderr, "** Error: packet of %u bytes does not fit a ring slot\n", len);
+    return -1;
+  }
+
+  while (sr_shm_push(&(shm->tx), buf, len, iface->name) != 0) {
+    shm->tx_pending = 0;
+    if (sr_shm_publish(&(shm->tx)) != 0) {
+      return -1;
+    }
+
+    /* -- give up if the relay has gone -- */
+    pfd.fd = shm->sock;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) != 0) {
+      fprintf(stderr, "** Error: relay is not draining its ring\n");
+      return -1;
+    }
+    sched_yield();
+  }
+
+  if (++shm->tx_pending >= SR_TX_BATCH_FRAMES) {
+    return sr_shm_flush(sr);
+  }
+  return 0;
+} /* -- sr_shm_send -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_flush(..)
+ * Scope: Global
+ *
+ * Publish the pushed frames, waking the relay if it sleeps.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_flush(struct sr_instance* sr) {
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(sr->shm);
+
+  sr->shm->tx_pending = 0;
+  return sr_shm_publish(&(sr->shm->tx));
+} /* -- sr_shm_flush -- */
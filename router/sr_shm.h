@@ -0,0 +1,54 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.h
+ *
+ * Description:
+ *
+ * Attachment to a relay process on the same host over shared memory, as
+ * an alternative to the VNS server's TCP connection.  sr connects to the
+ * relay's Unix socket, receives the memfd and eventfds of sr_shm_ring.h
+ * and the interfaces to use, and from then on exchanges frames through
+ * the rings only.  The socket stays open so either side notices when the
+ * other goes away.  sr_relay is a stand-in relay for measurements.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SHM_H
+#define SR_SHM_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include "sr_shm_ring.h"
+
+#define SR_SHM_RX_BURST 256 /* frames handled per readiness event */
+
+struct sr_instance;
+struct sr_event;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_shm
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_shm {
+  struct sr_instance* sr;
+  int sock;      /* connection to the relay */
+  int memfd;     /* holds region */
+  int efd_sr;    /* the relay wakes us through it */
+  int efd_relay; /* we wake the relay through it */
+  struct sr_shm_region* region;
+  struct sr_shm_end rx; /* to_sr ring */
+  struct sr_shm_end tx; /* from_sr ring */
+  struct sr_event* ev;
+  struct sr_event* sock_ev;
+  unsigned int tx_pending; /* frames pushed since the last publish */
+};
+
+int sr_shm_open(struct sr_instance* sr, const char* path);
+int sr_shm_start(struct sr_instance* sr);
+void sr_shm_close(struct sr_instance* sr);
+int sr_shm_send(struct sr_instance* sr, uint8_t* buf, unsigned int len, unsigned int ifidx);
+int sr_shm_flush(struct sr_instance* sr);
+
+#endif /* -- SR_SHM_H -- */
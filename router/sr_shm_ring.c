@@ -0,0 +1,342 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm_ring.c
+ *
+ * Description:
+ *
+ * Shared-memory rings between sr and a relay, see sr_shm_ring.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_shm_ring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_create(..)
+ * Scope: Global
+ *
+ * Relay side.  Create and map a fresh region, leaving its memfd in *fd.
+ * The caller fills in the interfaces.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_shm_region* sr_shm_create(int* fd) {
+  struct sr_shm_region* region;
+
+  /* -- REQUIRES -- */
+  assert(fd);
+
+  if ((*fd = memfd_create("sr_shm", MFD_CLOEXEC)) == -1) {
+    perror("memfd_create(..):sr_shm_ring.c::sr_shm_create(..)");
+    return 0;
+  }
+  if (ftruncate(*fd, sizeof(struct sr_shm_region)) == -1) {
+    perror("ftruncate(..):sr_shm_ring.c::sr_shm_create(..)");
+    close(*fd);
+    return 0;
+  }
+
+  region = (struct sr_shm_region*)mmap(0, sizeof(struct sr_shm_region), PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_POPULATE, *fd, 0);
+  if (region == MAP_FAILED) {
+    perror("mmap(..):sr_shm_ring.c::sr_shm_create(..)");
+    close(*fd);
+    return 0;
+  }
+
+  region->magic = SR_SHM_MAGIC;
+  region->version = SR_SHM_VERSION;
+  region->size = sizeof(struct sr_shm_region);
+  return region;
+} /* -- sr_shm_create -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_map(..)
+ * Scope: Global
+ *
+ * sr side.  Map the region in the memfd received from the relay and make
+ * sure it was laid out by a build that agrees with ours.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_shm_region* sr_shm_map(int fd) {
+  struct sr_shm_region* region;
+  struct stat st;
+
+  if (fstat(fd, &st) == -1) {
+    perror("fstat(..):sr_shm_ring.c::sr_shm_map(..)");
+    return 0;
+  }
+  if (st.st_size < (off_t)sizeof(struct sr_shm_region)) {
+    fprintf(stderr, "Error: shared memory region is too small\n");
+    return 0;
+  }
+
+  region = (struct sr_shm_region*)mmap(0, sizeof(struct sr_shm_region), PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_POPULATE, fd, 0);
+  if (region == MAP_FAILED) {
+    perror("mmap(..):sr_shm_ring.c::sr_shm_map(..)");
+    return 0;
+  }
+
+  if (region->magic != SR_SHM_MAGIC || region->version != SR_SHM_VERSION ||
+      region->size != sizeof(struct sr_shm_region) || region->niface > SR_SHM_MAX_IFACES) {
+    fprintf(stderr, "Error: shared memory region has the wrong layout\n");
+    sr_shm_unmap(region);
+    return 0;
+  }
+
+  return region;
+} /* -- sr_shm_map -- */
+
+void sr_shm_unmap(struct sr_shm_region* region) {
+  if (region) {
+    munmap(region, sizeof(struct sr_shm_region));
+  }
+} /* -- sr_shm_unmap -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_end_init(..)
+ * Scope: Global
+ *
+ * Set up one side of the to_sr (to_sr != 0) or from_sr ring of a fresh
+ * region.  efd is the eventfd of the ring's consumer.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_shm_end_init(struct sr_shm_end* end, struct sr_shm_region* region, int to_sr, int efd) {
+  /* -- REQUIRES -- */
+  assert(end);
+  assert(region);
+
+  end->ring = to_sr ? &(region->to_sr) : &(region->from_sr);
+  end->bufs = region->bufs[to_sr ? 0 : 1];
+  end->local = 0;
+  end->cached = 0;
+  end->efd = efd;
+} /* -- sr_shm_end_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_push(..)
+ * Scope: Global
+ *
+ * Producer side.  Copy a frame into the next slot; it is not seen by the
+ * consumer until sr_shm_publish(..).  Returns 0 on success, -1 if the
+ * ring is full.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_push(struct sr_shm_end* tx, const uint8_t* frame, unsigned int len, const char* iface) {
+  struct sr_shm_desc* desc;
+  uint32_t idx;
+
+  /* -- REQUIRES -- */
+  assert(len <= SR_SHM_SLOT_SIZE);
+
+  if (tx->local - tx->cached == SR_SHM_SLOTS) {
+    tx->cached = __atomic_load_n(&(tx->ring->head), __ATOMIC_ACQUIRE);
+    if (tx->local - tx->cached == SR_SHM_SLOTS) {
+      return -1;
+    }
+  }
+
+  idx = tx->local & (SR_SHM_SLOTS - 1);
+  memcpy(tx->bufs[idx], frame, len);
+  desc = &(tx->ring->desc[idx]);
+  desc->len = len;
+  strncpy(desc->iface, iface, SR_SHM_IFACE_NAMELEN);
+  tx->local++;
+
+  return 0;
+} /* -- sr_shm_push -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_publish(..)
+ * Scope: Global
+ *
+ * Producer side.  Make the pushed frames visible and wake the consumer
+ * if it went to sleep.  Returns -1 if the wakeup could not be sent.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_publish(struct sr_shm_end* tx) {
+  uint64_t one = 1;
+
+  if (tx->ring->tail == tx->local) {
+    return 0;
+  }
+
+  __atomic_store_n(&(tx->ring->tail), tx->local, __ATOMIC_RELEASE);
+
+  /* -- pairs with the fence in sr_shm_sleep(..): either the consumer sees
+   *    the new tail or we see it sleeping -- */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&(tx->ring->sleeping), __ATOMIC_RELAXED) &&
+      __atomic_exchange_n(&(tx->ring->sleeping), 0, __ATOMIC_SEQ_CST)) {
+    if (write(tx->efd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+      perror("write(..):sr_shm_ring.c::sr_shm_publish(..)");
+      return -1;
+    }
+  }
+
+  return 0;
+} /* -- sr_shm_publish -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_next(..)
+ * Scope: Global
+ *
+ * Consumer side.  The oldest frame not taken yet and its descriptor, or
+ * 0 if there is none.  Taken slots stay the caller's, so several can be
+ * held at once, until sr_shm_release(..) hands them all back.
+ *
+ *---------------------------------------------------------------------*/
+
+uint8_t* sr_shm_next(struct sr_shm_end* rx, struct sr_shm_desc** desc) {
+  uint32_t idx;
+
+  if (rx->local == rx->cached) {
+    rx->cached = __atomic_load_n(&(rx->ring->tail), __ATOMIC_ACQUIRE);
+    if (rx->local == rx->cached) {
+      return 0;
+    }
+  }
+
+  idx = rx->local++ & (SR_SHM_SLOTS - 1);
+  *desc = &(rx->ring->desc[idx]);
+  return rx->bufs[idx];
+} /* -- sr_shm_next -- */
+
+void sr_shm_release(struct sr_shm_end* rx) {
+  __atomic_store_n(&(rx->ring->head), rx->local, __ATOMIC_RELEASE);
+} /* -- sr_shm_release -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_sleep(..)
+ * Scope: Global
+ *
+ * Consumer side, once the ring looks empty.  Ask the producer for a
+ * wakeup.
+ *
+ * RETURN VALUES:
+ *
+ *  1 if the consumer may now block on its eventfd
+ *  0 if frames arrived meanwhile and it should keep going
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_sleep(struct sr_shm_end* rx) {
+  __atomic_store_n(&(rx->ring->sleeping), 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&(rx->ring->tail), __ATOMIC_ACQUIRE) != rx->local) {
+    __atomic_store_n(&(rx->ring->sleeping), 0, __ATOMIC_RELAXED);
+    return 0;
+  }
+  return 1;
+} /* -- sr_shm_sleep -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_wake_drain(..)
+ * Scope: Global
+ *
+ * Consumer side.  Clear a wakeup from the (non-blocking) eventfd.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_shm_wake_drain(struct sr_shm_end* rx) {
+  uint64_t count;
+
+  while (read(rx->efd, &count, sizeof(count)) == -1 && errno == EINTR) {
+  }
+} /* -- sr_shm_wake_drain -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_send_fds(..)
+ * Scope: Global
+ *
+ * Pass n file descriptors over the Unix socket sock.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_send_fds(int sock, const int* fds, int n) {
+  char control[CMSG_SPACE(4 * sizeof(int))];
+  struct msghdr msg;
+  struct cmsghdr* cmsg;
+  struct iovec iov;
+  char byte = 0;
+
+  /* -- REQUIRES -- */
+  assert(n > 0 && n <= 4);
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(n * sizeof(int));
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, n * sizeof(int));
+
+  if (sendmsg(sock, &msg, 0) == -1) {
+    perror("sendmsg(..):sr_shm_ring.c::sr_shm_send_fds(..)");
+    return -1;
+  }
+  return 0;
+} /* -- sr_shm_send_fds -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_recv_fds(..)
+ * Scope: Global
+ *
+ * Receive exactly n file descriptors sent with sr_shm_send_fds(..).
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_recv_fds(int sock, int* fds, int n) {
+  char control[CMSG_SPACE(4 * sizeof(int))];
+  struct msghdr msg;
+  struct cmsghdr* cmsg;
+  struct iovec iov;
+  char byte;
+
+  /* -- REQUIRES -- */
+  assert(n > 0 && n <= 4);
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) <= 0) {
+    perror("recvmsg(..):sr_shm_ring.c::sr_shm_recv_fds(..)");
+    return -1;
+  }
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == 0 || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(n * sizeof(int))) {
+    fprintf(stderr, "Error: expected %d descriptors from the relay\n", n);
+    return -1;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), n * sizeof(int));
+
+  return 0;
+} /* -- sr_shm_recv_fds -- */
@@ -0,0 +1,127 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm_ring.h
+ *
+ * Description:
+ *
+ * Shared-memory link between sr and a relay process on the same host,
+ * used by both sides.  The relay creates a memfd holding a header, one
+ * single producer / single consumer descriptor ring per direction and a
+ * packet buffer area with one slot per descriptor, plus an eventfd per
+ * side, and passes all three to sr over a Unix socket.  Frames are copied
+ * into the producer's next slot and published by moving the ring's tail.
+ * A consumer that runs out of frames sets its ring's sleeping flag before
+ * blocking on its eventfd, and producers only write the eventfd when they
+ * see the flag, so neither side makes a system call while both are busy.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SHM_RING_H
+#define SR_SHM_RING_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include "sr_ring.h"
+
+#define SR_SHM_MAGIC 0x73726d31 /* "srm1" */
+#define SR_SHM_VERSION 1
+#define SR_SHM_SLOTS 1024     /* descriptors per direction, power of two */
+#define SR_SHM_SLOT_SIZE 2048 /* largest frame */
+#define SR_SHM_MAX_IFACES 8
+#define SR_SHM_IFACE_NAMELEN 16 /* as in c_packet_header */
+#define SR_SHM_DEFAULT_PATH "/tmp/sr_relay.sock"
+
+/* ----------------------------------------------------------------------------
+ * struct sr_shm_iface
+ *
+ * A router interface, as announced by the relay
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_shm_iface {
+  char name[SR_SHM_IFACE_NAMELEN];
+  uint8_t addr[6];
+  uint8_t pad[2];
+  uint32_t ip; /* network byte order */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_shm_desc
+ *
+ * Descriptor i of a ring describes buffer slot i of its direction
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_shm_desc {
+  uint32_t len;
+  char iface[SR_SHM_IFACE_NAMELEN];
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_shm_ring
+ *
+ * tail, head and sleeping live on their own cache lines so the two
+ * processes do not false-share.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_shm_ring {
+  uint32_t tail __attribute__((aligned(SR_CACHE_LINE)));     /* next descriptor to fill, owned by producer */
+  uint32_t head __attribute__((aligned(SR_CACHE_LINE)));     /* next descriptor to drain, owned by consumer */
+  uint32_t sleeping __attribute__((aligned(SR_CACHE_LINE))); /* consumer is blocked on its eventfd */
+  struct sr_shm_desc desc[SR_SHM_SLOTS] __attribute__((aligned(SR_CACHE_LINE)));
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_shm_region
+ *
+ * Layout of the memfd
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_shm_region {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size; /* sizeof(struct sr_shm_region) */
+  uint32_t niface;
+  struct sr_shm_iface ifaces[SR_SHM_MAX_IFACES];
+  struct sr_shm_ring to_sr;   /* relay -> sr */
+  struct sr_shm_ring from_sr; /* sr -> relay */
+  uint8_t bufs[2][SR_SHM_SLOTS][SR_SHM_SLOT_SIZE] __attribute__((aligned(4096))); /* to_sr, from_sr */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_shm_end
+ *
+ * One side's private view of a ring.  local is the producer's unpublished
+ * tail or the consumer's next descriptor to take, ahead of its published
+ * head while it holds taken slots; cached is the last index seen from the
+ * other side.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_shm_end {
+  struct sr_shm_ring* ring;
+  uint8_t (*bufs)[SR_SHM_SLOT_SIZE];
+  uint32_t local;
+  uint32_t cached;
+  int efd; /* consumer's eventfd */
+};
+
+struct sr_shm_region* sr_shm_create(int* fd);
+struct sr_shm_region* sr_shm_map(int fd);
+void sr_shm_unmap(struct sr_shm_region* region);
+void sr_shm_end_init(struct sr_shm_end* end, struct sr_shm_region* region, int to_sr, int efd);
+
+int sr_shm_push(struct sr_shm_end* tx, const uint8_t* frame, unsigned int len, const char* iface);
+int sr_shm_publish(struct sr_shm_end* tx);
+uint8_t* sr_shm_next(struct sr_shm_end* rx, struct sr_shm_desc** desc);
+void sr_shm_release(struct sr_shm_end* rx);
+int sr_shm_sleep(struct sr_shm_end* rx);
+void sr_shm_wake_drain(struct sr_shm_end* rx);
+
+int sr_shm_send_fds(int sock, const int* fds, int n);
+int sr_shm_recv_fds(int sock, int* fds, int n);
+
+#endif /* -- SR_SHM_RING_H -- */
@@ -0,0 +1,310 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.c
+ *
+ * Description:
+ *
+ * Per thread packet counters, see sr_stats.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_stats.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "sr_if.h"
+
+static struct sr_stats* sr_stats_blocks[SR_STATS_THREADS];
+static unsigned int sr_stats_nblocks;
+
+/* -- counted into with atomic adds by threads that found no block left -- */
+static struct sr_stats sr_stats_shared;
+
+/* -- this thread's block, and whether it is the shared one -- */
+static __thread struct sr_stats* sr_stats_self;
+static __thread int sr_stats_is_shared;
+
+/* -- only the owning thread writes a counter, readers may load it at any time -- */
+#define SR_STAT_ADD(c, n)                                      \
+  do {                                                         \
+    if (sr_stats_is_shared) {                                  \
+      __atomic_add_fetch(&(c), (n), __ATOMIC_RELAXED);         \
+    } else {                                                   \
+      __atomic_store_n(&(c), (c) + (n), __ATOMIC_RELAXED);     \
+    }                                                          \
+  } while (0)
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_attach(..)
+ * Scope: Local
+ *
+ * Give the calling thread its block, once.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_stats* sr_stats_attach(void) {
+  struct sr_stats* s;
+  unsigned int i;
+
+  if ((i = __atomic_fetch_add(&sr_stats_nblocks, 1, __ATOMIC_RELAXED)) >= SR_STATS_THREADS ||
+      posix_memalign((void**)&s, 64, sizeof(struct sr_stats)) != 0) {
+    LOG_WARN("No counter block left for this thread, sharing one");
+    sr_stats_is_shared = 1;
+    sr_stats_self = &sr_stats_shared;
+    return sr_stats_self;
+  }
+  memset(s, 0, sizeof(struct sr_stats));
+  __atomic_store_n(&(sr_stats_blocks[i]), s, __ATOMIC_RELEASE);
+  sr_stats_self = s;
+  return s;
+} /* -- sr_stats_attach -- */
+
+static struct sr_if_stats* sr_stats_if(struct sr_stats* s, unsigned int ifidx) {
+  return &(s->ifs[ifidx < SR_IF_MAX ? ifidx : SR_STATS_NO_IF]);
+} /* -- sr_stats_if -- */
+
+static void sr_stats_record(struct sr_stats* s, unsigned int lat, uint64_t ns) {
+  struct sr_hist* h = &(s->lat[lat]);
+
+  SR_STAT_ADD(h->buckets[sr_hist_bucket(ns)], 1);
+  SR_STAT_ADD(h->sum_ns, ns);
+  SR_STAT_ADD(h->count, 1);
+} /* -- sr_stats_record -- */
+
+const char* sr_lat_name(unsigned int lat) {
+  static const char* names[SR_LAT_MAX] = {"forward", "local", "arp-queued", "arp-wait"};
+
+  return lat < SR_LAT_MAX ? names[lat] : "?";
+} /* -- sr_lat_name -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_burst(..)
+ * Scope: Global
+ *
+ * Count n received packets once the router has decided what to do with
+ * each of them, and time those it sent something for: their burst was
+ * done, every send in it returned, at end_ns (sr_clock_ns()).
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_burst(const struct sr_pkt_meta* meta, unsigned int n, uint64_t end_ns) {
+  struct sr_stats* s = sr_stats_self ? sr_stats_self : sr_stats_attach();
+  struct sr_if_stats* is;
+  unsigned int i;
+
+  for (i = 0; i < n; i++) {
+    is = sr_stats_if(s, meta[i].in_idx);
+    SR_STAT_ADD(is->rx_packets, 1);
+    SR_STAT_ADD(is->rx_bytes, meta[i].len);
+    SR_STAT_ADD(is->disp[meta[i].disp < SR_DISP_MAX ? meta[i].disp : SR_DISP_NONE], 1);
+
+    switch (meta[i].disp) {
+      case SR_DISP_FORWARD:
+        sr_stats_record(s, SR_LAT_FORWARD, end_ns - meta[i].rx_ns);
+        break;
+      case SR_DISP_ECHO_REPLY:
+      case SR_DISP_ARP_REPLY:
+      case SR_DISP_TTL_EXCEEDED:
+      case SR_DISP_NO_ROUTE:
+      case SR_DISP_PORT_UNREACH:
+        sr_stats_record(s, SR_LAT_LOCAL, end_ns - meta[i].rx_ns);
+        break;
+      default:
+        break;
+    }
+  }
+} /* -- sr_stats_burst -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_redecide(..)
+ * Scope: Global
+ *
+ * Count a packet that sr_stats_burst(..) counted under disposition from,
+ * received on ifidx, under to instead, once a later event decided its
+ * fate again.  The thread doing so need not be the one that counted it,
+ * so one thread's count can wrap below zero; the sums stay exact.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_redecide(unsigned int ifidx, unsigned int from, unsigned int to) {
+  struct sr_stats* s = sr_stats_self ? sr_stats_self : sr_stats_attach();
+  struct sr_if_stats* is = sr_stats_if(s, ifidx);
+
+  /* -- REQUIRES -- */
+  assert(from < SR_DISP_MAX);
+  assert(to < SR_DISP_MAX);
+
+  SR_STAT_ADD(is->disp[from], (uint64_t)-1);
+  SR_STAT_ADD(is->disp[to], 1);
+} /* -- sr_stats_redecide -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_latency(..)
+ * Scope: Global
+ *
+ * Record ns in histogram lat (enum sr_lat), for the paths that do not
+ * finish within their burst.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_latency(unsigned int lat, uint64_t ns) {
+  struct sr_stats* s = sr_stats_self ? sr_stats_self : sr_stats_attach();
+
+  /* -- REQUIRES -- */
+  assert(lat < SR_LAT_MAX);
+
+  sr_stats_record(s, lat, ns);
+} /* -- sr_stats_latency -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_tx(..)
+ * Scope: Global
+ *
+ * Count a frame of len bytes sent on ifidx, or that failed to be if ok
+ * is 0.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_tx(unsigned int ifidx, unsigned int len, int ok) {
+  struct sr_stats* s = sr_stats_self ? sr_stats_self : sr_stats_attach();
+  struct sr_if_stats* is = sr_stats_if(s, ifidx);
+
+  if (ok) {
+    SR_STAT_ADD(is->tx_packets, 1);
+    SR_STAT_ADD(is->tx_bytes, len);
+  } else {
+    SR_STAT_ADD(is->tx_errors, 1);
+  }
+} /* -- sr_stats_tx -- */
+
+static void sr_stats_sum(struct sr_stats* sum, struct sr_stats* s) {
+  uint64_t* to = (uint64_t*)sum;
+  uint64_t* from = (uint64_t*)s;
+  unsigned int i;
+
+  /* -- every counter is a uint64_t, histograms included, so the blocks can
+     be summed as flat arrays -- */
+  for (i = 0; i < sizeof(*s) / (sizeof(uint64_t)); i++) {
+    to[i] += __atomic_load_n(&(from[i]), __ATOMIC_RELAXED);
+  }
+} /* -- sr_stats_sum -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_snapshot(..)
+ * Scope: Global
+ *
+ * Sum every thread's counters into sum.  Safe from any thread; the
+ * counters keep moving while they are read, so the sum is as of some
+ * moment during the call for each counter, not one moment for all.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_snapshot(struct sr_stats* sum) {
+  struct sr_stats* s;
+  unsigned int i, n;
+
+  /* -- REQUIRES -- */
+  assert(sum);
+
+  memset(sum, 0, sizeof(*sum));
+  n = __atomic_load_n(&sr_stats_nblocks, __ATOMIC_RELAXED);
+  for (i = 0; i < n && i < SR_STATS_THREADS; i++) {
+    if ((s = __atomic_load_n(&(sr_stats_blocks[i]), __ATOMIC_ACQUIRE)) != 0) {
+      sr_stats_sum(sum, s);
+    }
+  }
+  sr_stats_sum(sum, &sr_stats_shared);
+} /* -- sr_stats_snapshot -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_print_counters(..)
+ * Scope: Global
+ *
+ * Print the counters of every interface in sum that has any, with the
+ * dispositions that occurred.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_print_counters(struct sr_instance* sr, const struct sr_stats* sum, FILE* out) {
+  const struct sr_if_stats* is;
+  struct sr_if* iface;
+  unsigned int i, d;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(sum);
+  assert(out);
+
+  for (i = 0; i <= SR_IF_MAX; i++) {
+    is = &(sum->ifs[i]);
+    if (is->rx_packets == 0 && is->tx_packets == 0 && is->tx_errors == 0) {
+      continue;
+    }
+    iface = i < SR_IF_MAX ? sr_get_interface_idx(sr, i) : 0;
+    fprintf(out, "%s: rx %lu packets %lu bytes, tx %lu packets %lu bytes, %lu tx errors\n",
+            iface ? iface->name : "(none)", (unsigned long)is->rx_packets, (unsigned long)is->rx_bytes,
+            (unsigned long)is->tx_packets, (unsigned long)is->tx_bytes, (unsigned long)is->tx_errors);
+    for (d = 0; d < SR_DISP_MAX; d++) {
+      if (is->disp[d]) {
+        fprintf(out, "  %-18s %lu\n", sr_disp_name(d), (unsigned long)is->disp[d]);
+      }
+    }
+  }
+} /* -- sr_stats_print_counters -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_print_latency(..)
+ * Scope: Global
+ *
+ * Print the percentiles of every latency histogram in sum that has any
+ * samples.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_print_latency(const struct sr_stats* sum, FILE* out) {
+  const struct sr_hist* h;
+  unsigned int i;
+
+  /* -- REQUIRES -- */
+  assert(sum);
+  assert(out);
+
+  for (i = 0; i < SR_LAT_MAX; i++) {
+    h = &(sum->lat[i]);
+    if (h->count == 0) {
+      continue;
+    }
+    fprintf(out, "latency %-10s %lu packets, ns: mean %lu p50 %lu p90 %lu p99 %lu p99.9 %lu max %lu\n",
+            sr_lat_name(i), (unsigned long)h->count, (unsigned long)(h->sum_ns / h->count),
+            (unsigned long)sr_hist_percentile(h, 0.5), (unsigned long)sr_hist_percentile(h, 0.9),
+            (unsigned long)sr_hist_percentile(h, 0.99), (unsigned long)sr_hist_percentile(h, 0.999),
+            (unsigned long)sr_hist_max(h));
+  }
+} /* -- sr_stats_print_latency -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_dump(..)
+ * Scope: Global
+ *
+ * Snapshot the counters and print them, then the latency percentiles.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_dump(struct sr_instance* sr, FILE* out) {
+  struct sr_stats* sum;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(out);
+
+  if ((sum = (struct sr_stats*)malloc(sizeof(struct sr_stats))) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_stats_dump)\n");
+    return;
+  }
+  sr_stats_snapshot(sum);
+  sr_stats_print_counters(sr, sum, out);
+  sr_stats_print_latency(sum, out);
+  free(sum);
+} /* -- sr_stats_dump -- */
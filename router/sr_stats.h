@@ -0,0 +1,85 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.h
+ *
+ * Description:
+ *
+ * Packet counters.  Every thread that handles or sends packets counts
+ * into a block of its own, cache line aligned, so counting is a plain
+ * add on memory no other thread writes.  Readers sum the blocks of all
+ * threads on demand with relaxed loads; they never write to a block or
+ * take a lock, so a snapshot does not slow the forwarding threads down.
+ *
+ * Counts are kept per interface (received on for dispositions and rx,
+ * sent on for tx) and per enum sr_disp, see sr_pktmeta.h.
+ *
+ * Next to them are latency histograms (sr_hist.h), from the moment a
+ * frame was read from its transport to the moment the router's send for
+ * it returned.  Forwarded packets, those answered by the router itself and
+ * those held for an ARP reply each have their own; a fourth holds how
+ * long the latter were held.  Packets dropped without anything sent are
+ * not timed.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_STATS_H
+#define SR_STATS_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include <stdio.h>
+
+#include "sr_hist.h"
+#include "sr_pktmeta.h"
+#include "sr_router.h"
+
+#define SR_STATS_THREADS 32      /* threads with a block of their own, later ones share one */
+#define SR_STATS_NO_IF SR_IF_MAX /* slot for packets without a known interface */
+
+/* -- latency histograms, see struct sr_stats -- */
+enum sr_lat {
+  SR_LAT_FORWARD = 0, /* forwarded right away */
+  SR_LAT_LOCAL,       /* answered by us: echo replies, ICMP errors, ARP replies */
+  SR_LAT_ARP_QUEUED,  /* forwarded once the next hop's ARP reply came in */
+  SR_LAT_ARP_WAIT,    /* how long those waited in the ARP queue */
+  SR_LAT_MAX
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_if_stats
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_if_stats {
+  uint64_t rx_packets;
+  uint64_t rx_bytes;
+  uint64_t tx_packets;
+  uint64_t tx_bytes;
+  uint64_t tx_errors;
+  uint64_t disp[SR_DISP_MAX]; /* received here, by what became of them */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_stats
+ *
+ * One thread's counters, or the sum over all threads.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_stats {
+  struct sr_if_stats ifs[SR_IF_MAX + 1]; /* by interface index, then SR_STATS_NO_IF */
+  struct sr_hist lat[SR_LAT_MAX];        /* by enum sr_lat */
+} __attribute__((aligned(64)));
+
+const char* sr_lat_name(unsigned int lat);
+void sr_stats_burst(const struct sr_pkt_meta* meta, unsigned int n, uint64_t end_ns);
+void sr_stats_redecide(unsigned int ifidx, unsigned int from, unsigned int to);
+void sr_stats_latency(unsigned int lat, uint64_t ns);
+void sr_stats_tx(unsigned int ifidx, unsigned int len, int ok);
+void sr_stats_snapshot(struct sr_stats* sum);
+void sr_stats_print_counters(struct sr_instance* sr, const struct sr_stats* sum, FILE* out);
+void sr_stats_print_latency(const struct sr_stats* sum, FILE* out);
+void sr_stats_dump(struct sr_instance* sr, FILE* out);
+
+#endif /* -- SR_STATS_H -- */
@@ -0,0 +1,647 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_uring.c
+ *
+ * Description:
+ *
+ * io_uring transport for the VNS server connection, see sr_uring.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_uring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "sr_event.h"
+#include "sr_router.h"
+
+#define SR_URING_RECV 1  /* user_data of the multishot receive */
+#define SR_URING_WRITE 2 /* user_data of a write, buffer index in the upper bits */
+#define SR_URING_BGID 0  /* provided buffer group of the receive buffers */
+#define SR_URING_REAP_MAX SR_URING_ENTRIES /* completions handled per readiness event */
+
+static int sr_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, 0, 0);
+}
+
+static int sr_uring_register(int fd, unsigned int opcode, void* arg, unsigned int nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_submit(..)
+ * Scope: Local
+ *
+ * Publish the prepared submissions and hand them to the kernel, waiting
+ * for at least min_complete completions.  This is the only place that
+ * calls io_uring_enter.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_uring_submit(struct sr_uring* u, unsigned int min_complete) {
+  unsigned int flags = 0;
+  int ret;
+
+  __atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+
+  if (min_complete > 0 || (__atomic_load_n(u->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)) {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+  if (u->sq_pending == 0 && flags == 0) {
+    return 0;
+  }
+
+  while ((ret = sr_uring_enter(u->fd, u->sq_pending, min_complete, flags)) == -1) {
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EBUSY) {
+      return 0; /* -- try again once completions are reaped -- */
+    }
+    perror("io_uring_enter(..):sr_uring.c::sr_uring_submit(..)");
+    return -1;
+  }
+  u->sq_pending -= ret;
+
+  return 0;
+} /* -- sr_uring_submit -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_get_sqe(..)
+ * Scope: Local
+ *
+ * Next free submission queue entry, cleared.  Submits what is pending
+ * first if the queue is full.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct io_uring_sqe* sr_uring_get_sqe(struct sr_uring* u) {
+  struct io_uring_sqe* sqe;
+  unsigned int idx;
+
+  if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries) {
+    if (sr_uring_submit(u, 0) != 0 || u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries) {
+      fprintf(stderr, "Error: io_uring submission queue is full\n");
+      return 0;
+    }
+  }
+
+  idx = u->sq_local & *(u->sq_mask);
+  u->sq_array[idx] = idx;
+  u->sq_local++;
+  u->sq_pending++;
+
+  sqe = &(u->sqes[idx]);
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+} /* -- sr_uring_get_sqe -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_arm_recv(..)
+ * Scope: Local
+ *
+ * Post the multishot receive.  It keeps completing, one provided buffer
+ * per completion, until the buffers run out or the connection ends.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_uring_arm_recv(struct sr_uring* u) {
+  struct io_uring_sqe* sqe;
+
+  if ((sqe = sr_uring_get_sqe(u)) == 0) {
+    return -1;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = 0; /* -- registered file 0, the server socket -- */
+  sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->buf_group = SR_URING_BGID;
+  sqe->user_data = SR_URING_RECV;
+  u->recv_armed = 1;
+
+  return 0;
+} /* -- sr_uring_arm_recv -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_recycle(..)
+ * Scope: Local
+ *
+ * Give receive buffer bid back to the kernel.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_uring_recycle(struct sr_uring* u, uint16_t bid) {
+  struct io_uring_buf* buf = &(u->br->bufs[u->br_tail & (SR_URING_RX_BUFS - 1)]);
+
+  buf->addr = (uint64_t)(unsigned long)(u->rx_bufs + (size_t)bid * SR_URING_RX_BUF_SIZE);
+  buf->len = SR_URING_RX_BUF_SIZE;
+  buf->bid = bid;
+  u->br_tail++;
+  __atomic_store_n(&(u->br->tail), u->br_tail, __ATOMIC_RELEASE);
+} /* -- sr_uring_recycle -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_start_chain(..)
+ * Scope: Local
+ *
+ * Write out every queued buffer as one chain of linked fixed writes, so
+ * they reach the socket in order.  A short write or an error cancels the
+ * rest of the chain; sr_uring_write_done(..) then starts a new one from
+ * where it stopped.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_uring_start_chain(struct sr_uring* u) {
+  struct io_uring_sqe* sqe;
+  struct sr_uring_tx* tx;
+  unsigned int i;
+  int slot;
+
+  for (i = 0; i < u->txq_count; i++) {
+    if ((sqe = sr_uring_get_sqe(u)) == 0) {
+      return -1;
+    }
+    slot = u->txq[(u->txq_head + i) % SR_URING_TX_BUFS];
+    tx = &(u->tx[slot]);
+
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = 0;
+    sqe->flags = IOSQE_FIXED_FILE;
+    if (i + 1 < u->txq_count) {
+      sqe->flags |= IOSQE_IO_LINK;
+    }
+    sqe->off = (uint64_t)-1; /* -- sockets have no file position -- */
+    sqe->addr = (uint64_t)(unsigned long)(tx->buf + tx->off);
+    sqe->len = tx->len - tx->off;
+    sqe->buf_index = slot;
+    sqe->user_data = SR_URING_WRITE | ((uint64_t)slot << 8);
+    u->tx_chain++;
+  }
+
+  return 0;
+} /* -- sr_uring_start_chain -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_write_done(..)
+ * Scope: Local
+ *
+ * Completion of one write in the chain.  Once the whole chain is in,
+ * release the buffers that are fully written and chain up the rest.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_uring_write_done(struct sr_instance* sr, int slot, int32_t res) {
+  struct sr_uring* u = sr->uring;
+  struct sr_uring_tx* tx;
+
+  if (res > 0) {
+    u->tx[slot].off += res;
+  } else if (res < 0 && res != -ECANCELED) {
+    fprintf(stderr, "Error writing to server: %s\n", strerror(-res));
+    u->closed = 1;
+    sr_event_stop(&(sr->loop));
+  }
+
+  if (--u->tx_chain > 0) {
+    return;
+  }
+
+  while (u->txq_count > 0) {
+    tx = &(u->tx[u->txq[u->txq_head]]);
+    if (tx->off < tx->len && !u->closed) {
+      break;
+    }
+    u->tx_free[u->ntx_free++] = u->txq[u->txq_head];
+    u->txq_head = (u->txq_head + 1) % SR_URING_TX_BUFS;
+    u->txq_count--;
+  }
+
+  if (u->txq_count > 0 && sr_uring_start_chain(u) != 0) {
+    sr_event_stop(&(sr->loop));
+  }
+} /* -- sr_uring_write_done -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_recv_done(..)
+ * Scope: Local
+ *
+ * Completion of the multishot receive: handle the commands in the buffer
+ * it filled, then recycle the buffer.  Re-arm the receive if this was its
+ * last completion, which happens when the buffers ran out.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_uring_recv_done(struct sr_instance* sr, int32_t res, uint32_t flags) {
+  struct sr_uring* u = sr->uring;
+  uint16_t bid;
+
+  if (flags & IORING_CQE_F_BUFFER) {
+    bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    if (res > 0 && !u->closed && sr_vns_receive(sr, u->rx_bufs + (size_t)bid * SR_URING_RX_BUF_SIZE, res) != 1) {
+      u->closed = 1;
+      sr_event_stop(&(sr->loop));
+    }
+    sr_uring_recycle(u, bid);
+  }
+
+  if (res == 0) {
+    fprintf(stderr, "Error: server closed the connection\n");
+    u->closed = 1;
+    sr_event_stop(&(sr->loop));
+  } else if (res < 0 && res != -ENOBUFS) {
+    fprintf(stderr, "Error reading from server: %s\n", strerror(-res));
+    u->closed = 1;
+    sr_event_stop(&(sr->loop));
+  }
+
+  if (!(flags & IORING_CQE_F_MORE)) {
+    u->recv_armed = 0;
+    if (!u->closed && sr_uring_arm_recv(u) != 0) {
+      sr_event_stop(&(sr->loop));
+    }
+  }
+} /* -- sr_uring_recv_done -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_reap(..)
+ * Scope: Local
+ *
+ * Handle completions.  While waiting for a transmit buffer only writes
+ * are handled, since receives run the router, which may want to send;
+ * receives are put aside in the backlog and handled first next time.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_uring_reap(struct sr_instance* sr) {
+  struct sr_uring* u = sr->uring;
+  struct sr_uring_cqe c;
+  struct io_uring_cqe* cqe;
+  unsigned int head, n = 0;
+
+  for (;;) {
+    if (!u->waiting && u->nbacklog > 0) {
+      c = u->backlog[u->backlog_head & (SR_URING_BACKLOG - 1)];
+      u->backlog_head++;
+      u->nbacklog--;
+    } else {
+      head = *(u->cq_head);
+      if (n == SR_URING_REAP_MAX || head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        break;
+      }
+      cqe = &(u->cqes[head & *(u->cq_mask)]);
+      c.user_data = cqe->user_data;
+      c.res = cqe->res;
+      c.flags = cqe->flags;
+      __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+      n++;
+
+      if (u->waiting && c.user_data == SR_URING_RECV) {
+        assert(u->nbacklog < SR_URING_BACKLOG);
+        u->backlog[(u->backlog_head + u->nbacklog) & (SR_URING_BACKLOG - 1)] = c;
+        u->nbacklog++;
+        continue;
+      }
+    }
+
+    if (c.user_data == SR_URING_RECV) {
+      sr_uring_recv_done(sr, c.res, c.flags);
+    } else {
+      sr_uring_write_done(sr, (int)(c.user_data >> 8), c.res);
+    }
+  }
+} /* -- sr_uring_reap -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_wait(..)
+ * Scope: Local
+ *
+ * Submit what is pending and block for at least one completion.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_uring_wait(struct sr_instance* sr) {
+  struct sr_uring* u = sr->uring;
+
+  if (sr_uring_submit(u, 1) != 0) {
+    return -1;
+  }
+  u->waiting = 1;
+  sr_uring_reap(sr);
+  u->waiting = 0;
+
+  return 0;
+} /* -- sr_uring_wait -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_event(..)
+ * Scope: Local
+ *
+ * Event loop callback for the ring's fd, readable when completions are
+ * waiting.  Handles them, then flushes the frames they produced.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_uring_event(int fd, uint32_t events, void* arg) {
+  struct sr_instance* sr = (struct sr_instance*)arg;
+
+  sr_uring_reap(sr);
+
+  /* -- end of the receive burst -- */
+  sr_flush_packets(sr);
+} /* -- sr_uring_event -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_idle(..)
+ * Scope: Local
+ *
+ * Runs once per event loop iteration: submit everything queued during
+ * the iteration (writes, re-armed receives) with a single io_uring_enter.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_uring_idle(void* arg) {
+  struct sr_instance* sr = (struct sr_instance*)arg;
+
+  if (sr_uring_submit(sr->uring, 0) != 0) {
+    sr_event_stop(&(sr->loop));
+  }
+} /* -- sr_uring_idle -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_map(..)
+ * Scope: Local
+ *
+ * Create the ring and map its submission and completion queues.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_uring_map(struct sr_uring* u) {
+  struct io_uring_params p;
+
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CLAMP;
+  if ((u->fd = syscall(__NR_io_uring_setup, SR_URING_ENTRIES, &p)) == -1) {
+    perror("io_uring_setup(..):sr_uring.c::sr_uring_map(..)");
+    return -1;
+  }
+
+  u->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  u->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if ((p.features & IORING_FEAT_SINGLE_MMAP) && u->cq_map_len > u->sq_map_len) {
+    u->sq_map_len = u->cq_map_len;
+  }
+
+  u->sq_map = mmap(0, u->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sq_map == MAP_FAILED) {
+    u->sq_map = 0;
+    perror("mmap(..):sr_uring.c::sr_uring_map(..)");
+    return -1;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    u->cq_map = u->sq_map;
+  } else {
+    u->cq_map = mmap(0, u->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (u->cq_map == MAP_FAILED) {
+      u->cq_map = 0;
+      perror("mmap(..):sr_uring.c::sr_uring_map(..)");
+      return -1;
+    }
+  }
+
+  u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = (struct io_uring_sqe*)mmap(0, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                                       IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED) {
+    u->sqes = 0;
+    perror("mmap(..):sr_uring.c::sr_uring_map(..)");
+    return -1;
+  }
+
+  u->sq_head = (unsigned int*)((uint8_t*)u->sq_map + p.sq_off.head);
+  u->sq_tail = (unsigned int*)((uint8_t*)u->sq_map + p.sq_off.tail);
+  u->sq_mask = (unsigned int*)((uint8_t*)u->sq_map + p.sq_off.ring_mask);
+  u->sq_flags = (unsigned int*)((uint8_t*)u->sq_map + p.sq_off.flags);
+  u->sq_array = (unsigned int*)((uint8_t*)u->sq_map + p.sq_off.array);
+  u->sq_entries = p.sq_entries;
+  u->sq_local = *(u->sq_tail);
+
+  u->cq_head = (unsigned int*)((uint8_t*)u->cq_map + p.cq_off.head);
+  u->cq_tail = (unsigned int*)((uint8_t*)u->cq_map + p.cq_off.tail);
+  u->cq_mask = (unsigned int*)((uint8_t*)u->cq_map + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe*)((uint8_t*)u->cq_map + p.cq_off.cqes);
+
+  return 0;
+} /* -- sr_uring_map -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_register_bufs(..)
+ * Scope: Local
+ *
+ * Register the server socket and the transmit buffers, so writes skip
+ * the fd lookup and the page pinning, and set up the provided buffer
+ * ring the receive fills.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_uring_register_bufs(struct sr_instance* sr, struct sr_uring* u) {
+  struct iovec iov[SR_URING_TX_BUFS];
+  struct io_uring_buf_reg reg;
+  int i;
+
+  if (sr_uring_register(u->fd, IORING_REGISTER_FILES, &(sr->sockfd), 1) == -1) {
+    perror("io_uring_register(IORING_REGISTER_FILES):sr_uring.c::sr_uring_register_bufs(..)");
+    return -1;
+  }
+
+  u->tx_mem = (uint8_t*)mmap(0, (size_t)SR_URING_TX_BUFS * SR_TX_BATCH_BYTES, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (u->tx_mem == MAP_FAILED) {
+    u->tx_mem = 0;
+    perror("mmap(..):sr_uring.c::sr_uring_register_bufs(..)");
+    return -1;
+  }
+  for (i = 0; i < SR_URING_TX_BUFS; i++) {
+    u->tx[i].buf = u->tx_mem + (size_t)i * SR_TX_BATCH_BYTES;
+    iov[i].iov_base = u->tx[i].buf;
+    iov[i].iov_len = SR_TX_BATCH_BYTES;
+    u->tx_free[u->ntx_free++] = i;
+  }
+  if (sr_uring_register(u->fd, IORING_REGISTER_BUFFERS, iov, SR_URING_TX_BUFS) == -1) {
+    perror("io_uring_register(IORING_REGISTER_BUFFERS):sr_uring.c::sr_uring_register_bufs(..)");
+    return -1;
+  }
+
+  u->rx_bufs = (uint8_t*)mmap(0, (size_t)SR_URING_RX_BUFS * SR_URING_RX_BUF_SIZE, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (u->rx_bufs == MAP_FAILED) {
+    u->rx_bufs = 0;
+    perror("mmap(..):sr_uring.c::sr_uring_register_bufs(..)");
+    return -1;
+  }
+
+  /* -- the buffer ring itself must be page aligned -- */
+  u->br_len = SR_URING_RX_BUFS * sizeof(struct io_uring_buf);
+  u->br = (struct io_uring_buf_ring*)mmap(0, u->br_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (u->br == MAP_FAILED) {
+    u->br = 0;
+    perror("mmap(..):sr_uring.c::sr_uring_register_bufs(..)");
+    return -1;
+  }
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(unsigned long)u->br;
+  reg.ring_entries = SR_URING_RX_BUFS;
+  reg.bgid = SR_URING_BGID;
+  if (sr_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+    perror("io_uring_register(IORING_REGISTER_PBUF_RING):sr_uring.c::sr_uring_register_bufs(..)");
+    return -1;
+  }
+  for (i = 0; i < SR_URING_RX_BUFS; i++) {
+    sr_uring_recycle(u, i);
+  }
+
+  return 0;
+} /* -- sr_uring_register_bufs -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_start(..)
+ * Scope: Global
+ *
+ * Switch the negotiated server connection over to io_uring: post the
+ * receive and let the event loop drive the ring from now on.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_uring_start(struct sr_instance* sr) {
+  struct sr_uring* u;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(sr->sockfd >= 0);
+
+  if ((u = (struct sr_uring*)calloc(1, sizeof(struct sr_uring))) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_uring_start)\n");
+    return -1;
+  }
+  u->fd = -1;
+  sr->uring = u;
+
+  if (sr_uring_map(u) != 0 || sr_uring_register_bufs(sr, u) != 0 || sr_uring_arm_recv(u) != 0) {
+    return -1;
+  }
+
+  if ((u->ev = sr_event_add_fd(&(sr->loop), u->fd, EPOLLIN, sr_uring_event, sr)) == 0) {
+    return -1;
+  }
+  sr_event_set_idle(&(sr->loop), sr_uring_idle, sr);
+
+  return sr_uring_submit(u, 0);
+} /* -- sr_uring_start -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_tx_buf(..)
+ * Scope: Global
+ *
+ * A free registered buffer to batch frames in, waiting for writes to
+ * complete if they are all in use.  Loop thread only.
+ *
+ *---------------------------------------------------------------------*/
+
+uint8_t* sr_uring_tx_buf(struct sr_instance* sr) {
+  struct sr_uring* u = sr->uring;
+
+  /* -- REQUIRES -- */
+  assert(u);
+
+  while (u->ntx_free == 0) {
+    if (sr_uring_wait(sr) != 0) {
+      return 0;
+    }
+  }
+
+  return u->tx[u->tx_free[--u->ntx_free]].buf;
+} /* -- sr_uring_tx_buf -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_write(..)
+ * Scope: Global
+ *
+ * Queue len bytes of buf, a buffer from sr_uring_tx_buf(..), for writing
+ * to the server.  The buffer is owned by the ring until written.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_uring_write(struct sr_instance* sr, uint8_t* buf, unsigned int len) {
+  struct sr_uring* u = sr->uring;
+  int slot;
+
+  /* -- REQUIRES -- */
+  assert(u);
+  assert(buf >= u->tx_mem && len <= SR_TX_BATCH_BYTES);
+
+  slot = (buf - u->tx_mem) / SR_TX_BATCH_BYTES;
+  if (u->closed) {
+    u->tx_free[u->ntx_free++] = slot;
+    return -1;
+  }
+
+  u->tx[slot].off = 0;
+  u->tx[slot].len = len;
+  u->txq[(u->txq_head + u->txq_count) % SR_URING_TX_BUFS] = slot;
+  u->txq_count++;
+
+  /* -- joins the next chain if one is in flight -- */
+  if (u->tx_chain == 0) {
+    return sr_uring_start_chain(u);
+  }
+  return 0;
+} /* -- sr_uring_write -- */
+
+void sr_uring_close(struct sr_instance* sr) {
+  struct sr_uring* u;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+
+  if ((u = sr->uring) == 0) {
+    return;
+  }
+
+  /* -- closing the ring cancels the receive and any write in flight -- */
+  if (u->fd >= 0) {
+    close(u->fd);
+  }
+  if (u->sqes) {
+    munmap(u->sqes, u->sqes_len);
+  }
+  if (u->cq_map && u->cq_map != u->sq_map) {
+    munmap(u->cq_map, u->cq_map_len);
+  }
+  if (u->sq_map) {
+    munmap(u->sq_map, u->sq_map_len);
+  }
+  if (u->br) {
+    munmap(u->br, u->br_len);
+  }
+  if (u->rx_bufs) {
+    munmap(u->rx_bufs, (size_t)SR_URING_RX_BUFS * SR_URING_RX_BUF_SIZE);
+  }
+  if (u->tx_mem) {
+    munmap(u->tx_mem, (size_t)SR_URING_TX_BUFS * SR_TX_BATCH_BYTES);
+  }
+  free(u);
+  sr->uring = 0;
+} /* -- sr_uring_close -- */
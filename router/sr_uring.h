@@ -0,0 +1,123 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_uring.h
+ *
+ * Description:
+ *
+ * io_uring transport for the VNS server connection, used instead of plain
+ * reads and writes once the session is negotiated.  A multishot receive
+ * stays posted on the socket and fills buffers from a provided buffer
+ * ring; commands are handled straight out of those buffers.  Outgoing
+ * batches are built in registered buffers and written with linked fixed
+ * writes, so they reach the socket in order.  The ring's fd is driven by
+ * the event loop, and new requests are submitted with a single
+ * io_uring_enter at the end of each loop iteration.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_URING_H
+#define SR_URING_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include <stddef.h>
+
+#define SR_URING_ENTRIES 256                   /* submission queue entries */
+#define SR_URING_RX_BUFS 64                    /* provided receive buffers, power of two */
+#define SR_URING_RX_BUF_SIZE 16384             /* bytes per receive buffer */
+#define SR_URING_TX_BUFS 16                    /* registered transmit buffers, one batch each */
+#define SR_URING_BACKLOG (2 * SR_URING_RX_BUFS) /* receive completions put aside, power of two */
+
+struct sr_instance;
+struct sr_event;
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_uring_tx
+ *
+ * A registered transmit buffer queued for writing
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_uring_tx {
+  uint8_t* buf;
+  unsigned int off; /* bytes already written */
+  unsigned int len;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_uring_cqe
+ *
+ * A completion put aside while waiting for a transmit buffer
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_uring_cqe {
+  uint64_t user_data;
+  int32_t res;
+  uint32_t flags;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_uring
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_uring {
+  int fd;
+  struct sr_event* ev; /* fd's registration with the loop */
+
+  /* -- submission queue -- */
+  void* sq_map;
+  size_t sq_map_len;
+  unsigned int* sq_head;
+  unsigned int* sq_tail;
+  unsigned int* sq_mask;
+  unsigned int* sq_flags;
+  unsigned int* sq_array;
+  unsigned int sq_entries;
+  unsigned int sq_local;   /* tail including entries not yet published */
+  unsigned int sq_pending; /* entries prepared since the last io_uring_enter */
+  struct io_uring_sqe* sqes;
+  size_t sqes_len;
+
+  /* -- completion queue -- */
+  void* cq_map;
+  size_t cq_map_len;
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  unsigned int* cq_mask;
+  struct io_uring_cqe* cqes;
+  struct sr_uring_cqe backlog[SR_URING_BACKLOG]; /* receives put aside, oldest first */
+  unsigned int backlog_head;
+  unsigned int nbacklog;
+  int waiting; /* in sr_uring_wait(..), receives go to the backlog */
+
+  /* -- provided receive buffers -- */
+  struct io_uring_buf_ring* br;
+  size_t br_len;
+  uint16_t br_tail;
+  uint8_t* rx_bufs;
+  int recv_armed;
+  int closed; /* connection is gone: stop re-arming, drop writes */
+
+  /* -- registered transmit buffers -- */
+  uint8_t* tx_mem;
+  int tx_free[SR_URING_TX_BUFS];
+  int ntx_free;
+  struct sr_uring_tx tx[SR_URING_TX_BUFS];
+  int txq[SR_URING_TX_BUFS]; /* buffers to write, in order */
+  unsigned int txq_head;
+  unsigned int txq_count;
+  unsigned int tx_chain; /* writes from the front of txq in flight */
+};
+
+int sr_uring_start(struct sr_instance* sr);
+void sr_uring_close(struct sr_instance* sr);
+uint8_t* sr_uring_tx_buf(struct sr_instance* sr);
+int sr_uring_write(struct sr_instance* sr, uint8_t* buf, unsigned int len);
+
+#endif /* -- SR_URING_H -- */
@@ -4,13 +4,36 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SR_CKSUM_X86
+#include <immintrin.h>
+#endif /* x86 */
 
 #include "log.h"
 #include "sr_protocol.h"
 
-uint16_t cksum(const void *_data, int len) {
+/* -- checksum kernels: each returns an unfolded one's complement sum of
+      the 16 bit words at data as loaded, an odd last byte padded with 0 -- */
+typedef uint64_t (*cksum_sum_fn)(const uint8_t *data, int len);
+
+/* Fold a 64 bit one's complement sum down to 16 bits. */
+static uint16_t cksum_fold(uint64_t sum) {
+  sum = (sum >> 32) + (sum & 0xffffffff);
+  sum = (sum >> 32) + (sum & 0xffffffff);
+  sum = (sum >> 16) + (sum & 0xffff);
+  sum = (sum >> 16) + (sum & 0xffff);
+  sum = (sum >> 16) + (sum & 0xffff);
+  return (uint16_t)sum;
+}
+
+/* The original kernel: one word per iteration, built from two byte loads.
+   Kept as the reference the others are checked against; the sum is 64
+   bits wide so it stays exact on the selftest's long buffers. */
+static uint16_t cksum_ref(const void *_data, int len) {
   const uint8_t *data = _data;
-  uint32_t sum;
+  uint64_t sum;
 
   for (sum = 0; len >= 2; data += 2, len -= 2) {
     sum += data[0] << 8 | data[1];
@@ -25,6 +48,308 @@ uint16_t cksum(const void *_data, int len) {
   return sum ? sum : 0xffff;
 }
 
+/* One's complement add of two 64 bit sums, the carry out wrapped back in. */
+static uint64_t cksum_add(uint64_t sum, uint64_t w) {
+  sum += w;
+  return sum + (sum < w);
+}
+
+/* Word at a time: 8 bytes per add into a 64 bit accumulator. */
+static uint64_t cksum_sum_scalar(const uint8_t *data, int len) {
+  uint64_t sum = 0, w;
+  uint32_t tail = 0;
+  uint16_t h;
+
+  for (; len >= 8; data += 8, len -= 8) {
+    memcpy(&w, data, 8);
+    sum = cksum_add(sum, w);
+  }
+  for (; len >= 2; data += 2, len -= 2) {
+    memcpy(&h, data, 2);
+    tail += h;
+  }
+  if (len > 0) {
+    h = 0;
+    memcpy(&h, data, 1);
+    tail += h;
+  }
+  return cksum_add(sum, tail);
+}
+
+#ifdef SR_CKSUM_X86
+/* 32 bit lanes take 65537 words before they can wrap, so the vector
+   kernels spill into the 64 bit sum every SR_CKSUM_SPILL blocks. */
+#define SR_CKSUM_SPILL 16384
+
+__attribute__((target("sse2"))) static uint64_t cksum_spill_sse2(__m128i acc) {
+  uint32_t lane[4];
+
+  _mm_storeu_si128((__m128i *)lane, acc);
+  return (uint64_t)lane[0] + lane[1] + lane[2] + lane[3];
+}
+
+/* 16 bytes per iteration, the words widened into four 32 bit lanes. */
+__attribute__((target("sse2"))) static uint64_t cksum_sum_sse2(const uint8_t *data, int len) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero, v;
+  uint64_t sum = 0;
+  int n = 0;
+
+  for (; len >= 16; data += 16, len -= 16) {
+    v = _mm_loadu_si128((const __m128i *)data);
+    acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+    acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+    if (++n == SR_CKSUM_SPILL) {
+      sum += cksum_spill_sse2(acc);
+      acc = zero;
+      n = 0;
+    }
+  }
+  return cksum_add(sum + cksum_spill_sse2(acc), cksum_sum_scalar(data, len));
+}
+
+__attribute__((target("avx2"))) static uint64_t cksum_spill_avx2(__m256i acc) {
+  uint32_t lane[8];
+
+  _mm256_storeu_si256((__m256i *)lane, acc);
+  return (uint64_t)lane[0] + lane[1] + lane[2] + lane[3] + lane[4] + lane[5] + lane[6] + lane[7];
+}
+
+/* 32 bytes per iteration into eight 32 bit lanes. */
+__attribute__((target("avx2"))) static uint64_t cksum_sum_avx2(const uint8_t *data, int len) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc = zero, v;
+  uint64_t sum = 0;
+  int n = 0;
+
+  for (; len >= 32; data += 32, len -= 32) {
+    v = _mm256_loadu_si256((const __m256i *)data);
+    acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+    acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+    if (++n == SR_CKSUM_SPILL) {
+      sum += cksum_spill_avx2(acc);
+      acc = zero;
+      n = 0;
+    }
+  }
+  return cksum_add(sum + cksum_spill_avx2(acc), cksum_sum_scalar(data, len));
+}
+
+static int cksum_has_sse2(void) { return __builtin_cpu_supports("sse2"); }
+static int cksum_has_avx2(void) { return __builtin_cpu_supports("avx2"); }
+
+/* Long enough for three spills of the widest kernel, odd to leave a tail. */
+#define SR_CKSUM_LONG (3 * SR_CKSUM_SPILL * 32 + 5)
+#else
+#define SR_CKSUM_LONG (1 << 20)
+#endif /* SR_CKSUM_X86 */
+
+static int cksum_has_scalar(void) { return 1; }
+
+/* -- widest first, cksum_sum() takes the first one the CPU can run for
+      anything longer than SR_CKSUM_SHORT bytes; below that setting up the
+      vector costs more than it saves -- */
+#define SR_CKSUM_SHORT 64
+
+static const struct cksum_kernel {
+  const char *name;
+  cksum_sum_fn sum;
+  int (*usable)(void);
+} cksum_kernels[] = {
+#ifdef SR_CKSUM_X86
+    {"avx2", cksum_sum_avx2, cksum_has_avx2},
+    {"sse2", cksum_sum_sse2, cksum_has_sse2},
+#endif /* SR_CKSUM_X86 */
+    {"scalar", cksum_sum_scalar, cksum_has_scalar},
+};
+
+#define CKSUM_NKERNELS (sizeof(cksum_kernels) / sizeof(cksum_kernels[0]))
+
+static cksum_sum_fn cksum_sum(int len) {
+  static cksum_sum_fn chosen = 0;
+  cksum_sum_fn fn;
+  unsigned int i;
+
+  if (len < SR_CKSUM_SHORT) {
+    return cksum_sum_scalar;
+  }
+  if ((fn = __atomic_load_n(&chosen, __ATOMIC_RELAXED)) == 0) {
+    for (i = 0; !cksum_kernels[i].usable(); i++) {
+    }
+    fn = cksum_kernels[i].sum;
+    __atomic_store_n(&chosen, fn, __ATOMIC_RELAXED);
+  }
+  return fn;
+}
+
+/* The Internet checksum (RFC 1071) of len bytes, in network byte order.
+   Never 0, a sum of all ones is sent as 0xffff.
+
+   The words are added as the CPU loads them: a one's complement sum
+   comes out byte swapped on a little endian machine, but swapped back
+   it is the same sum, so no per word shuffling is needed and the sum
+   can be taken 8 bytes (or a vector) at a time.  The widest kernel the
+   CPU supports is picked on first use, see cksum_kernels. */
+uint16_t cksum(const void *_data, int len) {
+  uint16_t sum = ~cksum_fold(cksum_sum(len)(_data, len));
+
+  return sum ? sum : 0xffff;
+}
+
+/* Verify a header in place, its checksum field included: the one's
+   complement sum of a valid header is all ones. */
+int cksum_ok(const void *_data, int len) {
+  return cksum_fold(cksum_sum(len)(_data, len)) == 0xffff;
+}
+
+/* The checksum, in network byte order, of an IP header after its TTL
+   drops by one.  Incremental update per RFC 1624: the TTL is the high
+   byte of its 16 bit word, so the checksum grows by 0x0100. */
+uint16_t cksum_ttl_dec(uint16_t sum) {
+  uint32_t s = ntohs(sum) + 0x0100;
+
+  return htons((uint16_t)(s + (s >> 16)));
+}
+
+/* The checksum, in network byte order, after one 16 bit word it covers
+   changes from old_word to new_word (both as stored).  RFC 1624 eqn. 3,
+   HC' = ~(~HC + ~m + m'). */
+uint16_t cksum_adjust(uint16_t sum, uint16_t old_word, uint16_t new_word) {
+  uint32_t s = (uint16_t)~ntohs(sum) + (uint32_t)(uint16_t)~ntohs(old_word) + ntohs(new_word);
+
+  s = (s >> 16) + (s & 0xffff);
+  s += s >> 16;
+  return htons((uint16_t)~s);
+}
+
+/* The same for a 32 bit field such as an IPv4 address, as stored. */
+uint16_t cksum_adjust32(uint16_t sum, uint32_t old_word, uint32_t new_word) {
+  uint16_t old_half[2], new_half[2];
+
+  memcpy(old_half, &old_word, 4);
+  memcpy(new_half, &new_word, 4);
+  sum = cksum_adjust(sum, old_half[0], new_half[0]);
+  return cksum_adjust(sum, old_half[1], new_half[1]);
+}
+
+/* Check every kernel this CPU can run against cksum_ref, bit for bit,
+   over all lengths up to a full pool buffer at every alignment, then over
+   SR_CKSUM_LONG bytes so the vector kernels spill more than once.  Reports
+   to out and returns the number of mismatches. */
+int cksum_selftest(FILE *out) {
+  static uint8_t buf[2048 + 8];
+  uint8_t *big;
+  uint16_t want, got;
+  unsigned int i, j;
+  int len, off, bad, total = 0;
+
+  if ((big = (uint8_t *)malloc(SR_CKSUM_LONG + 1)) == 0) {
+    fprintf(out, "cksum selftest: out of memory\n");
+    return 1;
+  }
+
+  for (i = 0; i < CKSUM_NKERNELS; i++) {
+    if (!cksum_kernels[i].usable()) {
+      fprintf(out, "cksum %-6s  not supported by this CPU\n", cksum_kernels[i].name);
+      continue;
+    }
+    bad = 0;
+    /* -- random data, then all ones to push every lane to its limit -- */
+    for (j = 0; j < 2; j++) {
+      for (len = 0; len < (int)sizeof(buf); len++) {
+        buf[len] = j ? 0xff : (uint8_t)rand();
+      }
+      for (off = 0; off < 8; off++) {
+        for (len = 0; len + off <= 2048; len++) {
+          want = cksum_ref(buf + off, len);
+          got = ~cksum_fold(cksum_kernels[i].sum(buf + off, len));
+          if ((got ? got : 0xffff) != want && bad++ == 0) {
+            fprintf(out, "cksum %-6s  len %d off %d: 0x%04x, want 0x%04x\n", cksum_kernels[i].name, len, off, got,
+                    want);
+          }
+        }
+      }
+
+      /* -- all ones here would wrap a 32 bit lane if a spill were missed -- */
+      for (len = 0; len < SR_CKSUM_LONG + 1; len++) {
+        big[len] = j ? 0xff : (uint8_t)rand();
+      }
+      for (off = 0; off < 2; off++) {
+        want = cksum_ref(big + off, SR_CKSUM_LONG);
+        got = ~cksum_fold(cksum_kernels[i].sum(big + off, SR_CKSUM_LONG));
+        if ((got ? got : 0xffff) != want && bad++ == 0) {
+          fprintf(out, "cksum %-6s  len %d off %d: 0x%04x, want 0x%04x\n", cksum_kernels[i].name, SR_CKSUM_LONG, off,
+                  got, want);
+        }
+      }
+    }
+    fprintf(out, "cksum %-6s  %s%s\n", cksum_kernels[i].name, bad ? "FAILED" : "ok",
+            cksum_kernels[i].sum == cksum_sum(SR_CKSUM_SHORT) ? " (in use)" : "");
+    total += bad;
+  }
+  free(big);
+  return total;
+} /* -- cksum_selftest -- */
+
+static double cksum_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Throughput of cksum_ref and every usable kernel across payload sizes,
+   from a bare header up to a full pool buffer. */
+void cksum_bench(FILE *out) {
+  static const int sizes[] = {20, 64, 128, 256, 576, 1024, 1500, 2048};
+  static uint8_t buf[2048];
+  volatile uint16_t sink = 0;
+  unsigned int i, k;
+  long n, rounds;
+  double t;
+
+  for (n = 0; n < (long)sizeof(buf); n++) {
+    buf[n] = (uint8_t)rand();
+  }
+  fprintf(out, "%6s", "bytes");
+  fprintf(out, " %10s", "ref");
+  for (k = 0; k < CKSUM_NKERNELS; k++) {
+    if (cksum_kernels[k].usable()) {
+      fprintf(out, " %10s", cksum_kernels[k].name);
+    }
+  }
+  fprintf(out, "   (MB/s)\n");
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    rounds = (64L << 20) / sizes[i];
+    fprintf(out, "%6d", sizes[i]);
+    t = cksum_now();
+    for (n = 0; n < rounds; n++) {
+      sink += cksum_ref(buf, sizes[i]);
+    }
+    fprintf(out, " %10.0f", rounds * (double)sizes[i] / (cksum_now() - t) / 1e6);
+    for (k = 0; k < CKSUM_NKERNELS; k++) {
+      if (!cksum_kernels[k].usable()) {
+        continue;
+      }
+      t = cksum_now();
+      for (n = 0; n < rounds; n++) {
+        sink += cksum_fold(cksum_kernels[k].sum(buf, sizes[i]));
+      }
+      fprintf(out, " %10.0f", rounds * (double)sizes[i] / (cksum_now() - t) / 1e6);
+    }
+    fprintf(out, "\n");
+  }
+} /* -- cksum_bench -- */
+
+/* CLOCK_MONOTONIC in nanoseconds, what every per packet time stamp uses. */
+uint64_t sr_clock_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+} /* -- sr_clock_ns -- */
+
 uint16_t ethertype(uint8_t *buf) {
   sr_ethernet_hdr_t *ehdr = (sr_ethernet_hdr_t *)buf;
   return ntohs(ehdr->ether_type);
@@ -26,12 +26,21 @@
  */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <netinet/in.h>
 
 #ifndef SR_UTILS_H
 #define SR_UTILS_H
 
 uint16_t cksum(const void *_data, int len);
+int cksum_ok(const void *_data, int len);
+uint16_t cksum_ttl_dec(uint16_t sum);
+uint16_t cksum_adjust(uint16_t sum, uint16_t old_word, uint16_t new_word);
+uint16_t cksum_adjust32(uint16_t sum, uint32_t old_word, uint32_t new_word);
+int cksum_selftest(FILE *out);
+void cksum_bench(FILE *out);
+
+uint64_t sr_clock_ns(void);
 
 uint16_t ethertype(uint8_t *buf);
 uint8_t ip_protocol(uint8_t *buf);
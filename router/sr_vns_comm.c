@@ -26,6 +26,7 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <stdio.h>
@@ -33,18 +34,61 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "log.h"
 #include "sha1.h"
-#include "sr_dumper.h"
+#include "sr_afpacket.h"
+#include "sr_capture.h"
+#include "sr_event.h"
 #include "sr_if.h"
+#include "sr_prof.h"
 #include "sr_protocol.h"
 #include "sr_router.h"
+#include "sr_shm.h"
+#include "sr_stats.h"
+#include "sr_uring.h"
+#include "sr_utils.h"
+#include "sr_worker.h"
+#include "sr_xdp.h"
 #include "vnscommand.h"
 
-static void sr_log_packet(struct sr_instance*, uint8_t*, int);
+#define SR_VNS_MAX_COMMAND 10000      /* largest command accepted from the server */
+#define SR_VNS_RX_BUF (256 * 1024)    /* receive buffer for the server stream */
+#define SR_VNS_RX_BURST 16            /* reads per readiness event */
+
+/* ----------------------------------------------------------------------------
+ * struct sr_tx_batch
+ *
+ * Frames sent by one thread that have not been written to the server yet,
+ * as an iovec array so a flush is a single writev(..).  The VNS headers
+ * sit in the arena; a frame in a pool buffer or in the receive buffer is
+ * pointed at where it lies, holding a reference to the pool buffer or
+ * keeping the receive buffer from being reused until the batch is out.
+ * Anything else is copied into the arena behind its header.  Over
+ * io_uring the arena is a registered buffer and every frame is copied.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_tx_batch {
+  uint8_t* arena;                             /* headers and copied frames, SR_TX_BATCH_BYTES */
+  unsigned int used;                          /* bytes of arena in use */
+  struct iovec iov[2 * SR_TX_BATCH_FRAMES];   /* the batch, in sending order */
+  int niov;                                   /* iovecs in use */
+  int done;                                   /* iovecs already written */
+  struct sr_pktbuf* pbs[SR_TX_BATCH_FRAMES];  /* pool buffers iov points into */
+  int npbs;
+  int count;                                  /* frames in the batch */
+  int stalled;                                /* server stopped reading, waiting for EPOLLOUT */
+};
+
+static __thread struct sr_tx_batch sr_tx;
+static __thread uint8_t sr_tx_arena[SR_TX_BATCH_BYTES];
+
 static int sr_arp_req_not_for_us(struct sr_instance* sr, uint8_t* packet /* lent */, unsigned int len,
-                                 char* interface /* lent */);
+                                 struct sr_if* iface);
+static struct sr_if* sr_vns_iface(struct sr_instance* sr, const char* name);
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
 
 /*-----------------------------------------------------------------------------
@@ -162,6 +206,7 @@ int sr_connect_to_server(struct sr_instance* sr, unsigned short port, char* serv
 int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo) {
   int num_entries;
   int i = 0;
+  int skip = 0; /* set while the entries belong to an interface left out */
 
   /* REQUIRES */
   assert(sr);
@@ -179,7 +224,7 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo) {
         break;
       case HWINTERFACE:
         /*Debug("INTERFACE: %s\n",hwinfo->mHWInfo[i].value);*/
-        sr_add_interface(sr, hwinfo->mHWInfo[i].value);
+        skip = sr_add_interface(sr, hwinfo->mHWInfo[i].value) != 0;
         break;
       case HWSPEED:
         /* Debug("Speed: %d\n",
@@ -196,18 +241,24 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo) {
       case HWETHIP:
         /*Debug("IP: %s\n",inet_ntoa(
          *((struct in_addr*)(hwinfo->mHWInfo[i].value))));*/
-        sr_set_ether_ip(sr, *((uint32_t*)hwinfo->mHWInfo[i].value));
+        if (!skip) {
+          sr_set_ether_ip(sr, *((uint32_t*)hwinfo->mHWInfo[i].value));
+        }
         break;
       case HWETHER:
         /*Debug("\tHardware Address: ");
         DebugMAC(hwinfo->mHWInfo[i].value);
         Debug("\n"); */
-        sr_set_ether_addr(sr, (unsigned char*)hwinfo->mHWInfo[i].value);
+        if (!skip) {
+          sr_set_ether_addr(sr, (unsigned char*)hwinfo->mHWInfo[i].value);
+        }
         break;
       default:
         printf(" %d \n", ntohl(hwinfo->mHWInfo[i].mKey));
     } /* -- switch -- */
   } /* -- for -- */
+  sr_build_if_templates(sr);
+  sr_build_local_addrs(sr);
 
   printf("Router interfaces:\n");
   sr_print_if_list(sr);
@@ -301,11 +352,109 @@ int sr_handle_auth_status(struct sr_instance* sr, c_auth_status* status) {
   return status->auth_ok;
 }
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_handle_command(..)
+ * Scope: Local
+ *
+ * Act on one complete command from the server.  buf holds the whole
+ * message, with mLen still in network and mType already in host byte order.
+ *
+ * RETURN VALUES:
+ *
+ *  1 to keep going
+ *  0 if the server closed the session
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_handle_command(struct sr_instance* sr /* borrowed */, uint8_t* buf /* borrowed */, int len,
+                             int command) {
+  struct sr_if* iface;
+  int ret = 1;
+
+  switch (command) {
+      /* -------------        VNSPACKET     -------------------- */
+
+    case VNSPACKET:
+      if ((iface = sr_vns_iface(sr, (char*)(buf + sizeof(c_base)))) == 0) {
+        break;
+      }
+
+      /* -- check if it is an ARP to another router if so drop   -- */
+      if (sr_arp_req_not_for_us(sr, (buf + sizeof(c_packet_header)),
+                                len - sizeof(c_packet_ethernet_header) + sizeof(struct sr_ethernet_hdr), iface)) {
+        break;
+      }
+
+      sr_input_frame(sr, (buf + sizeof(c_packet_header)),
+                     len - sizeof(c_packet_ethernet_header) + sizeof(struct sr_ethernet_hdr), iface->index);
+
+      break;
+
+      /* -------------        VNSCLOSE      -------------------- */
+
+    case VNSCLOSE:
+      fprintf(stderr, "VNS server closed session.\n");
+      fprintf(stderr, "Reason: %s\n", ((c_close*)buf)->mErrorMessage);
+      sr_session_closed_help();
+      ret = 0;
+      break;
+
+      /* -------------        VNSBANNER      -------------------- */
+
+    case VNSBANNER:
+      fprintf(stderr, "%s", ((c_banner*)buf)->mBannerMessage);
+      break;
+
+      /* -------------     VNSHWINFO     -------------------- */
+
+    case VNSHWINFO:
+      sr_handle_hwinfo(sr, (c_hwinfo*)buf);
+      if (sr_verify_routing_table(sr) != 0) {
+        fprintf(stderr, "Routing table not consistent with hardware\n");
+        ret = -1;
+        break;
+      }
+      printf(" <-- Ready to process packets --> \n");
+      break;
+
+      /* ---------------- VNS_RTABLE ---------------- */
+    case VNS_RTABLE:
+      if (!sr_handle_rtable(sr, (c_rtable*)buf)) {
+        ret = -1;
+      }
+      break;
+
+      /* ------------- VNS_AUTH_REQUEST ------------- */
+    case VNS_AUTH_REQUEST:
+      if (!sr_handle_auth_request(sr, (c_auth_request*)buf)) {
+        ret = -1;
+      }
+      break;
+
+      /* ------------- VNS_AUTH_STATUS -------------- */
+    case VNS_AUTH_STATUS:
+      if (!sr_handle_auth_status(sr, (c_auth_status*)buf)) {
+        ret = -1;
+      }
+      break;
+
+    default:
+      Debug("unknown command: %d\n", command);
+      break;
+
+  } /* -- switch -- */
+
+  return ret;
+} /* -- sr_handle_command -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_read_from_server(..)
  * Scope: global
  *
- * Houses main while loop for communicating with the virtual router server.
+ * Blocking read of a single command from the server, used while the session
+ * is being negotiated.  Once sr_vns_start(..) has run the socket belongs to
+ * the event loop and this must not be called any more.
  *
  *---------------------------------------------------------------------------*/
 
@@ -314,7 +463,6 @@ int sr_read_from_server(struct sr_instance* sr /* borrowed */) { return sr_read_
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd) {
   int command, len;
   unsigned char* buf = 0;
-  c_packet_ethernet_header* sr_pkt = 0;
   int ret = 0, bytes_read = 0;
 
   /* REQUIRES */
@@ -338,13 +486,17 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         perror("recv(..):sr_client.c::sr_read_from_server");
         return -1;
       }
+      if (ret == 0) {
+        fprintf(stderr, "Error: server closed the connection\n");
+        return -1;
+      }
       bytes_read += ret;
     } while (errno == EINTR); /* be mindful of signals */
   }
 
   len = ntohl(len);
 
-  if (len > 10000 || len < 0) {
+  if (len > SR_VNS_MAX_COMMAND || len < (int)sizeof(c_base)) {
     fprintf(stderr, "Error: command length to large %d\n", len);
     close(sr->sockfd);
     return -1;
@@ -364,12 +516,13 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
   while (bytes_read < len - 4) {
     do {         /* -- just in case SIGALRM breaks recv -- */
       errno = 0; /* -- hacky glibc workaround -- */
-      if ((ret = read(sr->sockfd, buf + 4 + bytes_read, len - 4 - bytes_read)) == -1) {
-        if (errno == EINTR) {
+      if ((ret = read(sr->sockfd, buf + 4 + bytes_read, len - 4 - bytes_read)) <= 0) {
+        if (ret == -1 && errno == EINTR) {
           continue;
         }
         fprintf(stderr, "Error: failed reading command body %d\n", ret);
         close(sr->sockfd);
+        free(buf);
         return -1;
       }
       bytes_read += ret;
@@ -384,96 +537,283 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
   if (expected_cmd && command != expected_cmd) {
     if (command != VNSCLOSE) { /* VNSCLOSE is always ok */
       fprintf(stderr, "Error: expected command %d but got %d\n", expected_cmd, command);
+      free(buf);
       return -1;
     }
   }
 
-  ret = 1;
-  switch (command) {
-      /* -------------        VNSPACKET     -------------------- */
+  ret = sr_handle_command(sr, buf, len, command);
 
-    case VNSPACKET:
-      sr_pkt = (c_packet_ethernet_header*)buf;
+  free(buf);
+  return ret;
+} /* -- sr_read_from_server -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_consume_buf(..)
+ * Scope: Local
+ *
+ * Dispatch every complete command at the start of buf, leaving the number
+ * of bytes they took up in *used.  Commands are modified in place.  Runs
+ * of VNSPACKET commands are handed to the router as one vector.  Stops
+ * short while the transmit batch waits for the server to drain.
+ *
+ * RETURN VALUES:
+ *
+ *  1 to keep going, otherwise what sr_handle_command(..) returned
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_consume_buf(struct sr_instance* sr /* borrowed */, uint8_t* buf /* borrowed */, unsigned int n,
+                              unsigned int* used) {
+  uint8_t* frames[SR_BURST_MAX];
+  unsigned int lens[SR_BURST_MAX];
+  unsigned int ifidx[SR_BURST_MAX];
+  struct sr_if* iface;
+  unsigned int off = 0, m = 0;
+  uint32_t len, command;
+  int ret = 1;
+
+  /* -- stop early once the server stops reading, the rest waits in buf -- */
+  while (ret == 1 && !sr_tx.stalled && n - off >= sizeof(c_base)) {
+    memcpy(&len, buf + off, sizeof(len));
+    len = ntohl(len);
+    if (len > SR_VNS_MAX_COMMAND || len < sizeof(c_base)) {
+      fprintf(stderr, "Error: command length to large %u\n", len);
+      return -1;
+    }
+    if (n - off < len) {
+      break; /* -- rest of it is still on the wire -- */
+    }
+
+    /* -- commands are handed on with mType in host byte order -- */
+    memcpy(&command, buf + off + sizeof(uint32_t), sizeof(command));
+    command = ntohl(command);
+    memcpy(buf + off + sizeof(uint32_t), &command, sizeof(command));
+
+    if (command == VNSPACKET && len >= sizeof(c_packet_header)) {
+      frames[m] = buf + off + sizeof(c_packet_header);
+      lens[m] = len - sizeof(c_packet_ethernet_header) + sizeof(struct sr_ethernet_hdr);
 
       /* -- check if it is an ARP to another router if so drop   -- */
-      if (sr_arp_req_not_for_us(sr, (buf + sizeof(c_packet_header)),
-                                len - sizeof(c_packet_ethernet_header) + sizeof(struct sr_ethernet_hdr),
-                                (char*)(buf + sizeof(c_base)))) {
-        break;
+      if ((iface = sr_vns_iface(sr, (char*)(buf + off + sizeof(c_base)))) != 0 &&
+          !sr_arp_req_not_for_us(sr, frames[m], lens[m], iface)) {
+        ifidx[m] = iface->index;
+        if (++m == SR_BURST_MAX) {
+          sr_input_burst(sr, frames, lens, ifidx, m);
+          m = 0;
+        }
       }
+    } else {
+      /* -- keep the frames before it in order with anything it does -- */
+      if (m > 0) {
+        sr_input_burst(sr, frames, lens, ifidx, m);
+        m = 0;
+      }
+      ret = sr_handle_command(sr, buf + off, len, command);
+    }
+    off += len;
+  }
 
-      /* -- log packet -- */
-      sr_log_packet(sr, buf + sizeof(c_packet_header), ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
-
-      /* -- pass to router, student's code should take over here -- */
-      sr_handlepacket(sr, (buf + sizeof(c_packet_header)),
-                      len - sizeof(c_packet_ethernet_header) + sizeof(struct sr_ethernet_hdr),
-                      (char*)(buf + sizeof(c_base)));
+  if (m > 0) {
+    sr_input_burst(sr, frames, lens, ifidx, m);
+  }
 
-      break;
+  *used = off;
+  return ret;
+} /* -- sr_vns_consume_buf -- */
 
-      /* -------------        VNSCLOSE      -------------------- */
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_consume(..)
+ * Scope: Local
+ *
+ * Dispatch every complete command sitting in the receive buffer and move
+ * any trailing partial command to the front.
+ *
+ * RETURN VALUES:
+ *
+ *  1 to keep going, otherwise what sr_handle_command(..) returned
+ *
+ *---------------------------------------------------------------------------*/
 
-    case VNSCLOSE:
-      fprintf(stderr, "VNS server closed session.\n");
-      fprintf(stderr, "Reason: %s\n", ((c_close*)buf)->mErrorMessage);
-      sr_session_closed_help();
+static int sr_vns_consume(struct sr_instance* sr /* borrowed */) {
+  unsigned int off;
+  int ret;
 
-      if (buf) {
-        free(buf);
-      }
-      return 0;
-      break;
+  ret = sr_vns_consume_buf(sr, sr->rx_buf, sr->rx_len, &off);
 
-      /* -------------        VNSBANNER      -------------------- */
+  if (off > 0) {
+    memmove(sr->rx_buf, sr->rx_buf + off, sr->rx_len - off);
+    sr->rx_len -= off;
+  }
 
-    case VNSBANNER:
-      fprintf(stderr, "%s", ((c_banner*)buf)->mBannerMessage);
-      break;
+  return ret;
+} /* -- sr_vns_consume -- */
 
-      /* -------------     VNSHWINFO     -------------------- */
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_receive(..)
+ * Scope: Global
+ *
+ * Handle n bytes of the server stream that arrived in a buffer of the
+ * caller's.  Complete commands are dispatched straight from data; only a
+ * command split across buffers is put together in the receive buffer.
+ *
+ * RETURN VALUES:
+ *
+ *  1 to keep going, otherwise what sr_handle_command(..) returned
+ *
+ *---------------------------------------------------------------------------*/
 
-    case VNSHWINFO:
-      sr_handle_hwinfo(sr, (c_hwinfo*)buf);
-      if (sr_verify_routing_table(sr) != 0) {
-        fprintf(stderr, "Routing table not consistent with hardware\n");
+int sr_vns_receive(struct sr_instance* sr /* borrowed */, uint8_t* data /* borrowed */, unsigned int n) {
+  unsigned int used, want;
+  uint32_t len;
+  int ret;
+
+  /* -- finish the command left over from the previous buffer -- */
+  while (sr->rx_len > 0 && n > 0) {
+    want = sizeof(uint32_t);
+    if (sr->rx_len >= sizeof(uint32_t)) {
+      memcpy(&len, sr->rx_buf, sizeof(len));
+      want = ntohl(len);
+      if (want > SR_VNS_MAX_COMMAND || want < sizeof(c_base)) {
+        fprintf(stderr, "Error: command length to large %u\n", want);
         return -1;
       }
-      printf(" <-- Ready to process packets --> \n");
-      break;
+    }
 
-      /* ---------------- VNS_RTABLE ---------------- */
-    case VNS_RTABLE:
-      if (!sr_handle_rtable(sr, (c_rtable*)buf)) {
-        ret = -1;
-      }
-      break;
+    used = want - sr->rx_len < n ? want - sr->rx_len : n;
+    memcpy(sr->rx_buf + sr->rx_len, data, used);
+    sr->rx_len += used;
+    data += used;
+    n -= used;
 
-      /* ------------- VNS_AUTH_REQUEST ------------- */
-    case VNS_AUTH_REQUEST:
-      if (!sr_handle_auth_request(sr, (c_auth_request*)buf)) {
-        ret = -1;
-      }
-      break;
+    if (sr->rx_len >= sizeof(c_base) && (ret = sr_vns_consume(sr)) != 1) {
+      return ret;
+    }
+  }
 
-      /* ------------- VNS_AUTH_STATUS -------------- */
-    case VNS_AUTH_STATUS:
-      if (!sr_handle_auth_status(sr, (c_auth_status*)buf)) {
-        ret = -1;
-      }
-      break;
+  ret = sr_vns_consume_buf(sr, data, n, &used);
+  if (ret == 1 && used < n) {
+    memcpy(sr->rx_buf, data + used, n - used);
+    sr->rx_len = n - used;
+  }
 
-    default:
-      Debug("unknown command: %d\n", command);
+  return ret;
+} /* -- sr_vns_receive -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_event(..)
+ * Scope: Local
+ *
+ * Event loop callback for the server socket.  Reads whatever the socket has
+ * queued (up to SR_VNS_RX_BURST reads so timers are not starved), handles
+ * every complete command and flushes the frames each read produced.  Those
+ * frames point into rx_buf, so it is only moved up once they are written.
+ * If the server's socket is full that waits for EPOLLOUT, and nothing more
+ * is read from the server until then.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_vns_event(int fd, uint32_t events, void* arg) {
+  struct sr_instance* sr = (struct sr_instance*)arg;
+  unsigned int used;
+  ssize_t ret;
+  int i;
+
+  if (events & EPOLLOUT) {
+    sr_flush_packets(sr);
+  }
+
+  for (i = 0;; i++) {
+    if (sr_vns_consume_buf(sr, sr->rx_buf + sr->rx_off, sr->rx_len - sr->rx_off, &used) != 1) {
+      sr_event_stop(&(sr->loop));
+      return;
+    }
+    sr->rx_off += used;
+
+    sr_flush_packets(sr);
+    if (sr_tx.stalled) {
+      return; /* -- rx_buf is still being sent from -- */
+    }
+    if (sr->rx_off > 0) {
+      memmove(sr->rx_buf, sr->rx_buf + sr->rx_off, sr->rx_len - sr->rx_off);
+      sr->rx_len -= sr->rx_off;
+      sr->rx_off = 0;
+    }
+
+    if (i == SR_VNS_RX_BURST) {
       break;
+    }
+    ret = read(fd, sr->rx_buf + sr->rx_len, SR_VNS_RX_BUF - sr->rx_len);
+    if (ret == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      perror("read(..):sr_vns_comm.c::sr_vns_event(..)");
+      sr_event_stop(&(sr->loop));
+      return;
+    }
+    if (ret == 0) {
+      fprintf(stderr, "Error: server closed the connection\n");
+      sr_event_stop(&(sr->loop));
+      return;
+    }
+    sr->rx_len += ret;
+  }
 
-  } /* -- switch -- */
+  /* -- the batch that stopped reading is out, back to waiting for input -- */
+  if (events & EPOLLOUT) {
+    sr_event_modify(&(sr->loop), sr->vns_ev, EPOLLIN);
+  }
+} /* -- sr_vns_event -- */
 
-  if (buf) {
-    free(buf);
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_start(..)
+ * Scope: Global
+ *
+ * Hand the negotiated server connection over to the event loop: the socket
+ * is switched to non-blocking mode and read from sr->loop from now on, or
+ * driven through io_uring if sr->vns_uring is set.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_vns_start(struct sr_instance* sr /* borrowed */) {
+  int flags;
+
+  /* REQUIRES */
+  assert(sr);
+  assert(sr->sockfd >= 0);
+
+  if ((sr->rx_buf = (uint8_t*)malloc(SR_VNS_RX_BUF)) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_vns_start)\n");
+    return -1;
   }
-  return ret;
-} /* -- sr_read_from_server -- */
+  sr->rx_len = 0;
+  sr->rx_off = 0;
+
+  /* -- io_uring waits for the socket itself, it stays blocking -- */
+  if (sr->vns_uring) {
+    return sr_uring_start(sr);
+  }
+
+  if ((flags = fcntl(sr->sockfd, F_GETFL, 0)) == -1 || fcntl(sr->sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    perror("fcntl(..):sr_vns_comm.c::sr_vns_start(..)");
+    return -1;
+  }
+
+  if ((sr->vns_ev = sr_event_add_fd(&(sr->loop), sr->sockfd, EPOLLIN, sr_vns_event, sr)) == 0) {
+    return -1;
+  }
+
+  return 0;
+} /* -- sr_vns_start -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_ether_addrs_match_interface(..)
@@ -485,20 +825,19 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
 static int sr_ether_addrs_match_interface(struct sr_instance* sr, /* borrowed */
                                           uint8_t* buf,           /* borrowed */
-                                          const char* name /* borrowed */) {
+                                          unsigned int ifidx) {
   struct sr_ethernet_hdr* ether_hdr = 0;
   struct sr_if* iface = 0;
 
   /* -- REQUIRES -- */
   assert(sr);
   assert(buf);
-  assert(name);
 
   ether_hdr = (struct sr_ethernet_hdr*)buf;
-  iface = sr_get_interface(sr, name);
+  iface = sr_get_interface_idx(sr, ifidx);
 
   if (iface == 0) {
-    fprintf(stderr, "** Error, interface %s, does not exist\n", name);
+    fprintf(stderr, "** Error, interface %u, does not exist\n", ifidx);
     return 0;
   }
 
@@ -517,85 +856,427 @@ static int sr_ether_addrs_match_interface(struct sr_instance* sr, /* borrowed */
 
 } /* -- sr_ether_addrs_match_interface -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_tx_reset(..)
+ * Scope: Local
+ *
+ * Empty this thread's batch, dropping the pool references it held.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_tx_reset(struct sr_instance* sr /* borrowed */) {
+  struct sr_tx_batch* tx = &sr_tx;
+  int i;
+
+  for (i = 0; i < tx->npbs; i++) {
+    sr_pktbuf_put(&(sr->pool), tx->pbs[i]);
+  }
+  tx->npbs = 0;
+  tx->niov = tx->done = 0;
+  tx->used = 0;
+  tx->count = 0;
+
+  /* -- sr_vns_event(..) rearms EPOLLIN once it has caught up with rx_buf -- */
+  tx->stalled = 0;
+} /* -- sr_tx_reset -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_tx_iov(..)
+ * Scope: Local
+ *
+ * Append len bytes at base to this thread's batch, extending the last
+ * iovec when they follow straight on from it.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_tx_iov(uint8_t* base /* borrowed */, unsigned int len) {
+  struct sr_tx_batch* tx = &sr_tx;
+  struct iovec* last = tx->niov > 0 ? &(tx->iov[tx->niov - 1]) : 0;
+
+  if (last && (uint8_t*)last->iov_base + last->iov_len == base) {
+    last->iov_len += len;
+    return;
+  }
+  tx->iov[tx->niov].iov_base = base;
+  tx->iov[tx->niov].iov_len = len;
+  tx->niov++;
+} /* -- sr_tx_iov -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_tx_write(..)
+ * Scope: Local
+ *
+ * Write out the unsent part of this thread's batch.  If the socket is full
+ * the rest stays in the batch and the server socket is switched over to
+ * EPOLLOUT only: nothing more is read from the server until the event loop
+ * has finished the job, see sr_vns_event(..).  Over io_uring the whole
+ * arena is queued on the ring instead and the batch starts over in a fresh
+ * buffer.
+ *
+ * RETURN VALUES:
+ *
+ *  0 if the batch is out or waiting for the socket to drain
+ *  -1 if it could not be written and was dropped
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_tx_write(struct sr_instance* sr /* borrowed */) {
+  struct sr_tx_batch* tx = &sr_tx;
+  struct iovec* iov;
+  ssize_t ret;
+
+  if (sr->uring) {
+    if (tx->used == 0) {
+      return 0;
+    }
+    ret = sr_uring_write(sr, tx->arena, tx->used);
+    tx->arena = 0;
+    sr_tx_reset(sr);
+    return ret;
+  }
+
+  while (tx->done < tx->niov) {
+    if ((ret = writev(sr->sockfd, tx->iov + tx->done, tx->niov - tx->done)) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        /* -- server is not keeping up, stop reading from it until the batch is out -- */
+        if (!tx->stalled && sr->vns_ev) {
+          sr_event_modify(&(sr->loop), sr->vns_ev, EPOLLOUT);
+        }
+        tx->stalled = 1;
+        return 0;
+      }
+      perror("writev(..):sr_vns_comm.c::sr_tx_write(..)");
+      fprintf(stderr, "Error writing %d batched packets\n", tx->count);
+      sr_tx_reset(sr);
+      return -1;
+    }
+
+    /* -- skip past what made it out -- */
+    while (tx->done < tx->niov && (size_t)ret >= tx->iov[tx->done].iov_len) {
+      ret -= tx->iov[tx->done].iov_len;
+      tx->done++;
+    }
+    if (tx->done < tx->niov) {
+      iov = &(tx->iov[tx->done]);
+      iov->iov_base = (uint8_t*)iov->iov_base + ret;
+      iov->iov_len -= ret;
+    }
+  }
+
+  sr_tx_reset(sr);
+  return 0;
+} /* -- sr_tx_write -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flush_packets(..)
+ * Scope: Global
+ *
+ * Write every frame batched by the calling thread to the server in one go.
+ * Called when a batch fills up and at the end of every event loop callback
+ * that can send: each receive read, ARP timer pass and worker TX drain.
+ * There is no flush timer, a frame never waits longer than the pass that
+ * queued it.  If the server's receive window is full the rest is written
+ * once the socket becomes writable again, and the server is not read from
+ * until then.  When attached to local interfaces, the queued TX ring
+ * entries are sent instead.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 if the batch could not be written
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_flush_packets(struct sr_instance* sr /* borrowed */) {
+  /* REQUIRES */
+  assert(sr);
+
+  if (sr->shm) {
+    return sr_shm_flush(sr);
+  }
+  if (sr->xdp) {
+    return sr_xdp_flush(sr);
+  }
+  if (sr->afp) {
+    return sr_afpacket_flush(sr);
+  }
+  return sr_tx_write(sr);
+} /* -- sr_flush_packets -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_send_packet(..)
  * Scope: Global
  *
  * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ * to be injected onto the wire.  Looks iface up by name, the data path
+ * calls sr_send_packet_idx(..) with the index it already has.
  *
  *---------------------------------------------------------------------------*/
 
 int sr_send_packet(struct sr_instance* sr /* borrowed */, uint8_t* buf /* borrowed */, unsigned int len,
                    const char* iface /* borrowed */) {
-  c_packet_header* sr_pkt;
-  unsigned int total_len = len + (sizeof(c_packet_header));
+  struct sr_if* if_entry;
 
   /* REQUIRES */
   assert(sr);
-  assert(buf);
   assert(iface);
-  print_hdrs(buf, len);
+
+  if ((if_entry = sr_get_interface(sr, iface)) == 0) {
+    fprintf(stderr, "** Error, interface %s, does not exist\n", iface);
+    return -1;
+  }
+  return sr_send_packet_idx(sr, buf, len, if_entry->index);
+} /* -- sr_send_packet -- */
+
+int sr_send_packet_idx(struct sr_instance* sr /* borrowed */, uint8_t* buf /* borrowed */, unsigned int len,
+                       unsigned int ifidx) {
+  int rc;
+
+  /* REQUIRES */
+  assert(sr);
+  assert(buf);
+
+  /* -- header dumps are written synchronously, so only when debugging -- */
+  if (LOG_ENABLED(LOG_LEVEL_DEBUG)) {
+    print_hdrs(buf, len);
+  }
 
   /* don't waste my time ... */
   if (len < sizeof(struct sr_ethernet_hdr)) {
     fprintf(stderr, "** Error: packet is too short \n");
+    sr_stats_tx(ifidx, len, 0);
     return -1;
   }
 
-  /* Create packet */
-  sr_pkt = (c_packet_header*)malloc(len + sizeof(c_packet_header));
-  assert(sr_pkt);
-  sr_pkt->mLen = htonl(total_len);
-  sr_pkt->mType = htonl(VNSPACKET);
-  strncpy(sr_pkt->mInterfaceName, iface, 16);
-  memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header), buf, len);
-
   /* -- log packet -- */
-  sr_log_packet(sr, buf, len);
+  SR_PROF_CALL(SR_PROF_LOG, 1);
+  sr_log_packet(sr, buf, len, ifidx, SR_CAP_OUT);
+  SR_PROF_STAGE(SR_PROF_SEND, 1);
 
-  if (!sr_ether_addrs_match_interface(sr, buf, iface)) {
+  if (!sr_ether_addrs_match_interface(sr, buf, ifidx)) {
     fprintf(stderr, "*** Error: problem with ethernet header, check log\n");
-    free(sr_pkt);
+    sr_stats_tx(ifidx, len, 0);
+    SR_PROF_RETURN();
     return -1;
   }
 
-  if (write(sr->sockfd, sr_pkt, total_len) < total_len) {
-    fprintf(stderr, "Error writing packet\n");
-    free(sr_pkt);
+  /* -- worker threads hand their frames to the loop thread to write -- */
+  if (sr->pipeline && (rc = sr_pipeline_send(sr, buf, len, ifidx)) != 0) {
+    if (rc == -1) {
+      sr_stats_tx(ifidx, len, 0);
+    }
+    rc = rc == 1 ? 0 : -1;
+  } else {
+    rc = sr_queue_frame(sr, buf, len, ifidx);
+  }
+  SR_PROF_RETURN();
+  return rc;
+} /* -- sr_send_packet_idx -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_input_frame(..)
+ * Scope: Global
+ *
+ * Hand a frame received on interface ifidx to the router, whichever transport it came
+ * in on: log it, then queue it for the worker owning its flow or handle it
+ * right away.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_input_frame(struct sr_instance* sr /* borrowed */, uint8_t* frame /* lent */, unsigned int len,
+                    unsigned int ifidx) {
+  uint64_t rx_ns = sr_clock_ns();
+
+  /* -- log packet -- */
+  SR_PROF_BEGIN(SR_PROF_LOG, 1);
+  sr_log_packet(sr, frame, len, ifidx, SR_CAP_IN);
+  SR_PROF_END();
+
+  /* -- hand IP frames to the worker owning their flow, if any -- */
+  if (sr->pipeline && sr_pipeline_dispatch(sr, frame, len, ifidx, rx_ns) == 0) {
+    return;
+  }
+
+  /* -- pass to router, student's code should take over here -- */
+  sr_handlepacket_idx(sr, frame, len, ifidx, rx_ns);
+} /* -- sr_input_frame -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_input_burst(..)
+ * Scope: Global
+ *
+ * sr_input_frame(..) for a vector of n frames from one receive burst.
+ * Frames taken by the worker pipeline are dropped from the arrays, which
+ * are compacted in place, and the rest go to the router in one go.  All
+ * of them count as received at the same moment.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_input_burst(struct sr_instance* sr /* borrowed */, uint8_t** frames /* lent */, unsigned int* lens,
+                    unsigned int* ifidx /* lent */, unsigned int n) {
+  uint64_t rx_ns[SR_BURST_MAX];
+  unsigned int i, keep = 0;
+
+  rx_ns[0] = sr_clock_ns();
+  for (i = 1; i < SR_BURST_MAX; i++) {
+    rx_ns[i] = rx_ns[0];
+  }
+
+  for (i = 0; i < n; i++) {
+    /* -- log packet -- */
+    SR_PROF_BEGIN(SR_PROF_LOG, 1);
+    sr_log_packet(sr, frames[i], lens[i], ifidx[i], SR_CAP_IN);
+    SR_PROF_END();
+
+    /* -- hand IP frames to the worker owning their flow, if any -- */
+    if (sr->pipeline && sr_pipeline_dispatch(sr, frames[i], lens[i], ifidx[i], rx_ns[0]) == 0) {
+      continue;
+    }
+    frames[keep] = frames[i];
+    lens[keep] = lens[i];
+    ifidx[keep] = ifidx[i];
+    keep++;
+  }
+
+  /* -- pass to router, student's code should take over here -- */
+  for (i = 0; i < keep; i += SR_BURST_MAX) {
+    sr_handlepacket_burst(sr, frames + i, lens + i, ifidx + i, rx_ns, keep - i < SR_BURST_MAX ? keep - i : SR_BURST_MAX);
+  }
+} /* -- sr_input_burst -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_queue_frame(..)
+ * Scope: Global
+ *
+ * Queue an already checked and logged frame on whichever transport the
+ * router is attached to: the VNS server or local interfaces.  This is
+ * where sent frames are counted, worker frames on the loop thread.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_queue_frame(struct sr_instance* sr /* borrowed */, uint8_t* buf /* borrowed */, unsigned int len,
+                   unsigned int ifidx) {
+  int rc;
+
+  if (sr->shm) {
+    rc = sr_shm_send(sr, buf, len, ifidx);
+  } else if (sr->xdp) {
+    rc = sr_xdp_send(sr, buf, len, ifidx);
+  } else if (sr->afp) {
+    rc = sr_afpacket_send(sr, buf, len, ifidx);
+  } else {
+    rc = sr_vns_queue_frame(sr, buf, len, ifidx);
+  }
+  sr_stats_tx(ifidx, len, rc == 0);
+  return rc;
+} /* -- sr_queue_frame -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_queue_frame(..)
+ * Scope: Global
+ *
+ * Append an already checked and logged frame to the calling thread's
+ * transmit batch, behind a VNS header in the arena.  A frame in a pool
+ * buffer is sent from there with a reference held, one in the receive
+ * buffer straight from there; anything else the caller reclaims on return
+ * and is copied.  A full batch is written out first, and if the server has
+ * not taken the last one yet the frame is dropped rather than waited for.
+ * Nothing here flushes on age: whoever queues a frame flushes at the end
+ * of its pass, see sr_flush_packets(..).
+ *
+ * RETURN VALUES:
+ *
+ *  0 if the frame is queued
+ *  -1 if it was dropped
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_vns_queue_frame(struct sr_instance* sr /* borrowed */, uint8_t* buf /* borrowed */, unsigned int len,
+                       unsigned int ifidx) {
+  struct sr_if* iface = sr_get_interface_idx(sr, ifidx);
+  struct sr_tx_batch* tx = &sr_tx;
+  struct sr_pktbuf* pb = 0;
+  c_packet_header* sr_pkt;
+  unsigned int need = sizeof(c_packet_header);
+  int copy = 1;
+
+  if (iface == 0) {
+    return -1;
+  }
+
+  /* -- registered buffers over io_uring, so no frame can be pointed at -- */
+  if (!sr->uring) {
+    if ((pb = sr_pktbuf_of(&(sr->pool), buf)) != 0) {
+      copy = 0;
+    } else if (sr->rx_buf && buf >= sr->rx_buf && buf + len <= sr->rx_buf + sr->rx_len) {
+      copy = 0;
+    }
+  }
+  if (copy) {
+    need += len;
+  }
+  if (need > SR_TX_BATCH_BYTES) {
+    fprintf(stderr, "Error: packet too big to send %u\n", len);
+    return -1;
+  }
+
+  /* -- make room, but never wait for a server that has stopped reading -- */
+  if (tx->count == SR_TX_BATCH_FRAMES || tx->used + need > SR_TX_BATCH_BYTES) {
+    sr_tx_write(sr);
+    if (tx->count > 0) {
+      return -1;
+    }
+  }
+
+  if (tx->arena == 0 && (tx->arena = sr->uring ? sr_uring_tx_buf(sr) : sr_tx_arena) == 0) {
     return -1;
   }
 
-  free(sr_pkt);
+  /* -- append to this thread's batch -- */
+  sr_pkt = (c_packet_header*)(tx->arena + tx->used);
+  memset(sr_pkt, 0, sizeof(c_packet_header));
+  sr_pkt->mLen = htonl(len + sizeof(c_packet_header));
+  sr_pkt->mType = htonl(VNSPACKET);
+  strncpy(sr_pkt->mInterfaceName, iface->name, 16);
+  sr_tx_iov((uint8_t*)sr_pkt, sizeof(c_packet_header));
+
+  if (copy) {
+    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header), buf, len);
+    sr_tx_iov(((uint8_t*)sr_pkt) + sizeof(c_packet_header), len);
+  } else {
+    sr_tx_iov(buf, len);
+    if (pb) {
+      sr_pktbuf_get(pb);
+      tx->pbs[tx->npbs++] = pb;
+    }
+  }
+
+  tx->used += need;
+  tx->count++;
 
   return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_vns_queue_frame -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_log_packet()
- * Scope: Local
+ * Scope: Global
+ *
+ * Hand a frame that went dir (SR_CAP_IN or SR_CAP_OUT) on interface ifidx
+ * to the -l capture, which copies it and writes it out on its own thread.
  *
  *---------------------------------------------------------------------------*/
 
-void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len) {
-  struct pcap_pkthdr h;
-  int size;
-
+void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len, unsigned int ifidx, int dir) {
   /* REQUIRES */
   assert(sr);
 
-  if (!sr->logfile) {
+  if (!sr->capture) {
     return;
   }
-
-  size = min(PACKET_DUMP_SIZE, len);
-
-  gettimeofday(&h.ts, 0);
-  h.caplen = size;
-  h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
-
-  sr_dump(sr->logfile, &h, buf);
-  fflush(sr->logfile);
+  sr_capture_frame(sr->capture, buf, len, ifidx, dir);
 } /* -- sr_log_packet -- */
 
 /*-----------------------------------------------------------------------------
@@ -605,8 +1286,7 @@ void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len) {
  *---------------------------------------------------------------------------*/
 
 int sr_arp_req_not_for_us(struct sr_instance* sr, uint8_t* packet /* lent */, unsigned int len,
-                          char* interface /* lent */) {
-  struct sr_if* iface = sr_get_interface(sr, interface);
+                          struct sr_if* iface) {
   struct sr_ethernet_hdr* e_hdr = 0;
   struct sr_arp_hdr* a_hdr = 0;
 
@@ -626,3 +1306,21 @@ int sr_arp_req_not_for_us(struct sr_instance* sr, uint8_t* packet /* lent */, un
 
   return 0;
 } /* -- sr_arp_req_not_for_us -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_iface()
+ * Scope: Local
+ *
+ * The interface a VNSPACKET names, or 0 if the router has none by that
+ * name.  The only place a received frame's interface is looked up by name.
+ *
+ *---------------------------------------------------------------------------*/
+
+static struct sr_if* sr_vns_iface(struct sr_instance* sr, const char* name) {
+  struct sr_if* iface = sr_get_interface(sr, name);
+
+  if (iface == 0) {
+    fprintf(stderr, "** Error, interface %.16s, does not exist\n", name);
+  }
+  return iface;
+} /* -- sr_vns_iface -- */
@@ -0,0 +1,411 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_worker.c
+ *
+ * Description:
+ *
+ * Multi-core forwarding pipeline, see sr_worker.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_worker.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "sr_event.h"
+#include "sr_router.h"
+#include "sr_utils.h"
+
+/* the worker running on this thread, 0 on the loop thread */
+static __thread struct sr_worker* sr_worker_self;
+
+/*---------------------------------------------------------------------
+ * Method: sr_worker_wake(..)
+ * Scope: Local
+ *
+ * Called by the loop after pushing to w->rx.  Only costs a syscall when
+ * the worker has run out of work and gone to sleep.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_worker_wake(struct sr_worker* w) {
+  uint64_t one = 1;
+
+  /* -- order the ring push before reading the flag, pairs with the worker -- */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&(w->sleeping), __ATOMIC_SEQ_CST) && __atomic_exchange_n(&(w->sleeping), 0, __ATOMIC_SEQ_CST)) {
+    if (write(w->evfd, &one, sizeof(one)) != sizeof(one)) {
+      perror("write(..):sr_worker.c::sr_worker_wake(..)");
+    }
+  }
+} /* -- sr_worker_wake -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_worker_kick_tx(..)
+ * Scope: Local
+ *
+ * Tell the loop thread there are frames on the TX rings, once per burst.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_worker_kick_tx(struct sr_pipeline* p) {
+  uint64_t one = 1;
+
+  if (!__atomic_exchange_n(&(p->tx_pending), 1, __ATOMIC_SEQ_CST)) {
+    if (write(p->tx_evfd, &one, sizeof(one)) != sizeof(one)) {
+      perror("write(..):sr_worker.c::sr_worker_kick_tx(..)");
+    }
+  }
+} /* -- sr_worker_kick_tx -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_worker_main(..)
+ * Scope: Local
+ *
+ * Worker thread: run sr_handlepacket_burst on the frames hashed to us,
+ * SR_WORKER_BURST at a time.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_worker_main(void* arg) {
+  struct sr_worker* w = (struct sr_worker*)arg;
+  struct sr_instance* sr = w->sr;
+  struct sr_work_item* items[SR_WORKER_BURST];
+  uint8_t* frames[SR_WORKER_BURST];
+  unsigned int lens[SR_WORKER_BURST];
+  unsigned int ifidx[SR_WORKER_BURST];
+  uint64_t rx_ns[SR_WORKER_BURST];
+  uint64_t val;
+  int i, n;
+
+  sr_worker_self = w;
+
+  while (__atomic_load_n(&(sr->pipeline->running), __ATOMIC_ACQUIRE)) {
+    for (n = 0; n < SR_WORKER_BURST && (items[n] = (struct sr_work_item*)sr_ring_pop(&(w->rx))) != 0; n++) {
+      frames[n] = items[n]->frame;
+      lens[n] = items[n]->len;
+      ifidx[n] = items[n]->ifidx;
+      rx_ns[n] = items[n]->rx_ns;
+    }
+    if (n > 0) {
+      sr_handlepacket_burst(sr, frames, lens, ifidx, rx_ns, n);
+    }
+    for (i = 0; i < n; i++) {
+      sr_ring_push(&(w->rx_free), items[i]); /* sized for every item, never full */
+    }
+
+    if (w->tx_pushed) {
+      w->tx_pushed = 0;
+      sr_worker_kick_tx(sr->pipeline);
+    }
+
+    if (n == 0) {
+      /* -- nothing to do, sleep unless something raced in -- */
+      __atomic_store_n(&(w->sleeping), 1, __ATOMIC_SEQ_CST);
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if (sr_ring_count(&(w->rx)) == 0 && __atomic_load_n(&(sr->pipeline->running), __ATOMIC_SEQ_CST)) {
+        if (read(w->evfd, &val, sizeof(val)) == -1 && errno != EINTR) {
+          perror("read(..):sr_worker.c::sr_worker_main(..)");
+        }
+      }
+      __atomic_store_n(&(w->sleeping), 0, __ATOMIC_SEQ_CST);
+    }
+  }
+
+  return 0;
+} /* -- sr_worker_main -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_tx_event(..)
+ * Scope: Local
+ *
+ * Event loop callback for tx_evfd.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_pipeline_tx_event(int fd, uint32_t events, void* arg) {
+  struct sr_instance* sr = (struct sr_instance*)arg;
+  uint64_t val;
+
+  if (read(fd, &val, sizeof(val)) == -1 && errno != EAGAIN) {
+    perror("read(..):sr_worker.c::sr_pipeline_tx_event(..)");
+  }
+  /* -- clear before draining so later pushes kick again -- */
+  __atomic_store_n(&(sr->pipeline->tx_pending), 0, __ATOMIC_SEQ_CST);
+
+  sr_pipeline_drain(sr);
+  sr_flush_packets(sr);
+} /* -- sr_pipeline_tx_event -- */
+
+static int sr_worker_init(struct sr_instance* sr, struct sr_worker* w, int id) {
+  int i;
+
+  memset(w, 0, sizeof(*w));
+  w->sr = sr;
+  w->id = id;
+
+  if ((w->evfd = eventfd(0, EFD_CLOEXEC)) == -1) {
+    perror("eventfd(..):sr_worker.c::sr_worker_init(..)");
+    return -1;
+  }
+  if (sr_ring_init(&(w->rx), SR_WORKER_RING) != 0 || sr_ring_init(&(w->rx_free), SR_WORKER_RING) != 0 ||
+      sr_ring_init(&(w->tx), SR_WORKER_RING) != 0 || sr_ring_init(&(w->tx_free), SR_WORKER_RING) != 0) {
+    return -1;
+  }
+  if (posix_memalign((void**)&(w->items), 64, 2 * SR_WORKER_RING * sizeof(struct sr_work_item)) != 0) {
+    fprintf(stderr, "Error: out of memory (sr_worker_init)\n");
+    w->items = 0;
+    return -1;
+  }
+
+  /* -- every item starts out free, half for each direction -- */
+  for (i = 0; i < SR_WORKER_RING; i++) {
+    sr_ring_push(&(w->rx_free), &(w->items[i]));
+    sr_ring_push(&(w->tx_free), &(w->items[SR_WORKER_RING + i]));
+  }
+  return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_start(..)
+ * Scope: Global
+ *
+ * Spawn nworkers forwarding threads.  Must be called from the loop thread
+ * once sr_init(..) has run.  Returns 0 on success, -1 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pipeline_start(struct sr_instance* sr, int nworkers) {
+  struct sr_pipeline* p;
+  int i;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(!sr->pipeline);
+
+  if (nworkers < 1 || nworkers > SR_WORKERS_MAX) {
+    fprintf(stderr, "Error: worker count must be between 1 and %d\n", SR_WORKERS_MAX);
+    return -1;
+  }
+
+  if ((p = (struct sr_pipeline*)calloc(1, sizeof(struct sr_pipeline))) == 0 ||
+      (p->workers = (struct sr_worker*)calloc(nworkers, sizeof(struct sr_worker))) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_pipeline_start)\n");
+    free(p);
+    return -1;
+  }
+  p->nworkers = nworkers;
+  p->running = 1;
+
+  if ((p->tx_evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+    perror("eventfd(..):sr_worker.c::sr_pipeline_start(..)");
+    return -1;
+  }
+  for (i = 0; i < nworkers; i++) {
+    if (sr_worker_init(sr, &(p->workers[i]), i) != 0) {
+      return -1;
+    }
+  }
+  if ((p->tx_ev = sr_event_add_fd(&(sr->loop), p->tx_evfd, EPOLLIN, sr_pipeline_tx_event, sr)) == 0) {
+    return -1;
+  }
+
+  /* -- workers share the ARP cache and packet pool with the loop thread from now on -- */
+  sr->cache.shared = 1;
+  sr->pool.shared = 1;
+  sr->pipeline = p;
+
+  for (i = 0; i < nworkers; i++) {
+    if (pthread_create(&(p->workers[i].thread), &(sr->attr), sr_worker_main, &(p->workers[i])) != 0) {
+      fprintf(stderr, "Error: unable to start worker %d\n", i);
+      p->nworkers = i;
+      sr_pipeline_stop(sr);
+      return -1;
+    }
+  }
+
+  printf("Forwarding on %d worker threads\n", nworkers);
+  return 0;
+} /* -- sr_pipeline_start -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_stop(..)
+ * Scope: Global
+ *
+ * Stop and join the workers.  Frames still in flight are dropped.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pipeline_stop(struct sr_instance* sr) {
+  struct sr_pipeline* p = sr->pipeline;
+  uint64_t one = 1;
+  int i;
+
+  if (!p) {
+    return;
+  }
+
+  __atomic_store_n(&(p->running), 0, __ATOMIC_SEQ_CST);
+  for (i = 0; i < p->nworkers; i++) {
+    if (write(p->workers[i].evfd, &one, sizeof(one)) != sizeof(one)) {
+      perror("write(..):sr_worker.c::sr_pipeline_stop(..)");
+    }
+    pthread_join(p->workers[i].thread, 0);
+  }
+
+  sr_event_remove(&(sr->loop), p->tx_ev);
+  close(p->tx_evfd);
+  for (i = 0; i < p->nworkers; i++) {
+    close(p->workers[i].evfd);
+    sr_ring_destroy(&(p->workers[i].rx));
+    sr_ring_destroy(&(p->workers[i].rx_free));
+    sr_ring_destroy(&(p->workers[i].tx));
+    sr_ring_destroy(&(p->workers[i].tx_free));
+    free(p->workers[i].items);
+  }
+  free(p->workers);
+  free(p);
+  sr->pipeline = 0;
+
+  /* -- the control thread, if any, still reads the cache and pool -- */
+  sr->cache.shared = sr->ctl != 0;
+  sr->pool.shared = sr->ctl != 0;
+} /* -- sr_pipeline_stop -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_hash(..)
+ * Scope: Local
+ *
+ * Hash an IPv4 frame on (src, dst, protocol).
+ *
+ *---------------------------------------------------------------------*/
+
+static uint32_t sr_flow_hash(const uint8_t* frame) {
+  const sr_ip_hdr_t* ip_hdr = (const sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+  uint32_t h;
+
+  h = ip_hdr->ip_src ^ (ip_hdr->ip_dst * 0x9e3779b1u) ^ ip_hdr->ip_p;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  return h;
+} /* -- sr_flow_hash -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_dispatch(..)
+ * Scope: Global
+ *
+ * Loop thread.  Queue an IP frame on the worker owning its flow; if that
+ * worker is backed up, keep draining TX rings until it frees a slot.
+ *
+ * RETURN VALUES:
+ *
+ *  0 if the frame was queued
+ *  -1 if the caller should handle it inline (ARP, anything not IP and
+ *  frames too big for an item)
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pipeline_dispatch(struct sr_instance* sr, uint8_t* frame, unsigned int len, unsigned int ifidx, uint64_t rx_ns) {
+  struct sr_pipeline* p = sr->pipeline;
+  struct sr_work_item* item;
+  struct sr_worker* w;
+
+  if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) || len > SR_WORKER_FRAME_MAX ||
+      ethertype(frame) != ethertype_ip) {
+    return -1;
+  }
+
+  w = &(p->workers[sr_flow_hash(frame) % p->nworkers]);
+  while ((item = (struct sr_work_item*)sr_ring_pop(&(w->rx_free))) == 0) {
+    sr_worker_wake(w);
+    sr_pipeline_drain(sr);
+    sched_yield();
+  }
+
+  item->len = len;
+  item->ifidx = ifidx;
+  item->rx_ns = rx_ns;
+  memcpy(item->frame, frame, len);
+  sr_ring_push(&(w->rx), item);
+  sr_worker_wake(w);
+
+  return 0;
+} /* -- sr_pipeline_dispatch -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_send(..)
+ * Scope: Global
+ *
+ * Called from sr_send_packet.  On a worker thread the frame is copied onto
+ * the worker's TX ring for the loop thread to write out.  Workers never
+ * write to the transport themselves, so a frame too big for an item is
+ * dropped, and so is one that finds the TX ring full once the pipeline is
+ * stopping.
+ *
+ * RETURN VALUES:
+ *
+ *  1 if the frame was taken
+ *  0 if the caller is not a worker and should send it itself
+ *  -1 if the caller is a worker and the frame was dropped
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pipeline_send(struct sr_instance* sr, uint8_t* frame, unsigned int len, unsigned int ifidx) {
+  struct sr_worker* w = sr_worker_self;
+  struct sr_work_item* item;
+
+  if (!w) {
+    return 0;
+  }
+  if (len > SR_WORKER_FRAME_MAX) {
+    fprintf(stderr, "** Error: frame of %u bytes too big for worker %d\n", len, w->id);
+    return -1;
+  }
+
+  while ((item = (struct sr_work_item*)sr_ring_pop(&(w->tx_free))) == 0) {
+    /* -- a stopping loop thread drains nothing any more, don't wait for it -- */
+    if (!__atomic_load_n(&(sr->pipeline->running), __ATOMIC_SEQ_CST)) {
+      return -1;
+    }
+    /* -- loop thread is behind, make sure it knows and wait -- */
+    sr_worker_kick_tx(sr->pipeline);
+    sched_yield();
+  }
+
+  item->len = len;
+  item->ifidx = ifidx;
+  memcpy(item->frame, frame, len);
+  sr_ring_push(&(w->tx), item);
+  w->tx_pushed++;
+
+  return 1;
+} /* -- sr_pipeline_send -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_drain(..)
+ * Scope: Global
+ *
+ * Loop thread.  Queue every frame on the workers' TX rings for sending,
+ * worker by worker and in ring order.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pipeline_drain(struct sr_instance* sr) {
+  struct sr_pipeline* p = sr->pipeline;
+  struct sr_work_item* item;
+  int i;
+
+  for (i = 0; i < p->nworkers; i++) {
+    while ((item = (struct sr_work_item*)sr_ring_pop(&(p->workers[i].tx))) != 0) {
+      sr_queue_frame(sr, item->frame, item->len, item->ifidx);
+      sr_ring_push(&(p->workers[i].tx_free), item);
+    }
+  }
+} /* -- sr_pipeline_drain -- */
@@ -0,0 +1,93 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_worker.h
+ *
+ * Description:
+ *
+ * Optional multi-core forwarding pipeline.  The event loop thread stays the
+ * RX and TX stage: it reads the server socket, hashes every IP frame by flow
+ * onto one of N worker threads over a lock-free SPSC ring, and later drains
+ * the frames the workers produced and writes them to the socket.  Frames of
+ * one flow always land on the same worker and leave through that worker's
+ * TX ring in order, so per-flow ordering is kept.  ARP stays on the loop
+ * thread with the ARP timers.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_WORKER_H
+#define SR_WORKER_H
+
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include "sr_protocol.h"
+#include "sr_ring.h"
+
+#define SR_WORKERS_MAX 16
+#define SR_WORKER_RING 256          /* frames in flight per worker and direction */
+#define SR_WORKER_BURST 32          /* frames a worker handles between TX kicks */
+#define SR_WORKER_ITEM_SIZE 2048    /* bytes per item, header included */
+#define SR_WORKER_FRAME_MAX (SR_WORKER_ITEM_SIZE - 16) /* any Ethernet frame with room to spare */
+
+struct sr_instance;
+struct sr_event;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_work_item
+ *
+ * A frame travelling between the loop thread and a worker.  Items are
+ * SR_WORKER_ITEM_SIZE bytes, enough for any Ethernet frame, so the items
+ * of both directions take 1 MB per worker.  Larger frames, which only the
+ * VNS server can deliver, are handled on the loop thread instead.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_work_item {
+  unsigned int len;
+  unsigned int ifidx;
+  uint64_t rx_ns; /* when the loop thread read it */
+  uint8_t frame[SR_WORKER_FRAME_MAX];
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_worker
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_worker {
+  struct sr_instance* sr;
+  int id;
+  pthread_t thread;
+  int evfd;                   /* wakes the worker while it sleeps */
+  int sleeping;               /* set by the worker before blocking on evfd */
+  int tx_pushed;              /* frames pushed since the last TX kick */
+  struct sr_ring rx;          /* loop -> worker, frames to handle */
+  struct sr_ring rx_free;     /* worker -> loop, spent rx items */
+  struct sr_ring tx;          /* worker -> loop, frames to send */
+  struct sr_ring tx_free;     /* loop -> worker, spent tx items */
+  struct sr_work_item* items; /* backing store for both directions */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_pipeline
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_pipeline {
+  struct sr_worker* workers;
+  int nworkers;
+  int running;
+  int tx_evfd;            /* workers -> loop, TX rings have frames */
+  int tx_pending;         /* a kick is outstanding on tx_evfd */
+  struct sr_event* tx_ev; /* tx_evfd's registration with the loop */
+};
+
+int sr_pipeline_start(struct sr_instance* sr, int nworkers);
+void sr_pipeline_stop(struct sr_instance* sr);
+int sr_pipeline_dispatch(struct sr_instance* sr, uint8_t* frame, unsigned int len, unsigned int ifidx, uint64_t rx_ns);
+int sr_pipeline_send(struct sr_instance* sr, uint8_t* frame, unsigned int len, unsigned int ifidx);
+void sr_pipeline_drain(struct sr_instance* sr);
+
+#endif /* -- SR_WORKER_H -- */
@@ -0,0 +1,665 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_xdp.c
+ *
+ * Description:
+ *
+ * AF_XDP backend, see sr_xdp.h
+ *
+ *---------------------------------------------------------------------------*/
+
+#include "sr_xdp.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_router.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/* generic XDP runs on every device; use XDP_FLAGS_DRV_MODE and bind with
+ * XDP_ZEROCOPY instead on NICs whose driver supports it */
+#define SR_XDP_ATTACH_FLAGS XDP_FLAGS_SKB_MODE
+#define SR_XDP_BIND_FLAGS XDP_COPY
+
+#define SR_XDP_FRAME_MASK (~((uint64_t)SR_XDP_FRAME_SIZE - 1))
+
+static const uint8_t sr_xdp_broadcast[ETHER_ADDR_LEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+static int sr_bpf(int cmd, union bpf_attr* attr) { return syscall(__NR_bpf, cmd, attr, sizeof(*attr)); }
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_port(..)
+ * Scope: Local
+ *
+ * Port attached to interface ifidx, or 0.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_xdp_port* sr_xdp_port(struct sr_xdp* xdp, unsigned int ifidx) {
+  int i;
+
+  for (i = 0; i < xdp->nports; i++) {
+    if (xdp->ports[i].iface->index == ifidx) {
+      return &(xdp->ports[i]);
+    }
+  }
+  return 0;
+} /* -- sr_xdp_port -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_load_prog(..)
+ * Scope: Local
+ *
+ * Create the port's XSKMAP and load the redirect program:
+ *
+ *   if the frame is IPv4 or ARP
+ *     return bpf_redirect_map(xsks, rx_queue_index, XDP_PASS)
+ *   return XDP_PASS
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_xdp_load_prog(struct sr_xdp_port* port) {
+  static char log[4096];
+  union bpf_attr attr;
+  struct bpf_insn prog[] = {
+      /* 0: r6 = ctx */
+      {BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0},
+      /* 1-2: r2 = data, r3 = data_end */
+      {BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, data), 0},
+      {BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_6, offsetof(struct xdp_md, data_end), 0},
+      /* 3-5: pass runts */
+      {BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0},
+      {BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, sizeof(struct sr_ethernet_hdr)},
+      {BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 9, 0},
+      /* 6-8: r4 = ether_type, pass anything but IPv4 and ARP */
+      {BPF_LDX | BPF_MEM | BPF_H, BPF_REG_4, BPF_REG_2, offsetof(struct sr_ethernet_hdr, ether_type), 0},
+      {BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, 1, 0},
+      {BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, 6, 0},
+      /* 9-14: return bpf_redirect_map(xsks, ctx->rx_queue_index, XDP_PASS) */
+      {BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index), 0},
+      {BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, 0},
+      {0, 0, 0, 0, 0},
+      {BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS},
+      {BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map},
+      {BPF_JMP | BPF_EXIT, 0, 0, 0, 0},
+      /* 15-16: return XDP_PASS */
+      {BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS},
+      {BPF_JMP | BPF_EXIT, 0, 0, 0, 0},
+  };
+
+  /* -- only queue 0 is served, see sr_xdp.h -- */
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof(uint32_t);
+  attr.value_size = sizeof(uint32_t);
+  attr.max_entries = 1;
+  if ((port->map_fd = sr_bpf(BPF_MAP_CREATE, &attr)) == -1) {
+    perror("bpf(BPF_MAP_CREATE):sr_xdp.c::sr_xdp_load_prog(..)");
+    return -1;
+  }
+
+  prog[7].imm = htons(ethertype_ip);
+  prog[8].imm = htons(ethertype_arp);
+  prog[10].imm = port->map_fd;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insns = (uint64_t)(unsigned long)prog;
+  attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+  attr.license = (uint64_t)(unsigned long)"GPL";
+  attr.log_buf = (uint64_t)(unsigned long)log;
+  attr.log_size = sizeof(log);
+  attr.log_level = 1;
+  if ((port->prog_fd = sr_bpf(BPF_PROG_LOAD, &attr)) == -1) {
+    perror("bpf(BPF_PROG_LOAD):sr_xdp.c::sr_xdp_load_prog(..)");
+    fprintf(stderr, "%s\n", log);
+    return -1;
+  }
+
+  return 0;
+} /* -- sr_xdp_load_prog -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_map_ring(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_xdp_map_ring(int fd, struct sr_xdp_ring* ring, struct xdp_ring_offset* off, size_t desc_size,
+                           off_t pgoff) {
+  ring->map_len = off->desc + SR_XDP_RING_SIZE * desc_size;
+  ring->map = mmap(0, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+  if (ring->map == MAP_FAILED) {
+    perror("mmap(..):sr_xdp.c::sr_xdp_map_ring(..)");
+    ring->map = 0;
+    return -1;
+  }
+  ring->producer = (uint32_t*)((uint8_t*)ring->map + off->producer);
+  ring->consumer = (uint32_t*)((uint8_t*)ring->map + off->consumer);
+  ring->descs = (uint8_t*)ring->map + off->desc;
+  ring->mask = SR_XDP_RING_SIZE - 1;
+  ring->head = 0;
+  return 0;
+} /* -- sr_xdp_map_ring -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_refill(..)
+ * Scope: Local
+ *
+ * Post free UMEM frames on the port's fill ring, always keeping a ring's
+ * worth back for the TX path.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_xdp_refill(struct sr_xdp* xdp, struct sr_xdp_port* port) {
+  struct sr_xdp_ring* fill = &(port->fill);
+  uint64_t* addrs = (uint64_t*)fill->descs;
+  uint32_t n;
+
+  n = SR_XDP_RING_SIZE - (fill->head - __atomic_load_n(fill->consumer, __ATOMIC_ACQUIRE));
+  if (xdp->nfree <= SR_XDP_RING_SIZE) {
+    return;
+  }
+  if (n > xdp->nfree - SR_XDP_RING_SIZE) {
+    n = xdp->nfree - SR_XDP_RING_SIZE;
+  }
+  if (n == 0) {
+    return;
+  }
+
+  while (n-- > 0) {
+    addrs[fill->head++ & fill->mask] = xdp->free[--xdp->nfree];
+  }
+  __atomic_store_n(fill->producer, fill->head, __ATOMIC_RELEASE);
+} /* -- sr_xdp_refill -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_reap(..)
+ * Scope: Local
+ *
+ * Take back the UMEM frames the kernel has finished transmitting.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_xdp_reap(struct sr_xdp* xdp) {
+  struct sr_xdp_ring* comp;
+  uint32_t prod;
+  int i;
+
+  for (i = 0; i < xdp->nports; i++) {
+    comp = &(xdp->ports[i].comp);
+    prod = __atomic_load_n(comp->producer, __ATOMIC_ACQUIRE);
+    if (prod == comp->head) {
+      continue;
+    }
+    while (comp->head != prod) {
+      xdp->free[xdp->nfree++] = ((uint64_t*)comp->descs)[comp->head++ & comp->mask] & SR_XDP_FRAME_MASK;
+    }
+    __atomic_store_n(comp->consumer, comp->head, __ATOMIC_RELEASE);
+  }
+} /* -- sr_xdp_reap -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_open_port(..)
+ * Scope: Local
+ *
+ * Create, map and bind the AF_XDP socket for one interface.  The first
+ * port registers the UMEM, the others share it.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_xdp_open_port(struct sr_instance* sr, struct sr_xdp_port* port, const char* name) {
+  struct sr_xdp* xdp = sr->xdp;
+  struct xdp_umem_reg reg;
+  struct xdp_mmap_offsets off;
+  struct sockaddr_xdp sxdp;
+  socklen_t optlen;
+  int size = SR_XDP_RING_SIZE;
+
+  port->sr = sr;
+  if ((port->iface = sr_add_os_interface(sr, name, &(port->ifindex))) == 0) {
+    return -1;
+  }
+
+  if ((port->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0)) == -1) {
+    perror("socket(AF_XDP):sr_xdp.c::sr_xdp_open_port(..)");
+    return -1;
+  }
+
+  if (port == &(xdp->ports[0])) {
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uint64_t)(unsigned long)xdp->umem;
+    reg.len = xdp->umem_len;
+    reg.chunk_size = SR_XDP_FRAME_SIZE;
+    if (setsockopt(port->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) == -1) {
+      perror("setsockopt(XDP_UMEM_REG):sr_xdp.c::sr_xdp_open_port(..)");
+      return -1;
+    }
+  }
+
+  /* -- every device bound to the UMEM needs its own fill and completion ring -- */
+  if (setsockopt(port->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) == -1 ||
+      setsockopt(port->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) == -1 ||
+      setsockopt(port->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) == -1 ||
+      setsockopt(port->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) == -1) {
+    perror("setsockopt(..):sr_xdp.c::sr_xdp_open_port(..)");
+    return -1;
+  }
+
+  optlen = sizeof(off);
+  if (getsockopt(port->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == -1) {
+    perror("getsockopt(XDP_MMAP_OFFSETS):sr_xdp.c::sr_xdp_open_port(..)");
+    return -1;
+  }
+  if (sr_xdp_map_ring(port->fd, &(port->rx), &(off.rx), sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) != 0 ||
+      sr_xdp_map_ring(port->fd, &(port->tx), &(off.tx), sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) != 0 ||
+      sr_xdp_map_ring(port->fd, &(port->fill), &(off.fr), sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) != 0 ||
+      sr_xdp_map_ring(port->fd, &(port->comp), &(off.cr), sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) != 0) {
+    return -1;
+  }
+  sr_xdp_refill(xdp, port);
+
+  memset(&sxdp, 0, sizeof(sxdp));
+  sxdp.sxdp_family = AF_XDP;
+  sxdp.sxdp_ifindex = port->ifindex;
+  sxdp.sxdp_queue_id = 0;
+  if (port == &(xdp->ports[0])) {
+    sxdp.sxdp_flags = SR_XDP_BIND_FLAGS;
+  } else {
+    sxdp.sxdp_flags = XDP_SHARED_UMEM;
+    sxdp.sxdp_shared_umem_fd = xdp->ports[0].fd;
+  }
+  if (bind(port->fd, (struct sockaddr*)&sxdp, sizeof(sxdp)) == -1) {
+    perror("bind(AF_XDP):sr_xdp.c::sr_xdp_open_port(..)");
+    return -1;
+  }
+
+  return sr_xdp_load_prog(port);
+} /* -- sr_xdp_open_port -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_open(..)
+ * Scope: Global
+ *
+ * Attach to the comma separated list of interfaces in ifnames, building
+ * the router's interface list from them.  Nothing is redirected to the
+ * router until sr_xdp_start(..).
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_xdp_open(struct sr_instance* sr, const char* ifnames) {
+  struct sr_xdp* xdp;
+  struct sr_xdp_port* port;
+  struct sr_if* iface;
+  char* names;
+  char* name;
+  char* save = 0;
+  unsigned int i;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(ifnames);
+
+  if ((xdp = (struct sr_xdp*)calloc(1, sizeof(struct sr_xdp))) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_xdp_open)\n");
+    return -1;
+  }
+  sr->xdp = xdp;
+
+  xdp->umem_len = (size_t)SR_XDP_FRAMES * SR_XDP_FRAME_SIZE;
+  xdp->umem = (uint8_t*)mmap(0, xdp->umem_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+                             -1, 0);
+  if (xdp->umem == MAP_FAILED) {
+    perror("mmap(UMEM):sr_xdp.c::sr_xdp_open(..)");
+    xdp->umem = 0;
+    return -1;
+  }
+  if ((xdp->free = (uint64_t*)malloc(SR_XDP_FRAMES * sizeof(uint64_t))) == 0 || (names = strdup(ifnames)) == 0) {
+    fprintf(stderr, "Error: out of memory (sr_xdp_open)\n");
+    return -1;
+  }
+  for (i = 0; i < SR_XDP_FRAMES; i++) {
+    xdp->free[i] = (uint64_t)(SR_XDP_FRAMES - 1 - i) * SR_XDP_FRAME_SIZE;
+  }
+  xdp->nfree = SR_XDP_FRAMES;
+
+  for (name = strtok_r(names, ",", &save); name; name = strtok_r(0, ",", &save)) {
+    if (xdp->nports == SR_XDP_MAX_PORTS) {
+      fprintf(stderr, "Error: more than %d interfaces\n", SR_XDP_MAX_PORTS);
+      free(names);
+      return -1;
+    }
+    if ((iface = sr_get_interface(sr, name)) != 0 && sr_xdp_port(xdp, iface->index)) {
+      continue;
+    }
+    port = &(xdp->ports[xdp->nports++]);
+    port->fd = port->map_fd = port->prog_fd = port->link_fd = -1;
+    if (sr_xdp_open_port(sr, port, name) != 0) {
+      free(names);
+      return -1;
+    }
+  }
+  free(names);
+
+  if (xdp->nports == 0) {
+    fprintf(stderr, "Error: no interfaces to attach to\n");
+    return -1;
+  }
+
+  sr_print_if_list(sr);
+  return 0;
+} /* -- sr_xdp_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_input(..)
+ * Scope: Local
+ *
+ * Hand one received frame to the router, in place in the UMEM.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_xdp_input(struct sr_xdp_port* port, uint8_t* frame, unsigned int len) {
+  struct sr_ethernet_hdr* e_hdr = (struct sr_ethernet_hdr*)frame;
+
+  /* -- multicast floods the link, only unicast to us and broadcast are ours -- */
+  if (memcmp(e_hdr->ether_dhost, port->iface->addr, ETHER_ADDR_LEN) != 0 &&
+      memcmp(e_hdr->ether_dhost, sr_xdp_broadcast, ETHER_ADDR_LEN) != 0) {
+    return;
+  }
+
+  sr_input_frame(port->sr, frame, len, port->iface->index);
+} /* -- sr_xdp_input -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_event(..)
+ * Scope: Local
+ *
+ * Event loop callback for a port's socket.  Handle up to SR_XDP_RX_BURST
+ * received frames, recycle the ones that were not forwarded in place,
+ * then top up the fill ring and flush what the burst produced.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_xdp_event(int fd, uint32_t events, void* arg) {
+  struct sr_xdp_port* port = (struct sr_xdp_port*)arg;
+  struct sr_xdp* xdp = port->sr->xdp;
+  struct sr_xdp_ring* rx = &(port->rx);
+  struct xdp_desc* desc;
+  uint32_t n;
+
+  if (events & EPOLLERR) {
+    fprintf(stderr, "Error on interface %s\n", port->iface->name);
+  }
+
+  n = __atomic_load_n(rx->producer, __ATOMIC_ACQUIRE) - rx->head;
+  if (n > SR_XDP_RX_BURST) {
+    n = SR_XDP_RX_BURST;
+  }
+
+  while (n-- > 0) {
+    desc = &(((struct xdp_desc*)rx->descs)[rx->head++ & rx->mask]);
+    xdp->rx_frame = xdp->umem + desc->addr;
+    xdp->rx_frame_sent = 0;
+    if (desc->len >= sizeof(struct sr_ethernet_hdr)) {
+      sr_xdp_input(port, xdp->rx_frame, desc->len);
+    }
+    if (!xdp->rx_frame_sent) {
+      xdp->free[xdp->nfree++] = desc->addr & SR_XDP_FRAME_MASK;
+    }
+  }
+  xdp->rx_frame = 0;
+  __atomic_store_n(rx->consumer, rx->head, __ATOMIC_RELEASE);
+
+  /* -- end of the receive burst -- */
+  sr_flush_packets(port->sr);
+} /* -- sr_xdp_event -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_start(..)
+ * Scope: Global
+ *
+ * Register every port with the event loop, then point its XSKMAP at the
+ * socket and attach the program, which starts the redirect.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_xdp_start(struct sr_instance* sr) {
+  struct sr_xdp_port* port;
+  union bpf_attr attr;
+  uint32_t key = 0;
+  int i;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(sr->xdp);
+
+  for (i = 0; i < sr->xdp->nports; i++) {
+    port = &(sr->xdp->ports[i]);
+    if ((port->ev = sr_event_add_fd(&(sr->loop), port->fd, EPOLLIN, sr_xdp_event, port)) == 0) {
+      return -1;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = port->map_fd;
+    attr.key = (uint64_t)(unsigned long)&key;
+    attr.value = (uint64_t)(unsigned long)&(port->fd);
+    attr.flags = BPF_ANY;
+    if (sr_bpf(BPF_MAP_UPDATE_ELEM, &attr) == -1) {
+      perror("bpf(BPF_MAP_UPDATE_ELEM):sr_xdp.c::sr_xdp_start(..)");
+      return -1;
+    }
+
+    /* -- a link detaches by itself when sr exits, however it exits -- */
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = port->prog_fd;
+    attr.link_create.target_ifindex = port->ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = SR_XDP_ATTACH_FLAGS;
+    if ((port->link_fd = sr_bpf(BPF_LINK_CREATE, &attr)) == -1) {
+      fprintf(stderr, "Error attaching XDP program to %s: %s\n", port->iface->name, strerror(errno));
+      return -1;
+    }
+  }
+
+  printf(" <-- Ready to process packets --> \n");
+  return 0;
+} /* -- sr_xdp_start -- */
+
+void sr_xdp_close(struct sr_instance* sr) {
+  struct sr_xdp_port* port;
+  int i;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+
+  if (!sr->xdp) {
+    return;
+  }
+
+  for (i = 0; i < sr->xdp->nports; i++) {
+    port = &(sr->xdp->ports[i]);
+    if (port->link_fd >= 0) {
+      close(port->link_fd);
+    }
+    if (port->prog_fd >= 0) {
+      close(port->prog_fd);
+    }
+    if (port->map_fd >= 0) {
+      close(port->map_fd);
+    }
+    if (port->rx.map) {
+      munmap(port->rx.map, port->rx.map_len);
+    }
+    if (port->tx.map) {
+      munmap(port->tx.map, port->tx.map_len);
+    }
+    if (port->fill.map) {
+      munmap(port->fill.map, port->fill.map_len);
+    }
+    if (port->comp.map) {
+      munmap(port->comp.map, port->comp.map_len);
+    }
+    if (port->fd >= 0) {
+      close(port->fd);
+    }
+  }
+  if (sr->xdp->umem) {
+    munmap(sr->xdp->umem, sr->xdp->umem_len);
+  }
+  free(sr->xdp->free);
+  free(sr->xdp);
+  sr->xdp = 0;
+} /* -- sr_xdp_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_kick(..)
+ * Scope: Local
+ *
+ * Publish the port's queued TX descriptors and have the kernel send them.
+ * In copy mode each sendto(..) only gets through a few dozen, so keep
+ * going while the kernel makes progress.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_xdp_kick(struct sr_xdp_port* port) {
+  struct sr_xdp_ring* tx = &(port->tx);
+  uint32_t left;
+
+  port->tx_pending = 0;
+  __atomic_store_n(tx->producer, tx->head, __ATOMIC_RELEASE);
+
+  while ((left = tx->head - __atomic_load_n(tx->consumer, __ATOMIC_ACQUIRE)) > 0) {
+    if (sendto(port->fd, 0, 0, MSG_DONTWAIT, 0, 0) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+        perror("sendto(..):sr_xdp.c::sr_xdp_kick(..)");
+        return -1;
+      }
+    }
+    if (tx->head - __atomic_load_n(tx->consumer, __ATOMIC_ACQUIRE) == left) {
+      break; /* -- device is busy, the next flush tries again -- */
+    }
+  }
+  return 0;
+} /* -- sr_xdp_kick -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_send(..)
+ * Scope: Global
+ *
+ * Queue a frame on the TX ring of the port attached to ifidx.  A frame
+ * that is the received frame currently being handled goes out as is;
+ * anything else is copied into a free UMEM frame first.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_xdp_send(struct sr_instance* sr, uint8_t* buf, unsigned int len, unsigned int ifidx) {
+  struct sr_xdp* xdp = sr->xdp;
+  struct sr_xdp_port* port;
+  struct xdp_desc* desc;
+  uint64_t addr;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(buf);
+
+  if ((port = sr_xdp_port(xdp, ifidx)) == 0) {
+    fprintf(stderr, "** Error, interface %u is not attached\n", ifidx);
+    return -1;
+  }
+  if (len > SR_XDP_FRAME_SIZE) {
+    fprintf(stderr, "** Error: packet of %u bytes does not fit a UMEM frame\n", len);
+    return -1;
+  }
+
+  if (port->tx.head - __atomic_load_n(port->tx.consumer, __ATOMIC_ACQUIRE) == SR_XDP_RING_SIZE) {
+    sr_xdp_kick(port);
+    if (port->tx.head - __atomic_load_n(port->tx.consumer, __ATOMIC_ACQUIRE) == SR_XDP_RING_SIZE) {
+      fprintf(stderr, "** Error: TX ring of %s is full\n", port->iface->name);
+      return -1;
+    }
+  }
+
+  if (buf == xdp->rx_frame && !xdp->rx_frame_sent) {
+    /* -- forwarded in place: the UMEM frame itself goes out -- */
+    addr = buf - xdp->umem;
+    xdp->rx_frame_sent = 1;
+  } else {
+    if (xdp->nfree == 0) {
+      sr_xdp_reap(xdp);
+      if (xdp->nfree == 0) {
+        fprintf(stderr, "** Error: out of UMEM frames\n");
+        return -1;
+      }
+    }
+    addr = xdp->free[--xdp->nfree];
+    memcpy(xdp->umem + addr, buf, len);
+  }
+
+  desc = &(((struct xdp_desc*)port->tx.descs)[port->tx.head++ & port->tx.mask]);
+  desc->addr = addr;
+  desc->len = len;
+  desc->options = 0;
+
+  if (++port->tx_pending >= SR_TX_BATCH_FRAMES) {
+    return sr_xdp_kick(port);
+  }
+  return 0;
+} /* -- sr_xdp_send -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_flush(..)
+ * Scope: Global
+ *
+ * Send whatever is queued on every port, take back completed frames and
+ * top the fill rings up again.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_xdp_flush(struct sr_instance* sr) {
+  struct sr_xdp* xdp = sr->xdp;
+  struct sr_xdp_port* port;
+  int i, ret = 0;
+
+  /* -- REQUIRES -- */
+  assert(sr);
+  assert(xdp);
+
+  for (i = 0; i < xdp->nports; i++) {
+    port = &(xdp->ports[i]);
+    if (port->tx.head != __atomic_load_n(port->tx.consumer, __ATOMIC_ACQUIRE) && sr_xdp_kick(port) != 0) {
+      ret = -1;
+    }
+  }
+
+  sr_xdp_reap(xdp);
+  for (i = 0; i < xdp->nports; i++) {
+    sr_xdp_refill(xdp, &(xdp->ports[i]));
+  }
+  return ret;
+} /* -- sr_xdp_flush -- */
@@ -0,0 +1,103 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_xdp.h
+ *
+ * Description:
+ *
+ * AF_XDP attachment to local Linux interfaces.  A small XDP program on
+ * every interface redirects IPv4 and ARP frames into an AF_XDP socket;
+ * everything else still goes to the kernel.  All sockets share one UMEM,
+ * so a frame received on one interface can be forwarded out of another
+ * by handing the very same UMEM frame to the egress TX ring, without a
+ * copy.  Frames built by the router (ICMP, ARP) are copied into a spare
+ * UMEM frame instead.
+ *
+ * Programs are attached in generic (skb) mode so any device works,
+ * veth pairs in a network namespace included.  Only queue 0 of each
+ * interface is served, so multi-queue NICs need to be set to one queue.
+ * AF_XDP does not say whether a frame still has checksum offload pending,
+ * so frames from a local stack must be sent with it off: on veth, run
+ * ethtool -K <peer> tx off on the far end of every pair.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_XDP_H
+#define SR_XDP_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include <stddef.h>
+
+#define SR_XDP_MAX_PORTS 16
+#define SR_XDP_FRAME_SIZE 2048 /* UMEM chunk */
+#define SR_XDP_FRAMES 8192     /* UMEM chunks shared by every port */
+#define SR_XDP_RING_SIZE 1024  /* RX, TX, fill and completion ring entries */
+#define SR_XDP_RX_BURST 64     /* RX descriptors handled per readiness event */
+
+struct sr_instance;
+struct sr_if;
+struct sr_event;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_xdp_ring
+ *
+ * One of the rings shared with the kernel.  head is our end of it: the
+ * producer index for fill and TX, the consumer index for RX and completion.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_xdp_ring {
+  uint32_t* producer;
+  uint32_t* consumer;
+  void* descs; /* struct xdp_desc for RX and TX, UMEM addresses otherwise */
+  uint32_t mask;
+  uint32_t head;
+  void* map;
+  size_t map_len;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_xdp_port
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_xdp_port {
+  struct sr_instance* sr;
+  struct sr_if* iface;
+  int fd;
+  int ifindex;
+  int map_fd;  /* XSKMAP the program redirects through */
+  int prog_fd;
+  int link_fd; /* closing it detaches the program */
+  struct sr_event* ev;
+  struct sr_xdp_ring rx;
+  struct sr_xdp_ring tx;
+  struct sr_xdp_ring fill;
+  struct sr_xdp_ring comp;
+  unsigned int tx_pending; /* TX descriptors queued since the last kick */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_xdp
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_xdp {
+  struct sr_xdp_port ports[SR_XDP_MAX_PORTS];
+  int nports;
+  uint8_t* umem;
+  size_t umem_len;
+  uint64_t* free; /* UMEM frames neither posted to nor held by the kernel */
+  unsigned int nfree;
+  uint8_t* rx_frame; /* received frame being handled, may be sent in place */
+  int rx_frame_sent;
+};
+
+int sr_xdp_open(struct sr_instance* sr, const char* ifnames);
+int sr_xdp_start(struct sr_instance* sr);
+void sr_xdp_close(struct sr_instance* sr);
+int sr_xdp_send(struct sr_instance* sr, uint8_t* buf, unsigned int len, unsigned int ifidx);
+int sr_xdp_flush(struct sr_instance* sr);
+
+#endif /* -- SR_XDP_H -- */
@@ -0,0 +1,114 @@
+/*-----------------------------------------------------------------------------
+ * file:  srctl.c
+ *
+ * Description:
+ *
+ * Client for the router's control socket (see sr_ctl.h), to look at a
+ * running sr without restarting it or turning on debug output:
+ *
+ *   ./srctl routes
+ *   ./srctl -j counters
+ *   ./srctl -s /tmp/r1.sock all
+ *
+ * Sends the request, copies the answer to stdout and exits 1 if the
+ * router reported an error or could not be reached.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include "sr_ctl.h"
+
+static void usage(char* argv0) {
+  printf("Query a running sr over its control socket\n");
+  printf("Format: %s [-h] [-s socket] [-j] command \n", argv0);
+  printf("   -j  answer in JSON \n");
+  printf("   %s help  lists the commands \n", argv0);
+  printf("   defaults socket=%s \n", SR_CTL_SOCKET);
+} /* -- usage -- */
+
+int main(int argc, char** argv) {
+  int c, fd, json = 0, first = 1, failed = 0;
+  char* path = SR_CTL_SOCKET;
+  char req[SR_CTL_LINE_MAX];
+  char buf[4096];
+  struct sockaddr_un addr;
+  ssize_t n;
+
+  while ((c = getopt(argc, argv, "hs:j")) != EOF) {
+    switch (c) {
+      case 'h':
+        usage(argv[0]);
+        exit(0);
+        break;
+      case 's':
+        path = optarg;
+        break;
+      case 'j':
+        json = 1;
+        break;
+      default:
+        usage(argv[0]);
+        exit(1);
+    }
+  }
+  if (optind + 1 != argc) {
+    usage(argv[0]);
+    exit(1);
+  }
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Error: socket path too long: %s\n", path);
+    exit(1);
+  }
+  if ((size_t)snprintf(req, sizeof(req), "%s%s\n", argv[optind], json ? " json" : "") >= sizeof(req)) {
+    fprintf(stderr, "Error: command too long\n");
+    exit(1);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+    perror("socket(..):srctl.c::main(..)");
+    exit(1);
+  }
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "Error: cannot reach sr at %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+  if (write(fd, req, strlen(req)) != (ssize_t)strlen(req)) {
+    perror("write(..):srctl.c::main(..)");
+    exit(1);
+  }
+  shutdown(fd, SHUT_WR);
+
+  /* -- copy the answer out, noting whether it is an error -- */
+  while ((n = read(fd, buf, sizeof(buf))) != 0) {
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("read(..):srctl.c::main(..)");
+      failed = 1;
+      break;
+    }
+    if (first && (strncmp(buf, "error:", n < 6 ? n : 6) == 0 || strncmp(buf, "{\"error\"", n < 8 ? n : 8) == 0)) {
+      failed = 1;
+    }
+    first = 0;
+    fwrite(buf, 1, n, stdout);
+  }
+  close(fd);
+
+  return failed;
+} /* -- main -- */